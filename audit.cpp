@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "audit.h"
+#include "log.h"
+
+/* Queued event, as the command path leaves it. */
+struct audit_event
+{
+  uint64_t ts_us;
+  uint32_t session;
+  uint16_t type;
+  uint16_t len;
+  int32_t ret;
+  uint32_t latency_us;
+  uint32_t node;
+  char text[AUDIT_TEXT_MAX];
+};
+
+/* Single producer, single consumer ring, as in log.cpp. */
+struct audit_ring
+{
+  struct audit_ring *next;
+
+  uint32_t head __attribute__ ((aligned (64)));
+  uint32_t tail __attribute__ ((aligned (64)));
+
+  struct audit_event ev[AUDIT_RING_SIZE];
+};
+
+/* String interning table, open addressing. Emptied when it gets too
+   full; strings are then simply written again under new ids. */
+#define AUDIT_INTERN_SIZE 16384
+
+struct audit_string
+{
+  char *str;
+  uint32_t hash;
+  uint32_t id;
+};
+
+static struct audit_string audit_strings[AUDIT_INTERN_SIZE];
+static int audit_nstrings;
+static uint32_t audit_string_id;
+
+static struct audit_ring *audit_rings;
+static __thread struct audit_ring *audit_self;
+
+static pthread_mutex_t audit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t audit_cond = PTHREAD_COND_INITIALIZER;
+
+static int audit_started;
+static int audit_fd = -1;
+
+/* Hot restart. The new process holds its writes back until the old
+   one hands the journal over, and the old one gives its events to
+   audit_fwd from then on; see audit_hold() and audit_forward(). */
+static int audit_held;
+static int (*audit_fwd) (int type, uint32_t session, const char *text, int ret,
+                         uint32_t latency_us, int node);
+
+/* Output batch of the consumer. */
+static unsigned char audit_obuf[131072];
+static size_t audit_olen;
+
+static uint64_t audit_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct audit_ring *audit_ring_get(void)
+{
+    struct audit_ring *r = audit_self;
+
+    if (r)
+        return r;
+    r = (struct audit_ring *)aligned_alloc(64, sizeof(struct audit_ring));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->next = __atomic_load_n(&audit_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&audit_rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    audit_self = r;
+    return r;
+}
+
+static void audit_batch_flush(void)
+{
+    unsigned char *p = audit_obuf;
+    size_t n = audit_olen;
+
+    while (n)
+    {
+        ssize_t ret = write(audit_fd, p, n);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+        {
+            zlog_err("Audit journal write failed: %s", strerror(errno));
+            break;
+        }
+        p += ret;
+        n -= ret;
+    }
+    audit_olen = 0;
+}
+
+static void audit_emit(const struct audit_record *rec, const void *payload)
+{
+    size_t size = sizeof(*rec) + AUDIT_ALIGN(rec->len);
+
+    if (audit_olen + size > sizeof(audit_obuf))
+        audit_batch_flush();
+    memcpy(audit_obuf + audit_olen, rec, sizeof(*rec));
+    if (rec->len)
+    {
+        memcpy(audit_obuf + audit_olen + sizeof(*rec), payload, rec->len);
+        memset(audit_obuf + audit_olen + sizeof(*rec) + rec->len, 0, AUDIT_ALIGN(rec->len) - rec->len);
+    }
+    audit_olen += size;
+}
+
+static uint32_t audit_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static void audit_intern_reset(void)
+{
+    for (int i = 0; i < AUDIT_INTERN_SIZE; i++)
+    {
+        free(audit_strings[i].str);
+        audit_strings[i].str = NULL;
+    }
+    audit_nstrings = 0;
+}
+
+/* Id of a string, writing its AUDIT_STRING record on first use. */
+static uint32_t audit_intern(const char *s, size_t len, uint64_t ts_us)
+{
+    uint32_t h = audit_hash(s, len);
+    unsigned int i = h & (AUDIT_INTERN_SIZE - 1);
+    struct audit_record rec;
+
+    while (audit_strings[i].str)
+    {
+        if (audit_strings[i].hash == h && strncmp(audit_strings[i].str, s, len) == 0 &&
+            audit_strings[i].str[len] == '\0')
+            return audit_strings[i].id;
+        i = (i + 1) & (AUDIT_INTERN_SIZE - 1);
+    }
+
+    if (audit_nstrings >= AUDIT_INTERN_SIZE / 4 * 3)
+    {
+        audit_intern_reset();
+        i = h & (AUDIT_INTERN_SIZE - 1);
+    }
+    audit_strings[i].str = strndup(s, len);
+    if (audit_strings[i].str == NULL)
+        abort();
+    audit_strings[i].hash = h;
+    audit_strings[i].id = ++audit_string_id;
+    audit_nstrings++;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = AUDIT_STRING;
+    rec.len = len;
+    rec.ts_us = ts_us;
+    rec.ref = audit_string_id;
+    audit_emit(&rec, s);
+    return audit_string_id;
+}
+
+static void audit_encode(const struct audit_event *ev)
+{
+    struct audit_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = ev->type;
+    rec.session = ev->session;
+    rec.ts_us = ev->ts_us;
+    if (ev->type == AUDIT_OPEN || ev->type == AUDIT_COMMAND)
+        rec.ref = audit_intern(ev->text, ev->len, ev->ts_us);
+    rec.ret = ev->ret;
+    rec.latency_us = ev->latency_us;
+    rec.node = ev->node;
+    audit_emit(&rec, NULL);
+}
+
+/* Drain every ring in time order. Caller holds audit_lock. */
+static void audit_drain(void)
+{
+    struct audit_ring *rings = __atomic_load_n(&audit_rings, __ATOMIC_ACQUIRE);
+
+    if (audit_held)
+        return;
+    while (1)
+    {
+        struct audit_ring *first = NULL, *r;
+
+        for (r = rings; r; r = r->next)
+        {
+            if (r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+                continue;
+            if (first == NULL ||
+                r->ev[r->tail & (AUDIT_RING_SIZE - 1)].ts_us < first->ev[first->tail & (AUDIT_RING_SIZE - 1)].ts_us)
+                first = r;
+        }
+        if (first == NULL)
+            break;
+        audit_encode(&first->ev[first->tail & (AUDIT_RING_SIZE - 1)]);
+        __atomic_store_n(&first->tail, first->tail + 1, __ATOMIC_RELEASE);
+    }
+    audit_batch_flush();
+}
+
+static void *audit_writer(void *arg)
+{
+    pthread_mutex_lock(&audit_lock);
+    while (1)
+    {
+        struct timespec ts;
+
+        audit_drain();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += AUDIT_FLUSH_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&audit_cond, &audit_lock, &ts);
+    }
+    return NULL;
+}
+
+/* See zlog_flush() for why this gives up eventually. */
+void audit_flush(void)
+{
+    struct timespec ts = { 0, 1000000 };
+    int tries = 100;
+
+    if (!__atomic_load_n(&audit_started, __ATOMIC_ACQUIRE))
+        return;
+    while (pthread_mutex_trylock(&audit_lock) != 0)
+    {
+        if (--tries == 0)
+            return;
+        nanosleep(&ts, NULL);
+    }
+    audit_drain();
+    pthread_mutex_unlock(&audit_lock);
+}
+
+/* Every server start begins an epoch, see audit.h. */
+static void audit_epoch(void)
+{
+    struct audit_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = AUDIT_EPOCH;
+    rec.ts_us = audit_now_us();
+    audit_emit(&rec, NULL);
+    audit_batch_flush();
+}
+
+int audit_init(const char *path)
+{
+    struct audit_file_header fh;
+    struct stat st;
+    pthread_t tid;
+
+    audit_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (audit_fd < 0 || fstat(audit_fd, &st) < 0)
+    {
+        zlog_err("Can't open audit journal %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (st.st_size == 0)
+    {
+        memset(&fh, 0, sizeof(fh));
+        memcpy(fh.magic, AUDIT_MAGIC, sizeof(fh.magic));
+        fh.version = AUDIT_VERSION;
+        fh.header_size = sizeof(struct audit_record);
+        memcpy(audit_obuf, &fh, sizeof(fh));
+        audit_olen = sizeof(fh);
+    }
+    else if (pread(audit_fd, &fh, sizeof(fh), 0) != sizeof(fh) ||
+             memcmp(fh.magic, AUDIT_MAGIC, sizeof(fh.magic)) != 0 ||
+             fh.version != AUDIT_VERSION || fh.header_size != sizeof(struct audit_record))
+    {
+        zlog_err("%s is not an audit journal of this version", path);
+        close(audit_fd);
+        return -1;
+    }
+
+    if (!audit_held)
+        audit_epoch();
+
+    if (pthread_create(&tid, NULL, audit_writer, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    atexit(audit_flush);
+    __atomic_store_n(&audit_started, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Queue an event. An audit trail must not have holes, so unlike the
+   log a full ring makes the caller wait for the writer. */
+static void audit_queue(int type, uint32_t session, const char *text, int ret,
+                        uint32_t latency_us, int node)
+{
+    struct audit_ring *r;
+    struct audit_event *ev;
+    uint32_t head;
+    int (*fwd) (int, uint32_t, const char *, int, uint32_t, int);
+
+    if (!__atomic_load_n(&audit_started, __ATOMIC_ACQUIRE))
+        return;
+    fwd = __atomic_load_n(&audit_fwd, __ATOMIC_ACQUIRE);
+    if (fwd && (*fwd) (type, session, text, ret, latency_us, node) == 0)
+        return;
+    if ((r = audit_ring_get()) == NULL)
+        return;
+
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == AUDIT_RING_SIZE)
+    {
+        pthread_cond_signal(&audit_cond);
+        sched_yield();
+    }
+
+    ev = &r->ev[head & (AUDIT_RING_SIZE - 1)];
+    ev->ts_us = audit_now_us();
+    ev->session = session;
+    ev->type = type;
+    ev->ret = ret;
+    ev->latency_us = latency_us;
+    ev->node = node;
+    ev->len = 0;
+    if (text)
+    {
+        size_t len = strlen(text);
+
+        ev->len = (len < AUDIT_TEXT_MAX) ? len : AUDIT_TEXT_MAX;
+        memcpy(ev->text, text, ev->len);
+    }
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    if (head + 1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) == AUDIT_RING_SIZE / 2)
+        pthread_cond_signal(&audit_cond);
+}
+
+void audit_session_open(uint32_t session, const char *peer)
+{
+    audit_queue(AUDIT_OPEN, session, peer, 0, 0, 0);
+}
+
+void audit_command(uint32_t session, int node, const char *command, int ret, uint32_t latency_us)
+{
+    audit_queue(AUDIT_COMMAND, session, command, ret, latency_us, node);
+}
+
+void audit_session_close(uint32_t session)
+{
+    audit_queue(AUDIT_CLOSE, session, NULL, 0, 0, 0);
+}
+
+void audit_hold(void)
+{
+    audit_held = 1;
+}
+
+void audit_release(void)
+{
+    pthread_mutex_lock(&audit_lock);
+    if (audit_held)
+    {
+        audit_held = 0;
+        if (audit_fd >= 0)
+        {
+            audit_epoch();
+            audit_drain();
+        }
+    }
+    pthread_mutex_unlock(&audit_lock);
+}
+
+void audit_forward(int (*func) (int type, uint32_t session, const char *text, int ret,
+                                uint32_t latency_us, int node))
+{
+    __atomic_store_n(&audit_fwd, func, __ATOMIC_RELEASE);
+    if (func)
+        audit_flush();
+}
+
+void audit_event(int type, uint32_t session, const char *text, int ret, uint32_t latency_us, int node)
+{
+    audit_queue(type, session, text, ret, latency_us, node);
+}
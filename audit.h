@@ -0,0 +1,75 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stdint.h>
+
+/* Command audit journal. An append-only binary file: a file header,
+   then records of a fixed size header followed by len payload bytes
+   padded to 8. Strings (peer addresses, command lines) are interned:
+   the first use writes an AUDIT_STRING record with a new id, later
+   records only carry the id. Every server start appends AUDIT_EPOCH,
+   which resets string ids and session numbers. Records are in host
+   byte order. */
+#define AUDIT_MAGIC    "VTYAUDIT"
+#define AUDIT_VERSION  1
+
+struct audit_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;		/* sizeof(struct audit_record). */
+};
+
+enum audit_type
+{
+  AUDIT_EPOCH = 1,		/* Server started. */
+  AUDIT_STRING,			/* Payload is string ref. */
+  AUDIT_OPEN,			/* Session opened from peer string ref. */
+  AUDIT_COMMAND,		/* Session ran command string ref. */
+  AUDIT_CLOSE,			/* Session closed. */
+};
+
+struct audit_record
+{
+  uint16_t type;
+  uint16_t len;			/* Payload bytes, before padding. */
+  uint32_t session;
+  uint64_t ts_us;		/* CLOCK_REALTIME. */
+  uint32_t ref;			/* Interned string id. */
+  int32_t ret;			/* AUDIT_COMMAND: CMD_* result. */
+  uint32_t latency_us;		/* AUDIT_COMMAND: execution time. */
+  uint32_t node;		/* AUDIT_COMMAND: node it was run in. */
+};
+
+#define AUDIT_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/* Longest string kept; longer command lines are truncated. */
+#define AUDIT_TEXT_MAX 256
+
+/* Server side writer. Events are queued in per-thread lock-free rings
+   and a background thread interns strings and appends them in batches
+   with one write(). */
+#define AUDIT_RING_SIZE 1024
+#define AUDIT_FLUSH_MS  100
+
+int audit_init(const char *path);
+void audit_flush(void);
+
+void audit_session_open(uint32_t session, const char *peer);
+void audit_command(uint32_t session, int node, const char *command, int ret, uint32_t latency_us);
+void audit_session_close(uint32_t session);
+
+/* Hot restart. The new process calls audit_hold() before audit_init():
+   events queue up but nothing is written, not even its AUDIT_EPOCH,
+   until audit_release(), once the old process has let go of the
+   journal. That one calls audit_forward(), which writes out what it
+   queued so far and has func take every event after it; func returns
+   -1 to have an event written here after all, and NULL undoes it. The
+   new process queues what it is given with audit_event(). */
+void audit_hold(void);
+void audit_release(void);
+void audit_forward(int (*func) (int type, uint32_t session, const char *text, int ret,
+                                uint32_t latency_us, int node));
+void audit_event(int type, uint32_t session, const char *text, int ret, uint32_t latency_us, int node);
+
+#endif /*AUDIT_H*/
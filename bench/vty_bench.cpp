@@ -0,0 +1,643 @@
+/* Load generator for mini_vtysh. Opens N telnet sessions against a
+   running server, answers the option negotiation vty_hello_echo()
+   starts, replays a script and reports connection setup rate, echo
+   and command latency percentiles and throughput. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <arpa/telnet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define BENCH_OPS_MAX   64
+#define BENCH_TEXT_MAX  256
+#define BENCH_TAIL_MAX  128
+#define BENCH_EVENTS    256
+
+/* Script operations. "type" sends the text one keystroke at a time,
+   each waiting for its echo, then enter; "cmd" sends the whole line at
+   once. Both wait for the next prompt. */
+enum bench_op_type { OP_TYPE, OP_CMD };
+
+struct bench_op
+{
+  enum bench_op_type type;
+  char text[BENCH_TEXT_MAX];
+  int len;
+};
+
+/* Growable array of latency samples in microseconds. */
+struct bench_samples
+{
+  uint32_t *v;
+  size_t n;
+  size_t max;
+};
+
+struct bench_stats
+{
+  struct bench_samples setup;
+  struct bench_samples echo;
+  struct bench_samples cmd;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t keystrokes;
+  uint64_t commands;
+  int ok;
+  int failed;
+  uint64_t last_ready;		/* Monotonic us of the last prompt seen. */
+};
+
+enum bench_state { S_CONNECTING, S_LOGIN, S_ECHO, S_PROMPT, S_DONE };
+
+/* Client side telnet parser states. */
+enum bench_tn_state { TN_DATA, TN_IAC, TN_OPT, TN_SB, TN_SB_IAC };
+
+struct bench_session
+{
+  int fd;
+  enum bench_state state;
+  int op;			/* Current script operation. */
+  int pos;			/* Keystrokes of it already typed. */
+  int iter;
+  uint64_t t_start;
+  uint64_t t0;			/* When the awaited reply was provoked. */
+  unsigned char expect;		/* Echo awaited in S_ECHO. */
+
+  enum bench_tn_state tn;
+  unsigned char verb;
+
+  /* Last output line, to spot the prompt. */
+  char tail[BENCH_TAIL_MAX];
+  int tail_len;
+};
+
+struct bench_thread
+{
+  pthread_t tid;
+  int nsessions;
+  struct bench_session *sessions;
+  struct bench_stats stats;
+};
+
+static struct bench_op bench_ops[BENCH_OPS_MAX];
+static int bench_nops;
+
+static struct sockaddr_in bench_addr;
+static int bench_sessions = 10;
+static int bench_threads = 1;
+static int bench_iterations = 10;
+static int bench_timeout = 60;
+static const char *bench_password;
+
+/* Used when no script is given. */
+static const char *bench_default_script[] =
+{
+  "type show version",
+  "cmd show interface",
+  "type show history",
+  "cmd show running-config",
+};
+
+static uint64_t bench_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bench_sample(struct bench_samples *s, uint64_t us)
+{
+    if (s->n == s->max)
+    {
+        s->max = s->max ? s->max * 2 : 1024;
+        s->v = (uint32_t *)realloc(s->v, s->max * sizeof(uint32_t));
+        if (s->v == NULL)
+            abort();
+    }
+    s->v[s->n++] = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+}
+
+static void bench_samples_merge(struct bench_samples *to, struct bench_samples *from)
+{
+    for (size_t i = 0; i < from->n; i++)
+        bench_sample(to, from->v[i]);
+    free(from->v);
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t bench_pct(struct bench_samples *s, double p)
+{
+    size_t i = (size_t)(p * s->n);
+
+    return s->v[(i < s->n) ? i : s->n - 1];
+}
+
+static void bench_report_samples(const char *name, struct bench_samples *s)
+{
+    if (s->n == 0)
+    {
+        printf("%-8s us: no samples\n", name);
+        return;
+    }
+    qsort(s->v, s->n, sizeof(uint32_t), bench_cmp);
+    printf("%-8s us: p50 %u  p99 %u  p999 %u  max %u  (%zu samples)\n", name,
+           bench_pct(s, 0.50), bench_pct(s, 0.99), bench_pct(s, 0.999), s->v[s->n - 1], s->n);
+}
+
+/* Parse one script line; returns -1 when it is not understood. */
+static int bench_script_line(const char *line)
+{
+    struct bench_op *op;
+    const char *text;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line == '\0' || *line == '#')
+        return 0;
+    if (bench_nops == BENCH_OPS_MAX)
+        return -1;
+
+    op = &bench_ops[bench_nops];
+    if (strncmp(line, "type ", 5) == 0)
+        op->type = OP_TYPE, text = line + 5;
+    else if (strncmp(line, "cmd ", 4) == 0)
+        op->type = OP_CMD, text = line + 4;
+    else
+        return -1;
+
+    snprintf(op->text, sizeof(op->text), "%s", text);
+    op->len = strcspn(op->text, "\r\n");
+    op->text[op->len] = '\0';
+    bench_nops++;
+    return 0;
+}
+
+static int bench_script_load(const char *path)
+{
+    char line[BENCH_TEXT_MAX + 8];
+    int lineno = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if (bench_script_line(line) < 0)
+        {
+            fprintf(stderr, "%s:%d: expected \"type TEXT\" or \"cmd TEXT\"\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void bench_send(struct bench_thread *th, struct bench_session *s, const void *p, size_t n)
+{
+    ssize_t ret = write(s->fd, p, n);
+
+    /* Requests are tiny, a full socket buffer means the server is not
+       reading at all. */
+    if (ret > 0)
+        th->stats.bytes_out += ret;
+}
+
+static void bench_close(struct bench_thread *th, struct bench_session *s, int ok)
+{
+    if (s->state == S_DONE)
+        return;
+    if (!ok)
+        th->stats.failed++;
+    close(s->fd);
+    s->fd = -1;
+    s->state = S_DONE;
+}
+
+/* Provoke the next reply the script wants. */
+static void bench_next(struct bench_thread *th, struct bench_session *s)
+{
+    struct bench_op *op;
+
+    if (s->op == bench_nops)
+    {
+        s->op = 0;
+        if (++s->iter == bench_iterations)
+        {
+            th->stats.ok++;
+            bench_close(th, s, 1);
+            return;
+        }
+    }
+    op = &bench_ops[s->op];
+
+    s->t0 = bench_now_us();
+    if (op->type == OP_TYPE && s->pos < op->len)
+    {
+        s->expect = op->text[s->pos];
+        s->state = S_ECHO;
+        bench_send(th, s, &s->expect, 1);
+        return;
+    }
+
+    s->state = S_PROMPT;
+    if (op->type == OP_CMD)
+        bench_send(th, s, op->text, op->len);
+    bench_send(th, s, "\r\n", 2);
+}
+
+static int bench_is_prompt(struct bench_session *s)
+{
+    return s->tail_len >= 2 && s->tail[s->tail_len - 1] == ' ' &&
+        (s->tail[s->tail_len - 2] == '#' || s->tail[s->tail_len - 2] == '>');
+}
+
+/* Answer an option request: we do NAWS with an unlimited height so the
+   pager never stops us, let the server echo, and refuse the rest. */
+static void bench_option(struct bench_thread *th, struct bench_session *s, unsigned char verb, unsigned char opt)
+{
+    unsigned char reply[3] = { IAC, 0, opt };
+
+    switch (verb)
+    {
+        case DO:
+            reply[1] = (opt == TELOPT_NAWS) ? WILL : WONT;
+            bench_send(th, s, reply, 3);
+            if (opt == TELOPT_NAWS)
+            {
+                unsigned char naws[] = { IAC, SB, TELOPT_NAWS, 0, 200, 0, 0, IAC, SE };
+
+                bench_send(th, s, naws, sizeof(naws));
+            }
+            break;
+        case WILL:
+            reply[1] = (opt == TELOPT_ECHO || opt == TELOPT_SGA) ? DO : DONT;
+            bench_send(th, s, reply, 3);
+            break;
+        default:
+            break;
+    }
+}
+
+/* One byte of terminal output. */
+static void bench_data(struct bench_thread *th, struct bench_session *s, unsigned char c)
+{
+    uint64_t now;
+
+    if (c == '\n')
+        s->tail_len = 0;
+    else if (s->tail_len < BENCH_TAIL_MAX)
+        s->tail[s->tail_len++] = c;
+
+    switch (s->state)
+    {
+        case S_LOGIN:
+            if (s->tail_len == 10 && memcmp(s->tail, "Password: ", 10) == 0)
+            {
+                if (bench_password == NULL)
+                {
+                    bench_close(th, s, 0);
+                    return;
+                }
+                bench_send(th, s, bench_password, strlen(bench_password));
+                bench_send(th, s, "\r\n", 2);
+                s->tail_len = 0;
+            }
+            else if (bench_is_prompt(s))
+            {
+                now = bench_now_us();
+                bench_sample(&th->stats.setup, now - s->t_start);
+                th->stats.last_ready = now;
+                bench_next(th, s);
+            }
+            break;
+        case S_ECHO:
+            if (c == s->expect)
+            {
+                bench_sample(&th->stats.echo, bench_now_us() - s->t0);
+                th->stats.keystrokes++;
+                s->pos++;
+                bench_next(th, s);
+            }
+            break;
+        case S_PROMPT:
+            if (bench_is_prompt(s))
+            {
+                bench_sample(&th->stats.cmd, bench_now_us() - s->t0);
+                th->stats.commands++;
+                s->op++;
+                s->pos = 0;
+                bench_next(th, s);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void bench_input(struct bench_thread *th, struct bench_session *s, const unsigned char *p, size_t n)
+{
+    for (size_t i = 0; i < n && s->state != S_DONE; i++)
+    {
+        unsigned char c = p[i];
+
+        switch (s->tn)
+        {
+            case TN_DATA:
+                if (c == IAC)
+                    s->tn = TN_IAC;
+                else
+                    bench_data(th, s, c);
+                break;
+            case TN_IAC:
+                if (c == DO || c == DONT || c == WILL || c == WONT)
+                    s->verb = c, s->tn = TN_OPT;
+                else if (c == SB)
+                    s->tn = TN_SB;
+                else
+                {
+                    if (c == IAC)
+                        bench_data(th, s, c);
+                    s->tn = TN_DATA;
+                }
+                break;
+            case TN_OPT:
+                bench_option(th, s, s->verb, c);
+                s->tn = TN_DATA;
+                break;
+            case TN_SB:
+                if (c == IAC)
+                    s->tn = TN_SB_IAC;
+                break;
+            case TN_SB_IAC:
+                s->tn = (c == SE) ? TN_DATA : TN_SB;
+                break;
+        }
+    }
+}
+
+static void bench_read(struct bench_thread *th, struct bench_session *s)
+{
+    unsigned char buf[16384];
+
+    while (s->state != S_DONE)
+    {
+        ssize_t n = read(s->fd, buf, sizeof(buf));
+
+        if (n > 0)
+        {
+            th->stats.bytes_in += n;
+            bench_input(th, s, buf, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        /* Closed by the server, e.g. over its session limit. */
+        bench_close(th, s, 0);
+    }
+}
+
+static int bench_connect(int ep, struct bench_session *s, int idx)
+{
+    struct epoll_event ev;
+    int one = 1;
+
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->fd < 0)
+        return -1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    s->t_start = bench_now_us();
+    s->state = S_CONNECTING;
+    if (connect(s->fd, (struct sockaddr *)&bench_addr, sizeof(bench_addr)) < 0 && errno != EINPROGRESS)
+        return -1;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u32 = idx;
+    return epoll_ctl(ep, EPOLL_CTL_ADD, s->fd, &ev);
+}
+
+static void *bench_run(void *arg)
+{
+    struct bench_thread *th = (struct bench_thread *)arg;
+    struct epoll_event events[BENCH_EVENTS];
+    uint64_t deadline = bench_now_us() + (uint64_t)bench_timeout * 1000000;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    int active = 0;
+
+    for (int i = 0; i < th->nsessions; i++)
+    {
+        struct bench_session *s = &th->sessions[i];
+
+        if (bench_connect(ep, s, i) < 0)
+        {
+            th->stats.failed++;
+            if (s->fd >= 0)
+                close(s->fd);
+            s->state = S_DONE;
+            continue;
+        }
+        active++;
+    }
+
+    while (active > 0 && bench_now_us() < deadline)
+    {
+        int n = epoll_wait(ep, events, BENCH_EVENTS, 100);
+
+        for (int i = 0; i < n; i++)
+        {
+            struct bench_session *s = &th->sessions[events[i].data.u32];
+
+            if (s->state == S_DONE)
+                continue;
+            if (s->state == S_CONNECTING)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err)
+                {
+                    bench_close(th, s, 0);
+                    active--;
+                    continue;
+                }
+                s->state = S_LOGIN;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                bench_read(th, s);
+            if (s->state == S_DONE)
+                active--;
+        }
+    }
+
+    /* Whatever is still running timed out. */
+    for (int i = 0; i < th->nsessions; i++)
+        bench_close(th, &th->sessions[i], 0);
+    close(ep);
+    return NULL;
+}
+
+static void usage(const char *progname)
+{
+    printf("Usage: %s [-H host] [-p port] [-c sessions] [-t threads] [-n iterations]\n"
+           "          [-s script] [-a password] [-T timeout]\n"
+           "  script lines are \"type TEXT\" (keystroke by keystroke, each echo\n"
+           "  timed) or \"cmd TEXT\" (whole line); both time the command round trip\n",
+           progname);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_thread *threads;
+    struct bench_stats total;
+    const char *host = "127.0.0.1";
+    const char *script = NULL;
+    int port = 23;
+    uint64_t start, elapsed;
+    struct rlimit rl;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:c:t:n:s:a:T:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'c':
+                bench_sessions = atoi(optarg);
+                break;
+            case 't':
+                bench_threads = atoi(optarg);
+                break;
+            case 'n':
+                bench_iterations = atoi(optarg);
+                break;
+            case 's':
+                script = optarg;
+                break;
+            case 'a':
+                bench_password = optarg;
+                break;
+            case 'T':
+                bench_timeout = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : -1;
+        }
+    }
+    if (bench_sessions < 1 || bench_threads < 1 || bench_iterations < 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (bench_threads > bench_sessions)
+        bench_threads = bench_sessions;
+
+    if (script)
+    {
+        if (bench_script_load(script) < 0)
+            return -1;
+    }
+    else
+        for (size_t i = 0; i < sizeof(bench_default_script) / sizeof(bench_default_script[0]); i++)
+            bench_script_line(bench_default_script[i]);
+    if (bench_nops == 0)
+    {
+        fprintf(stderr, "empty script\n");
+        return -1;
+    }
+
+    memset(&bench_addr, 0, sizeof(bench_addr));
+    bench_addr.sin_family = AF_INET;
+    bench_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &bench_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", host);
+        return -1;
+    }
+
+    /* One descriptor per session. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    threads = (struct bench_thread *)calloc(bench_threads, sizeof(struct bench_thread));
+    start = bench_now_us();
+    for (int i = 0; i < bench_threads; i++)
+    {
+        struct bench_thread *th = &threads[i];
+
+        th->nsessions = bench_sessions / bench_threads + (i < bench_sessions % bench_threads);
+        th->sessions = (struct bench_session *)calloc(th->nsessions, sizeof(struct bench_session));
+        pthread_create(&th->tid, NULL, bench_run, th);
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < bench_threads; i++)
+    {
+        struct bench_thread *th = &threads[i];
+
+        pthread_join(th->tid, NULL);
+        bench_samples_merge(&total.setup, &th->stats.setup);
+        bench_samples_merge(&total.echo, &th->stats.echo);
+        bench_samples_merge(&total.cmd, &th->stats.cmd);
+        total.bytes_in += th->stats.bytes_in;
+        total.bytes_out += th->stats.bytes_out;
+        total.keystrokes += th->stats.keystrokes;
+        total.commands += th->stats.commands;
+        total.ok += th->stats.ok;
+        total.failed += th->stats.failed;
+        if (th->stats.last_ready > total.last_ready)
+            total.last_ready = th->stats.last_ready;
+        free(th->sessions);
+    }
+    elapsed = bench_now_us() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    printf("sessions: %d completed, %d failed, %d threads, %d iterations of %d ops\n",
+           total.ok, total.failed, bench_threads, bench_iterations, bench_nops);
+    if (total.last_ready > start)
+        printf("setup: %zu sessions ready in %.1f ms, %.0f sessions/s\n", total.setup.n,
+               (total.last_ready - start) / 1000.0, total.setup.n * 1e6 / (total.last_ready - start));
+    bench_report_samples("setup", &total.setup);
+    bench_report_samples("echo", &total.echo);
+    bench_report_samples("command", &total.cmd);
+    printf("throughput: %.0f keystrokes/s, %.0f commands/s, in %.2f MB/s, out %.2f MB/s over %.2f s\n",
+           total.keystrokes * 1e6 / elapsed, total.commands * 1e6 / elapsed,
+           total.bytes_in / (double)elapsed, total.bytes_out / (double)elapsed, elapsed / 1e6);
+
+    free(threads);
+    return total.failed ? 1 : 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "buffer.h"
+
+/* Freelist of BUFFER_SIZE_DEFAULT chunks. A chunk may be freed by
+   another thread than the one that took it; it then simply joins that
+   thread's list. */
+static __thread struct buffer_data *buffer_chunks;
+static __thread int buffer_nchunks;
+static unsigned long buffer_heap_chunks;
+
+unsigned long buffer_chunk_count(void)
+{
+    return __atomic_load_n(&buffer_heap_chunks, __ATOMIC_RELAXED);
+}
+
+static struct buffer_data *buffer_chunk_get(size_t size)
+{
+    struct buffer_data *d;
+
+    if (size == BUFFER_SIZE_DEFAULT && buffer_chunks)
+    {
+        d = buffer_chunks;
+        buffer_chunks = d->next;
+        buffer_nchunks--;
+        return d;
+    }
+    d = (struct buffer_data *)malloc(sizeof(struct buffer_data) + size);
+    if (d == NULL)
+        abort();
+    d->size = size;
+    __atomic_add_fetch(&buffer_heap_chunks, 1, __ATOMIC_RELAXED);
+    return d;
+}
+
+static void buffer_chunk_put(struct buffer_data *d)
+{
+    if (d->size == BUFFER_SIZE_DEFAULT && buffer_nchunks < BUFFER_CHUNK_CACHE)
+    {
+        d->next = buffer_chunks;
+        buffer_chunks = d;
+        buffer_nchunks++;
+        return;
+    }
+    __atomic_sub_fetch(&buffer_heap_chunks, 1, __ATOMIC_RELAXED);
+    free(d);
+}
+
+static struct buffer_data *buffer_add(struct buffer *b, size_t need)
+{
+    struct buffer_data *d;
+    size_t size = (need > b->size) ? need : b->size;
+
+    d = buffer_chunk_get(size);
+    d->next = NULL;
+    d->cp = d->sp = 0;
+
+    if (b->tail)
+        b->tail->next = d;
+    else
+        b->head = d;
+    b->tail = d;
+
+    return d;
+}
+
+struct buffer *buffer_new(size_t size)
+{
+    struct buffer *b;
+
+    b = (struct buffer *)malloc(sizeof(struct buffer));
+    if (b == NULL)
+        return NULL;
+    buffer_init(b, size);
+
+    return b;
+}
+
+void buffer_init(struct buffer *b, size_t size)
+{
+    memset(b, 0, sizeof(*b));
+    b->size = size ? size : BUFFER_SIZE_DEFAULT;
+}
+
+void buffer_free(struct buffer *b)
+{
+    if (b == NULL)
+        return;
+    buffer_reset(b);
+    free(b);
+}
+
+void buffer_reset(struct buffer *b)
+{
+    struct buffer_data *d, *next;
+
+    for (d = b->head; d; d = next)
+    {
+        next = d->next;
+        buffer_chunk_put(d);
+    }
+    b->head = b->tail = NULL;
+}
+
+void buffer_put(struct buffer *b, const void *p, size_t size)
+{
+    struct buffer_data *d = b->tail;
+    const unsigned char *ptr = (const unsigned char *)p;
+
+    while (size)
+    {
+        size_t chunk;
+
+        if (d == NULL || d->cp == d->size)
+            d = buffer_add(b, 0);
+
+        chunk = d->size - d->cp;
+        if (chunk > size)
+            chunk = size;
+        memcpy(d->data + d->cp, ptr, chunk);
+        d->cp += chunk;
+        ptr += chunk;
+        size -= chunk;
+    }
+}
+
+void buffer_putc(struct buffer *b, unsigned char c)
+{
+    struct buffer_data *d = b->tail;
+
+    if (d == NULL || d->cp == d->size)
+        d = buffer_add(b, 0);
+    d->data[d->cp++] = c;
+}
+
+void buffer_putstr(struct buffer *b, const char *str)
+{
+    buffer_put(b, str, strlen(str));
+}
+
+int buffer_vprintf(struct buffer *b, const char *format, va_list args)
+{
+    struct buffer_data *d = b->tail;
+    size_t avail;
+    va_list ac;
+    int len;
+
+    if (d == NULL || d->cp == d->size)
+        d = buffer_add(b, 0);
+
+    /* Try to format into the free space of the tail chunk. vsnprintf
+       always wants room for the trailing NUL, which is not kept. */
+    avail = d->size - d->cp;
+    va_copy(ac, args);
+    len = vsnprintf((char *)d->data + d->cp, avail, format, ac);
+    va_end(ac);
+    if (len < 0)
+        return -1;
+    if ((size_t)len < avail)
+    {
+        d->cp += len;
+        return len;
+    }
+
+    /* Did not fit: format again into a fresh chunk big enough to hold
+       the whole string, so the output stays contiguous. */
+    d = buffer_add(b, len + 1);
+    va_copy(ac, args);
+    vsnprintf((char *)d->data, d->size, format, ac);
+    va_end(ac);
+    d->cp = len;
+
+    return len;
+}
+
+int buffer_empty(struct buffer *b)
+{
+    return (b->head == NULL) || (b->head == b->tail && b->head->sp == b->head->cp);
+}
+
+size_t buffer_length(struct buffer *b)
+{
+    struct buffer_data *d;
+    size_t total = 0;
+
+    for (d = b->head; d; d = d->next)
+        total += d->cp - d->sp;
+    return total;
+}
+
+buffer_status_t buffer_flush_available(struct buffer *b, int fd)
+{
+    struct iovec iov[BUFFER_MAX_CHUNKS];
+    struct buffer_data *d;
+    size_t total;
+    int iovcnt;
+    ssize_t nbytes;
+
+again:
+    iovcnt = 0;
+    total = 0;
+    for (d = b->head; d && iovcnt < BUFFER_MAX_CHUNKS; d = d->next)
+    {
+        if (d->cp == d->sp)
+            continue;
+        iov[iovcnt].iov_base = d->data + d->sp;
+        iov[iovcnt].iov_len = d->cp - d->sp;
+        total += iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+    if (iovcnt == 0)
+    {
+        buffer_reset(b);
+        return BUFFER_EMPTY;
+    }
+
+    nbytes = writev(fd, iov, iovcnt);
+    if (nbytes < 0)
+    {
+        if (errno == EINTR)
+            goto again;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return BUFFER_PENDING;
+        return BUFFER_ERROR;
+    }
+
+    buffer_consume(b, nbytes);
+    if ((size_t)nbytes < total)
+        return BUFFER_PENDING;
+
+    /* The socket took everything offered but there were more chunks
+       than iovecs: no EPOLLOUT edge would come for the rest. */
+    if (b->head)
+        goto again;
+
+    return BUFFER_EMPTY;
+}
+
+void buffer_consume(struct buffer *b, size_t n)
+{
+    struct buffer_data *d;
+
+    b->flushed += n;
+    while ((d = b->head) != NULL)
+    {
+        if (n < d->cp - d->sp)
+        {
+            d->sp += n;
+            return;
+        }
+        n -= d->cp - d->sp;
+        b->head = d->next;
+        if (b->head == NULL)
+            b->tail = NULL;
+        buffer_chunk_put(d);
+    }
+}
+
+/* Consume bytes while there are lines left on the screen. A character
+   that would start a line beyond the budget is not consumed. */
+static size_t buffer_scan_lines(const unsigned char *p, size_t n, int width, int *lines, int *col)
+{
+    size_t i;
+
+    for (i = 0; i < n && *lines > 0; i++)
+    {
+        if (p[i] == '\n')
+        {
+            (*lines)--;
+            *col = 0;
+        }
+        else if (p[i] != '\r' && width)
+        {
+            if (*col == width)
+            {
+                if (--(*lines) == 0)
+                    break;
+                *col = 0;
+            }
+            (*col)++;
+        }
+    }
+    return i;
+}
+
+size_t buffer_move_lines(struct buffer *to, struct buffer *from, int width, int *lines, int *col)
+{
+    struct buffer_data *d;
+    size_t moved = 0;
+
+    while ((d = from->head) != NULL && (lines == NULL || *lines > 0))
+    {
+        size_t len = d->cp - d->sp;
+        size_t n = lines ? buffer_scan_lines(d->data + d->sp, len, width, lines, col) : len;
+
+        if (n < len)
+        {
+            buffer_put(to, d->data + d->sp, n);
+            d->sp += n;
+            moved += n;
+            continue;
+        }
+
+        /* The whole chunk goes: relink it instead of copying. */
+        from->head = d->next;
+        if (from->head == NULL)
+            from->tail = NULL;
+        if (len == 0)
+        {
+            buffer_chunk_put(d);
+            continue;
+        }
+        d->next = NULL;
+        if (to->tail)
+            to->tail->next = d;
+        else
+            to->head = d;
+        to->tail = d;
+        moved += len;
+    }
+    return moved;
+}
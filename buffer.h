@@ -0,0 +1,114 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+/* Default size of one buffer_data chunk, a multiple of the vty read
+   size. Chunks of this size are recycled through a per-thread freelist
+   of up to BUFFER_CHUNK_CACHE chunks instead of going back to the heap,
+   so steady output does not allocate. */
+#define BUFFER_SIZE_DEFAULT 4096
+#define BUFFER_CHUNK_CACHE  1024
+
+/* Upper bound of iovecs handed to one writev(). */
+#define BUFFER_MAX_CHUNKS 64
+
+/* Buffer master. Output is kept as a list of fixed size chunks so that
+   formatting never moves data that was already produced. */
+struct buffer
+{
+  /* Data list. */
+  struct buffer_data *head;
+  struct buffer_data *tail;
+
+  /* Size of each buffer_data chunk. */
+  size_t size;
+
+  /* Bytes written out so far, for statistics. */
+  unsigned long flushed;
+};
+
+/* Data container. */
+struct buffer_data
+{
+  struct buffer_data *next;
+
+  /* Location to add new data. */
+  size_t cp;
+
+  /* Pointer to data not yet flushed. */
+  size_t sp;
+
+  /* Size of data[]. */
+  size_t size;
+
+  /* Actual data stream (variable length). */
+  unsigned char data[];
+};
+
+typedef enum
+{
+  /* An I/O error occurred. The buffer should be destroyed and the
+     file descriptor should be closed. */
+  BUFFER_ERROR = -1,
+
+  /* The data was written successfully, and the buffer is now empty
+     (there is no pending data waiting to be flushed). */
+  BUFFER_EMPTY = 0,
+
+  /* There is pending data in the buffer waiting to be flushed. Please
+     try flushing the buffer when select indicates that the file
+     descriptor is writeable. */
+  BUFFER_PENDING = 1
+} buffer_status_t;
+
+/* Create a new buffer. Memory will be allocated in chunks of the given
+   size. If the argument is 0, BUFFER_SIZE_DEFAULT is used. */
+struct buffer *buffer_new(size_t size);
+
+/* Same for a buffer embedded in another object. */
+void buffer_init(struct buffer *b, size_t size);
+
+/* Chunks currently taken from the heap, in use or cached. */
+unsigned long buffer_chunk_count(void);
+
+/* Free all data in the buffer and the buffer itself. */
+void buffer_free(struct buffer *b);
+
+/* Release all data queued in the buffer, keep the buffer itself. */
+void buffer_reset(struct buffer *b);
+
+/* Add the given data to the end of the buffer. */
+void buffer_put(struct buffer *b, const void *p, size_t size);
+void buffer_putc(struct buffer *b, unsigned char c);
+void buffer_putstr(struct buffer *b, const char *str);
+
+/* Format directly into the tail chunk of the buffer. Returns the
+   number of bytes added, or -1 on a format error. */
+int buffer_vprintf(struct buffer *b, const char *format, va_list args);
+
+/* Returns 1 if there is no pending data in the buffer. */
+int buffer_empty(struct buffer *b);
+
+/* Number of bytes waiting to be flushed. */
+size_t buffer_length(struct buffer *b);
+
+/* Try to write as much pending data as possible to fd, BUFFER_MAX_CHUNKS
+   chunks per writev(), until the socket refuses more. fd should be
+   non-blocking. */
+buffer_status_t buffer_flush_available(struct buffer *b, int fd);
+
+/* Drop n bytes from the head, written out by other means (e.g. an
+   asynchronous send of the chunks in place). */
+void buffer_consume(struct buffer *b, size_t n);
+
+/* Move data from the head of one buffer to the tail of another, no more
+   than *lines lines of a terminal width columns wide (0: no wrapping).
+   *lines and *col keep the screen position between calls; lines NULL
+   moves everything. Whole chunks are relinked rather than copied.
+   Returns the number of bytes moved. */
+size_t buffer_move_lines(struct buffer *to, struct buffer *from, int width, int *lines, int *col);
+
+#endif /*BUFFER_H*/
@@ -0,0 +1,1087 @@
+#include "mini_vtysh.h"
+
+/* Hostname shown in the prompt, changed by "hostname WORD". */
+static char host_name[64] = "SWITCH";
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-thread scratch space for tokenizing command lines, rewound after
+   every command. */
+static __thread struct arena cmd_arena;
+
+/* The commands of command.def by index. */
+#define CMD(cmdname, spec) extern struct cmd_element cmdname;
+#define INSTALL(node, cmdname)
+#include "command.def"
+#undef CMD
+#undef INSTALL
+
+static constexpr struct cmd_element *cmd_elements[CMD_INDEX_MAX] =
+{
+  NULL,
+#define CMD(cmdname, spec) &cmdname,
+#define INSTALL(node, cmdname)
+#include "command.def"
+#undef CMD
+#undef INSTALL
+};
+
+/* The INSTALL() lines of command.def. */
+struct cmd_install
+{
+  enum node_type node;
+  enum cmd_index cmd;
+};
+
+static constexpr struct cmd_install cmd_installs[] =
+{
+#define CMD(cmdname, spec)
+#define INSTALL(node, cmdname) { node, CMD_INDEX_##cmdname },
+#include "command.def"
+#undef CMD
+#undef INSTALL
+};
+
+#define CMD_NINSTALLS (int)(sizeof(cmd_installs) / sizeof(cmd_installs[0]))
+
+/* Every specification of command.def, each token NUL terminated, for
+   the graph nodes' text to point into. start is where each begins. */
+template <size_t S>
+struct cmd_text
+{
+  char text[S];
+  size_t start[CMD_INDEX_MAX];
+};
+
+constexpr size_t cmd_text_size(void)
+{
+    size_t n = 0;
+
+    for (int i = 0; i < CMD_INDEX_MAX; i++)
+        for (size_t j = 0; j == 0 || cmd_specs[i][j - 1]; j++)
+            n++;
+    return n;
+}
+
+template <size_t S>
+constexpr struct cmd_text<S> cmd_text_build(void)
+{
+    struct cmd_text<S> ct {};
+    size_t n = 0;
+
+    for (int i = 0; i < CMD_INDEX_MAX; i++)
+    {
+        const char *spec = cmd_specs[i];
+
+        ct.start[i] = n;
+        for (size_t j = 0; spec[j]; j++)
+            ct.text[n++] = cmd_spec_blank(spec[j]) ? '\0' : spec[j];
+        ct.text[n++] = '\0';
+    }
+    return ct;
+}
+
+static constexpr auto cmd_texts = cmd_text_build<cmd_text_size()>();
+
+/* What cmd_table_build() finds wrong with the commands of a node. */
+enum cmd_table_error
+{
+  CMD_TABLE_OK,
+  CMD_TABLE_DUPLICATE,		/* Two commands with the same tokens. */
+  CMD_TABLE_VARIABLE,		/* Two that differ only in variable names,
+				   or ranges that overlap. */
+  CMD_TABLE_HASH,		/* No seed hashes some keywords apart. */
+};
+
+/* A node's command graph, nodes[0] the root, with the keyword hash
+   slots and the node's commands. dup and with are the two commands an
+   error is about. */
+template <int N>
+struct cmd_table
+{
+  struct cmd_graph_node nodes[N];
+  unsigned short slots[4 * N];
+  struct cmd_element *cmds[N];
+  int ncmds;
+  enum cmd_table_error error;
+  enum cmd_index dup, with;
+};
+
+/* A graph position while the graph is built: its children are a list
+   in the order they were met, from is the command that first took it
+   and cmd the one ending there. */
+struct cmd_trie
+{
+  struct cmd_graph_node gn;
+  int child, last, next;
+  enum cmd_index from, cmd;
+};
+
+/* Graph positions a node needs at most: the root, and one per token
+   of each of its commands. */
+constexpr int cmd_table_size(enum node_type node)
+{
+    int n = 1;
+
+    for (int i = 0; i < CMD_NINSTALLS; i++)
+        if (cmd_installs[i].node == node)
+            n += cmd_spec_count(cmd_specs[cmd_installs[i].cmd]);
+    return n;
+}
+
+/* Do two specifications have the same tokens, whatever the blanks? */
+constexpr int cmd_spec_same_tokens(const char *a, const char *b)
+{
+    size_t i = 0, j = 0;
+
+    while (1)
+    {
+        while (cmd_spec_blank(a[i]))
+            i++;
+        while (cmd_spec_blank(b[j]))
+            j++;
+        if (a[i] == '\0' || b[j] == '\0')
+            return a[i] == b[j];
+
+        size_t len = cmd_spec_token_len(a + i);
+
+        if (len != cmd_spec_token_len(b + j))
+            return 0;
+        for (size_t k = 0; k < len; k++)
+            if (a[i + k] != b[j + k])
+                return 0;
+        i += len;
+        j += len;
+    }
+}
+
+constexpr int cmd_text_cmp(const char *a, const char *b)
+{
+    size_t i = 0;
+
+    for (; a[i] && a[i] == b[i]; i++)
+        ;
+    return (unsigned char)a[i] - (unsigned char)b[i];
+}
+
+template <int N>
+constexpr void cmd_table_fail(struct cmd_table<N> &t, enum cmd_table_error error,
+                              enum cmd_index dup, enum cmd_index with)
+{
+    if (t.error != CMD_TABLE_OK)
+        return;
+    t.error = error;
+    t.dup = dup;
+    t.with = with;
+}
+
+/* Find a seed that hashes the keyword children of g apart into 2^bits
+   slots from nslots on, the fewest bits with twice the slots as
+   keywords. Returns where the next position's slots start. */
+template <int N>
+constexpr int cmd_table_seed(struct cmd_table<N> &t, struct cmd_graph_node &g, int nslots)
+{
+    const struct cmd_graph_node *kw = &g + g.keywords;
+
+    while ((1 << g.bits) < 2 * g.nkeywords)
+        g.bits++;
+    g.slot = nslots;
+    for (g.seed = 0; g.seed < 65536; g.seed++)
+    {
+        int k = 0;
+
+        for (int s = 0; s < (1 << g.bits); s++)
+            t.slots[g.slot + s] = 0;
+        for (; k < g.nkeywords && !t.slots[g.slot + cmd_hash_slot(kw[k].hash, g.seed, g.bits)]; k++)
+            t.slots[g.slot + cmd_hash_slot(kw[k].hash, g.seed, g.bits)] = k + 1;
+        if (k == g.nkeywords)
+            return nslots + (1 << g.bits);
+    }
+    cmd_table_fail(t, CMD_TABLE_HASH, CMD_INDEX_NONE, CMD_INDEX_NONE);
+    return nslots + (1 << g.bits);
+}
+
+/* Build the graph of node from command.def, see struct cmd_graph_node.
+   Variables of one kind match the same words whatever their names, so
+   they share a position; two commands that end on the same position
+   cannot be told apart, which is an error, as are two ranges of one
+   position that overlap. */
+template <int N>
+constexpr struct cmd_table<N> cmd_table_build(enum node_type node)
+{
+    struct cmd_table<N> t {};
+    struct cmd_trie trie[N] {};
+    int order[N] {};
+    int ntrie = 1, n = 1, nslots = 0;
+
+    for (int i = 0; i < CMD_NINSTALLS; i++)
+    {
+        enum cmd_index idx = cmd_installs[i].cmd;
+        const char *spec = cmd_specs[idx];
+        int cur = 0, token = 0;
+
+        if (cmd_installs[i].node != node)
+            continue;
+        for (size_t p = 0; spec[p]; p++)
+        {
+            if (cmd_spec_blank(spec[p]) || (p > 0 && !cmd_spec_blank(spec[p - 1])))
+                continue;
+
+            size_t len = cmd_spec_token_len(spec + p);
+            long min = 0, max = 0;
+            int type = cmd_spec_type(spec + p, len, &min, &max);
+            int c = trie[cur].child;
+
+            /* A bad range fails cmd_spec_check() in its DEFUN(). */
+            if (type < 0)
+                type = TOKEN_KEYWORD;
+            for (; c; c = trie[c].next)
+            {
+                const struct cmd_graph_node &g = trie[c].gn;
+
+                if (g.type == type &&
+                    (type == TOKEN_KEYWORD ? (g.len == len && cmd_spec_equal(spec + p, len, g.text))
+                                           : (type != TOKEN_RANGE || (g.min == min && g.max == max))))
+                    break;
+                if (g.type == type && type == TOKEN_RANGE && g.min <= max && min <= g.max)
+                    cmd_table_fail(t, CMD_TABLE_VARIABLE, idx, trie[c].from);
+            }
+            if (c == 0)
+            {
+                struct cmd_graph_node &g = trie[ntrie].gn;
+
+                c = ntrie++;
+                g.type = (enum cmd_token_type)type;
+                g.text = cmd_texts.text + cmd_texts.start[idx] + p;
+                g.len = len;
+                g.hash = (type == TOKEN_KEYWORD) ? cmd_hash(spec + p, len) : 0;
+                g.min = min;
+                g.max = max;
+                g.owner = cmd_elements[idx];
+                g.token = token;
+                trie[c].from = idx;
+                if (trie[cur].last)
+                    trie[trie[cur].last].next = c;
+                else
+                    trie[cur].child = c;
+                trie[cur].last = c;
+            }
+            cur = c;
+            token++;
+        }
+
+        if (trie[cur].cmd)
+        {
+            cmd_table_fail(t, cmd_spec_same_tokens(cmd_specs[trie[cur].cmd], spec) ?
+                           CMD_TABLE_DUPLICATE : CMD_TABLE_VARIABLE, idx, trie[cur].cmd);
+            continue;
+        }
+        trie[cur].cmd = idx;
+        t.cmds[t.ncmds++] = cmd_elements[idx];
+    }
+
+    /* Lay the graph out breadth first, each position's keywords sorted
+       and then its variables, and hash the keywords. */
+    for (int q = 0; q < n; q++)
+    {
+        struct cmd_graph_node &g = t.nodes[q];
+        const struct cmd_trie &tq = trie[order[q]];
+        int first = n;
+
+        g = tq.gn;
+        g.cmd = cmd_elements[tq.cmd];
+        for (int c = tq.child; c; c = trie[c].next)
+            if (trie[c].gn.type == TOKEN_KEYWORD)
+            {
+                int k = n++;
+
+                for (; k > first && cmd_text_cmp(trie[order[k - 1]].gn.text, trie[c].gn.text) > 0; k--)
+                    order[k] = order[k - 1];
+                order[k] = c;
+            }
+        g.nkeywords = n - first;
+        g.keywords = g.nkeywords ? first - q : 0;
+
+        first = n;
+        for (int c = tq.child; c; c = trie[c].next)
+            if (trie[c].gn.type != TOKEN_KEYWORD)
+                order[n++] = c;
+        g.nvars = n - first;
+        g.vars = g.nvars ? first - q : 0;
+    }
+    for (int q = 0; q < n; q++)
+        if (t.nodes[q].nkeywords)
+            nslots = cmd_table_seed(t, t.nodes[q], nslots);
+    return t;
+}
+
+/* Instantiated for every node's table, so that an error names the
+   node and the two commands of command.def it is about. */
+template <enum node_type node, enum cmd_table_error error, enum cmd_index dup, enum cmd_index with>
+struct cmd_table_check
+{
+  static_assert(error != CMD_TABLE_DUPLICATE, "two commands of a node have the same tokens");
+  static_assert(error != CMD_TABLE_VARIABLE,
+                "two commands of a node differ only in variable names, or in overlapping ranges");
+  static_assert(error != CMD_TABLE_HASH, "no seed hashes the keywords of a position apart");
+  static constexpr int ok = 1;
+};
+
+#define CMD_TABLE(table, node) \
+  static constexpr auto table = cmd_table_build<cmd_table_size(node)>(node); \
+  static_assert(cmd_table_check<node, table.error, table.dup, table.with>::ok, #node);
+
+CMD_TABLE (cmd_auth_table, AUTH_NODE)
+CMD_TABLE (cmd_view_table, VIEW_NODE)
+CMD_TABLE (cmd_enable_table, ENABLE_NODE)
+CMD_TABLE (cmd_config_table, CONFIG_NODE)
+CMD_TABLE (cmd_interface_table, INTERFACE_NODE)
+
+#define CMD_NODE(node, prompt, table) \
+  { node, prompt, table.nodes, table.slots, table.cmds, table.ncmds, NULL }
+
+/* Command nodes. */
+static struct cmd_node cmd_nodes[NODE_MAX] =
+{
+  CMD_NODE (AUTH_NODE, "Password: ", cmd_auth_table),
+  CMD_NODE (VIEW_NODE, "%s> ", cmd_view_table),
+  CMD_NODE (ENABLE_NODE, "%s# ", cmd_enable_table),
+  CMD_NODE (CONFIG_NODE, "%s(config)# ", cmd_config_table),
+  CMD_NODE (INTERFACE_NODE, "%s(config-if)# ", cmd_interface_table),
+};
+
+/* Ranking of a word against a token. A command wins when its sequence
+   of ranks is the lexicographically largest. */
+enum match_type
+{
+  no_match = 0,
+  any_match,			/* WORD, .LINE */
+  partial_match,		/* abbreviated keyword */
+  vararg_match,			/* A.B.C.D, A.B.C.D/M, <lo-hi> */
+  exact_match,			/* keyword typed in full */
+};
+
+struct cmd_node *cmd_node_get(enum node_type node)
+{
+    return (node >= 0 && node < NODE_MAX) ? &cmd_nodes[node] : NULL;
+}
+
+const char *cmd_hostname(void)
+{
+    return host_name;
+}
+
+/* Prompt of the vty's current node. The hostname may be changed by
+   another worker, so it is copied under the lock into a per-thread
+   buffer. */
+const char *cmd_prompt(struct vty *vty)
+{
+    static __thread char buf[128];
+    struct cmd_node *cnode = cmd_node_get((enum node_type)vty->node);
+
+    if (cnode == NULL)
+        return "";
+    pthread_mutex_lock(&host_lock);
+    snprintf(buf, sizeof(buf), cnode->prompt, host_name);
+    pthread_mutex_unlock(&host_lock);
+    return buf;
+}
+
+int cmd_split(char *line, const char *words[], int max)
+{
+    int n = 0;
+    char *p = line;
+
+    while (1)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0')
+            return n;
+        if (n == max)
+            return -1;
+        words[n++] = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0')
+            return n;
+        *p++ = '\0';
+    }
+}
+
+/* Index of the first keyword child not sorting before text. */
+static int cmd_keyword_lower_bound(const struct cmd_graph_node *gn, const char *text)
+{
+    const struct cmd_graph_node *kw = gn + gn->keywords;
+    int lo = 0, hi = gn->nkeywords;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (strcmp(kw[mid].text, text) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The keyword child of gn that word of len bytes, with hash h, is
+   typed in full as, if any. */
+static const struct cmd_graph_node *cmd_keyword_find(const unsigned short *slots,
+                                                     const struct cmd_graph_node *gn,
+                                                     const char *word, size_t len, uint32_t h)
+{
+    const struct cmd_graph_node *kw;
+    int k;
+
+    if (gn->nkeywords == 0)
+        return NULL;
+    k = slots[gn->slot + cmd_hash_slot(h, gn->seed, gn->bits)];
+    if (k == 0)
+        return NULL;
+    kw = gn + gn->keywords + k - 1;
+    return (kw->hash == h && kw->len == len && memcmp(kw->text, word, len) == 0) ? kw : NULL;
+}
+
+int cmd_element_count(void)
+{
+    return CMD_INDEX_MAX - 1;
+}
+
+struct cmd_element *cmd_element_get(int i)
+{
+    return cmd_elements[i + 1];
+}
+
+const char *cmd_token_desc(const struct cmd_graph_node *gn)
+{
+    return gn->owner ? gn->owner->desc + gn->owner->tokens[gn->token].desc : NULL;
+}
+
+static int cmd_ipv4_match(const char *str, int prefix)
+{
+    unsigned int a, b, c, d, m;
+    char tail;
+
+    if (prefix)
+        return sscanf(str, "%u.%u.%u.%u/%u%c", &a, &b, &c, &d, &m, &tail) == 5 &&
+               a < 256 && b < 256 && c < 256 && d < 256 && m <= 32;
+    return sscanf(str, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) == 4 &&
+           a < 256 && b < 256 && c < 256 && d < 256;
+}
+
+static int cmd_range_match(const struct cmd_graph_node *gn, const char *str)
+{
+    char *end;
+    long val;
+
+    if (!isdigit((unsigned char)*str) && *str != '-')
+        return 0;
+    errno = 0;
+    val = strtol(str, &end, 10);
+    if (*end != '\0' || errno)
+        return 0;
+    return val >= gn->min && val <= gn->max;
+}
+
+/* Rank of a word against a variable token. */
+static enum match_type cmd_var_match(const struct cmd_graph_node *gn, const char *word)
+{
+    switch (gn->type)
+    {
+        case TOKEN_WORD:
+        case TOKEN_LINE:
+            return any_match;
+        case TOKEN_IPV4:
+            return cmd_ipv4_match(word, 0) ? vararg_match : no_match;
+        case TOKEN_IPV4_PREFIX:
+            return cmd_ipv4_match(word, 1) ? vararg_match : no_match;
+        case TOKEN_RANGE:
+            return cmd_range_match(gn, word) ? vararg_match : no_match;
+        default:
+            return no_match;
+    }
+}
+
+/* Walk state of one lookup. */
+struct cmd_match
+{
+    const char **words;
+    int nwords;
+    size_t len[CMD_ARGC_MAX];
+    uint32_t hash[CMD_ARGC_MAX];
+    const unsigned short *slots;
+
+    unsigned char rank[CMD_ARGC_MAX];
+    const struct cmd_graph_node *path[CMD_ARGC_MAX];
+
+    struct cmd_element *best;
+    unsigned char best_rank[CMD_ARGC_MAX];
+    const struct cmd_graph_node *best_path[CMD_ARGC_MAX];
+    int ambiguous;
+    int incomplete;
+};
+
+static void cmd_match_complete(struct cmd_match *m, struct cmd_element *cmd)
+{
+    int cmp = 0;
+
+    if (m->best)
+        cmp = memcmp(m->rank, m->best_rank, m->nwords);
+    if (m->best == NULL || cmp > 0)
+    {
+        m->best = cmd;
+        m->ambiguous = 0;
+        memcpy(m->best_rank, m->rank, m->nwords);
+        memcpy(m->best_path, m->path, m->nwords * sizeof(m->path[0]));
+    }
+    else if (cmp == 0 && m->best != cmd)
+        m->ambiguous = 1;
+}
+
+/* Depth first walk of every path the words can take through the graph.
+   A keyword typed in full is found by its hash, and the keywords a word
+   abbreviates are one contiguous run of the sorted children, found by
+   binary search. */
+static void cmd_match_walk(struct cmd_match *m, const struct cmd_graph_node *gn, int depth)
+{
+    const struct cmd_graph_node *kw;
+    const char *word;
+    size_t len;
+    int i;
+
+    if (depth == m->nwords)
+    {
+        if (gn->cmd)
+            cmd_match_complete(m, gn->cmd);
+        else
+            m->incomplete = 1;
+        return;
+    }
+
+    word = m->words[depth];
+    len = m->len[depth];
+    kw = cmd_keyword_find(m->slots, gn, word, len, m->hash[depth]);
+    if (kw)
+    {
+        m->rank[depth] = exact_match;
+        m->path[depth] = kw;
+        cmd_match_walk(m, kw, depth + 1);
+    }
+    for (i = cmd_keyword_lower_bound(gn, word); i < gn->nkeywords; i++)
+    {
+        kw = gn + gn->keywords + i;
+        if (strncmp(kw->text, word, len) != 0)
+            break;
+        if (kw->len == len)
+            continue;
+        m->rank[depth] = partial_match;
+        m->path[depth] = kw;
+        cmd_match_walk(m, kw, depth + 1);
+    }
+
+    for (i = 0; i < gn->nvars; i++)
+    {
+        const struct cmd_graph_node *var = gn + gn->vars + i;
+        enum match_type rank = cmd_var_match(var, word);
+
+        if (rank == no_match)
+            continue;
+        if (var->type == TOKEN_LINE)
+        {
+            for (int j = depth; j < m->nwords; j++)
+            {
+                m->rank[j] = any_match;
+                m->path[j] = var;
+            }
+            if (var->cmd)
+                cmd_match_complete(m, var->cmd);
+            continue;
+        }
+        m->rank[depth] = rank;
+        m->path[depth] = var;
+        cmd_match_walk(m, var, depth + 1);
+    }
+}
+
+/* Resolve words to one command of the node. On success argv holds the
+   words matched by variables, .LINE arguments are given as the rest of
+   the original line. */
+static int cmd_match_command(struct cmd_node *cnode, const char **words, int nwords,
+                             const char *line, const char *copy,
+                             struct cmd_element **cmd, const char *argv[], int *argc)
+{
+    struct cmd_match m;
+
+    memset(&m, 0, sizeof(m));
+    m.words = words;
+    m.nwords = nwords;
+    m.slots = cnode->slots;
+    for (int i = 0; i < nwords; i++)
+    {
+        m.len[i] = strlen(words[i]);
+        m.hash[i] = cmd_hash(words[i], m.len[i]);
+    }
+    cmd_match_walk(&m, cnode->root, 0);
+
+    if (m.best == NULL)
+        return m.incomplete ? CMD_ERR_INCOMPLETE : CMD_ERR_NO_MATCH;
+    if (m.ambiguous)
+        return CMD_ERR_AMBIGUOUS;
+
+    *argc = 0;
+    for (int i = 0; i < nwords; i++)
+    {
+        const struct cmd_graph_node *gn = m.best_path[i];
+
+        if (gn->type == TOKEN_KEYWORD)
+            continue;
+        if (gn->type == TOKEN_LINE)
+        {
+            argv[(*argc)++] = line + (words[i] - copy);
+            break;
+        }
+        argv[(*argc)++] = words[i];
+    }
+    *cmd = m.best;
+    return CMD_SUCCESS;
+}
+
+/* Could the partial word still become a match of the variable? */
+static int cmd_var_partial(const struct cmd_graph_node *gn, const char *word)
+{
+    switch (gn->type)
+    {
+        case TOKEN_WORD:
+        case TOKEN_LINE:
+            return 1;
+        case TOKEN_IPV4:
+            return strspn(word, "0123456789.") == strlen(word);
+        case TOKEN_IPV4_PREFIX:
+            return strspn(word, "0123456789./") == strlen(word);
+        case TOKEN_RANGE:
+            return strspn(word, "0123456789-") == strlen(word);
+        default:
+            return 0;
+    }
+}
+
+static int cmd_candidate_add(const struct cmd_graph_node **vec, int n, int max,
+                             const struct cmd_graph_node *gn)
+{
+    for (int i = 0; i < n; i++)
+        if (vec[i] == gn)
+            return n;
+    if (n < max)
+        vec[n++] = gn;
+    return n;
+}
+
+/* Collect the tokens that can follow the complete words of line, or that
+   the last, partial word can still become. Keywords typed in full are
+   found by hash and the keyword runs come straight from the sorted
+   children, so nothing is scanned linearly except the few variables
+   of a position. Returns the number of
+   candidates, -1 when the words already fail to match. *cr is set when
+   the line as typed is a complete command. */
+int cmd_candidates(struct vty *vty, const char *line, const struct cmd_graph_node *out[], int max,
+                   int *cr, int keywords_only)
+{
+    struct cmd_node *cnode = cmd_node_get((enum node_type)vty->node);
+    const struct cmd_graph_node *cur[CMD_CANDIDATE_MAX], *next[CMD_CANDIDATE_MAX];
+    const char *words[CMD_ARGC_MAX];
+    char copy[CMD_LINE_MAX];
+    const char *prefix;
+    int ncur, nwords, ncomplete, nout = 0, i, j, k;
+    size_t len;
+
+    *cr = 0;
+    if (cnode == NULL)
+        return -1;
+
+    snprintf(copy, sizeof(copy), "%s", line);
+    len = strlen(copy);
+    nwords = cmd_split(copy, words, CMD_ARGC_MAX);
+    if (nwords < 0)
+        return -1;
+    if (nwords == 0 || isspace((unsigned char)line[len - 1]))
+    {
+        ncomplete = nwords;
+        prefix = "";
+    }
+    else
+    {
+        ncomplete = nwords - 1;
+        prefix = words[nwords - 1];
+    }
+
+    cur[0] = cnode->root;
+    ncur = 1;
+    for (i = 0; i < ncomplete; i++)
+    {
+        int nexact = 0, nnext = 0;
+        size_t wlen = strlen(words[i]);
+        uint32_t h = cmd_hash(words[i], wlen);
+
+        /* A keyword typed in full hides the keywords it abbreviates. */
+        for (j = 0; j < ncur; j++)
+        {
+            const struct cmd_graph_node *kw = cmd_keyword_find(cnode->slots, cur[j], words[i], wlen, h);
+
+            if (kw)
+                nexact = cmd_candidate_add(next, nexact, CMD_CANDIDATE_MAX, kw);
+        }
+        nnext = nexact;
+        for (j = 0; j < ncur; j++)
+        {
+            const struct cmd_graph_node *gn = cur[j];
+
+            if (gn->type == TOKEN_LINE)
+            {
+                nnext = cmd_candidate_add(next, nnext, CMD_CANDIDATE_MAX, gn);
+                continue;
+            }
+            if (!nexact)
+                for (k = cmd_keyword_lower_bound(gn, words[i]); k < gn->nkeywords; k++)
+                {
+                    if (strncmp(gn[gn->keywords + k].text, words[i], wlen) != 0)
+                        break;
+                    nnext = cmd_candidate_add(next, nnext, CMD_CANDIDATE_MAX, gn + gn->keywords + k);
+                }
+            for (k = 0; k < gn->nvars; k++)
+                if (cmd_var_match(gn + gn->vars + k, words[i]) != no_match)
+                    nnext = cmd_candidate_add(next, nnext, CMD_CANDIDATE_MAX, gn + gn->vars + k);
+        }
+        if (nnext == 0)
+            return -1;
+        memcpy(cur, next, nnext * sizeof(cur[0]));
+        ncur = nnext;
+    }
+
+    len = strlen(prefix);
+    for (j = 0; j < ncur; j++)
+    {
+        const struct cmd_graph_node *gn = cur[j];
+
+        if (gn->cmd && !len)
+            *cr = 1;
+        if (gn->type == TOKEN_LINE)
+        {
+            if (!keywords_only)
+                nout = cmd_candidate_add(out, nout, max, gn);
+            continue;
+        }
+        for (k = cmd_keyword_lower_bound(gn, prefix); k < gn->nkeywords; k++)
+        {
+            if (strncmp(gn[gn->keywords + k].text, prefix, len) != 0)
+                break;
+            nout = cmd_candidate_add(out, nout, max, gn + gn->keywords + k);
+        }
+        if (!keywords_only)
+            for (k = 0; k < gn->nvars; k++)
+                if (cmd_var_partial(gn + gn->vars + k, prefix))
+                    nout = cmd_candidate_add(out, nout, max, gn + gn->vars + k);
+    }
+    return nout;
+}
+
+/* Split line and resolve it to a command of the vty's node. The words
+   and argv point into a copy in cmd_arena, which the caller rewinds. */
+static int cmd_parse(struct vty *vty, const char *line, struct cmd_element **cmd,
+                     const char *argv[], int *argc)
+{
+    struct cmd_node *cnode = cmd_node_get((enum node_type)vty->node);
+    const char *words[CMD_ARGC_MAX];
+    char *copy, *trimmed;
+    size_t len;
+    int nwords;
+
+    *cmd = NULL;
+    if (cnode == NULL)
+        return CMD_ERR_NO_MATCH;
+
+    /* Two copies: one is split into words, the other keeps the spacing
+       of the line for .LINE arguments. */
+    len = strlen(line);
+    while (len && isspace((unsigned char)line[len - 1]))
+        len--;
+    copy = (char *)arena_alloc(&cmd_arena, 2 * (len + 1));
+    if (copy == NULL)
+        return CMD_WARNING;
+    trimmed = copy + len + 1;
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    memcpy(trimmed, line, len);
+    trimmed[len] = '\0';
+
+    nwords = cmd_split(copy, words, CMD_ARGC_MAX);
+    if (nwords < 0)
+        return CMD_ERR_EXEED_ARGC_MAX;
+    if (nwords == 0)
+        return CMD_SUCCESS;
+    return cmd_match_command(cnode, words, nwords, trimmed, copy, cmd, argv, argc);
+}
+
+enum node_type cmd_node_parent(enum node_type node)
+{
+    switch (node)
+    {
+        case INTERFACE_NODE:
+            return CONFIG_NODE;
+        case CONFIG_NODE:
+            return ENABLE_NODE;
+        default:
+            return node;
+    }
+}
+
+/* Execute command by argument line. A configuration file line that is
+   no command of the vty's node is tried in the nodes above, as if it
+   was preceded by "exit"; it fails in its own node if none has it. */
+int cmd_execute_command(struct vty *vty, const char *line, struct cmd_element **matched)
+{
+    const char *argv[CMD_ARGC_MAX];
+    struct cmd_element *cmd;
+    struct arena_mark mark;
+    int argc, ret;
+
+    mark = arena_mark(&cmd_arena);
+    ret = cmd_parse(vty, line, &cmd, argv, &argc);
+    if (ret != CMD_SUCCESS && vty->type == vty::VTY_FILE)
+    {
+        int node = vty->node, parent;
+        void *index = vty->index;
+
+        while ((parent = cmd_node_parent((enum node_type)vty->node)) != vty->node)
+        {
+            vty->node = parent;
+            vty->index = NULL;
+            arena_release(&cmd_arena, mark);
+            if (cmd_parse(vty, line, &cmd, argv, &argc) == CMD_SUCCESS)
+            {
+                ret = CMD_SUCCESS;
+                break;
+            }
+        }
+        if (ret != CMD_SUCCESS)
+        {
+            vty->node = node;
+            vty->index = index;
+        }
+    }
+    if (ret == CMD_SUCCESS && cmd)
+        ret = (*cmd->func) (cmd, vty, argc, argv);
+    else if (ret != CMD_SUCCESS)
+        cmd = NULL;
+    arena_release(&cmd_arena, mark);
+
+    if (matched)
+        *matched = cmd;
+    return ret;
+}
+
+struct cmd_element *cmd_lookup(struct vty *vty, const char *line)
+{
+    const char *argv[CMD_ARGC_MAX];
+    struct cmd_element *cmd;
+    struct arena_mark mark;
+    int argc;
+
+    mark = arena_mark(&cmd_arena);
+    if (cmd_parse(vty, line, &cmd, argv, &argc) != CMD_SUCCESS)
+        cmd = NULL;
+    arena_release(&cmd_arena, mark);
+    return cmd;
+}
+
+DEFUN (config_terminal,
+       config_terminal_cmd,
+       "configure terminal",
+       "Configuration from vty interface\n"
+       "Configuration terminal\n")
+{
+    if (vty->node_max < CONFIG_NODE)
+    {
+        vty_out (vty, "%% Configuration is not allowed on this connection%s", VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+    vty->node = CONFIG_NODE;
+    return CMD_SUCCESS;
+}
+
+/* Enable command */
+DEFUN (enable,
+       config_enable_cmd,
+       "enable",
+       "Turn on privileged mode command\n")
+{
+    if (vty->node_max < ENABLE_NODE)
+    {
+        vty_out (vty, "%% Privileged mode is not allowed on this connection%s", VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+    vty->node = ENABLE_NODE;
+    return CMD_SUCCESS;
+}
+
+/* Disable command */
+DEFUN (disable,
+       config_disable_cmd,
+       "disable",
+       "Turn off privileged mode command\n")
+{
+    if (vty->node == ENABLE_NODE)
+        vty->node = VIEW_NODE;
+    return CMD_SUCCESS;
+}
+
+/* Down vty node level. */
+DEFUN (config_exit,
+       config_exit_cmd,
+       "exit",
+       "Exit current mode and down to previous mode\n")
+{
+    switch (vty->node)
+    {
+        case VIEW_NODE:
+        case ENABLE_NODE:
+            vty->status = vty::VTY_CLOSE;
+            break;
+        case CONFIG_NODE:
+            vty->node = ENABLE_NODE;
+            break;
+        case INTERFACE_NODE:
+            vty->node = CONFIG_NODE;
+            vty->index = NULL;
+            break;
+        default:
+            break;
+    }
+    return CMD_SUCCESS;
+}
+
+/* quit is alias of exit. */
+DEFUN (config_quit,
+       config_quit_cmd,
+       "quit",
+       "Exit current mode and down to previous mode\n")
+{
+    return config_exit (self, vty, argc, argv);
+}
+
+/* End of configuration. */
+DEFUN (config_end,
+       config_end_cmd,
+       "end",
+       "End current mode and change to enable mode.\n")
+{
+    vty->node = ENABLE_NODE;
+    vty->index = NULL;
+    return CMD_SUCCESS;
+}
+
+/* Show version. */
+DEFUN (show_version,
+       show_version_cmd,
+       "show version",
+       "Show running system information\n"
+       "Displays mini_vtysh version\n")
+{
+    vty_out (vty, "mini_vtysh, built %s %s.%s", __DATE__, __TIME__, VTY_NEWLINE);
+    return CMD_SUCCESS;
+}
+
+/* Help display function for all node. */
+DEFUN (config_list,
+       config_list_cmd,
+       "list",
+       "Print command list\n")
+{
+    struct cmd_node *cnode = cmd_node_get((enum node_type)vty->node);
+
+    for (int i = 0; i < cnode->ncmds; i++)
+        vty_out (vty, "  %s%s", cnode->cmds[i]->string, VTY_NEWLINE);
+    return CMD_SUCCESS;
+}
+
+/* Configuration is written one node per call as the pager drains.
+   output_pos is the next node. */
+static int config_write_next(struct vty *vty, void *arg)
+{
+    long *node = &vty->output_pos;
+
+    while (*node < NODE_MAX && cmd_nodes[*node].func == NULL)
+        (*node)++;
+    if (*node == NODE_MAX)
+    {
+        vty_out (vty, "end%s", VTY_NEWLINE);
+        return 0;
+    }
+    (*cmd_nodes[(*node)++].func) (vty);
+    return 1;
+}
+
+/* The whole configuration at once, as "show running-config" has it
+   after its header. */
+void cmd_config_write(struct vty *vty)
+{
+    vty->output_pos = 0;
+    while (config_write_next(vty, NULL))
+        ;
+}
+
+/* Write current configuration into the terminal. Every node's writer
+   runs under its lock, so it goes to the job pool. */
+DEFUN_ATTR (show_running_config,
+            show_running_config_cmd,
+            "show running-config",
+            "Show running system information\n"
+            "Current operating configuration\n",
+            CMD_ATTR_ASYNC)
+{
+    vty_out (vty, "%sCurrent configuration:%s", VTY_NEWLINE, VTY_NEWLINE);
+    vty_out (vty, "!%s", VTY_NEWLINE);
+    vty_output_stream(vty, config_write_next, NULL, NULL);
+    return CMD_SUCCESS;
+}
+
+/* Hostname configuration */
+DEFUN (config_hostname,
+       hostname_cmd,
+       "hostname WORD",
+       "Set system's network name\n"
+       "This system's network name\n")
+{
+    if (!isalpha((unsigned char)argv[0][0]))
+    {
+        vty_out (vty, "Please specify string starting with alphabet%s", VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+
+    pthread_mutex_lock(&host_lock);
+    snprintf(host_name, sizeof(host_name), "%s", argv[0]);
+    pthread_mutex_unlock(&host_lock);
+    return CMD_SUCCESS;
+}
+
+static int config_write_host(struct vty *vty)
+{
+    pthread_mutex_lock(&host_lock);
+    vty_out (vty, "hostname %s%s", host_name, VTY_NEWLINE);
+    pthread_mutex_unlock(&host_lock);
+    vty_out (vty, "!%s", VTY_NEWLINE);
+    return 1;
+}
+
+void install_node_config(enum node_type node, int (*func) (struct vty *))
+{
+    cmd_nodes[node].func = func;
+}
+
+/* Initialize command interface. The nodes' commands are in
+   command.def, their graphs built when this file is compiled. */
+void cmd_init(void)
+{
+    install_node_config(CONFIG_NODE, config_write_host);
+}
@@ -0,0 +1,361 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct vty;
+struct cmd_element;
+
+/* There are some command levels which called from command node. */
+enum node_type
+{
+  AUTH_NODE,			/* Authentication mode of vty interface. */
+  VIEW_NODE,			/* View node. Default mode of vty interface. */
+  ENABLE_NODE,			/* Enable node. */
+  CONFIG_NODE,			/* Config node. Default mode of config file. */
+  INTERFACE_NODE,		/* Interface mode node. */
+  NODE_MAX
+};
+
+/* Return value of the commands. */
+#define CMD_SUCCESS              0
+#define CMD_WARNING              1
+#define CMD_ERR_NO_MATCH         2
+#define CMD_ERR_AMBIGUOUS        3
+#define CMD_ERR_INCOMPLETE       4
+#define CMD_ERR_EXEED_ARGC_MAX   5
+
+/* Command attributes, cmd_element.attr. */
+#define CMD_ATTR_ASYNC           0x01	/* Long running, executed on the job pool. */
+
+/* Argc max counts. */
+#define CMD_ARGC_MAX   25
+
+/* Limits of help and completion lookups. */
+#define CMD_CANDIDATE_MAX  256
+#define CMD_LINE_MAX       1024
+
+/* Kinds of token in a command specification string. */
+enum cmd_token_type
+{
+  TOKEN_KEYWORD,		/* show */
+  TOKEN_WORD,			/* WORD, any upper case name */
+  TOKEN_LINE,			/* .LINE, swallows the rest of the line */
+  TOKEN_IPV4,			/* A.B.C.D */
+  TOKEN_IPV4_PREFIX,		/* A.B.C.D/M */
+  TOKEN_RANGE,			/* <1-100> */
+};
+
+/* A command's specification and help are split when it is compiled,
+   see DEFUN_CMD_ELEMENT(): a struct cmd_spec constant in .rodata holds
+   both strings with the blanks and newlines between tokens and help
+   lines turned into NULs, and a token table with offsets into them.
+   A malformed specification does not build. */
+struct cmd_token
+{
+  enum cmd_token_type type;
+  unsigned short text;		/* Offset in cmd_element.text. */
+  unsigned short desc;		/* Offset in cmd_element.desc. */
+  long min, max;		/* Bounds of a TOKEN_RANGE. */
+};
+
+template <size_t S, size_t D, int N>
+struct cmd_spec
+{
+  char text[S];
+  char desc[D];
+  struct cmd_token tokens[N ? N : 1];
+};
+
+/* What can be wrong with a specification, see cmd_spec_check(). */
+enum cmd_spec_error
+{
+  CMD_SPEC_OK,
+  CMD_SPEC_EMPTY,		/* No token at all. */
+  CMD_SPEC_ARGC,		/* More than CMD_ARGC_MAX tokens. */
+  CMD_SPEC_RANGE,		/* <...> that is no <lo-hi> with lo <= hi. */
+  CMD_SPEC_LINE,		/* .LINE before the last token. */
+  CMD_SPEC_HELP,		/* Not one help line per token. */
+};
+
+/* isspace() of the C locale, which cmd_split() splits lines at. */
+constexpr int cmd_spec_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+constexpr int cmd_spec_count(const char *spec)
+{
+    int n = 0;
+
+    for (size_t i = 0; spec[i]; i++)
+        if (!cmd_spec_blank(spec[i]) && (i == 0 || cmd_spec_blank(spec[i - 1])))
+            n++;
+    return n;
+}
+
+/* Help lines, the newline after the last one optional. */
+constexpr int cmd_spec_lines(const char *doc)
+{
+    int n = 0;
+    size_t i = 0;
+
+    for (; doc[i]; i++)
+        if (doc[i] == '\n')
+            n++;
+    return (i > 0 && doc[i - 1] != '\n') ? n + 1 : n;
+}
+
+constexpr int cmd_spec_equal(const char *s, size_t len, const char *word)
+{
+    size_t i = 0;
+
+    for (; i < len && word[i]; i++)
+        if (s[i] != word[i])
+            return 0;
+    return i == len && word[i] == '\0';
+}
+
+/* <lo-hi>, each bound with an optional sign. Returns 0 if s is none. */
+constexpr int cmd_spec_range(const char *s, size_t len, long *min, long *max)
+{
+    long *bound[2] = { min, max };
+    size_t i = 1;
+
+    for (int k = 0; k < 2; k++)
+    {
+        long v = 0;
+        int neg = 0, digits = 0;
+
+        if (i < len && (s[i] == '-' || s[i] == '+'))
+            neg = (s[i++] == '-');
+        for (; i < len && s[i] >= '0' && s[i] <= '9'; i++, digits++)
+            v = v * 10 + (s[i] - '0');
+        if (digits == 0 || i == len || s[i] != (k ? '>' : '-'))
+            return 0;
+        *bound[k] = neg ? -v : v;
+        i++;
+    }
+    return i == len && *min <= *max;
+}
+
+/* Kind of the token of len bytes at s, -1 for a malformed range. */
+constexpr int cmd_spec_type(const char *s, size_t len, long *min, long *max)
+{
+    if (s[0] == '<' && s[len - 1] == '>')
+        return cmd_spec_range(s, len, min, max) ? TOKEN_RANGE : -1;
+    if (cmd_spec_equal(s, len, "A.B.C.D"))
+        return TOKEN_IPV4;
+    if (cmd_spec_equal(s, len, "A.B.C.D/M"))
+        return TOKEN_IPV4_PREFIX;
+    if (s[0] == '.')
+        return TOKEN_LINE;
+    if (s[0] >= 'A' && s[0] <= 'Z')
+        return TOKEN_WORD;
+    return TOKEN_KEYWORD;
+}
+
+constexpr size_t cmd_spec_token_len(const char *s)
+{
+    size_t len = 0;
+
+    while (s[len] && !cmd_spec_blank(s[len]))
+        len++;
+    return len;
+}
+
+constexpr enum cmd_spec_error cmd_spec_check(const char *spec, const char *doc)
+{
+    int n = cmd_spec_count(spec), k = 0;
+
+    if (n == 0)
+        return CMD_SPEC_EMPTY;
+    if (n > CMD_ARGC_MAX)
+        return CMD_SPEC_ARGC;
+    for (size_t i = 0; spec[i]; i++)
+    {
+        long min = 0, max = 0;
+
+        if (cmd_spec_blank(spec[i]) || (i > 0 && !cmd_spec_blank(spec[i - 1])))
+            continue;
+
+        int type = cmd_spec_type(spec + i, cmd_spec_token_len(spec + i), &min, &max);
+
+        k++;
+        if (type < 0)
+            return CMD_SPEC_RANGE;
+        if (type == TOKEN_LINE && k < n)
+            return CMD_SPEC_LINE;
+    }
+    return (cmd_spec_lines(doc) == n) ? CMD_SPEC_OK : CMD_SPEC_HELP;
+}
+
+/* Split a specification of S bytes with its help of D bytes into its
+   N tokens. */
+template <size_t S, size_t D, int N>
+constexpr struct cmd_spec<S, D, N> cmd_spec_parse(const char *spec, const char *doc)
+{
+    struct cmd_spec<S, D, N> cs {};
+    size_t d = 0;
+    int n = 0;
+
+    for (size_t i = 0; i < S; i++)
+        cs.text[i] = cmd_spec_blank(spec[i]) ? '\0' : spec[i];
+    for (size_t i = 0; i < D; i++)
+        cs.desc[i] = (doc[i] == '\n') ? '\0' : doc[i];
+    for (size_t i = 0; i + 1 < S && n < N; i++)
+    {
+        if (cs.text[i] == '\0' || (i > 0 && cs.text[i - 1] != '\0'))
+            continue;
+
+        struct cmd_token &t = cs.tokens[n++];
+        int type = cmd_spec_type(spec + i, cmd_spec_token_len(spec + i), &t.min, &t.max);
+
+        /* A bad range fails cmd_spec_check() instead. */
+        t.type = (type < 0) ? TOKEN_KEYWORD : (enum cmd_token_type)type;
+        t.text = i;
+        t.desc = d;
+        while (d + 1 < D && cs.desc[d] != '\0')
+            d++;
+        if (d + 1 < D)
+            d++;
+    }
+    return cs;
+}
+
+constexpr int cmd_spec_same(const char *a, const char *b)
+{
+    size_t i = 0;
+
+    for (; a[i] && a[i] == b[i]; i++)
+        ;
+    return a[i] == b[i];
+}
+
+/* Every command of command.def by name, from 1. DEFUN_CMD_ELEMENT()
+   makes it the command's index, and checks the specification there
+   against its own. */
+enum cmd_index
+{
+  CMD_INDEX_NONE,
+#define CMD(cmdname, spec) CMD_INDEX_##cmdname,
+#define INSTALL(node, cmdname)
+#include "command.def"
+#undef CMD
+#undef INSTALL
+  CMD_INDEX_MAX
+};
+
+constexpr const char *cmd_specs[CMD_INDEX_MAX] =
+{
+  "",
+#define CMD(cmdname, spec) spec,
+#define INSTALL(node, cmdname)
+#include "command.def"
+#undef CMD
+#undef INSTALL
+};
+
+/* FNV-1a of the len bytes at s. */
+constexpr uint32_t cmd_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+/* Slot of a keyword hash in a table of 2^bits, see cmd_graph_node. */
+constexpr unsigned int cmd_hash_slot(uint32_t h, uint32_t seed, int bits)
+{
+    return bits ? (uint32_t)((h ^ seed) * 2654435761u) >> (32 - bits) : 0;
+}
+
+/* One position in a node's command graph. Every node's graph is a
+   constant in .rodata, built from command.def when command.cpp is
+   compiled: commands sharing a prefix share the path, and a parent's
+   children follow it in the graph, the keywords sorted so that the
+   ones an abbreviation can stand for are found by binary search. A
+   keyword typed in full is found by its hash instead: the table's
+   slots from slot on, 2^bits of them, hold the position of each
+   keyword child plus one at cmd_hash_slot() of its hash, with a seed
+   chosen so that no two of them collide. */
+struct cmd_graph_node
+{
+  enum cmd_token_type type;
+  const char *text;		/* Keyword or variable name as written. */
+  unsigned short len;
+  uint32_t hash;		/* cmd_hash() of a keyword. */
+  long min, max;		/* Bounds of a TOKEN_RANGE. */
+
+  /* Children at this + keywords and this + vars. */
+  unsigned short keywords, nkeywords;
+  unsigned short vars, nvars;
+
+  unsigned short slot;
+  unsigned char bits;
+  uint32_t seed;
+
+  /* Help string, the token of owner this position was written as,
+     see cmd_token_desc(). */
+  struct cmd_element *owner;
+  unsigned char token;
+
+  /* Command completed by the path ending here, if any. */
+  struct cmd_element *cmd;
+};
+
+/* Node information. */
+struct cmd_node
+{
+  enum node_type node;
+
+  /* Prompt format, %s is replaced by the hostname. */
+  const char *prompt;
+
+  /* Root of the command graph and its keyword hash slots. */
+  const struct cmd_graph_node *root;
+  const unsigned short *slots;
+
+  /* Commands in command.def order, for "list". */
+  struct cmd_element *const *cmds;
+  int ncmds;
+
+  /* Node's configuration write function. */
+  int (*func) (struct vty *);
+};
+
+/* Prototypes. */
+void cmd_init(void);
+void install_node_config(enum node_type node, int (*func) (struct vty *));
+struct cmd_node *cmd_node_get(enum node_type node);
+const char *cmd_prompt(struct vty *vty);
+const char *cmd_hostname(void);
+void cmd_config_write(struct vty *vty);
+int cmd_execute_command(struct vty *vty, const char *line, struct cmd_element **cmd);
+
+/* The command line would run in the vty's node, NULL if none. */
+struct cmd_element *cmd_lookup(struct vty *vty, const char *line);
+
+/* The node "exit" goes down to from node in a configuration file,
+   node itself at the top. */
+enum node_type cmd_node_parent(enum node_type node);
+
+/* Every command of command.def once, whatever nodes it is in. Index
+   i is the command with cmd_element index i + 1. */
+int cmd_element_count(void);
+struct cmd_element *cmd_element_get(int i);
+
+/* Help string of a graph position. */
+const char *cmd_token_desc(const struct cmd_graph_node *gn);
+
+int cmd_candidates(struct vty *vty, const char *line, const struct cmd_graph_node *out[], int max,
+                   int *cr, int keywords_only);
+
+/* Split a line into whitespace separated words in place. Returns the
+   number of words, or -1 when there are more than max. */
+int cmd_split(char *line, const char *words[], int max);
+
+#endif /*COMMAND_H*/
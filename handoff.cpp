@@ -0,0 +1,118 @@
+#include "mini_vtysh.h"
+#include "handoff.h"
+
+int handoff_send(int sock, int type, const void *data, size_t len, const int *fds, int nfds)
+{
+    union
+    {
+        char buf[CMSG_SPACE(HANDOFF_FDS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct handoff_msg msg;
+    struct iovec iov[2];
+    struct msghdr mh;
+    ssize_t n;
+
+    if (len > HANDOFF_MSG_MAX || nfds > HANDOFF_FDS_MAX)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    msg.type = type;
+    msg.len = len;
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof(msg);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = len ? 2 : 1;
+    if (nfds > 0)
+    {
+        struct cmsghdr *cmsg;
+
+        memset(&ctl, 0, sizeof(ctl));
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    /* A record goes whole or not at all. */
+    do
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return (n < 0) ? -1 : 0;
+}
+
+ssize_t handoff_recv(int sock, int *type, void *buf, int *fds, int *nfds, int timeout)
+{
+    union
+    {
+        char buf[CMSG_SPACE(HANDOFF_FDS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct handoff_msg msg;
+    struct iovec iov[2];
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    *nfds = 0;
+    if (timeout >= 0)
+    {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret;
+
+        while ((ret = poll(&pfd, 1, timeout)) < 0 && errno == EINTR)
+            ;
+        if (ret == 0)
+            errno = ETIMEDOUT;
+        if (ret <= 0)
+            return -1;
+    }
+
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = sizeof(msg);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = HANDOFF_MSG_MAX;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    do
+        n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            memcpy(fds + *nfds, CMSG_DATA(cmsg), got * sizeof(int));
+            *nfds += got;
+        }
+
+    if (n == 0)
+    {
+        errno = 0;
+        return -1;
+    }
+    if ((size_t)n < sizeof(msg) || msg.len != n - sizeof(msg) ||
+        (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        for (int i = 0; i < *nfds; i++)
+            close(fds[i]);
+        *nfds = 0;
+        errno = EBADMSG;
+        return -1;
+    }
+    *type = msg.type;
+    return msg.len;
+}
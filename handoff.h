@@ -0,0 +1,134 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Hot restart. On SIGUSR2 the server execs its binary again with one
+   end of a SOCK_SEQPACKET socketpair named in HANDOFF_ENV, and the two
+   processes talk in records of one message each, a struct handoff_msg
+   and its payload, with file descriptors attached (SCM_RIGHTS) where
+   the record has any:
+
+   old -> new  HANDOFF_HELLO      struct handoff_hello
+               HANDOFF_CONFIG     running configuration, in as many
+                                  records as it takes
+               HANDOFF_LISTENER   the spec given to -p, NUL terminated;
+                                  its sockets, one per old worker for
+                                  TCP, the shared one for Unix
+               HANDOFF_END        no more listeners
+   new -> old  HANDOFF_READY      the new process accepts on them
+   old -> new  HANDOFF_JOURNAL    the audit journal is the new one's
+               HANDOFF_SESSION    struct handoff_session, the edit line,
+                                  the history and the queued input; the
+                                  client's socket
+               HANDOFF_AUDIT      struct handoff_audit and its text: an
+                                  event of the old process, which no
+                                  longer writes the journal itself
+               HANDOFF_DONE       every session moved, the old process
+                                  exits
+
+   Records are in host byte order: both ends are on one machine, but
+   not necessarily of one build, hence the version. */
+#define HANDOFF_MAGIC   0x56545948
+#define HANDOFF_VERSION 2
+#define HANDOFF_ENV     "MINI_VTYSH_HANDOFF"
+
+/* Largest payload, room for a session with all the input it may hold
+   back (VTY_INPUT_BACKLOG), and most descriptors on a record (the
+   kernel's SCM_MAX_FD). */
+#define HANDOFF_MSG_MAX (128 * 1024)
+#define HANDOFF_FDS_MAX 253
+
+enum handoff_type
+{
+  HANDOFF_HELLO = 1,
+  HANDOFF_CONFIG,
+  HANDOFF_LISTENER,
+  HANDOFF_END,
+  HANDOFF_READY,
+  HANDOFF_JOURNAL,
+  HANDOFF_SESSION,
+  HANDOFF_AUDIT,
+  HANDOFF_DONE,
+};
+
+struct handoff_msg
+{
+  uint32_t type;
+  uint32_t len;			/* Payload bytes. */
+};
+
+struct handoff_hello
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;			/* Of the old process. */
+  uint32_t workers;
+  uint32_t session_seq;		/* Last session number handed out. */
+};
+
+/* A session, or a connection still waiting for one. Timers go as how
+   long ago they started, the interface of INTERFACE_NODE as the
+   command that enters it again. */
+struct handoff_session
+{
+  uint32_t session_id;
+  uint32_t listener;		/* Index among the HANDOFF_LISTENER records. */
+  uint8_t waiting;		/* In the admission queue, no session yet. */
+  uint8_t node;
+  uint8_t escape;
+  uint8_t escape_param;
+  int32_t fail;
+  int32_t lines;
+  uint32_t timeout;		/* exec-timeout, seconds. */
+  uint32_t start_ms;		/* Since the connection came. */
+  uint32_t input_ms;		/* Since the last input. */
+
+  /* Edit line and history. length bytes of line follow the record,
+     then hist history slots, NUL terminated, then input bytes the
+     client sent that were not run yet. */
+  uint32_t length;
+  uint32_t cp;
+  uint32_t hist;
+  uint32_t hindex;
+  uint32_t hp;
+  uint32_t input;
+
+  /* Telnet, see struct telnet: the parser between commands, the option
+     masks as low and high 64 bits. */
+  uint8_t telnet_state;
+  uint16_t width;
+  uint16_t height;
+  uint64_t local[2];
+  uint64_t remote[2];
+  uint64_t local_pending[2];
+  uint64_t remote_pending[2];
+  uint64_t local_supported[2];
+  char ttype[32];
+
+  char address[46];
+  char context[64];
+};
+
+struct handoff_audit
+{
+  uint32_t type;		/* enum audit_type. */
+  uint32_t session;
+  int32_t ret;
+  uint32_t latency_us;
+  uint32_t node;
+};
+
+/* Send a record of len payload bytes with nfds descriptors attached.
+   Returns 0, or -1 with errno set. */
+int handoff_send(int sock, int type, const void *data, size_t len, const int *fds, int nfds);
+
+/* Receive a record into buf, HANDOFF_MSG_MAX bytes, and the descriptors
+   attached to it into fds, HANDOFF_FDS_MAX of them, close-on-exec.
+   Waits up to timeout milliseconds, -1 for ever. Returns the payload
+   length, or -1 with errno set: ETIMEDOUT, EBADMSG for a record that
+   makes no sense, 0 once the other end is gone. */
+ssize_t handoff_recv(int sock, int *type, void *buf, int *fds, int *nfds, int timeout);
+
+#endif /*HANDOFF_H*/
@@ -0,0 +1,298 @@
+#include "mini_vtysh.h"
+#include "if.h"
+
+#define IF_MTU_DEFAULT 1500
+
+static struct interface if_table[IF_MAX];
+static int if_count;
+static pthread_mutex_t if_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Name index over if_table, open addressing, slot number + 1 and 0 for
+   empty. Slots are never freed, so entries never go either. Twice
+   IF_MAX keeps probes short with the table full, which a config file
+   with all the interfaces in it gets to. */
+#define IF_HASH_SIZE (IF_MAX * 2)
+static unsigned short if_hash[IF_HASH_SIZE];
+
+static unsigned int if_hash_key(const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/* Look up an interface by name, creating it when asked. Caller holds
+   if_lock. */
+static struct interface *if_get_by_name(const char *name, int create)
+{
+    struct interface *ifp;
+    unsigned int i = if_hash_key(name) % IF_HASH_SIZE;
+
+    for (; if_hash[i]; i = (i + 1) % IF_HASH_SIZE)
+    {
+        ifp = &if_table[if_hash[i] - 1];
+        if (strcmp(ifp->name, name) != 0)
+            continue;
+        if (create && !ifp->active)
+        {
+            memset(ifp, 0, sizeof(*ifp));
+            snprintf(ifp->name, sizeof(ifp->name), "%s", name);
+            ifp->mtu = IF_MTU_DEFAULT;
+            ifp->active = 1;
+        }
+        return ifp->active ? ifp : NULL;
+    }
+
+    if (!create || if_count == IF_MAX)
+        return NULL;
+    ifp = &if_table[if_count++];
+    snprintf(ifp->name, sizeof(ifp->name), "%s", name);
+    ifp->mtu = IF_MTU_DEFAULT;
+    ifp->active = 1;
+    if_hash[i] = if_count;
+    return ifp;
+}
+
+static void if_dump_vty(struct vty *vty, struct interface *ifp)
+{
+    vty_out (vty, "Interface %s is %s%s", ifp->name,
+             ifp->shutdown ? "administratively down" : "up", VTY_NEWLINE);
+    if (ifp->desc[0])
+        vty_out (vty, "  Description: %s%s", ifp->desc, VTY_NEWLINE);
+    vty_out (vty, "  mtu %d%s", ifp->mtu, VTY_NEWLINE);
+    if (ifp->address[0])
+        vty_out (vty, "  inet %s%s", ifp->address, VTY_NEWLINE);
+}
+
+DEFUN (interface,
+       interface_cmd,
+       "interface WORD",
+       "Select an interface to configure\n"
+       "Interface's name\n")
+{
+    struct interface *ifp;
+
+    if (strlen(argv[0]) >= IFNAMSIZ)
+    {
+        vty_out (vty, "%% Interface name %s is invalid: length exceeds %d characters%s",
+                 argv[0], IFNAMSIZ - 1, VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+
+    pthread_mutex_lock(&if_lock);
+    ifp = if_get_by_name(argv[0], 1);
+    pthread_mutex_unlock(&if_lock);
+    if (ifp == NULL)
+    {
+        vty_out (vty, "%% Too many interfaces%s", VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+
+    vty->index = ifp;
+    vty->node = INTERFACE_NODE;
+    return CMD_SUCCESS;
+}
+
+DEFUN (no_interface,
+       no_interface_cmd,
+       "no interface WORD",
+       "Negate a command or set its defaults\n"
+       "Delete a pseudo interface's configuration\n"
+       "Interface's name\n")
+{
+    struct interface *ifp;
+
+    pthread_mutex_lock(&if_lock);
+    ifp = if_get_by_name(argv[0], 0);
+    if (ifp)
+        ifp->active = 0;
+    pthread_mutex_unlock(&if_lock);
+    if (ifp == NULL)
+    {
+        vty_out (vty, "%% Interface %s does not exist%s", argv[0], VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+    return CMD_SUCCESS;
+}
+
+DEFUN (interface_desc,
+       interface_desc_cmd,
+       "description .LINE",
+       "Interface specific description\n"
+       "Characters describing this interface\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    pthread_mutex_lock(&if_lock);
+    snprintf(ifp->desc, sizeof(ifp->desc), "%s", argv[0]);
+    pthread_mutex_unlock(&if_lock);
+    return CMD_SUCCESS;
+}
+
+DEFUN (no_interface_desc,
+       no_interface_desc_cmd,
+       "no description",
+       "Negate a command or set its defaults\n"
+       "Interface specific description\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    pthread_mutex_lock(&if_lock);
+    ifp->desc[0] = '\0';
+    pthread_mutex_unlock(&if_lock);
+    return CMD_SUCCESS;
+}
+
+DEFUN (ip_address,
+       ip_address_cmd,
+       "ip address A.B.C.D/M",
+       "Interface Internet Protocol config commands\n"
+       "Set the IP address of an interface\n"
+       "IP address (e.g. 10.0.0.1/8)\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    pthread_mutex_lock(&if_lock);
+    snprintf(ifp->address, sizeof(ifp->address), "%s", argv[0]);
+    pthread_mutex_unlock(&if_lock);
+    return CMD_SUCCESS;
+}
+
+DEFUN (no_ip_address,
+       no_ip_address_cmd,
+       "no ip address",
+       "Negate a command or set its defaults\n"
+       "Interface Internet Protocol config commands\n"
+       "Set the IP address of an interface\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    pthread_mutex_lock(&if_lock);
+    ifp->address[0] = '\0';
+    pthread_mutex_unlock(&if_lock);
+    return CMD_SUCCESS;
+}
+
+DEFUN (interface_mtu,
+       interface_mtu_cmd,
+       "mtu <68-9216>",
+       "Set mtu value for interface\n"
+       "mtu value for interface\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    pthread_mutex_lock(&if_lock);
+    ifp->mtu = atoi(argv[0]);
+    pthread_mutex_unlock(&if_lock);
+    return CMD_SUCCESS;
+}
+
+DEFUN (interface_shutdown,
+       interface_shutdown_cmd,
+       "shutdown",
+       "Shutdown the selected interface\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    __atomic_store_n(&ifp->shutdown, 1, __ATOMIC_RELAXED);
+    return CMD_SUCCESS;
+}
+
+DEFUN (no_interface_shutdown,
+       no_interface_shutdown_cmd,
+       "no shutdown",
+       "Negate a command or set its defaults\n"
+       "Shutdown the selected interface\n")
+{
+    struct interface *ifp = (struct interface *)vty->index;
+
+    __atomic_store_n(&ifp->shutdown, 0, __ATOMIC_RELAXED);
+    return CMD_SUCCESS;
+}
+
+/* "show interface" is streamed, IF_SHOW_BATCH interfaces each time the
+   pager wants more, from the job pool. output_pos is the next if_table
+   index; slots are never freed so it stays valid between calls. */
+#define IF_SHOW_BATCH 16
+
+static int if_show_next(struct vty *vty, void *arg)
+{
+    long *pos = &vty->output_pos;
+    int n = 0, more;
+
+    pthread_mutex_lock(&if_lock);
+    for (; *pos < if_count && n < IF_SHOW_BATCH; (*pos)++)
+        if (if_table[*pos].active)
+        {
+            if_dump_vty(vty, &if_table[*pos]);
+            n++;
+        }
+    more = (*pos < if_count);
+    pthread_mutex_unlock(&if_lock);
+    return more;
+}
+
+DEFUN_ATTR (show_interface,
+            show_interface_cmd,
+            "show interface",
+            "Show running system information\n"
+            "Interface status and configuration\n",
+            CMD_ATTR_ASYNC)
+{
+    vty_output_stream(vty, if_show_next, NULL, NULL);
+    return CMD_SUCCESS;
+}
+
+DEFUN (show_interface_name,
+       show_interface_name_cmd,
+       "show interface WORD",
+       "Show running system information\n"
+       "Interface status and configuration\n"
+       "Interface name\n")
+{
+    struct interface *ifp;
+
+    pthread_mutex_lock(&if_lock);
+    ifp = if_get_by_name(argv[0], 0);
+    if (ifp)
+        if_dump_vty(vty, ifp);
+    pthread_mutex_unlock(&if_lock);
+    if (ifp == NULL)
+    {
+        vty_out (vty, "%% Can't find interface %s%s", argv[0], VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+    return CMD_SUCCESS;
+}
+
+/* Write interface configuration for "show running-config". */
+static int if_config_write(struct vty *vty)
+{
+    pthread_mutex_lock(&if_lock);
+    for (int i = 0; i < if_count; i++)
+    {
+        struct interface *ifp = &if_table[i];
+
+        if (!ifp->active)
+            continue;
+        vty_out (vty, "interface %s%s", ifp->name, VTY_NEWLINE);
+        if (ifp->desc[0])
+            vty_out (vty, " description %s%s", ifp->desc, VTY_NEWLINE);
+        if (ifp->address[0])
+            vty_out (vty, " ip address %s%s", ifp->address, VTY_NEWLINE);
+        if (ifp->mtu != IF_MTU_DEFAULT)
+            vty_out (vty, " mtu %d%s", ifp->mtu, VTY_NEWLINE);
+        if (ifp->shutdown)
+            vty_out (vty, " shutdown%s", VTY_NEWLINE);
+        vty_out (vty, "!%s", VTY_NEWLINE);
+    }
+    pthread_mutex_unlock(&if_lock);
+    return 0;
+}
+
+void if_init(void)
+{
+    install_node_config(INTERFACE_NODE, if_config_write);
+}
@@ -0,0 +1,23 @@
+#ifndef IF_H
+#define IF_H
+
+#include <net/if.h>
+
+#define IF_MAX 1024
+#define IF_DESC_MAX 80
+
+/* Interface configuration. Slots are never freed, "no interface" only
+   clears active, so a vty->index pointing here stays valid. */
+struct interface
+{
+  char name[IFNAMSIZ];
+  char desc[IF_DESC_MAX];
+  char address[20];		/* A.B.C.D/M, empty when unset. */
+  int mtu;
+  int shutdown;
+  int active;
+};
+
+void if_init(void);
+
+#endif /*IF_H*/
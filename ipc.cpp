@@ -0,0 +1,568 @@
+#include <sys/mman.h>
+#include <sys/un.h>
+
+#include "mini_vtysh.h"
+#include "ipc.h"
+
+const char *ipc_daemon_names[IPC_DAEMON_MAX] =
+{
+    "zebra", "ripd", "ripngd", "ospfd", "ospf6d", "bgpd", "isisd", "pimd",
+};
+
+/* How a daemon is connected. */
+#define IPC_DOWN   0
+#define IPC_SHM    1
+#define IPC_SOCKET 2
+
+/* One per daemon, run by its own thread, see ipc_thread(). Workers
+   read up, gen and kick_fd only: up is set last when the daemon
+   comes, and when it goes up is cleared, gen bumped and every worker
+   kicked; the thread then waits for all of them to have seen gen and
+   reset their rings (resets) before it closes kick_fd or connects
+   again. */
+struct ipc_daemon
+{
+    const char *name;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+    /* Rings of every worker, kept for the life of the process. */
+    void *base;
+    int memfd;
+
+    int sock;
+    int up;
+    unsigned int gen;
+    int resets;
+
+    /* Workers kick it after queueing requests: the daemon's eventfd,
+       or over the socket bridge_fd, which the thread waits on. */
+    int kick_fd;
+    int bridge_fd;
+
+    pthread_t tid;
+};
+
+static struct ipc_daemon ipc_daemons[IPC_DAEMON_MAX];
+static unsigned int ipc_mask;
+static int ipc_workers;
+static int *ipc_wakeup;
+
+/* gen of every daemon as worker i last saw it, row i. */
+static unsigned int *ipc_seen;
+
+static void ipc_kick(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0)
+        zlog_err("ipc wakeup: %s", strerror(errno));
+}
+
+/* IPC_HELLO and its answer. The rings go with ours if there are any;
+   the answer says which way it is to be and brings the daemon's
+   eventfd if it is shared memory. */
+static int ipc_hello(struct ipc_daemon *d)
+{
+    struct
+    {
+        struct ipc_msg msg;
+        struct ipc_hello hello;
+    } out, in;
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    int nfds = (d->memfd >= 0) ? ipc_workers + 1 : 0;
+    int *fds = NULL;
+    char *fdbuf = NULL;
+    int fd = -1;
+    ssize_t n;
+
+    memset(&out, 0, sizeof(out));
+    out.msg.type = IPC_HELLO;
+    out.msg.len = sizeof(out.hello);
+    out.hello.magic = IPC_MAGIC;
+    out.hello.version = IPC_VERSION;
+    out.hello.workers = ipc_workers;
+    out.hello.ring_size = IPC_RING_SIZE;
+
+    iov.iov_base = &out;
+    iov.iov_len = sizeof(out);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds)
+    {
+        fdbuf = (char *)calloc(1, CMSG_SPACE(nfds * sizeof(int)));
+        if (fdbuf == NULL)
+            return -1;
+        mh.msg_control = fdbuf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        fds = (int *)CMSG_DATA(cmsg);
+        fds[0] = d->memfd;
+        memcpy(fds + 1, ipc_wakeup, ipc_workers * sizeof(int));
+    }
+    n = sendmsg(d->sock, &mh, MSG_NOSIGNAL);
+    free(fdbuf);
+    if (n != (ssize_t)sizeof(out))
+        return -1;
+
+    iov.iov_base = &in;
+    iov.iov_len = sizeof(in);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    n = recvmsg(d->sock, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int *got = (int *)CMSG_DATA(cmsg);
+            int ngot = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            for (int i = 0; i < ngot; i++)
+                if (fd < 0)
+                    fd = got[i];
+                else
+                    close(got[i]);
+        }
+
+    if (n != (ssize_t)sizeof(in) || in.msg.type != IPC_HELLO ||
+        in.hello.magic != IPC_MAGIC || in.hello.version != IPC_VERSION)
+    {
+        zlog_warn("%s at %s does not speak our protocol", d->name, d->path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (in.msg.ret == 1 && nfds && fd >= 0)
+    {
+        d->kick_fd = fd;
+        return IPC_SHM;
+    }
+    if (fd >= 0)
+        close(fd);
+    d->kick_fd = d->bridge_fd;
+    return IPC_SOCKET;
+}
+
+static int ipc_connect(struct ipc_daemon *d)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = { 1, 0 };
+    int mode;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, d->path, sizeof(addr.sun_path));
+    d->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (d->sock < 0)
+        return -1;
+    /* A daemon that never answers the hello is retried. */
+    setsockopt(d->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(d->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        (mode = ipc_hello(d)) < 0)
+    {
+        close(d->sock);
+        d->sock = -1;
+        return -1;
+    }
+    tv.tv_sec = 0;
+    setsockopt(d->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return mode;
+}
+
+/* Over shared memory the socket only says when the daemon is gone. */
+static void ipc_watch(struct ipc_daemon *d)
+{
+    struct pollfd pfd = { d->sock, POLLIN, 0 };
+    char buf[256];
+
+    while (1)
+    {
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (read(d->sock, buf, sizeof(buf)) <= 0)
+            return;
+    }
+}
+
+/* A reply that came over the socket, into its worker's ring. The
+   worker drains it whenever kicked, so a full ring does not last. */
+static void ipc_bridge_reply(struct ipc_daemon *d, struct ipc_msg *msg)
+{
+    struct ipc_ring *r = ipc_ring_at(d->base, msg->worker, 1);
+    struct ipc_msg *out;
+    uint32_t next;
+
+    while ((out = ipc_ring_reserve(r, msg->len, &next)) == NULL)
+        usleep(100);
+    memcpy(out, msg, sizeof(*msg) + msg->len);
+    if (ipc_ring_commit(r, next))
+        ipc_kick(ipc_wakeup[msg->worker]);
+}
+
+/* Requests queued on the rings, into buf as far as whole records fit.
+   A worker kicks only when its ring had been drained, so whatever is
+   left is picked up by the next call, not by a kick. */
+static size_t ipc_bridge_pull(struct ipc_daemon *d, char *buf, size_t size)
+{
+    size_t len = 0;
+
+    for (int w = 0; w < ipc_workers; w++)
+    {
+        struct ipc_ring *r = ipc_ring_at(d->base, w, 0);
+        struct ipc_msg *msg;
+        uint32_t next;
+
+        while ((msg = ipc_ring_peek(r, &next)) != NULL)
+        {
+            if (size - len < IPC_RECORD(msg->len))
+                return len;
+            memcpy(buf + len, msg, IPC_RECORD(msg->len));
+            ((struct ipc_msg *)(buf + len))->worker = w;
+            len += IPC_RECORD(msg->len);
+            ipc_ring_release(r, next);
+        }
+    }
+    return len;
+}
+
+/* Move records between the rings and a daemon that does not map them:
+   requests out when a worker kicks bridge_fd, replies in as they
+   come. Requests are written without blocking and replies read all
+   the while, so neither side waits on the other's full socket. */
+static void ipc_bridge(struct ipc_daemon *d)
+{
+    struct pollfd pfd[2] = { { d->sock, POLLIN, 0 }, { d->bridge_fd, POLLIN, 0 } };
+    size_t size = 2 * IPC_RECORD(IPC_MSG_MAX), have = 0, out_len = 0, out_off = 0;
+    char *in = (char *)malloc(size);
+    char *out = (char *)malloc(size);
+
+    if (in == NULL || out == NULL)
+        goto out;
+    while (1)
+    {
+        pfd[0].events = POLLIN | (out_len ? POLLOUT : 0);
+        pfd[1].events = out_len ? 0 : POLLIN;
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t count;
+
+            if (read(d->bridge_fd, &count, sizeof(count)) < 0)
+                zlog_err("ipc bridge: %s", strerror(errno));
+            out_len = ipc_bridge_pull(d, out, size);
+        }
+        while (out_len)
+        {
+            ssize_t n = send(d->sock, out + out_off, out_len - out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n <= 0)
+                goto out;
+            out_off += n;
+            if (out_off == out_len)
+            {
+                out_off = 0;
+                out_len = ipc_bridge_pull(d, out, size);
+            }
+        }
+
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = read(d->sock, in + have, size - have);
+            size_t off = 0;
+
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            have += n;
+            while (have - off >= sizeof(struct ipc_msg))
+            {
+                struct ipc_msg *msg = (struct ipc_msg *)(in + off);
+
+                if (msg->len > IPC_MSG_MAX || msg->worker >= (uint32_t)ipc_workers)
+                {
+                    zlog_warn("Bad record from %s, dropping it", d->name);
+                    goto out;
+                }
+                if (have - off < IPC_RECORD(msg->len))
+                    break;
+                if (msg->type == IPC_REPLY || msg->type == IPC_END)
+                    ipc_bridge_reply(d, msg);
+                off += IPC_RECORD(msg->len);
+            }
+            memmove(in, in + off, have - off);
+            have -= off;
+        }
+    }
+out:
+    free(in);
+    free(out);
+}
+
+/* The daemon went away: have every worker fail what it had waiting on
+   it and reset its rings, and wait for that. */
+static void ipc_down(struct ipc_daemon *d)
+{
+    __atomic_store_n(&d->resets, ipc_workers, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->up, IPC_DOWN, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&d->gen, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < ipc_workers; i++)
+        ipc_kick(ipc_wakeup[i]);
+    while (__atomic_load_n(&d->resets, __ATOMIC_ACQUIRE) > 0)
+        usleep(1000);
+
+    if (d->kick_fd != d->bridge_fd)
+        close(d->kick_fd);
+    d->kick_fd = -1;
+    close(d->sock);
+    d->sock = -1;
+}
+
+static void *ipc_thread(void *arg)
+{
+    struct ipc_daemon *d = (struct ipc_daemon *)arg;
+    int mode;
+
+    while (1)
+    {
+        if ((mode = ipc_connect(d)) < 0)
+        {
+            sleep(1);
+            continue;
+        }
+        zlog_notice("Connected to %s over %s", d->name,
+                    (mode == IPC_SHM) ? "shared memory" : "its socket");
+        __atomic_store_n(&d->up, mode, __ATOMIC_RELEASE);
+
+        if (mode == IPC_SHM)
+            ipc_watch(d);
+        else
+            ipc_bridge(d);
+
+        ipc_down(d);
+        zlog_warn("Lost %s, reconnecting", d->name);
+    }
+    return NULL;
+}
+
+int ipc_start(const char *dir, int workers, const int *wakeup)
+{
+    size_t size = IPC_SEGMENT_SIZE(workers);
+
+    ipc_workers = workers;
+    ipc_wakeup = (int *)malloc(workers * sizeof(int));
+    ipc_seen = (unsigned int *)calloc(workers * IPC_DAEMON_MAX, sizeof(unsigned int));
+    if (ipc_wakeup == NULL || ipc_seen == NULL)
+        return -1;
+    memcpy(ipc_wakeup, wakeup, workers * sizeof(int));
+
+    for (int i = 0; i < IPC_DAEMON_MAX; i++)
+    {
+        struct ipc_daemon *d = &ipc_daemons[i];
+
+        d->name = ipc_daemon_names[i];
+        d->sock = -1;
+        d->kick_fd = -1;
+        if (snprintf(d->path, sizeof(d->path), "%s/%s.vty", dir, d->name) >= (int)sizeof(d->path))
+        {
+            zlog_err("Daemon directory %s is too long", dir);
+            return -1;
+        }
+
+        /* Without a memfd the rings are ours alone and every daemon
+           is bridged. */
+        d->memfd = memfd_create(d->name, MFD_CLOEXEC);
+        if (d->memfd >= 0 && ftruncate(d->memfd, size) < 0)
+        {
+            close(d->memfd);
+            d->memfd = -1;
+        }
+        if (d->memfd >= 0)
+            d->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, d->memfd, 0);
+        else
+            d->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (d->base == MAP_FAILED)
+        {
+            zlog_err("Can't map the rings of %s: %s", d->name, strerror(errno));
+            return -1;
+        }
+        if ((d->bridge_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        {
+            zlog_err("eventfd: %s", strerror(errno));
+            return -1;
+        }
+        if (pthread_create(&d->tid, NULL, ipc_thread, d) != 0)
+            return -1;
+        pthread_detach(d->tid);
+        ipc_mask |= 1u << i;
+    }
+    return 0;
+}
+
+unsigned int ipc_up(unsigned int mask)
+{
+    unsigned int up = 0;
+
+    mask &= ipc_mask;
+    for (int i = 0; mask >> i; i++)
+        if ((mask & (1u << i)) && __atomic_load_n(&ipc_daemons[i].up, __ATOMIC_ACQUIRE))
+            up |= 1u << i;
+    return up;
+}
+
+unsigned int ipc_request(int worker, unsigned int mask, uint64_t id, int node,
+                         const char *line, uint32_t len)
+{
+    unsigned int sent = 0;
+
+    mask = ipc_up(mask);
+    for (int i = 0; mask >> i; i++)
+    {
+        struct ipc_daemon *d = &ipc_daemons[i];
+        struct ipc_ring *r;
+        struct ipc_msg *msg;
+        uint32_t next;
+
+        if (!(mask & (1u << i)))
+            continue;
+        r = ipc_ring_at(d->base, worker, 0);
+        if ((msg = ipc_ring_reserve(r, len, &next)) == NULL)
+        {
+            zlog_warn("Too many requests waiting for %s", d->name);
+            continue;
+        }
+        msg->len = len;
+        msg->type = IPC_REQUEST;
+        msg->node = node;
+        msg->id = id;
+        msg->ret = 0;
+        msg->worker = worker;
+        memcpy(msg + 1, line, len);
+        if (ipc_ring_commit(r, next))
+            ipc_kick(d->kick_fd);
+        sent |= 1u << i;
+    }
+    return sent;
+}
+
+void ipc_poll(int worker, void (*func) (int daemon, struct ipc_msg *msg, void *arg), void *arg)
+{
+    unsigned int *seen = &ipc_seen[worker * IPC_DAEMON_MAX];
+
+    for (int i = 0; ipc_mask >> i; i++)
+    {
+        struct ipc_daemon *d = &ipc_daemons[i];
+        unsigned int gen = __atomic_load_n(&d->gen, __ATOMIC_ACQUIRE);
+        struct ipc_ring *r;
+        struct ipc_msg *msg;
+        uint32_t next;
+
+        if (!(ipc_mask & (1u << i)))
+            continue;
+        if (seen[i] != gen)
+        {
+            seen[i] = gen;
+            ipc_ring_reset(ipc_ring_at(d->base, worker, 0));
+            ipc_ring_reset(ipc_ring_at(d->base, worker, 1));
+            (*func) (i, NULL, arg);
+            __atomic_sub_fetch(&d->resets, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        r = ipc_ring_at(d->base, worker, 1);
+        while ((msg = ipc_ring_peek(r, &next)) != NULL)
+        {
+            (*func) (i, msg, arg);
+            ipc_ring_release(r, next);
+        }
+    }
+}
+
+/* What a daemon command does when no daemon took it. */
+int vty_daemon_unreachable(struct cmd_element *self, struct vty *vty, int argc, const char *argv[])
+{
+    for (int i = 0; i < IPC_DAEMON_MAX; i++)
+        if (self->daemon & (1u << i))
+            vty_out (vty, "%% %s is not running%s", ipc_daemon_names[i], VTY_NEWLINE);
+    return CMD_WARNING;
+}
+
+DEFSH (VTYSH_ZEBRA, show_ip_route_cmd,
+       "show ip route",
+       "Show running system information\n"
+       "IP information\n"
+       "IP routing table\n")
+
+DEFSH (VTYSH_RIPD, show_ip_rip_cmd,
+       "show ip rip",
+       "Show running system information\n"
+       "IP information\n"
+       "Show RIP routes\n")
+
+DEFSH (VTYSH_OSPFD, show_ip_ospf_cmd,
+       "show ip ospf",
+       "Show running system information\n"
+       "IP information\n"
+       "OSPF information\n")
+
+DEFSH (VTYSH_BGPD, show_ip_bgp_cmd,
+       "show ip bgp",
+       "Show running system information\n"
+       "IP information\n"
+       "BGP information\n")
+
+DEFSH (VTYSH_ALL, show_thread_cpu_cmd,
+       "show thread cpu",
+       "Show running system information\n"
+       "Thread information\n"
+       "Thread CPU usage\n")
+
+DEFUN (show_daemons,
+       show_daemons_cmd,
+       "show daemons",
+       "Show running system information\n"
+       "Backend daemons\n")
+{
+    static const char *state[] = { "down", "shared memory", "socket" };
+
+    if (ipc_mask == 0)
+    {
+        vty_out (vty, "%% No daemon directory, see -D%s", VTY_NEWLINE);
+        return CMD_WARNING;
+    }
+    vty_out (vty, "%-8s %-14s %s%s", "Daemon", "Connection", "Socket", VTY_NEWLINE);
+    for (int i = 0; i < IPC_DAEMON_MAX; i++)
+    {
+        struct ipc_daemon *d = &ipc_daemons[i];
+
+        vty_out (vty, "%-8s %-14s %s%s", d->name, state[__atomic_load_n(&d->up, __ATOMIC_ACQUIRE)],
+                 d->path, VTY_NEWLINE);
+    }
+    return CMD_SUCCESS;
+}
@@ -0,0 +1,194 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stdint.h>
+
+/* Command forwarding to backend daemons. Commands whose cmd_element
+   has daemon bits (see DEFSH) are sent to every daemon named there
+   that is up, as quagga's vtysh does, and the replies become the
+   command's output.
+
+   A daemon listens on a Unix socket, <dir>/<name>.vty. The server
+   connects and sends IPC_HELLO with a memfd and the eventfds of its
+   workers attached (SCM_RIGHTS). The memfd holds a pair of single
+   producer, single consumer rings per worker: requests from the
+   worker and replies to it. A daemon that maps it answers IPC_HELLO
+   with ret 1 and an eventfd of its own, which workers kick when they
+   queue requests; from then on the socket only tells either side that
+   the other went away. A daemon that answers ret 0 gets the same
+   records over the socket instead, with worker saying which ring they
+   belong to, and a bridge thread in the server moves them between the
+   socket and the rings, so workers see no difference.
+
+   Requests carry a correlation id that every reply to them repeats,
+   so any number of commands may be in flight on a ring and a command
+   sent to several daemons is one request on each. A reply is any
+   number of IPC_REPLY records with output and a final IPC_END with
+   the command's return code. Records are in host byte order. */
+#define IPC_MAGIC    0x56545949
+#define IPC_VERSION  1
+
+/* Daemons, bit i of cmd_element.daemon is ipc_daemon_names[i]. */
+#define IPC_DAEMON_MAX 8
+
+/* Bytes of one ring, a power of two, and the largest payload of a
+   record in it. */
+#define IPC_RING_SIZE (256 * 1024)
+#define IPC_MSG_MAX   (16 * 1024)
+
+enum ipc_type
+{
+  IPC_PAD = 0,			/* Filler up to the end of the ring. */
+  IPC_HELLO,			/* Payload is struct ipc_hello. */
+  IPC_REQUEST,			/* Payload is the command line, run in node. */
+  IPC_REPLY,			/* Payload is output of request id. */
+  IPC_END,			/* Request id is done, with ret. */
+};
+
+struct ipc_msg
+{
+  uint32_t len;			/* Payload bytes, before padding. */
+  uint16_t type;
+  uint16_t node;		/* IPC_REQUEST: enum node_type to run in. */
+  uint64_t id;			/* Correlation id. */
+  int32_t ret;			/* IPC_END: CMD_* result. IPC_HELLO: see above. */
+  uint32_t worker;		/* Over the socket: ring of this worker. */
+};
+
+struct ipc_hello
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t workers;
+  uint32_t ring_size;
+};
+
+#define IPC_ALIGN(n)  (((n) + 7) & ~(uint32_t)7)
+#define IPC_RECORD(n) ((uint32_t)sizeof(struct ipc_msg) + IPC_ALIGN(n))
+
+/* head and tail count bytes ever written and read. A record never
+   wraps: it is preceded by an IPC_PAD record up to the end of the ring
+   when it does not fit there, or by nothing if less than a header's
+   worth is left, which the consumer skips as well. */
+struct ipc_ring
+{
+  uint32_t head __attribute__ ((aligned (64)));
+  uint32_t tail __attribute__ ((aligned (64)));
+  char data[] __attribute__ ((aligned (64)));
+};
+
+#define IPC_RING_BYTES (sizeof(struct ipc_ring) + IPC_RING_SIZE)
+#define IPC_SEGMENT_SIZE(workers) (2 * (size_t)(workers) * IPC_RING_BYTES)
+
+/* Ring of worker's requests, or of the replies to it, in a segment. */
+static inline struct ipc_ring *ipc_ring_at(void *base, int worker, int reply)
+{
+    return (struct ipc_ring *)((char *)base + (2 * (size_t)worker + reply) * IPC_RING_BYTES);
+}
+
+/* Producer: room for a record of len payload bytes, or NULL if the
+   ring is too full. Fill it in, then ipc_ring_commit(next). */
+static inline struct ipc_msg *ipc_ring_reserve(struct ipc_ring *r, uint32_t len, uint32_t *next)
+{
+    uint32_t head = r->head;
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    uint32_t off = head & (IPC_RING_SIZE - 1);
+    uint32_t need = IPC_RECORD(len);
+    uint32_t skip = 0;
+
+    if (len > IPC_MSG_MAX)
+        return NULL;
+    if (IPC_RING_SIZE - off < need)
+        skip = IPC_RING_SIZE - off;
+    if (IPC_RING_SIZE - (head - tail) < skip + need)
+        return NULL;
+    if (skip >= sizeof(struct ipc_msg))
+    {
+        struct ipc_msg *pad = (struct ipc_msg *)(r->data + off);
+
+        pad->type = IPC_PAD;
+        pad->len = skip - sizeof(struct ipc_msg);
+    }
+    *next = head + skip + need;
+    return (struct ipc_msg *)(r->data + ((head + skip) & (IPC_RING_SIZE - 1)));
+}
+
+/* Publish what ipc_ring_reserve() gave. Returns 1 if the consumer had
+   read everything before it, and so may be asleep and is to be woken;
+   the fence pairs with the one in ipc_ring_release(). */
+static inline int ipc_ring_commit(struct ipc_ring *r, uint32_t next)
+{
+    uint32_t head = r->head;
+
+    __atomic_store_n(&r->head, next, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->tail, __ATOMIC_RELAXED) == head;
+}
+
+/* Consumer: the oldest record, or NULL if there is none. Free it with
+   ipc_ring_release(next) once done with it; a consumer goes on until
+   this returns NULL before it sleeps. A record that does not fit in
+   the ring drops everything queued. */
+static inline struct ipc_msg *ipc_ring_peek(struct ipc_ring *r, uint32_t *next)
+{
+    uint32_t tail = r->tail;
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head)
+    {
+        uint32_t off = tail & (IPC_RING_SIZE - 1);
+        struct ipc_msg *msg = (struct ipc_msg *)(r->data + off);
+
+        if (IPC_RING_SIZE - off < sizeof(struct ipc_msg))
+            tail += IPC_RING_SIZE - off;
+        else if (msg->len > IPC_RING_SIZE - off - sizeof(struct ipc_msg) ||
+                 IPC_RECORD(msg->len) > head - tail)
+            tail = head;
+        else if (msg->type == IPC_PAD)
+            tail += IPC_RECORD(msg->len);
+        else
+        {
+            *next = tail + IPC_RECORD(msg->len);
+            return msg;
+        }
+    }
+    if (tail != r->tail)
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static inline void ipc_ring_release(struct ipc_ring *r, uint32_t next)
+{
+    __atomic_store_n(&r->tail, next, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Only the ring's worker may do this, while nobody is at the other
+   end. */
+static inline void ipc_ring_reset(struct ipc_ring *r)
+{
+    r->head = 0;
+    r->tail = 0;
+}
+
+extern const char *ipc_daemon_names[IPC_DAEMON_MAX];
+
+/* Server side. ipc_start() connects to the daemons in dir, keeping at
+   it in a thread per daemon; wakeup[i] is the eventfd worker i is
+   kicked on, after which it calls ipc_poll(). */
+int ipc_start(const char *dir, int workers, const int *wakeup);
+
+/* Daemons of mask that are up. */
+unsigned int ipc_up(unsigned int mask);
+
+/* Queue line for the daemons of mask that are up. Returns those it
+   went to. */
+unsigned int ipc_request(int worker, unsigned int mask, uint64_t id, int node,
+                         const char *line, uint32_t len);
+
+/* Pass the replies queued for worker to func. A daemon that went away
+   since the last call is reported once with msg NULL: nothing more
+   comes from it for the requests it had. */
+void ipc_poll(int worker, void (*func) (int daemon, struct ipc_msg *msg, void *arg), void *arg);
+
+#endif /*IPC_H*/
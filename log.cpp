@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+
+/* A formatted record. Fixed size so a ring is one allocation and the
+   producer never calls malloc. */
+struct zlog_record
+{
+  uint64_t ts_us;		/* CLOCK_REALTIME. */
+  int priority;
+  int fd;
+  uint32_t latency_us;
+  char peer[ZLOG_PEER_MAX];
+  char command[ZLOG_CMD_MAX];
+  char msg[ZLOG_MSG_MAX];
+};
+
+/* Single producer (the owning thread), single consumer (whoever holds
+   zlog_lock). head and tail run freely and are masked on use. */
+struct zlog_ring
+{
+  struct zlog_ring *next;
+  uint64_t dropped;
+
+  uint32_t head __attribute__ ((aligned (64)));
+  uint32_t tail __attribute__ ((aligned (64)));
+
+  struct zlog_record rec[ZLOG_RING_SIZE];
+};
+
+static const char *zlog_priority[] =
+{
+  "emergencies",
+  "alerts",
+  "critical",
+  "errors",
+  "warnings",
+  "notifications",
+  "informational",
+  "debugging",
+};
+
+static struct zlog_ring *zlog_rings;
+static __thread struct zlog_ring *zlog_self;
+
+/* Consumer side: serializes draining between the flusher and
+   zlog_flush(), and carries the flusher's wakeup. */
+static pthread_mutex_t zlog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zlog_cond = PTHREAD_COND_INITIALIZER;
+
+static int zlog_started;
+static int zlog_syslog;
+static int zlog_fd = STDERR_FILENO;
+
+/* Output batch of the consumer. */
+static char zlog_obuf[65536];
+static size_t zlog_olen;
+
+static struct zlog_ring *zlog_ring_get(void)
+{
+    struct zlog_ring *r = zlog_self;
+
+    if (r)
+        return r;
+    r = (struct zlog_ring *)aligned_alloc(64, sizeof(struct zlog_ring));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+
+    /* Rings are never freed, so a lock-free push is all it takes. */
+    r->next = __atomic_load_n(&zlog_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&zlog_rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    zlog_self = r;
+    return r;
+}
+
+static void zlog_write(const char *p, size_t n)
+{
+    while (n)
+    {
+        ssize_t ret = write(zlog_fd, p, n);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return;
+        p += ret;
+        n -= ret;
+    }
+}
+
+static void zlog_batch_flush(void)
+{
+    zlog_write(zlog_obuf, zlog_olen);
+    zlog_olen = 0;
+}
+
+/* Format one record as a line: time, priority, message, then the
+   structured fields as key=value. */
+static size_t zlog_format(const struct zlog_record *rec, char *buf, size_t size, int stamp)
+{
+    size_t len = 0;
+    int n;
+
+#define ZLOG_APPEND(...) \
+    do { n = snprintf(buf + len, size - len, __VA_ARGS__); \
+         len += (n < 0) ? 0 : ((size_t)n < size - len) ? (size_t)n : size - len - 1; } while (0)
+
+    if (stamp)
+    {
+        time_t sec = rec->ts_us / 1000000;
+        struct tm tm;
+
+        localtime_r(&sec, &tm);
+        len = strftime(buf, size, "%Y/%m/%d %H:%M:%S", &tm);
+        ZLOG_APPEND(".%03u %s: ", (unsigned)(rec->ts_us / 1000 % 1000), zlog_priority[rec->priority & 7]);
+    }
+    ZLOG_APPEND("%s", rec->msg);
+    if (rec->fd >= 0)
+        ZLOG_APPEND(" fd=%d", rec->fd);
+    if (rec->peer[0])
+        ZLOG_APPEND(" peer=%s", rec->peer);
+    if (rec->latency_us)
+        ZLOG_APPEND(" latency=%uus", rec->latency_us);
+    if (rec->command[0])
+        ZLOG_APPEND(" command=\"%s\"", rec->command);
+    ZLOG_APPEND("\n");
+#undef ZLOG_APPEND
+
+    return len;
+}
+
+static void zlog_emit(const struct zlog_record *rec)
+{
+    char line[ZLOG_MSG_MAX + ZLOG_CMD_MAX + ZLOG_PEER_MAX + 128];
+    size_t len;
+
+    if (zlog_syslog)
+    {
+        len = zlog_format(rec, line, sizeof(line), 0);
+        line[len - 1] = '\0';
+        syslog(rec->priority, "%s", line);
+        return;
+    }
+    len = zlog_format(rec, line, sizeof(line), 1);
+    if (zlog_olen + len > sizeof(zlog_obuf))
+        zlog_batch_flush();
+    memcpy(zlog_obuf + zlog_olen, line, len);
+    zlog_olen += len;
+}
+
+/* Drain every ring, merging them in time order. Caller holds
+   zlog_lock. */
+static void zlog_drain(void)
+{
+    struct zlog_ring *rings = __atomic_load_n(&zlog_rings, __ATOMIC_ACQUIRE);
+    struct zlog_ring *r;
+
+    while (1)
+    {
+        struct zlog_ring *first = NULL;
+        struct zlog_record *rec;
+
+        for (r = rings; r; r = r->next)
+        {
+            uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+            if (r->tail == head)
+                continue;
+            if (first == NULL ||
+                r->rec[r->tail & (ZLOG_RING_SIZE - 1)].ts_us < first->rec[first->tail & (ZLOG_RING_SIZE - 1)].ts_us)
+                first = r;
+        }
+        if (first == NULL)
+            break;
+
+        rec = &first->rec[first->tail & (ZLOG_RING_SIZE - 1)];
+        zlog_emit(rec);
+        __atomic_store_n(&first->tail, first->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    for (r = rings; r; r = r->next)
+    {
+        uint64_t dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+
+        if (dropped)
+        {
+            struct zlog_record rec;
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            memset(&rec, 0, sizeof(rec));
+            rec.ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+            rec.priority = LOG_WARNING;
+            rec.fd = -1;
+            snprintf(rec.msg, sizeof(rec.msg), "%llu log records dropped", (unsigned long long)dropped);
+            zlog_emit(&rec);
+        }
+    }
+    zlog_batch_flush();
+}
+
+static void *zlog_flusher(void *arg)
+{
+    pthread_mutex_lock(&zlog_lock);
+    while (1)
+    {
+        struct timespec ts;
+
+        zlog_drain();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += ZLOG_FLUSH_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&zlog_cond, &zlog_lock, &ts);
+    }
+    return NULL;
+}
+
+/* Also runs from exit(), possibly in a signal handler that interrupted
+   the flusher itself, so it gives up rather than wait forever. */
+void zlog_flush(void)
+{
+    struct timespec ts = { 0, 1000000 };
+    int tries = 100;
+
+    while (pthread_mutex_trylock(&zlog_lock) != 0)
+    {
+        if (--tries == 0)
+            return;
+        nanosleep(&ts, NULL);
+    }
+    zlog_drain();
+    pthread_mutex_unlock(&zlog_lock);
+}
+
+int zlog_init(const char *dest)
+{
+    pthread_t tid;
+
+    if (dest == NULL || strcmp(dest, "stderr") == 0)
+        zlog_fd = STDERR_FILENO;
+    else if (strcmp(dest, "syslog") == 0)
+    {
+        openlog("[MINI_VTYSH]", LOG_NDELAY | LOG_PID, LOG_LOCAL5);
+        zlog_syslog = 1;
+    }
+    else if ((zlog_fd = open(dest, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    {
+        fprintf(stderr, "Can't open log file %s: %s\n", dest, strerror(errno));
+        zlog_fd = STDERR_FILENO;
+        return -1;
+    }
+
+    if (pthread_create(&tid, NULL, zlog_flusher, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    atexit(zlog_flush);
+    __atomic_store_n(&zlog_started, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void zlog_out(int priority, const struct zlog_fields *f, const char *format, ...)
+{
+    struct zlog_ring *r = NULL;
+    struct zlog_record *rec, early;
+    struct timespec ts;
+    uint32_t head = 0;
+    va_list args;
+
+    if (!__atomic_load_n(&zlog_started, __ATOMIC_ACQUIRE))
+        rec = &early;
+    else if ((r = zlog_ring_get()) == NULL)
+        return;
+    else
+    {
+        head = r->head;
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == ZLOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+            pthread_cond_signal(&zlog_cond);
+            return;
+        }
+        rec = &r->rec[head & (ZLOG_RING_SIZE - 1)];
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    rec->priority = priority;
+    rec->fd = f ? f->fd : -1;
+    rec->latency_us = f ? f->latency_us : 0;
+    snprintf(rec->peer, sizeof(rec->peer), "%s", (f && f->peer) ? f->peer : "");
+    snprintf(rec->command, sizeof(rec->command), "%s", (f && f->command) ? f->command : "");
+    va_start(args, format);
+    vsnprintf(rec->msg, sizeof(rec->msg), format, args);
+    va_end(args);
+
+    if (rec == &early)
+    {
+        char line[ZLOG_MSG_MAX + ZLOG_CMD_MAX + ZLOG_PEER_MAX + 128];
+
+        zlog_write(line, zlog_format(rec, line, sizeof(line), 1));
+        return;
+    }
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    /* Hurry the flusher along before the ring fills up. */
+    if (head + 1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) == ZLOG_RING_SIZE / 2)
+        pthread_cond_signal(&zlog_cond);
+}
@@ -0,0 +1,58 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <syslog.h>
+
+/* Asynchronous logging. Each thread formats its records into its own
+   lock-free ring; a background thread drains all rings and writes them
+   in batches to syslog, a file or stderr. Logging never blocks and
+   never makes a system call on the caller's thread; when a ring is full
+   the record is dropped and counted. */
+
+/* Records above this priority are compiled out. Build with
+   -DZLOG_LEVEL=LOG_DEBUG to keep debug records. */
+#ifndef ZLOG_LEVEL
+#define ZLOG_LEVEL LOG_INFO
+#endif
+
+/* Records per thread ring, a power of two. */
+#define ZLOG_RING_SIZE 512
+
+#define ZLOG_MSG_MAX  192
+#define ZLOG_CMD_MAX  128
+#define ZLOG_PEER_MAX 48
+
+/* Flush period of the background thread, milliseconds. */
+#define ZLOG_FLUSH_MS 100
+
+/* Structured fields of a record, all optional: fd < 0, NULL strings
+   and latency 0 are left out. */
+struct zlog_fields
+{
+  int fd;
+  const char *peer;
+  const char *command;
+  uint32_t latency_us;
+};
+
+/* Destination is "syslog", "stderr" or a file name. Starts the flusher;
+   records logged before this are written straight to stderr. */
+int zlog_init(const char *dest);
+
+/* Write out everything logged so far. */
+void zlog_flush(void);
+
+void zlog_out(int priority, const struct zlog_fields *f, const char *format, ...)
+  __attribute__ ((format (printf, 3, 4)));
+
+#define zlog(pri, f, ...) \
+  do { if ((pri) <= ZLOG_LEVEL) zlog_out((pri), (f), __VA_ARGS__); } while (0)
+
+#define zlog_err(...)    zlog(LOG_ERR, NULL, __VA_ARGS__)
+#define zlog_warn(...)   zlog(LOG_WARNING, NULL, __VA_ARGS__)
+#define zlog_notice(...) zlog(LOG_NOTICE, NULL, __VA_ARGS__)
+#define zlog_info(...)   zlog(LOG_INFO, NULL, __VA_ARGS__)
+#define zlog_debug(...)  zlog(LOG_DEBUG, NULL, __VA_ARGS__)
+
+#endif /*LOG_H*/
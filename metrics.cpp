@@ -0,0 +1,275 @@
+#include <limits.h>
+#include <sys/un.h>
+
+#include "mini_vtysh.h"
+#include "metrics.h"
+
+static struct metrics *metrics_list;
+static int metrics_ncmds;
+
+/* Smallest value that falls into bucket b. */
+static uint32_t metrics_bucket_value(int b)
+{
+    int exp;
+
+    if (b < (1 << METRICS_SUB_BITS))
+        return b;
+    exp = (b >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    return ((1u << METRICS_SUB_BITS) | (b & ((1u << METRICS_SUB_BITS) - 1))) << (exp - METRICS_SUB_BITS);
+}
+
+int metrics_register(struct metrics *m)
+{
+    metrics_ncmds = cmd_element_count();
+    m->latency = (struct metrics_hist *)calloc(metrics_ncmds, sizeof(struct metrics_hist));
+    if (m->latency == NULL)
+        return -1;
+
+    m->next = __atomic_load_n(&metrics_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&metrics_list, &m->next, m, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return 0;
+}
+
+void metrics_command(struct metrics *m, struct cmd_element *cmd, uint32_t latency_us)
+{
+    struct metrics_hist *h;
+
+    if (cmd == NULL || cmd->index == 0 || (int)cmd->index > metrics_ncmds)
+        return;
+    h = &m->latency[cmd->index - 1];
+    metrics_add(&h->bucket[metrics_bucket(latency_us)], 1);
+    metrics_add(&h->sum, latency_us);
+}
+
+#define METRICS_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/* Sum of every worker; hist gets one histogram per command. */
+static void metrics_collect(struct metrics *total, struct metrics_hist *hist)
+{
+    struct metrics *m;
+
+    memset(total, 0, sizeof(*total));
+    memset(hist, 0, metrics_ncmds * sizeof(struct metrics_hist));
+    for (m = __atomic_load_n(&metrics_list, __ATOMIC_ACQUIRE); m; m = m->next)
+    {
+        total->sessions += METRICS_LOAD(m->sessions);
+        total->waiting += METRICS_LOAD(m->waiting);
+        total->accepts += METRICS_LOAD(m->accepts);
+        total->queued += METRICS_LOAD(m->queued);
+        total->rejects += METRICS_LOAD(m->rejects);
+        total->bytes_in += METRICS_LOAD(m->bytes_in);
+        total->bytes_out += METRICS_LOAD(m->bytes_out);
+        total->iac += METRICS_LOAD(m->iac);
+        total->stalls += METRICS_LOAD(m->stalls);
+        total->zlib_in += METRICS_LOAD(m->zlib_in);
+        total->zlib_out += METRICS_LOAD(m->zlib_out);
+        for (int i = 0; i < metrics_ncmds; i++)
+        {
+            hist[i].sum += METRICS_LOAD(m->latency[i].sum);
+            for (int b = 0; b < METRICS_BUCKETS; b++)
+                hist[i].bucket[b] += METRICS_LOAD(m->latency[i].bucket[b]);
+        }
+    }
+}
+
+static unsigned long metrics_count(const struct metrics_hist *h)
+{
+    unsigned long n = 0;
+
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+        n += h->bucket[b];
+    return n;
+}
+
+/* Value at quantile q, as the lower bound of its bucket. */
+static uint32_t metrics_quantile(const struct metrics_hist *h, unsigned long count, double q)
+{
+    unsigned long rank = (unsigned long)(q * count + 0.5), seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+    {
+        seen += h->bucket[b];
+        if (seen >= rank)
+            return metrics_bucket_value(b);
+    }
+    return 0;
+}
+
+DEFUN (show_server_statistics,
+       show_server_statistics_cmd,
+       "show server statistics",
+       "Show running system information\n"
+       "Telnet server\n"
+       "Counters and command latency\n")
+{
+    struct metrics total;
+    struct metrics_hist *hist;
+
+    hist = (struct metrics_hist *)malloc(metrics_ncmds * sizeof(struct metrics_hist));
+    if (hist == NULL)
+        return CMD_WARNING;
+    metrics_collect(&total, hist);
+
+    vty_out (vty, "Sessions: %d open, %d waiting, %lu accepted, %lu queued first, %lu rejected%s",
+             total.sessions, total.waiting, total.accepts, total.queued, total.rejects, VTY_NEWLINE);
+    vty_out (vty, "Traffic: %lu bytes in, %lu bytes out, %lu telnet commands, %lu write stalls%s",
+             total.bytes_in, total.bytes_out, total.iac, total.stalls, VTY_NEWLINE);
+    if (total.zlib_in)
+        vty_out (vty, "Compression: %lu bytes sent as %lu (%.1f%%)%s", total.zlib_in, total.zlib_out,
+                 100.0 * total.zlib_out / total.zlib_in, VTY_NEWLINE);
+    vty_out (vty, "%s%-32s %10s %8s %8s %8s %8s%s", VTY_NEWLINE,
+             "Command", "Count", "Avg(us)", "p50", "p99", "Max", VTY_NEWLINE);
+    for (int i = 0; i < metrics_ncmds; i++)
+    {
+        unsigned long count = metrics_count(&hist[i]);
+
+        if (count == 0)
+            continue;
+        vty_out (vty, "%-32s %10lu %8lu %8u %8u %8u%s", cmd_element_get(i)->string, count,
+                 hist[i].sum / count, metrics_quantile(&hist[i], count, 0.5),
+                 metrics_quantile(&hist[i], count, 0.99), metrics_quantile(&hist[i], count, 1.0),
+                 VTY_NEWLINE);
+    }
+    free(hist);
+    return CMD_SUCCESS;
+}
+
+/* Prometheus text exposition format. Histograms list buckets up to the
+   highest one in use. */
+static void metrics_prometheus(FILE *fp)
+{
+    struct metrics total;
+    struct metrics_hist *hist;
+
+    hist = (struct metrics_hist *)malloc(metrics_ncmds * sizeof(struct metrics_hist));
+    if (hist == NULL)
+        return;
+    metrics_collect(&total, hist);
+
+#define METRICS_PRINT(name, type, help, value) \
+    fprintf(fp, "# HELP " name " " help "\n# TYPE " name " " type "\n" name " %lu\n", (unsigned long)(value))
+
+    METRICS_PRINT("vty_sessions", "gauge", "Open sessions.", total.sessions);
+    METRICS_PRINT("vty_waiting", "gauge", "Connections waiting for a session.", total.waiting);
+    METRICS_PRINT("vty_accepts_total", "counter", "Sessions started.", total.accepts);
+    METRICS_PRINT("vty_queued_total", "counter", "Connections that had to wait for a session.", total.queued);
+    METRICS_PRINT("vty_rejects_total", "counter", "Connections refused, queue full or address over its cap.", total.rejects);
+    METRICS_PRINT("vty_bytes_in_total", "counter", "Bytes read from clients.", total.bytes_in);
+    METRICS_PRINT("vty_bytes_out_total", "counter", "Bytes written to clients.", total.bytes_out);
+    METRICS_PRINT("vty_telnet_commands_total", "counter", "Telnet IAC commands parsed.", total.iac);
+    METRICS_PRINT("vty_write_stalls_total", "counter", "Output flushes that hit EAGAIN.", total.stalls);
+    METRICS_PRINT("vty_compress_in_bytes_total", "counter", "Output bytes compressed with MCCP.", total.zlib_in);
+    METRICS_PRINT("vty_compress_out_bytes_total", "counter", "Bytes the compressed output took.", total.zlib_out);
+#undef METRICS_PRINT
+
+    fprintf(fp, "# HELP vty_command_latency_us Command execution time.\n"
+                "# TYPE vty_command_latency_us histogram\n");
+    for (int i = 0; i < metrics_ncmds; i++)
+    {
+        const char *name = cmd_element_get(i)->string;
+        unsigned long count = metrics_count(&hist[i]), seen = 0;
+        int last = METRICS_BUCKETS - 1;
+
+        if (count == 0)
+            continue;
+        while (hist[i].bucket[last] == 0)
+            last--;
+        for (int b = 0; b <= last && b < METRICS_BUCKETS - 1; b++)
+        {
+            seen += hist[i].bucket[b];
+            fprintf(fp, "vty_command_latency_us_bucket{command=\"%s\",le=\"%u\"} %lu\n",
+                    name, metrics_bucket_value(b + 1) - 1, seen);
+        }
+        fprintf(fp, "vty_command_latency_us_bucket{command=\"%s\",le=\"+Inf\"} %lu\n", name, count);
+        fprintf(fp, "vty_command_latency_us_sum{command=\"%s\"} %lu\n", name, hist[i].sum);
+        fprintf(fp, "vty_command_latency_us_count{command=\"%s\"} %lu\n", name, count);
+    }
+    free(hist);
+}
+
+/* Rewrite the file atomically every METRICS_DUMP_SEC seconds. */
+static void *metrics_file_thread(void *arg)
+{
+    const char *path = (const char *)arg;
+    char tmp[PATH_MAX];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    while (1)
+    {
+        FILE *fp = fopen(tmp, "w");
+
+        if (fp)
+        {
+            metrics_prometheus(fp);
+            if (fclose(fp) == 0)
+                rename(tmp, path);
+        }
+        else
+            zlog_warn("Can't write metrics to %s: %s", tmp, strerror(errno));
+        sleep(METRICS_DUMP_SEC);
+    }
+    return NULL;
+}
+
+/* Answer every connection on the socket with a dump. */
+static void *metrics_socket_thread(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+
+    while (1)
+    {
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        FILE *fp;
+
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+                zlog_warn("metrics accept: %s", strerror(errno));
+            continue;
+        }
+        if ((fp = fdopen(fd, "w")) == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        metrics_prometheus(fp);
+        fclose(fp);
+    }
+    return NULL;
+}
+
+int metrics_export(const char *dest)
+{
+    pthread_t tid;
+    int ret;
+
+    if (strncmp(dest, "unix:", 5) == 0)
+    {
+        struct sockaddr_un addr;
+        int sock;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", dest + 5);
+        unlink(addr.sun_path);
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0)
+        {
+            zlog_err("Can't listen for metrics on %s: %s", addr.sun_path, strerror(errno));
+            if (sock >= 0)
+                close(sock);
+            return -1;
+        }
+        ret = pthread_create(&tid, NULL, metrics_socket_thread, (void *)(intptr_t)sock);
+    }
+    else
+        ret = pthread_create(&tid, NULL, metrics_file_thread, (void *)dest);
+
+    if (ret != 0)
+        return -1;
+    pthread_detach(tid);
+    return 0;
+}
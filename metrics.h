@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/* Server counters. Every worker owns one struct metrics and is its only
+   writer, so counters are bumped with a relaxed load and store rather
+   than a locked add; readers sum all workers with relaxed loads. */
+
+/* Latency histograms use HDR-style log-linear buckets: values below
+   2^METRICS_SUB_BITS get a bucket each, above that every power of two
+   is split into 2^METRICS_SUB_BITS buckets, i.e. 12.5% resolution over
+   the whole uint32_t microsecond range. */
+#define METRICS_SUB_BITS 3
+#define METRICS_BUCKETS  ((32 - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+
+/* Prometheus text file refresh period, seconds. */
+#define METRICS_DUMP_SEC 5
+
+struct metrics_hist
+{
+  unsigned long sum;		/* Microseconds. */
+  unsigned long bucket[METRICS_BUCKETS];
+};
+
+struct metrics
+{
+  int sessions;			/* Gauge. */
+  int waiting;			/* Gauge, in the admission queue. */
+  unsigned long accepts;
+  unsigned long queued;		/* Had to wait for a session. */
+  unsigned long rejects;	/* Queue full or address over its cap. */
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  unsigned long iac;		/* Telnet commands parsed. */
+  unsigned long stalls;		/* Flushes that hit EAGAIN. */
+  unsigned long zlib_in;	/* Output bytes MCCP compressed... */
+  unsigned long zlib_out;	/* ...and what they became. */
+
+  /* One histogram per command, indexed by cmd_element index; the
+     command count is the sum of its buckets. */
+  struct metrics_hist *latency;
+
+  struct metrics *next;
+} __attribute__ ((aligned (64)));
+
+struct cmd_element;
+
+static inline void metrics_add(unsigned long *counter, unsigned long n)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline int metrics_bucket(uint32_t v)
+{
+  int exp;
+
+  if (v < (1u << METRICS_SUB_BITS))
+    return v;
+  exp = 31 - __builtin_clz(v);
+  return ((exp - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) +
+    ((v >> (exp - METRICS_SUB_BITS)) & ((1u << METRICS_SUB_BITS) - 1));
+}
+
+/* Add a worker's block to the set that is reported. Call after every
+   command is installed. */
+int metrics_register(struct metrics *m);
+
+void metrics_command(struct metrics *m, struct cmd_element *cmd, uint32_t latency_us);
+
+/* Export in Prometheus text format: dest is a file rewritten every
+   METRICS_DUMP_SEC seconds, or unix:PATH for a socket that answers
+   every connection with a dump. */
+int metrics_export(const char *dest);
+
+#endif /*METRICS_H*/
@@ -1,4 +1,7 @@
+#include <zlib.h>
+
 #include "mini_vtysh.h"
+#include "if.h"
 
 const char *safe_strerror(int errnum)
 {
@@ -11,61 +14,541 @@ int set_nonblocking(int fd)
     int flags;
     if ((flags = fcntl(fd, F_GETFL)) < 0)
     {
-        Syslog(LOG_ERR, "fcntl(F_GETFL) failed for fd %d: %s",fd, safe_strerror(errno));
+        zlog_err("fcntl(F_GETFL) failed for fd %d: %s", fd, safe_strerror(errno));
         return -1;
     }
     if (fcntl(fd, F_SETFL, (flags | O_NONBLOCK)) < 0)
     {
-        Syslog(LOG_ERR, "fcntl failed setting fd %d non-blocking: %s",fd, safe_strerror(errno));
+        zlog_err("fcntl failed setting fd %d non-blocking: %s", fd, safe_strerror(errno));
         return -1;
     }
     return 0;
 }
 
-/* VTY standard output function. */
-int vty_out(int socket_fd, const char *format, ...) 
+/* Size of a session's edit buffer, see main() options. */
+static int vty_max_input = MAX_INPUT_LENGTH;
+
+/* zlib level of MCCP2 output, -z; 0 does not offer it. */
+static int vty_compress_level;
+
+/* A session and everything it keeps for its lifetime, as one object of
+   vty_pool: the output and input buffers, the edit buffer and the
+   history ring follow the vty in data[]. */
+struct vty_slab
 {
-	va_list args;
-	int len = 0;
+    struct vty vty;
+    struct buffer obuf;
+    struct buffer pbuf;
+    struct buffer ibuf;
+    struct buffer zbuf;
+    char data[];
+};
 
-    int stdout_backup = dup(STDOUT_FILENO);
+/* Sessions to carve up front; the pool grows past this on demand. */
+#define VTY_POOL_RESERVE 256
 
-    if (stdout_backup == -1) {
-        perror("dup");
-        return 1;
+static struct pool vty_pool;
+
+/* Event loop state of one worker: its own SO_REUSEPORT listeners and
+   every client fd it accepted are watched by one epoll set, or one
+   io_uring, sessions are looked up by fd in vtyvec. Nothing here is
+   touched by other workers except the metrics, which sit on their own
+   cache line. */
+struct vty_master
+{
+    int id;
+    pthread_t tid;
+
+    int epoll_fd;
+
+    /* Socket of each of vty_listeners. */
+    int listen_fd[VTY_LISTEN_MAX];
+
+#ifdef VTY_IO_URING
+    struct uring ring;
+    struct uring_bufs bufs;
+#endif
+
+    /* Sessions indexed by file descriptor. */
+    struct vty **vtyvec;
+    int vtyvec_size;
+
+    /* Login, idle and keepalive timers of this worker's sessions. */
+    struct timer_wheel wheel;
+
+    /* Sessions with queued input, see vty_run(), and the round count. */
+    struct vty *run_head;
+    struct vty *run_tail;
+    int run_count;
+    unsigned long round;
+
+    /* Ticks while this worker has connections in the admission queue,
+       see vty_wait_admit(). */
+    struct timer t_admit;
+
+    /* Jobs of this worker's sessions with news, pushed by the pool
+       threads, which then kick job_fd; see vty_job_events(). job_count
+       is where the io_uring backend reads the kick to. */
+    struct vty_job *jobs;
+    int job_fd;
+    uint64_t job_count;
+
+    /* Hot restart, see vty_restart(): the state as this worker last
+       acted on it, the timer that hands its sessions over, and the
+       sessions of an old process it is to take over, pushed by
+       vty_handoff_thread() before a kick of job_fd. */
+    int restart;
+    struct timer t_drain;
+    struct vty_adopt *adopts;
+
+#ifdef VTY_IO_URING
+    /* Listeners with their accept armed, a bit each. */
+    unsigned int accept_armed;
+#endif
+
+    /* Commands forwarded to daemons by slot, the low bits of their
+       correlation ids, and the slots free; see vty_fwd_submit(). */
+    struct vty_job **fwd;
+    int *fwd_free;
+    int fwd_size;
+    int fwd_nfree;
+    uint64_t fwd_seq;
+
+    struct metrics metrics;
+} __attribute__ ((aligned (64)));
+
+static struct vty_master *masters;
+static int vty_worker_num = 1;
+
+/* Where a hot restart is, see vty_restart(). Workers follow it when
+   kicked; VTY_RESTART_DONE is only ever a worker's own, once it has
+   nothing left to hand over. */
+enum
+{
+    VTY_RESTART_NONE,
+    VTY_RESTART_STOP,		/* Stop accepting. */
+    VTY_RESTART_DRAIN,		/* Hand sessions over as they go idle. */
+    VTY_RESTART_FORCE,		/* Close those that did not in time. */
+    VTY_RESTART_DONE,
+};
+
+static int vty_restart_state;
+
+/* I/O backend of the workers, chosen at startup. Sessions, the pager,
+   timers and the command path are the same for all of them; a backend
+   only watches the listener and the client sockets, moves the bytes
+   and reports accepts, input and errors back through
+   vty_session_open(), vty_recv() and vty_session_close(). */
+struct vty_io
+{
+    const char *name;
+
+    /* Watch the listeners. */
+    int (*start) (struct vty_master *m);
+
+    /* Watch a new session's socket. */
+    int (*add) (struct vty_master *m, struct vty *vty);
+
+    /* Write out vty->wbuf, see vty_flush(). */
+    buffer_status_t (*flush) (struct vty *vty);
+
+    /* Read on after input was held off, see vty_run(). Returns -1 if
+       the session is to close. */
+    int (*resume) (struct vty *vty);
+
+    /* The session is closed, free it with vty_close() once the backend
+       no longer refers to it. */
+    void (*release) (struct vty_master *m, struct vty *vty);
+
+    /* Hot restart. Start or stop accepting on the listeners; once
+       stopped, vty_restart_ack(). */
+    void (*listen) (struct vty_master *m, int on);
+
+    /* Stop watching the socket of an idle session that moves to the new
+       process. Returns 1 if something is still in flight on it, to try
+       again later; add() takes it back. */
+    int (*detach) (struct vty_master *m, struct vty *vty);
+
+    /* Run the worker forever. */
+    void (*loop) (struct vty_master *m);
+};
+
+static const struct vty_io *vty_io;
+
+/* A CMD_ATTR_ASYNC command on the job pool. The pool thread formats
+   its output into local and hands it over a chunk at a time in out,
+   which vty_job_collect() moves to the pager. A generator is only
+   asked for more while out holds less than VTY_OUTPUT_LOW, so output
+   streams with the same bounds as on the worker and a slow client
+   stalls the command, not the worker. out, done, cancel and notified
+   are under lock. */
+struct vty_job
+{
+    struct work work;
+    struct vty *vty;
+    struct vty_master *master;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct buffer out;
+    int done;
+    int cancel;
+
+    /* On master->jobs, linked through next. */
+    int notified;
+    struct vty_job *next;
+
+    /* Pool thread only; the result is read once done. */
+    struct buffer local;
+    struct cmd_element *matched;
+    uint32_t latency;
+    int ret;
+
+    /* The session was freed by its backend meanwhile, the job does it
+       when it ends. */
+    int orphan;
+
+    /* Sent to daemons instead, see vty_fwd_submit(); only the worker
+       touches it then. fwd_sent are the daemons it went to, fwd_wait
+       those yet to end it. Output goes to out in daemon order,
+       straight from fwd_cur and from the others through fwd_hold once
+       it is their turn. */
+    uint64_t fwd_id;
+    unsigned int fwd_sent;
+    unsigned int fwd_wait;
+    int fwd_cur;
+    uint64_t fwd_start;
+    struct buffer fwd_hold[IPC_DAEMON_MAX];
+
+    char line[];
+};
+
+static struct workq vty_jobq;
+static int vty_job_threads = VTY_JOB_THREADS_DEFAULT;
+
+/* Job run by this thread, which has vty_out() go to it. */
+static __thread struct vty_job *vty_job_self;
+
+/* Where the daemons listen, -D; NULL forwards nothing. */
+static const char *vty_daemon_dir;
+
+static void vty_fwd_drop(struct vty_job *job);
+
+/* Put job on m->jobs for vty_job_events(), unless it is there already.
+   Under job->lock, or on the worker itself. */
+static int vty_job_push(struct vty_master *m, struct vty_job *job)
+{
+    if (job->notified)
+        return 0;
+    job->notified = 1;
+    job->next = __atomic_load_n(&m->jobs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&m->jobs, &job->next, job, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return 1;
+}
+
+/* Hand what local holds to the worker, and wake it. done is the last
+   call, made when the command returned. */
+static void vty_job_publish(struct vty_job *job, int done)
+{
+    struct vty_master *m = job->master;
+    uint64_t one = 1;
+    int notify;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->cancel)
+        buffer_reset(&job->local);
+    else
+        buffer_move_lines(&job->out, &job->local, 0, NULL, NULL);
+    job->done = done;
+
+    /* Pushed under the lock: the worker frees a done job only after
+       taking it off m->jobs and then the lock. */
+    notify = vty_job_push(m, job);
+    pthread_mutex_unlock(&job->lock);
+
+    if (notify && write(m->job_fd, &one, sizeof(one)) < 0)
+        zlog_err("job wakeup: %s", safe_strerror(errno));
+}
+
+/* Between the steps of a job's output generator, where it holds no
+   locks: wait while the pager has enough of the output. */
+static void vty_job_throttle(struct vty_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    while (!job->cancel && buffer_length(&job->out) >= VTY_OUTPUT_LOW)
+        pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* vty_out() of a job. It never waits, commands call it with their
+   locks held. */
+static int vty_job_vout(struct vty_job *job, const char *format, va_list args)
+{
+    int len;
+
+    if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+        return -1;
+    len = buffer_vprintf(&job->local, format, args);
+    if (buffer_length(&job->local) >= BUFFER_SIZE_DEFAULT)
+        vty_job_publish(job, 0);
+    return len;
+}
+
+/* Output of the session's job so far, into the pager. */
+static size_t vty_job_collect(struct vty *vty)
+{
+    struct vty_job *job = vty->job;
+    size_t n;
+
+    pthread_mutex_lock(&job->lock);
+    n = buffer_move_lines(vty->pbuf, &job->out, 0, NULL, NULL);
+    if (n)
+        pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    return n;
+}
+
+/* ^C or a closed session. The command sees it through vty_cancelled()
+   and its output is dropped from now on. */
+static void vty_job_cancel(struct vty_job *job)
+{
+    if (job->fwd_id)
+    {
+        vty_fwd_drop(job);
+        return;
     }
+    pthread_mutex_lock(&job->lock);
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+    buffer_reset(&job->out);
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
 
-   // 将标准输出重定向到套接字
-    if (dup2(socket_fd, STDOUT_FILENO) == -1) {
-        perror("dup2");
-        // 处理重定向失败的情况
-        close(stdout_backup);
-        return 1;
+/* For long running commands to check between steps: the user gave up
+   on the output. Always 0 outside the job pool. */
+int vty_cancelled(struct vty *vty)
+{
+    struct vty_job *job = vty_job_self;
+
+    return job && job->vty == vty && __atomic_load_n(&job->cancel, __ATOMIC_RELAXED);
+}
+
+/* Allocate a new vty bound to a connected socket from vty_pool. The
+   edit buffer and the history ring are sized once, by -i. */
+struct vty *vty_new(int fd)
+{
+    struct vty_slab *s = (struct vty_slab *)pool_get(&vty_pool);
+    struct vty *vty;
+
+    if (s == NULL)
+        return NULL;
+    memset(s, 0, sizeof(*s) + (VTY_MAXHIST + 1) * vty_max_input);
+    vty = &s->vty;
+    buffer_init(&s->obuf, 0);
+    buffer_init(&s->pbuf, 0);
+    buffer_init(&s->ibuf, 0);
+    buffer_init(&s->zbuf, 0);
+    vty->obuf = &s->obuf;
+    vty->wbuf = &s->obuf;
+    vty->pbuf = &s->pbuf;
+    vty->ibuf = &s->ibuf;
+    vty->max = vty_max_input;
+    vty->buf = s->data;
+    vty->hist = s->data + vty->max;
+    vty->fd = fd;
+    vty->wfd = fd;
+    vty->type = vty::VTY_TERM;
+    vty->node = ENABLE_NODE;
+    vty->node_max = NODE_MAX;
+    vty->lines = -1;
+    telnet_init(&vty->telnet);
+    return vty;
+}
+
+/* Release vty and close its socket. Pending output is dropped. A vty
+   whose command still runs on the job pool is released when the job
+   ends. */
+void vty_close(struct vty *vty)
+{
+    if (vty->job)
+    {
+        vty->job->orphan = 1;
+        return;
+    }
+    if (vty->output_clean)
+        (*vty->output_clean) (vty, vty->output_arg);
+    buffer_reset(vty->obuf);
+    buffer_reset(vty->pbuf);
+    buffer_reset(vty->ibuf);
+    buffer_reset(&((struct vty_slab *)vty)->zbuf);
+    if (vty->zs)
+    {
+        deflateEnd(vty->zs);
+        free(vty->zs);
     }
-	/* Try to write to initial buffer.  */
-	va_start(args, format);
-    len = vprintf (format, args);
+    close(vty->fd);
+    pool_put(&vty_pool, vty);
+}
+
+/* VTY standard output function. Output is formatted into the vty's own
+   buffer, nothing is written to the socket until vty_flush(). On the
+   job pool it goes to the job instead. */
+int vty_out(struct vty *vty, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    if (vty_job_self && vty_job_self->vty == vty)
+        len = vty_job_vout(vty_job_self, format, args);
+    else
+        len = buffer_vprintf(vty->obuf, format, args);
     va_end(args);
 
-    fflush(stdout); // 刷新输出缓冲区
+    return len;
+}
 
-    // 恢复标准输出
-    if (dup2(stdout_backup, STDOUT_FILENO) == -1) {
-        perror("dup2");
-        close(stdout_backup);
-        // 处理恢复标准输出失败的情况
-        return 1;
+/* Run deflate over in, which may be NULL, into wbuf and empty it;
+   flush is Z_SYNC_FLUSH to have everything so far go out, or Z_FINISH
+   to end the stream. */
+static int vty_deflate(struct vty *vty, struct buffer *in, int flush)
+{
+    z_stream *zs = vty->zs;
+    struct buffer_data *d;
+    unsigned char out[BUFFER_SIZE_DEFAULT];
+    int ret;
+
+    for (d = in ? in->head : NULL; ; d = d->next)
+    {
+        int last = (d == NULL || d->next == NULL);
+
+        zs->next_in = d ? d->data + d->sp : NULL;
+        zs->avail_in = d ? d->cp - d->sp : 0;
+        do
+        {
+            zs->next_out = out;
+            zs->avail_out = sizeof(out);
+            ret = deflate(zs, last ? flush : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR)
+                return -1;
+            buffer_put(vty->wbuf, out, sizeof(out) - zs->avail_out);
+        } while (zs->avail_out == 0 || (flush == Z_FINISH && last && ret != Z_STREAM_END));
+        if (last)
+            break;
     }
+    if (in)
+        buffer_reset(in);
+    return 0;
+}
+
+/* MCCP2, telnet option 86. Once the client sent DO COMPRESS2 all its
+   output passes through here on the way to wbuf. A flush of at least
+   VTY_COMPRESS_MIN bytes starts a compressed stream, IAC SB COMPRESS2
+   IAC SE and deflate output from there on, which every flush after it
+   sync flushes so the client sees it at once. A smaller one, which is
+   what echo and prompts are, ends the stream and goes out as it is:
+   keystrokes do not wait for deflate, nor carry its flush markers.
+   The next bulk output starts a fresh stream on the same state. */
+static int vty_compress(struct vty *vty)
+{
+    static const unsigned char start[] = { IAC, SB, TELOPT_COMPRESS2, IAC, SE };
+    size_t len = buffer_length(vty->obuf);
+    size_t before;
+    int want = (vty->telnet.local & TELNET_OPT_BIT(TELOPT_COMPRESS2)) != 0;
+
+    if (vty->wbuf == vty->obuf)
+        vty->wbuf = &((struct vty_slab *)vty)->zbuf;
+
+    if (vty->z_on && (!want || len < VTY_COMPRESS_MIN))
+    {
+        /* obuf follows uncompressed. */
+        if (vty_deflate(vty, NULL, Z_FINISH) < 0)
+            return -1;
+        vty->z_on = 0;
+    }
+    if (len == 0)
+        return 0;
+
+    if (!vty->z_on && want && len >= VTY_COMPRESS_MIN)
+    {
+        if (vty->zs == NULL)
+        {
+            vty->zs = (z_stream *)calloc(1, sizeof(z_stream));
+            if (vty->zs && deflateInit(vty->zs, vty_compress_level) != Z_OK)
+            {
+                free(vty->zs);
+                vty->zs = NULL;
+            }
+            if (vty->zs == NULL)
+            {
+                /* Stay uncompressed for good. */
+                zlog_err("vty[%d] cannot start compression", vty->fd);
+                vty->telnet.local_supported &= ~TELNET_OPT_BIT(TELOPT_COMPRESS2);
+                telnet_request(&vty->telnet, vty->wbuf, WONT, TELOPT_COMPRESS2);
+            }
+        }
+        else
+            deflateReset(vty->zs);
+        if (vty->zs)
+        {
+            buffer_put(vty->wbuf, start, sizeof(start));
+            vty->z_on = 1;
+        }
+    }
+
+    if (!vty->z_on)
+    {
+        buffer_move_lines(vty->wbuf, vty->obuf, 0, NULL, NULL);
+        return 0;
+    }
+    before = buffer_length(vty->wbuf);
+    if (vty_deflate(vty, vty->obuf, Z_SYNC_FLUSH) < 0)
+        return -1;
+    if (vty->master)
+    {
+        metrics_add(&vty->master->metrics.zlib_in, len);
+        metrics_add(&vty->master->metrics.zlib_out, buffer_length(vty->wbuf) - before);
+    }
+    return 0;
+}
+
+/* Write as much buffered output as the socket accepts. */
+buffer_status_t vty_flush(struct vty *vty)
+{
+    unsigned long flushed;
+    buffer_status_t ret;
+
+    if (vty->master == NULL)
+        return buffer_flush_available(vty->obuf, vty->wfd);
 
-    close(stdout_backup);
+    if ((vty->wbuf != vty->obuf || (vty->telnet.local & TELNET_OPT_BIT(TELOPT_COMPRESS2))) &&
+        vty_compress(vty) < 0)
+        return BUFFER_ERROR;
 
-	return len;
+    flushed = vty->wbuf->flushed;
+    ret = (*vty_io->flush) (vty);
+    metrics_add(&vty->master->metrics.bytes_out, vty->wbuf->flushed - flushed);
+    if (ret == BUFFER_PENDING)
+        metrics_add(&vty->master->metrics.stalls, 1);
+    return ret;
 }
 
-/* Send WILL TELOPT_ECHO to remote server. */
-static void vty_hello_echo(int socket_fd) {
-    unsigned char cmd[] = { 0xff, 0xfb , 0x01 , 0xff , 0xfb , 0x03 , 0xff , 0xfe , 0x22 , 0xff , 0xfd , 0x1f, '\0' };
-	vty_out(socket_fd, "%s", cmd);
+/* Send WILL TELOPT_ECHO to remote server. Character mode: we echo and
+   suppress go-ahead, the client must not do line mode, and we want its
+   window size and terminal type. */
+static void vty_hello_echo(struct vty *vty) {
+    telnet_request(&vty->telnet, vty->obuf, WILL, TELOPT_ECHO);
+    telnet_request(&vty->telnet, vty->obuf, WILL, TELOPT_SGA);
+    telnet_request(&vty->telnet, vty->obuf, DONT, TELOPT_LINEMODE);
+    telnet_request(&vty->telnet, vty->obuf, DO, TELOPT_NAWS);
+    telnet_request(&vty->telnet, vty->obuf, DO, TELOPT_TTYPE);
+    if (vty_compress_level)
+    {
+        vty->telnet.local_supported |= TELNET_OPT_BIT(TELOPT_COMPRESS2);
+        telnet_request(&vty->telnet, vty->obuf, WILL, TELOPT_COMPRESS2);
+    }
 }
 
 // static void vty_will_echo(int socket_fd) {
@@ -101,206 +584,4352 @@ const char *sockunion2str (const union sockunion *su, char *buf, size_t len)
             return buf;
         case AF_INET:
             return inet_ntop (AF_INET, &su->sin.sin_addr, buf, len);
+        case AF_INET6:
+            /* A dual stack peer shows as itself, for the -P count too. */
+            if (IN6_IS_ADDR_V4MAPPED(&su->sin6.sin6_addr))
+                return inet_ntop (AF_INET, &su->sin6.sin6_addr.s6_addr[12], buf, len);
+            return inet_ntop (AF_INET6, &su->sin6.sin6_addr, buf, len);
     }
     snprintf (buf, len, "(af %d)", sockunion_family(su));
     return buf;
 }
 
-// 定义命令解析器
-int vty_execute(int sock_fd, const unsigned char *cmd)
+/* Monotonic microseconds, for command latency. */
+static uint64_t vty_clock_us(void)
 {
-    printf("socket: %d Command received:%s \n", sock_fd,cmd);
-    // HexPrint(cmd,strlen(cmd));
-    
-    fflush(stdout); // 刷新输出缓冲区
-    vty_out(sock_fd,"%s %s",cmd, VTY_NEWLINE);
-    return 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-void signal_handler(int signal) {
-    printf("Received signal %d. Exiting...\n", signal);
-    fflush(stdout); // 刷新输出缓冲区
-    exit(EXIT_SUCCESS);
+/* Journal and log a command that ran, here or in daemons. */
+static void vty_command_log(struct vty *vty, int node, const char *cmd, int ret, uint32_t latency)
+{
+    struct zlog_fields f;
+
+    audit_command(vty->session_id, node, cmd, ret, latency);
+
+    /* Audit record, formatted into this thread's log ring. A batch
+       file gets one summary record instead, see vty_batch(). */
+    if (vty->type != vty::VTY_FILE)
+    {
+        f.fd = vty->fd;
+        f.peer = vty->address;
+        f.command = cmd;
+        f.latency_us = latency;
+        zlog(LOG_INFO, &f, "command ret=%d", ret);
+    }
 }
 
-int analyze_char(char c) {
-    if (isalnum(c) || ispunct(c) || c == 0x03 || c == 0x04) {
-        return 1;
-    } else {
-        return 0;
+/* Run a command line and report its errors, on the worker or on the
+   job pool. */
+static int vty_command(struct vty *vty, const char *cmd, struct cmd_element **matched,
+                       uint32_t *latency)
+{
+    uint64_t start;
+    int node = vty->node;
+    int ret;
+
+    start = vty_clock_us();
+    ret = cmd_execute_command(vty, cmd, matched);
+    *latency = vty_clock_us() - start;
+    vty_command_log(vty, node, cmd, ret, *latency);
+
+    switch (ret)
+    {
+        case CMD_WARNING:
+            if (vty->type == vty::VTY_FILE)
+                vty_out (vty, "Warning...%s", VTY_NEWLINE);
+            break;
+        case CMD_ERR_AMBIGUOUS:
+            vty_out (vty, "%% Ambiguous command.%s", VTY_NEWLINE);
+            break;
+        case CMD_ERR_NO_MATCH:
+            vty_out (vty, "%% Unknown command.%s", VTY_NEWLINE);
+            break;
+        case CMD_ERR_INCOMPLETE:
+            vty_out (vty, "%% Command incomplete.%s", VTY_NEWLINE);
+            break;
+        case CMD_ERR_EXEED_ARGC_MAX:
+            vty_out (vty, "%% Too many arguments.%s", VTY_NEWLINE);
+            break;
     }
+    return ret;
 }
 
-void *handle_client(void *args) {
-    int client_socket = *((int *) args);
-    unsigned char buffer[VTY_READ_BUFSIZ];
-    char buf[SU_ADDRSTRLEN] = {0};
-    union sockunion su;
-    unsigned char *p;
-    int length = 0;
+static void vty_job_run(struct work *w)
+{
+    struct vty_job *job = (struct vty_job *)w;
 
-    memset (&su, 0, sizeof (union sockunion));
-    socklen_t len;
-    len = sizeof (union sockunion);
+    vty_job_self = job;
+    job->ret = vty_command(job->vty, job->line, &job->matched, &job->latency);
+    vty_job_self = NULL;
+    vty_job_publish(job, 1);
+}
+
+static void vty_job_free(struct vty_job *job)
+{
+    buffer_reset(&job->out);
+    for (int i = 0; i < IPC_DAEMON_MAX; i++)
+        buffer_reset(&job->fwd_hold[i]);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+static struct vty_job *vty_job_new(struct vty *vty, const char *cmd)
+{
+    size_t len = strlen(cmd);
+    struct vty_job *job;
 
-    // 获取客户端地址信息
-    if (getpeername(client_socket,(struct sockaddr *)&su, &len) == -1) {
-        connect_num--;
-        perror("getpeername");
-        close(client_socket);
+    job = (struct vty_job *)calloc(1, sizeof(struct vty_job) + len + 1);
+    if (job == NULL)
         return NULL;
+    job->vty = vty;
+    job->master = vty->master;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    buffer_init(&job->out, 0);
+    buffer_init(&job->local, 0);
+    memcpy(job->line, cmd, len + 1);
+    return job;
+}
+
+/* Correlation ids of forwarded commands: a sequence number over the
+   slot of the command in vty_master.fwd. */
+#define VTY_FWD_SLOT_BITS 24
+#define VTY_FWD_SLOT(id) ((int)((id) & ((1u << VTY_FWD_SLOT_BITS) - 1)))
+
+/* Send a daemon command to those of its daemons that are up, see
+   vty_fwd_reply() for the way back. Returns 1 if it went, 0 if it
+   runs here, -1 if it cannot be sent. */
+static int vty_fwd_submit(struct vty *vty, struct cmd_element *matched, const char *cmd)
+{
+    struct vty_master *m = vty->master;
+    size_t len = strlen(cmd);
+    struct vty_job *job;
+    int slot;
+
+    if (len > IPC_MSG_MAX)
+    {
+        vty_out (vty, "%% Command line too long for the daemons.%s", VTY_NEWLINE);
+        return -1;
+    }
+    if (m->fwd_nfree == 0)
+    {
+        int size = m->fwd_size ? 2 * m->fwd_size : 64;
+        struct vty_job **fwd;
+        int *fwd_free;
+
+        if (size > (1 << VTY_FWD_SLOT_BITS))
+            return 0;
+        fwd = (struct vty_job **)realloc(m->fwd, size * sizeof(*fwd));
+        if (fwd == NULL)
+            return 0;
+        m->fwd = fwd;
+        fwd_free = (int *)realloc(m->fwd_free, size * sizeof(*fwd_free));
+        if (fwd_free == NULL)
+            return 0;
+        m->fwd_free = fwd_free;
+        for (int i = size - 1; i >= m->fwd_size; i--)
+        {
+            m->fwd[i] = NULL;
+            m->fwd_free[m->fwd_nfree++] = i;
+        }
+        m->fwd_size = size;
     }
+    if ((job = vty_job_new(vty, cmd)) == NULL)
+        return 0;
 
-    if(set_nonblocking(client_socket) < 0)
+    slot = m->fwd_free[m->fwd_nfree - 1];
+    job->fwd_id = (++m->fwd_seq << VTY_FWD_SLOT_BITS) | slot;
+    job->fwd_sent = ipc_request(m->id, matched->daemon, job->fwd_id, vty->node, cmd, len);
+    if (job->fwd_sent == 0)
     {
-        connect_num--;
-        perror("set_nonblocking");
-        close(client_socket);
-        return NULL;
+        vty_job_free(job);
+        return 0;
+    }
+    m->fwd_nfree--;
+    m->fwd[slot] = job;
+    for (int i = 0; i < IPC_DAEMON_MAX; i++)
+        buffer_init(&job->fwd_hold[i], 0);
+    job->fwd_wait = job->fwd_sent;
+    job->fwd_cur = __builtin_ctz(job->fwd_sent);
+    job->fwd_start = vty_clock_us();
+    job->matched = matched;
+    vty->job = job;
+    return 1;
+}
+
+/* Output of a forwarded command from daemon d. */
+static void vty_fwd_output(struct vty_job *job, int d, const char *p, size_t len)
+{
+    struct buffer *b = (d == job->fwd_cur) ? &job->out : &job->fwd_hold[d];
+
+    if (job->vty->type != vty::VTY_TERM)
+    {
+        buffer_put(b, p, len);
+        return;
     }
+    /* Daemons end lines with \n, a terminal wants \r\n. */
+    while (len)
+    {
+        const char *nl = (const char *)memchr(p, '\n', len);
+        size_t n = nl ? (size_t)(nl - p) : len;
 
-    vty_hello_echo(client_socket);
-    // vty_will_echo(client_socket);
-    // vty_will_suppress_go_ahead(client_socket);
-    // vty_dont_linemode(client_socket);
-    // vty_do_window_size(client_socket);
+        buffer_put(b, p, n);
+        if (nl == NULL)
+            break;
+        buffer_put(b, "\r\n", 2);
+        p += n + 1;
+        len -= n + 1;
+    }
+}
 
-    vty_out(client_socket, "Vty connection from %s. %s",sockunion2str (&su, buf, SU_ADDRSTRLEN), VTY_NEWLINE);
+static void vty_fwd_slot_free(struct vty_master *m, struct vty_job *job)
+{
+    int slot = VTY_FWD_SLOT(job->fwd_id);
 
-    // 发送欢迎消息
-    vty_out(client_socket, "Welcome to my Telnet server![%d]. %s", connect_num, VTY_NEWLINE);
-    // 创建epoll句柄
-    int epoll_fd = epoll_create(5);
+    m->fwd[slot] = NULL;
+    m->fwd_free[m->fwd_nfree++] = slot;
+}
 
-    // 将client_socket添加到epoll监听
-    struct epoll_event event,events[EVENT_NUM];
-    event.events = EPOLLIN;
-    event.data.fd = client_socket;
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event);
-
-    while (1) 
-    {
-        int n = epoll_wait(epoll_fd, events, 5, -1);
-        for (int i = 0; i < n; i++) {
-            if (events[i].data.fd == client_socket) {
-                memset(buffer, 0, sizeof(buffer));
-
-                int valread = read(client_socket, buffer, VTY_READ_BUFSIZ);
-                if (valread == 0) {
-                    goto CLOSE;
-                }
-                for (p = buffer; p < buffer+valread; p++)
-                {
-                    length++;
-                    if (*p == '\0')
-                        break;
-                }
-                unsigned char *cmd = (unsigned char *)malloc(length * sizeof(unsigned char));
-                memcpy(cmd, buffer,length);
-                if(cmd[0] == IAC)
-                {
-                }
-                else
-                    vty_execute(client_socket, cmd);
-                free(cmd);
-                length = 0;
+/* Daemon d is done with job. Output held back behind it follows, up
+   to the next daemon still sending; after the last the job is done. */
+static void vty_fwd_end(struct vty_master *m, struct vty_job *job, int d, int ret)
+{
+    job->fwd_wait &= ~(1u << d);
+    if (ret != CMD_SUCCESS && job->ret == CMD_SUCCESS)
+        job->ret = ret;
+    for (; job->fwd_cur < IPC_DAEMON_MAX; job->fwd_cur++)
+    {
+        if (!(job->fwd_sent & (1u << job->fwd_cur)))
+            continue;
+        buffer_move_lines(&job->out, &job->fwd_hold[job->fwd_cur], 0, NULL, NULL);
+        if (job->fwd_wait & (1u << job->fwd_cur))
+            break;
+    }
+    if (job->fwd_wait == 0)
+    {
+        job->latency = vty_clock_us() - job->fwd_start;
+        vty_command_log(job->vty, job->vty->node, job->line, job->ret, job->latency);
+        vty_fwd_slot_free(m, job);
+        job->done = 1;
+    }
+}
 
-            }
+/* Replies of daemon d to this worker, see ipc_poll(). Jobs with news
+   go on m->jobs. */
+static void vty_fwd_reply(int d, struct ipc_msg *msg, void *arg)
+{
+    struct vty_master *m = (struct vty_master *)arg;
+    struct vty_job *job;
+    int slot;
+
+    if (msg == NULL)
+    {
+        /* Whatever d owed is not coming. */
+        for (slot = 0; slot < m->fwd_size; slot++)
+        {
+            if ((job = m->fwd[slot]) == NULL || !(job->fwd_wait & (1u << d)))
+                continue;
+            vty_fwd_output(job, d, "% ", 2);
+            vty_fwd_output(job, d, ipc_daemon_names[d], strlen(ipc_daemon_names[d]));
+            vty_fwd_output(job, d, " went away\n", 11);
+            vty_fwd_end(m, job, d, CMD_WARNING);
+            vty_job_push(m, job);
         }
+        return;
     }
 
-    connect_num--;
-    printf("Client disconnected.\n");
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
-    close(client_socket);
-    
-    return NULL;
-CLOSE:
-    connect_num--;
-    printf("Connection closed by the client\n");
-    
-    // 从epoll监听中移除套接字
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
-    // 关闭套接字
-    close(client_socket);
-    fflush(stdout); 
-    return NULL;
+    /* Anything for a command given up on is dropped. */
+    slot = VTY_FWD_SLOT(msg->id);
+    if (slot >= m->fwd_size || (job = m->fwd[slot]) == NULL || job->fwd_id != msg->id ||
+        !(job->fwd_wait & (1u << d)))
+        return;
+    if (msg->type == IPC_REPLY)
+        vty_fwd_output(job, d, (const char *)(msg + 1), msg->len);
+    else if (msg->type == IPC_END)
+        vty_fwd_end(m, job, d, msg->ret);
+    else
+        return;
+    vty_job_push(m, job);
 }
 
-int main() {
-    int server_fd, new_socket;
-    struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
+/* Send a CMD_ATTR_ASYNC command to the job pool, see vty_job_events()
+   for its return, or a daemon command to its daemons. Returns 1 if it
+   went, 0 if it runs here, -1 if the pool has too much waiting
+   already. */
+static int vty_job_submit(struct vty *vty, const char *cmd)
+{
+    struct vty_master *m = vty->master;
+    struct cmd_element *matched;
+    struct vty_job *job;
 
-    // 注册信号处理函数
-    signal(SIGINT, signal_handler); // Ctrl+C
-    signal(SIGTERM, signal_handler); // 终止信号
-    signal(SIGPIPE, signal_handler); // 终止信号
+    if (m == NULL || m->job_fd < 0)
+        return 0;
+    matched = cmd_lookup(vty, cmd);
+    if (matched == NULL)
+        return 0;
+    if (matched->daemon && ipc_up(matched->daemon))
+        return vty_fwd_submit(vty, matched, cmd);
+    if (!(matched->attr & CMD_ATTR_ASYNC) || vty_job_threads == 0)
+        return 0;
 
-    /* 处理子进程退出以免产生僵尸进程 */
-    signal(SIGCHLD, SIG_IGN);
+    if ((job = vty_job_new(vty, cmd)) == NULL)
+        return 0;
+    job->work.func = vty_job_run;
 
-    // 创建 socket 文件描述符
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("Socket creation failed");
+    vty->job = job;
+    if (workq_submit(&vty_jobq, &job->work, m->id) < 0)
+    {
+        vty->job = NULL;
+        vty_job_free(job);
+        vty_out (vty, "%% Too many commands running, try again later.%s", VTY_NEWLINE);
         return -1;
     }
+    return 1;
+}
 
-    // 设置 socket 选项，允许多个连接
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("Setsockopt failed");
-        return -1;
-    }
+// 定义命令解析器
+int vty_execute(struct vty *vty, const unsigned char *cmd)
+{
+    struct cmd_element *matched;
+    uint32_t latency;
+    int ret;
+
+    ret = vty_job_submit(vty, (const char *)cmd);
+    if (ret != 0)
+        return (ret > 0) ? CMD_SUCCESS : CMD_WARNING;
+
+    ret = vty_command(vty, (const char *)cmd, &matched, &latency);
+    if (vty->master)
+        metrics_command(&vty->master->metrics, matched, latency);
+    vty->deficit -= latency;
+    return ret;
+}
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(23); // Telnet 默认端口号
+/* SIGINT and SIGTERM are blocked in every thread from main() on and
+   taken here, where logging and exit() are safe: a handler could land
+   in the middle of a zlog_out() on its own thread. */
+static void *vty_signal_thread(void *arg)
+{
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    while (sigwait(&set, &sig) != 0)
+        ;
+    zlog_notice("Received signal %d. Exiting...", sig);
+    exit(EXIT_SUCCESS);
+    return NULL;
+}
+
+static int vty_signal_init(void)
+{
+    pthread_t tid;
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("Bind failed");
+    if (pthread_create(&tid, NULL, vty_signal_thread, NULL) != 0)
+    {
+        zlog_err("Can't start the signal thread");
         return -1;
     }
+    pthread_detach(tid);
+    return 0;
+}
 
-    if (listen(server_fd, 5) < 0) {
-        perror("Listen failed");
-        return -1;
+int analyze_char(char c) {
+    if (isalnum(c) || ispunct(c) || c == 0x03 || c == 0x04) {
+        return 1;
+    } else {
+        return 0;
     }
+}
 
-    perror("Server started. Waiting for connections..." );
 
-    while ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen))) {
-        if (new_socket < 0) {
-            perror("Accept failed");
-            continue;
-        }
-        connect_num++;
-        if(connect_num > 3)
-        {
-            const char msg[] = "\r\n"
-            "mini_vtysh just permit 3 socket connect!\r\n"
-            "please wait other connect close.\r\n"; 
-            
-            set_nonblocking(new_socket);
-            vty_hello_echo(new_socket);
+/* Session limit and accept backlog, see main() options. */
+static int vty_max_sessions = 3;
+static int vty_backlog = SOMAXCONN;
+
+/* An address to listen on with its policy, see vty_listen_parse(). A
+   TCP listener has a socket per worker, bound with SO_REUSEPORT; a
+   Unix one is a single socket in every worker's set, and speaks the
+   vtysh protocol instead of telnet, see vty_serv_input(). */
+struct vty_listener
+{
+    /* As given to -p. */
+    char *spec;
+
+    union sockunion su;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int fd;
+
+    /* Unix socket, its sessions are VTY_SHELL_SERV. */
+    int shell;
+
+    /* Sessions of its own, taken under vty_admit_lock; 0 shares the -m
+       slots and the admission queue. */
+    int max;
+    int sessions;
+
+    /* Highest node its sessions may enter. */
+    int node_max;
+
+    /* Sockets taken over from the old process of a hot restart, one per
+       old worker for TCP, see vty_handoff_begin(). */
+    int *adopt;
+    int nadopt;
+};
+
+static struct vty_listener vty_listeners[VTY_LISTEN_MAX];
+static int vty_nlisteners;
+
+/* Admission queue length and the longest wait in it, seconds (0: no
+   limit), and the cap of sessions from one address (0: none). */
+static int vty_wait_max = VTY_WAIT_QUEUE_DEFAULT;
+static unsigned long vty_wait_timeout_val = VTY_WAIT_TIMEOUT_DEFAULT;
+static int vty_max_per_peer;
+
+/* Login password (none by default) and the session timers, seconds. */
+static const char *vty_password;
+static unsigned long vty_timeout_val = VTY_TIMEOUT_DEFAULT;
+static unsigned long vty_login_timeout = VTY_LOGIN_TIMEOUT_DEFAULT;
+static unsigned long vty_keepalive = VTY_KEEPALIVE_DEFAULT;
+
+/* Audit journal file, none by default, and the session numbering. */
+static const char *vty_journal;
+static uint32_t vty_session_seq;
+
+static int vty_session_total(void)
+{
+    int total = 0;
+
+    for (int i = 0; i < vty_worker_num; i++)
+        total += __atomic_load_n(&masters[i].metrics.sessions, __ATOMIC_RELAXED);
+    return total;
+}
+
+static void vty_session_count(struct vty_master *m, int delta)
+{
+    __atomic_store_n(&m->metrics.sessions, m->metrics.sessions + delta, __ATOMIC_RELAXED);
+}
+
+static void vty_wait_count(struct vty_master *m, int delta)
+{
+    __atomic_store_n(&m->metrics.waiting, m->metrics.waiting + delta, __ATOMIC_RELAXED);
+}
+
+static int vtyvec_set(struct vty_master *m, int fd, struct vty *vty)
+{
+    if (fd >= m->vtyvec_size)
+    {
+        int size = m->vtyvec_size ? m->vtyvec_size : 64;
+        struct vty **vec;
+
+        while (size <= fd)
+            size *= 2;
+        vec = (struct vty **)realloc(m->vtyvec, size * sizeof(struct vty *));
+        if (vec == NULL)
+            return -1;
+        memset(vec + m->vtyvec_size, 0, (size - m->vtyvec_size) * sizeof(struct vty *));
+        m->vtyvec = vec;
+        m->vtyvec_size = size;
+    }
+    m->vtyvec[fd] = vty;
+    return 0;
+}
+
+static struct vty *vtyvec_lookup(struct vty_master *m, int fd)
+{
+    return (fd < m->vtyvec_size) ? m->vtyvec[fd] : NULL;
+}
+
+/* Admission control. Connections over the session limit wait in one
+   FIFO shared by all workers, up to vty_wait_max of them, and are told
+   their place in it. Slots, the queue and the per-address counts are
+   kept under vty_admit_lock, so the limit holds exactly; a waiter is
+   only ever started or dropped by the worker that accepted it. */
+static pthread_mutex_t vty_admit_lock = PTHREAD_MUTEX_INITIALIZER;
+static int vty_admitted;
+static struct vty *vty_wait_head;
+static struct vty *vty_wait_tail;
+static int vty_wait_len;
+
+enum
+{
+    VTY_ADMIT_OPEN,		/* Got a session. */
+    VTY_ADMIT_WAIT,		/* Queued. */
+    VTY_ADMIT_FULL,		/* Queue full. */
+    VTY_ADMIT_PEER,		/* Address at its cap. */
+    VTY_ADMIT_LISTENER,		/* Listener at its own limit. */
+};
+
+/* Connections per source address, waiting ones included, for the -P
+   cap. Open addressing on the address string: a slot whose count
+   dropped to zero is reused by the next new address, but lookups still
+   probe past it. */
+#define VTY_PEER_SLOTS_MAX 65536
+
+struct vty_peer
+{
+    char address[SU_ADDRSTRLEN];
+    int count;
+};
+
+static struct vty_peer *vty_peers;
+static unsigned int vty_peers_mask;
+
+static struct vty_peer *vty_peer_get(const char *address, int create)
+{
+    struct vty_peer *slot = NULL;
+    unsigned int h = 2166136261u;
+
+    /* FNV-1a. */
+    for (const char *p = address; *p; p++)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+
+    for (unsigned int i = 0; i <= vty_peers_mask; i++)
+    {
+        struct vty_peer *peer = &vty_peers[(h + i) & vty_peers_mask];
+
+        if (peer->address[0] == '\0')
+        {
+            if (slot == NULL)
+                slot = peer;
+            break;
+        }
+        if (strcmp(peer->address, address) == 0)
+            return peer;
+        if (peer->count == 0 && slot == NULL)
+            slot = peer;
+    }
+    if (!create || slot == NULL)
+        return NULL;
+    snprintf(slot->address, sizeof(slot->address), "%s", address);
+    slot->count = 0;
+    return slot;
+}
+
+/* Caller holds vty_admit_lock. Local clients have no address to cap. */
+static void vty_peer_count(struct vty *vty, int delta)
+{
+    struct vty_peer *peer;
+
+    if (vty_peers && vty->type == vty::VTY_TERM &&
+        (peer = vty_peer_get(vty->address, delta > 0)) != NULL)
+        peer->count += delta;
+}
+
+/* Decide on a connection just accepted by vty->master: a session slot,
+   a place in the queue or no. */
+static int vty_admit(struct vty *vty)
+{
+    struct vty_master *m = vty->master;
+    struct vty_listener *l = vty->listener;
+    struct vty_peer *peer;
+    int ret;
+
+    pthread_mutex_lock(&vty_admit_lock);
+    if (vty_peers && vty->type == vty::VTY_TERM &&
+        (peer = vty_peer_get(vty->address, 0)) != NULL && peer->count >= vty_max_per_peer)
+        ret = VTY_ADMIT_PEER;
+    else if (l->max)
+    {
+        if (l->sessions < l->max)
+        {
+            l->sessions++;
+            ret = VTY_ADMIT_OPEN;
+        }
+        else
+            ret = VTY_ADMIT_LISTENER;
+    }
+    else if (vty_wait_head == NULL && vty_admitted < vty_max_sessions)
+    {
+        vty_admitted++;
+        ret = VTY_ADMIT_OPEN;
+    }
+    else if (vty_wait_len < vty_wait_max)
+    {
+        vty->wait_prev = vty_wait_tail;
+        vty->wait_next = NULL;
+        if (vty_wait_tail)
+            vty_wait_tail->wait_next = vty;
+        else
+            vty_wait_head = vty;
+        vty_wait_tail = vty;
+        vty->waiting = 1;
+        vty->wait_pos = ++vty_wait_len;
+        ret = VTY_ADMIT_WAIT;
+    }
+    else
+        ret = VTY_ADMIT_FULL;
+    if (ret == VTY_ADMIT_OPEN || ret == VTY_ADMIT_WAIT)
+        vty_peer_count(vty, 1);
+    pthread_mutex_unlock(&vty_admit_lock);
+
+    if (ret == VTY_ADMIT_WAIT)
+    {
+        vty_wait_count(m, 1);
+        if (!timer_pending(&m->t_admit))
+            timer_add(&m->wheel, &m->t_admit, 1);
+    }
+    return ret;
+}
+
+/* Caller holds vty_admit_lock. */
+static void vty_wait_unlink(struct vty *vty)
+{
+    if (vty->wait_prev)
+        vty->wait_prev->wait_next = vty->wait_next;
+    else
+        vty_wait_head = vty->wait_next;
+    if (vty->wait_next)
+        vty->wait_next->wait_prev = vty->wait_prev;
+    else
+        vty_wait_tail = vty->wait_prev;
+    vty->wait_next = vty->wait_prev = NULL;
+    vty->waiting = 0;
+    vty_wait_len--;
+    vty_wait_count(vty->master, -1);
+}
+
+/* Give back what vty_admit() handed out. Returns 1 if a session slot
+   came free. */
+static int vty_admit_leave(struct vty *vty)
+{
+    int freed = 0;
+
+    pthread_mutex_lock(&vty_admit_lock);
+    if (vty->waiting)
+        vty_wait_unlink(vty);
+    else if (vty->listener->max)
+        vty->listener->sessions--;
+    else
+    {
+        vty_admitted--;
+        freed = 1;
+    }
+    vty_peer_count(vty, -1);
+    pthread_mutex_unlock(&vty_admit_lock);
+    return freed;
+}
+
+static int vty_wait_position(struct vty *vty)
+{
+    struct vty *w;
+    int pos = 1;
+
+    pthread_mutex_lock(&vty_admit_lock);
+    for (w = vty_wait_head; w && w != vty; w = w->wait_next)
+        pos++;
+    pthread_mutex_unlock(&vty_admit_lock);
+    return pos;
+}
+
+static void vty_session_start(struct vty_master *m, struct vty *vty);
+
+/* Hand free slots to the head of the queue. A slot whose waiter
+   belongs to another worker is left to it; that worker picks it up on
+   its next tick. */
+static void vty_wait_admit(struct vty_master *m)
+{
+    struct vty *w, *next, *admit = NULL, **tail = &admit;
+    int free;
+
+    /* No session starts while a restart is on: the new process goes on
+       numbering them from the old one's last. */
+    if (m->restart != VTY_RESTART_NONE)
+        return;
+    pthread_mutex_lock(&vty_admit_lock);
+    free = vty_max_sessions - vty_admitted;
+    for (w = vty_wait_head; w && free > 0; w = next, free--)
+    {
+        next = w->wait_next;
+        if (w->master != m)
+            continue;
+        vty_wait_unlink(w);
+        vty_admitted++;
+        *tail = w;
+        tail = &w->wait_next;
+    }
+    pthread_mutex_unlock(&vty_admit_lock);
+
+    while ((w = admit) != NULL)
+    {
+        admit = w->wait_next;
+        w->wait_next = NULL;
+        vty_session_start(m, w);
+    }
+}
+
+
+static void vty_admit_tick(struct timer *t)
+{
+    struct vty_master *m = timer_entry(t, struct vty_master, t_admit);
+
+    vty_wait_admit(m);
+    if (m->metrics.waiting > 0 && !timer_pending(t))
+        timer_add(&m->wheel, t, 1);
+}
+
+/* Input a hot restart holds back: once its worker stops accepting no
+   command line runs, so the configuration the new process gets is the
+   final one, and what comes after goes along with the session to run
+   there; VTY_INPUT_BACKLOG of it at most as ever, the rest stays in
+   the socket, which goes too. The pager and the line editor go on
+   meanwhile. */
+static int vty_input_held(struct vty *vty)
+{
+    return vty->master && vty->master->restart != VTY_RESTART_NONE;
+}
+
+/* Queue a session whose input is not all fed yet for the next round,
+   see vty_run(). */
+static void vty_run_add(struct vty *vty)
+{
+    struct vty_master *m = vty->master;
+
+    if (vty->run_queued || vty_input_held(vty))
+        return;
+    vty->run_queued = 1;
+    vty->run_next = NULL;
+    if (m->run_tail)
+        m->run_tail->run_next = vty;
+    else
+        m->run_head = vty;
+    m->run_tail = vty;
+    m->run_count++;
+}
+
+/* Only the head leaves the run queue in a round; a closing session is
+   looked for, the queue holds only the busy ones. */
+static void vty_run_del(struct vty *vty)
+{
+    struct vty_master *m = vty->master;
+    struct vty **pp, *prev = NULL;
+
+    if (!vty->run_queued)
+        return;
+    for (pp = &m->run_head; *pp != vty; pp = &(*pp)->run_next)
+        prev = *pp;
+    *pp = vty->run_next;
+    if (m->run_tail == vty)
+        m->run_tail = prev;
+    vty->run_next = NULL;
+    vty->run_queued = 0;
+    m->run_count--;
+}
+
+/* Tear down a session, or a connection still waiting for one. The
+   backend frees it once it is done with it. */
+static void vty_session_close(struct vty_master *m, struct vty *vty)
+{
+    int freed;
+
+    vtyvec_set(m, vty->fd, NULL);
+    vty_run_del(vty);
+    timer_del(&m->wheel, &vty->t_timeout);
+    if (vty->waiting)
+        zlog_info("Connection closed from %s while waiting, fd %d", vty->address, vty->fd);
+    else
+    {
+        vty_session_count(m, -1);
+        audit_session_close(vty->session_id);
+        zlog_info("Connection closed from %s, fd %d", vty->address, vty->fd);
+    }
+    freed = vty_admit_leave(vty);
+    if (vty->job)
+        vty_job_cancel(vty->job);
+    /* Last words, e.g. output of the command that ended the session. */
+    vty_flush(vty);
+    (*vty_io->release) (m, vty);
+    if (freed)
+        vty_wait_admit(m);
+}
+
+/* The prompt, or for a vtysh client the end of a command's output:
+   three NULs and its return code, as quagga's vtysh expects. */
+static void vty_prompt(struct vty *vty)
+{
+    if (vty->type == vty::VTY_SHELL_SERV)
+    {
+        unsigned char status[4] = { 0, 0, 0, (unsigned char)vty->ret };
+
+        buffer_put(vty->obuf, status, sizeof(status));
+        return;
+    }
+    vty_out(vty, "%s", cmd_prompt(vty));
+}
+
+/* A command's output is all queued. A terminal's prompt waits for
+   vty_session_flush(), a vtysh client gets its status now, one for
+   every command however many it sent. */
+static void vty_prompt_owed(struct vty *vty)
+{
+    if (vty->type == vty::VTY_SHELL_SERV)
+        vty_prompt(vty);
+    else
+        vty->prompt_wait = 1;
+}
+
+#define CONTROL(X)  ((X) - '@')
+
+/* Width of the client's terminal, from NAWS. */
+static int vty_width(struct vty *vty)
+{
+    return vty->telnet.width ? vty->telnet.width : 80;
+}
+
+/* Lines per screen for the pager, 0 when not paging. */
+static int vty_height(struct vty *vty)
+{
+    return (vty->lines >= 0) ? vty->lines : vty->telnet.height;
+}
+
+/* Output is pending while the pager holds data, a generator is
+   attached or a job runs; the prompt comes once all are done. */
+static int vty_more_active(struct vty *vty)
+{
+    return vty->output_func != NULL || vty->job != NULL || !buffer_empty(vty->pbuf);
+}
+
+/* Start a new screen; one line is kept for --More--. */
+static void vty_more_screen(struct vty *vty)
+{
+    vty->more_lines = (vty_height(vty) > 2) ? vty_height(vty) - 1 : 1;
+    vty->more_col = 0;
+}
+
+void vty_output_stream(struct vty *vty, int (*func) (struct vty *, void *),
+                       void (*clean) (struct vty *, void *), void *arg)
+{
+    /* On the job pool the generator just runs to the end, paced by
+       how fast the pager takes its output. */
+    if (vty_job_self && vty_job_self->vty == vty)
+    {
+        vty->output_pos = 0;
+        do
+            vty_job_throttle(vty_job_self);
+        while (!vty_cancelled(vty) && (*func) (vty, arg));
+        if (clean)
+            (*clean) (vty, arg);
+        return;
+    }
+
+    vty->output_func = func;
+    vty->output_clean = clean;
+    vty->output_arg = arg;
+    vty->output_pos = 0;
+}
+
+static void vty_output_end(struct vty *vty)
+{
+    if (vty->output_clean)
+        (*vty->output_clean) (vty, vty->output_arg);
+    vty->output_func = NULL;
+    vty->output_clean = NULL;
+    vty->output_arg = NULL;
+}
+
+/* Drop whatever the pager still holds. A job is stopped, the prompt
+   comes when it returns. */
+static void vty_more_quit(struct vty *vty)
+{
+    buffer_reset(vty->pbuf);
+    vty_output_end(vty);
+    if (vty->job)
+        vty_job_cancel(vty->job);
+}
+
+/* Move command output to the socket queue a screen at a time. Nothing
+   moves while the socket queue holds VTY_OUTPUT_LOW, so a slow client
+   stalls the producer instead of growing the buffers, and the next
+   EPOLLOUT resumes it. Generators are asked for more only as the
+   pager drains, and jobs produce only as much ahead, which keeps
+   multi-megabyte output bounded. */
+static void vty_more_pump(struct vty *vty)
+{
+    while (vty->status == vty::VTY_NORMAL && vty_more_active(vty))
+    {
+        if (buffer_length(vty->obuf) >= VTY_OUTPUT_LOW ||
+            (vty->wbuf != vty->obuf && buffer_length(vty->wbuf) >= VTY_OUTPUT_LOW))
+            return;
+
+        /* A job's output comes in as it is produced; with nothing new
+           the next vty_job_events() goes on. */
+        if (vty->job && buffer_length(vty->pbuf) < VTY_OUTPUT_LOW &&
+            vty_job_collect(vty) == 0 && buffer_empty(vty->pbuf))
+            return;
+
+        if (vty->output_func && buffer_length(vty->pbuf) < VTY_OUTPUT_LOW)
+        {
+            struct buffer *obuf = vty->obuf;
+            int more;
+
+            /* The generator's vty_out() goes to the pager. */
+            vty->obuf = vty->pbuf;
+            more = (*vty->output_func) (vty, vty->output_arg);
+            vty->obuf = obuf;
+            if (!more)
+                vty_output_end(vty);
+        }
+        else if (vty_height(vty) == 0)
+            buffer_move_lines(vty->obuf, vty->pbuf, 0, NULL, NULL);
+        else if (vty->more_lines > 0)
+            buffer_move_lines(vty->obuf, vty->pbuf, vty_width(vty), &vty->more_lines, &vty->more_col);
+        else
+        {
+            vty_out(vty, "%s", VTY_MORE_STR);
+            vty->status = vty::VTY_MORE;
+            return;
+        }
+
+        if (!vty_more_active(vty))
+            vty_prompt_owed(vty);
+    }
+}
+
+/* A key typed at --More--: space for a screen, enter for a line, q or
+   ^C to stop. */
+static void vty_more_char(struct vty *vty, unsigned char c)
+{
+    switch (c)
+    {
+        case ' ':
+            vty_more_screen(vty);
+            break;
+        case '\n':
+            vty->more_lines = 1;
+            vty->more_col = 0;
+            break;
+        case 'q':
+        case 'Q':
+        case CONTROL('C'):
+            vty_more_quit(vty);
+            break;
+        default:
+            return;
+    }
+    /* Wipe the --More-- prompt. */
+    vty_out(vty, "\r%*s\r", (int)strlen(VTY_MORE_STR), "");
+    vty->status = vty::VTY_NORMAL;
+    if (!vty_more_active(vty))
+        vty_prompt(vty);
+}
+
+/* Command output not yet all handed to the socket, see vty_run(). */
+static int vty_output_pending(struct vty *vty)
+{
+    return vty->status == vty::VTY_NORMAL && vty_more_active(vty);
+}
+
+/* The client has sent all it will. What it typed still runs and the
+   output goes out without the pager; vty_session_flush() then has the
+   session closed. */
+static void vty_input_end(struct vty *vty)
+{
+    vty->input_eof = 1;
+    vty->lines = 0;
+    if (vty->status == vty::VTY_MORE)
+        vty->status = vty::VTY_NORMAL;
+}
+
+/* Push pending output. Client sockets are registered edge-triggered for
+   both EPOLLIN and EPOLLOUT, so when the socket pushes back the session
+   simply keeps its data and is resumed on the next EPOLLOUT edge without
+   any epoll_ctl() round trip. While the socket keeps up the pager is
+   refilled here. Returns -1 if the session is to close: a write error,
+   or a client that hung up has all its output. */
+static int vty_session_flush(struct vty *vty)
+{
+    buffer_status_t ret;
+
+    /* A job with nothing new is picked up again by vty_job_events(). */
+    do
+    {
+        vty_more_pump(vty);
+        if (vty->prompt_wait && !vty_more_active(vty) && buffer_empty(vty->ibuf))
+        {
+            vty->prompt_wait = 0;
+            vty_prompt(vty);
+        }
+        if ((ret = vty_flush(vty)) == BUFFER_ERROR)
+            return -1;
+    } while (ret == BUFFER_EMPTY && vty->status == vty::VTY_NORMAL &&
+             (vty->output_func || !buffer_empty(vty->pbuf)));
+
+    /* Input held back behind that output can go on. */
+    if (!vty->waiting && !buffer_empty(vty->ibuf) && !vty_output_pending(vty))
+        vty_run_add(vty);
+    if (vty->input_eof && ret == BUFFER_EMPTY && buffer_empty(vty->ibuf) && !vty_more_active(vty))
+        return -1;
+    return 0;
+}
+
+/* The session's job returned: its last output goes to the pager, and
+   the prompt follows it. */
+static void vty_job_finish(struct vty_master *m, struct vty_job *job)
+{
+    struct vty *vty = job->vty;
+
+    vty->job = NULL;
+    if (job->orphan)
+        vty_close(vty);
+    else if (vty->status != vty::VTY_CLOSE)
+    {
+        metrics_command(&m->metrics, job->matched, job->latency);
+        vty->ret = job->ret;
+        buffer_move_lines(vty->pbuf, &job->out, 0, NULL, NULL);
+        if (!vty_more_active(vty))
+        {
+            /* Nothing came after a --More--. */
+            if (vty->status == vty::VTY_MORE)
+            {
+                vty_out(vty, "\r%*s\r", (int)strlen(VTY_MORE_STR), "");
+                vty->status = vty::VTY_NORMAL;
+            }
+            vty_prompt_owed(vty);
+        }
+        if (vty_session_flush(vty) < 0)
+            vty_session_close(m, vty);
+    }
+    vty_job_free(job);
+}
+
+static void vty_restart_events(struct vty_master *m);
+static void vty_restart_ack(void);
+static void vty_drain_tick(struct timer *t);
+static void vty_handoff_events(struct vty_master *m);
+
+/* Jobs of this worker with new output, or done, replies from daemons
+   included, and what a hot restart has for it. */
+static void vty_job_events(struct vty_master *m)
+{
+    struct vty_job *job;
+
+    vty_restart_events(m);
+    vty_handoff_events(m);
+    if (vty_daemon_dir)
+        ipc_poll(m->id, vty_fwd_reply, m);
+
+    job = __atomic_exchange_n(&m->jobs, NULL, __ATOMIC_ACQUIRE);
+
+    while (job)
+    {
+        struct vty_job *next = job->next;
+        struct vty *vty = job->vty;
+        int done;
+
+        pthread_mutex_lock(&job->lock);
+        job->notified = 0;
+        done = job->done;
+        pthread_mutex_unlock(&job->lock);
+
+        if (done)
+            vty_job_finish(m, job);
+        else if (!job->orphan && vty->status != vty::VTY_CLOSE && vty_session_flush(vty) < 0)
+            vty_session_close(m, vty);
+        job = next;
+    }
+}
+
+/* A forwarded command given up on, by ^C or a closed session: it ends
+   now, and what the daemons still send for it is dropped. The caller
+   sees to the prompt. */
+static void vty_fwd_drop(struct vty_job *job)
+{
+    struct vty *vty = job->vty;
+
+    vty_fwd_slot_free(job->master, job);
+    vty->job = NULL;
+    vty->ret = CMD_WARNING;
+    vty_command_log(vty, vty->node, job->line, CMD_WARNING, vty_clock_us() - job->fwd_start);
+    vty_job_free(job);
+}
+
+/* Arm the session timer for the earliest of its deadlines. */
+static void vty_timeout_arm(struct vty *vty)
+{
+    struct timer_wheel *w = &vty->master->wheel;
+    uint32_t due = 0;
+    int armed = 0;
+
+#define VTY_DEADLINE(d) \
+    do { uint32_t _d = (d); if (!armed || (int32_t)(_d - due) < 0) due = _d; armed = 1; } while (0)
+
+    if (vty->node == AUTH_NODE && vty_login_timeout)
+        VTY_DEADLINE(vty->v_start + TIMER_SEC(vty_login_timeout));
+    if (vty->v_timeout)
+        VTY_DEADLINE(vty->v_input + TIMER_SEC(vty->v_timeout));
+    if (vty_keepalive)
+    {
+        uint32_t last = ((int32_t)(vty->v_keepalive - vty->v_input) > 0) ? vty->v_keepalive : vty->v_input;
+
+        VTY_DEADLINE(last + TIMER_SEC(vty_keepalive));
+    }
+#undef VTY_DEADLINE
+
+    if (!armed)
+        timer_del(w, &vty->t_timeout);
+    else
+        timer_add(w, &vty->t_timeout, ((int32_t)(due - w->now) > 0) ? due - w->now : 1);
+}
+
+/* The session timer fired: find out which deadline, if any, really
+   passed. Input since arming only moved v_input forward. */
+static void vty_timeout(struct timer *t)
+{
+    struct vty *vty = timer_entry(t, struct vty, t_timeout);
+    struct vty_master *m = vty->master;
+    uint32_t now = m->wheel.now;
+
+    if (vty->node == AUTH_NODE && vty_login_timeout &&
+        now - vty->v_start >= TIMER_SEC(vty_login_timeout))
+    {
+        vty_out(vty, "%s%% Login timeout.%s", VTY_NEWLINE, VTY_NEWLINE);
+        vty_session_close(m, vty);
+        return;
+    }
+    if (vty->v_timeout && now - vty->v_input >= TIMER_SEC(vty->v_timeout))
+    {
+        vty_out(vty, "%sVty connection is timed out.%s", VTY_NEWLINE, VTY_NEWLINE);
+        vty_session_close(m, vty);
+        return;
+    }
+    if (vty_keepalive && vty->type == vty::VTY_TERM &&
+        now - vty->v_input >= TIMER_SEC(vty_keepalive) &&
+        now - vty->v_keepalive >= TIMER_SEC(vty_keepalive))
+    {
+        /* Idle but alive? A NOP makes a dead peer show up as a write
+           error instead of a session that sits there forever. */
+        unsigned char nop[] = { IAC, NOP };
+
+        buffer_put(vty->obuf, nop, sizeof(nop));
+        vty->v_keepalive = now;
+        if (vty_session_flush(vty) < 0)
+        {
+            vty_session_close(m, vty);
+            return;
+        }
+    }
+    vty_timeout_arm(vty);
+}
+
+/* Move the terminal cursor n columns left. */
+static void vty_backspace(struct vty *vty, int n)
+{
+    static const char bs[] = "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b";
+
+    for (; n > 0; n -= sizeof(bs) - 1)
+        buffer_put(vty->obuf, bs, (n < (int)sizeof(bs) - 1) ? n : sizeof(bs) - 1);
+}
+
+/* Blank n columns from the cursor and come back. */
+static void vty_blank(struct vty *vty, int n)
+{
+    static const char sp[] = "                ";
+
+    for (int left = n; left > 0; left -= sizeof(sp) - 1)
+        buffer_put(vty->obuf, sp, (left < (int)sizeof(sp) - 1) ? left : sizeof(sp) - 1);
+    vty_backspace(vty, n);
+}
+
+/* Basic function to insert character into vty. Only the tail right of
+   the cursor is redrawn. */
+static void vty_self_insert(struct vty *vty, char c)
+{
+    int length;
+
+    if (vty->length + 1 >= vty->max)
+        return;
+
+    length = vty->length - vty->cp;
+    memmove(&vty->buf[vty->cp + 1], &vty->buf[vty->cp], length);
+    vty->buf[vty->cp] = c;
+    buffer_put(vty->obuf, &vty->buf[vty->cp], length + 1);
+    vty_backspace(vty, length);
+
+    vty->cp++;
+    vty->length++;
+}
+
+/* Forward character. */
+static void vty_forward_char(struct vty *vty)
+{
+    if (vty->cp < vty->length)
+        buffer_putc(vty->obuf, vty->buf[vty->cp++]);
+}
+
+/* Backward character. */
+static void vty_backward_char(struct vty *vty)
+{
+    if (vty->cp > 0)
+    {
+        vty->cp--;
+        vty_backspace(vty, 1);
+    }
+}
+
+/* Move to the beginning of the line. */
+static void vty_beginning_of_line(struct vty *vty)
+{
+    vty_backspace(vty, vty->cp);
+    vty->cp = 0;
+}
+
+/* Move to the end of the line. */
+static void vty_end_of_line(struct vty *vty)
+{
+    buffer_put(vty->obuf, &vty->buf[vty->cp], vty->length - vty->cp);
+    vty->cp = vty->length;
+}
+
+/* Delete a character at the current point. */
+static void vty_delete_char(struct vty *vty)
+{
+    int size;
+
+    if (vty->cp == vty->length)
+        return;
+
+    size = vty->length - vty->cp - 1;
+    memmove(&vty->buf[vty->cp], &vty->buf[vty->cp + 1], size);
+    vty->length--;
+
+    buffer_put(vty->obuf, &vty->buf[vty->cp], size);
+    buffer_putc(vty->obuf, ' ');
+    vty_backspace(vty, size + 1);
+}
+
+/* Delete a character before the point. */
+static void vty_delete_backward_char(struct vty *vty)
+{
+    if (vty->cp == 0)
+        return;
+    vty_backward_char(vty);
+    vty_delete_char(vty);
+}
+
+/* Kill rest of line from current point. */
+static void vty_kill_line(struct vty *vty)
+{
+    vty_blank(vty, vty->length - vty->cp);
+    vty->length = vty->cp;
+}
+
+/* Kill line from the beginning. */
+static void vty_kill_line_from_beginning(struct vty *vty)
+{
+    vty_beginning_of_line(vty);
+    vty_kill_line(vty);
+}
+
+/* Delete a word before the point. */
+static void vty_backward_kill_word(struct vty *vty)
+{
+    int cp = vty->cp;
+    int size;
+
+    while (cp > 0 && vty->buf[cp - 1] == ' ')
+        cp--;
+    while (cp > 0 && vty->buf[cp - 1] != ' ')
+        cp--;
+    if (cp == vty->cp)
+        return;
+
+    size = vty->cp - cp;
+    memmove(&vty->buf[cp], &vty->buf[vty->cp], vty->length - vty->cp);
+    vty_backspace(vty, size);
+    vty->cp = cp;
+    vty->length -= size;
+    buffer_put(vty->obuf, &vty->buf[cp], vty->length - cp);
+    vty_blank(vty, size);
+    vty_backspace(vty, vty->length - cp);
+}
+
+/* History slot i of the ring. */
+static char *vty_hist(struct vty *vty, int i)
+{
+    return vty->hist + i * vty->max;
+}
+
+/* Add current command line to the history buffer. */
+static void vty_hist_add(struct vty *vty)
+{
+    int index;
+
+    if (vty->length == 0)
+        return;
+
+    index = vty->hindex ? vty->hindex - 1 : VTY_MAXHIST - 1;
+
+    /* Ignore the same string as previous one. */
+    if (strcmp(vty->buf, vty_hist(vty, index)) != 0)
+    {
+        memcpy(vty_hist(vty, vty->hindex), vty->buf, vty->length + 1);
+        vty->hindex++;
+        if (vty->hindex == VTY_MAXHIST)
+            vty->hindex = 0;
+    }
+    vty->hp = vty->hindex;
+}
+
+/* Replace the edited line with history entry hp. */
+static void vty_history_print(struct vty *vty)
+{
+    int length;
+
+    vty_kill_line_from_beginning(vty);
+
+    length = strlen(vty_hist(vty, vty->hp));
+    memcpy(vty->buf, vty_hist(vty, vty->hp), length);
+    vty->cp = vty->length = length;
+    buffer_put(vty->obuf, vty->buf, length);
+}
+
+/* Show next command line history. */
+static void vty_next_line(struct vty *vty)
+{
+    int try_index;
+
+    if (vty->hp == vty->hindex)
+        return;
+
+    /* Try is there history exist or not. */
+    try_index = vty->hp + 1;
+    if (try_index == VTY_MAXHIST)
+        try_index = 0;
+
+    vty->hp = try_index;
+    if (try_index == vty->hindex)
+    {
+        /* Back to the empty line being typed. */
+        vty_kill_line_from_beginning(vty);
+        return;
+    }
+    vty_history_print(vty);
+}
+
+/* Show previous command line history. */
+static void vty_previous_line(struct vty *vty)
+{
+    int try_index;
+
+    try_index = vty->hp ? vty->hp - 1 : VTY_MAXHIST - 1;
+    if (try_index == vty->hindex || vty_hist(vty, try_index)[0] == '\0')
+        return;
+
+    vty->hp = try_index;
+    vty_history_print(vty);
+}
+
+/* ^C stop current input and do not add command line to the history. */
+static void vty_stop_input(struct vty *vty)
+{
+    vty->cp = vty->length = 0;
+    vty_out(vty, "^C%s", VTY_NEWLINE);
+    vty->hp = vty->hindex;
+    vty_prompt(vty);
+}
+
+/* Execute current command line. */
+static void vty_execute_line(struct vty *vty)
+{
+    vty->buf[vty->length] = '\0';
+    vty->ret = CMD_SUCCESS;
+    if (vty->type == vty::VTY_TERM)
+    {
+        vty_out(vty, "%s", VTY_NEWLINE);
+        vty_hist_add(vty);
+    }
+    if (vty->length)
+    {
+        struct buffer *obuf = vty->obuf;
+
+        /* Command output is collected for the pager. */
+        vty->obuf = vty->pbuf;
+        vty->ret = vty_execute(vty, (unsigned char *)vty->buf);
+        vty->obuf = obuf;
+    }
+    vty->cp = vty->length = 0;
+    vty_more_screen(vty);
+    if (vty->status == vty::VTY_CLOSE)
+    {
+        /* No pager on the way out. */
+        buffer_move_lines(vty->obuf, vty->pbuf, 0, NULL, NULL);
+        vty_output_end(vty);
+    }
+    else
+    {
+        /* Straight on to the socket queue, so that the next line
+           typed ahead can run and the output of all of them goes out
+           in one flush. The pump owes the prompt once it drains. */
+        if (vty_more_active(vty))
+            vty_more_pump(vty);
+        else
+            vty_prompt_owed(vty);
+    }
+}
+
+/* ^D on an empty line leaves the current node, like "exit". */
+static void vty_down_level(struct vty *vty)
+{
+    vty_out(vty, "%s", VTY_NEWLINE);
+    cmd_execute_command(vty, "exit", NULL);
+    if (vty->status != vty::VTY_CLOSE)
+        vty_prompt(vty);
+}
+
+/* Print the prompt and the line being edited again, cursor at cp. */
+static void vty_redraw_line(struct vty *vty)
+{
+    vty_prompt(vty);
+    buffer_put(vty->obuf, vty->buf, vty->length);
+    vty_backspace(vty, vty->length - vty->cp);
+}
+
+/* Token as shown to the user: .LINE is shown as LINE. */
+static const char *vty_token_text(const struct cmd_graph_node *gn)
+{
+    return (gn->type == TOKEN_LINE) ? gn->text + 1 : gn->text;
+}
+
+/* List candidate tokens in as many columns as the terminal is wide. */
+static void vty_columns(struct vty *vty, const struct cmd_graph_node **vec, int n)
+{
+    int width = 0, cols;
+
+    for (int i = 0; i < n; i++)
+        if ((int)strlen(vty_token_text(vec[i])) > width)
+            width = strlen(vty_token_text(vec[i]));
+    width += 2;
+    cols = vty_width(vty) / width;
+    if (cols < 1)
+        cols = 1;
+
+    for (int i = 0; i < n; i++)
+    {
+        vty_out(vty, "%-*s", width, vty_token_text(vec[i]));
+        if ((i + 1) % cols == 0 || i == n - 1)
+            vty_out(vty, "%s", VTY_NEWLINE);
+    }
+}
+
+/* '?' shows what may be typed at this point with its help string. */
+static void vty_describe_command(struct vty *vty)
+{
+    const struct cmd_graph_node *vec[CMD_CANDIDATE_MAX];
+    int cr, n, width = 4;
+
+    vty->buf[vty->length] = '\0';
+    n = cmd_candidates(vty, vty->buf, vec, CMD_CANDIDATE_MAX, &cr, 0);
+    vty_out(vty, "%s", VTY_NEWLINE);
+
+    if (n < 0 || (n == 0 && !cr))
+        vty_out(vty, "%% There is no matched command.%s", VTY_NEWLINE);
+    else
+    {
+        for (int i = 0; i < n; i++)
+            if ((int)strlen(vty_token_text(vec[i])) > width)
+                width = strlen(vty_token_text(vec[i]));
+        for (int i = 0; i < n; i++)
+        {
+            const char *desc = cmd_token_desc(vec[i]);
+
+            vty_out(vty, "  %-*s  %s%s", width, vty_token_text(vec[i]), desc ? desc : "", VTY_NEWLINE);
+        }
+        if (cr)
+            vty_out(vty, "  <cr>%s", VTY_NEWLINE);
+    }
+    vty_redraw_line(vty);
+}
+
+/* TAB completes the keyword being typed as far as it is unique, and
+   lists the candidates when there is nothing left to add. */
+static void vty_complete_command(struct vty *vty)
+{
+    const struct cmd_graph_node *vec[CMD_CANDIDATE_MAX];
+    int cr, n, start, plen, lcp;
+
+    vty_end_of_line(vty);
+    vty->buf[vty->length] = '\0';
+    n = cmd_candidates(vty, vty->buf, vec, CMD_CANDIDATE_MAX, &cr, 1);
+    if (n < 0)
+    {
+        vty_out(vty, "%s%% There is no matched command.%s", VTY_NEWLINE, VTY_NEWLINE);
+        vty_redraw_line(vty);
+        return;
+    }
+    if (n == 0)
+        return;
+
+    for (start = vty->length; start > 0 && vty->buf[start - 1] != ' '; start--)
+        ;
+    plen = vty->length - start;
+
+    if (n == 1)
+    {
+        for (const char *p = vec[0]->text + plen; *p; p++)
+            vty_self_insert(vty, *p);
+        vty_self_insert(vty, ' ');
+        return;
+    }
+
+    /* Longest prefix common to all candidates. */
+    lcp = vec[0]->len;
+    for (int i = 1; i < n; i++)
+    {
+        int j = plen;
+
+        while (j < lcp && vec[i]->text[j] == vec[0]->text[j])
+            j++;
+        lcp = j;
+    }
+    if (lcp > plen)
+    {
+        for (int j = plen; j < lcp; j++)
+            vty_self_insert(vty, vec[0]->text[j]);
+        return;
+    }
+
+    vty_out(vty, "%s", VTY_NEWLINE);
+    vty_columns(vty, vec, n);
+    vty_redraw_line(vty);
+}
+
+/* Final byte of an ESC [ or ESC O sequence. */
+static void vty_escape_map(struct vty *vty, unsigned char c)
+{
+    switch (c)
+    {
+        case 'A': vty_previous_line(vty); break;
+        case 'B': vty_next_line(vty); break;
+        case 'C': vty_forward_char(vty); break;
+        case 'D': vty_backward_char(vty); break;
+        case 'H': vty_beginning_of_line(vty); break;
+        case 'F': vty_end_of_line(vty); break;
+        case '~':
+            switch (vty->escape_param)
+            {
+                case 1: case 7: vty_beginning_of_line(vty); break;
+                case 4: case 8: vty_end_of_line(vty); break;
+                case 3: vty_delete_char(vty); break;
+            }
+            break;
+    }
+}
+
+/* Check the password typed at the login prompt. */
+static void vty_auth(struct vty *vty)
+{
+    vty->buf[vty->length] = '\0';
+    if (vty_password && strcmp(vty->buf, vty_password) == 0)
+    {
+        vty->fail = 0;
+        vty->node = (vty->node_max < ENABLE_NODE) ? VIEW_NODE : ENABLE_NODE;
+    }
+    else if (++vty->fail >= 3)
+    {
+        vty_out (vty, "%% Bad passwords, too many failures!%s", VTY_NEWLINE);
+        vty->status = vty::VTY_CLOSE;
+    }
+    memset(vty->buf, 0, vty->length);
+    vty->cp = vty->length = 0;
+}
+
+/* Password entry: nothing is echoed and nothing goes to the history. */
+static void vty_auth_char(struct vty *vty, unsigned char c)
+{
+    switch (c)
+    {
+        case '\n':
+            vty_out(vty, "%s", VTY_NEWLINE);
+            vty_auth(vty);
+            if (vty->status != vty::VTY_CLOSE)
+                vty_prompt(vty);
+            break;
+        case CONTROL('H'):
+        case 0x7f:
+            if (vty->length)
+                vty->cp = --vty->length;
+            break;
+        case CONTROL('U'):
+            vty->cp = vty->length = 0;
+            break;
+        default:
+            if (isprint(c) && vty->length + 1 < vty->max)
+            {
+                vty->buf[vty->length++] = c;
+                vty->cp = vty->length;
+            }
+            break;
+    }
+}
+
+/* ^C while output streams: drop it, and the input typed ahead. */
+static void vty_stop_output(struct vty *vty)
+{
+    vty_more_quit(vty);
+    buffer_reset(vty->ibuf);
+    vty_out(vty, "^C%s", VTY_NEWLINE);
+    if (!vty_more_active(vty))
+        vty_prompt(vty);
+}
+
+/* Input of a vtysh client: a command per line, ended by a newline or
+   a NUL, no telnet, echo or line editing. A line longer than the edit
+   buffer is refused whole. */
+static int vty_serv_input(struct vty *vty, const unsigned char *buf, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        unsigned char c = buf[i];
+
+        /* The last command's output still goes out: input waits. */
+        if (vty_more_active(vty))
+            return i;
+
+        if (c == '\n' || c == '\0')
+        {
+            if (vty_input_held(vty))
+                return i;
+            if (vty->cp)
+            {
+                vty->length = vty->cp = 0;
+                vty_out(vty, "%% Command line too long.%s", VTY_NEWLINE);
+                vty->ret = CMD_WARNING;
+                vty_prompt(vty);
+            }
+            else
+                vty_execute_line(vty);
+            if (vty->status == vty::VTY_CLOSE || vty->deficit <= 0)
+                return i + 1;
+        }
+        else if (c == '\r')
+            continue;
+        else if (vty->length < vty->max - 1)
+            vty->buf[vty->length++] = c;
+        else
+            vty->cp = 1;	/* No cursor without editing: cp flags the overflow. */
+    }
+    return n;
+}
+
+/* Feed telnet-decoded input to the pager or the line editor. Stops
+   after a command that used up the session's execution time for this
+   round, when the session ends, or at a line a hot restart holds back;
+   returns the bytes taken. */
+static int vty_input(struct vty *vty, const unsigned char *buf, int n)
+{
+    if (vty->type == vty::VTY_SHELL_SERV)
+        return vty_serv_input(vty, buf, n);
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned char c = buf[i];
+
+        if (vty->status == vty::VTY_MORE)
+        {
+            vty_more_char(vty, c);
+            continue;
+        }
+
+        /* Output still streaming: only ^C gets through, the rest waits
+           for it to finish. */
+        if (vty_more_active(vty))
+        {
+            if (c != CONTROL('C'))
+                return i;
+            vty_stop_output(vty);
+            continue;
+        }
+
+        /* Typed ahead: no prompt before it. */
+        vty->prompt_wait = 0;
+
+        if (vty->node == AUTH_NODE)
+        {
+            vty_auth_char(vty, c);
+            if (vty->status == vty::VTY_CLOSE)
+                return i + 1;
+            continue;
+        }
+
+        /* Escape character. */
+        if (vty->escape == VTY_ESCAPE)
+        {
+            if (isdigit(c))
+            {
+                vty->escape_param = vty->escape_param * 10 + (c - '0');
+                continue;
+            }
+            vty_escape_map(vty, c);
+            vty->escape = VTY_ESCAPE_NONE;
+            continue;
+        }
+
+        /* Pre-escape status. */
+        if (vty->escape == VTY_PRE_ESCAPE)
+        {
+            if (c == '[' || c == 'O')
+            {
+                vty->escape = VTY_ESCAPE;
+                vty->escape_param = 0;
+            }
+            else
+                vty->escape = VTY_ESCAPE_NONE;
+            continue;
+        }
+
+        switch (c)
+        {
+            case CONTROL('A'):
+                vty_beginning_of_line(vty);
+                break;
+            case CONTROL('B'):
+                vty_backward_char(vty);
+                break;
+            case CONTROL('C'):
+                vty_stop_input(vty);
+                break;
+            case CONTROL('D'):
+                if (vty->length == 0)
+                    vty_down_level(vty);
+                else
+                    vty_delete_char(vty);
+                break;
+            case CONTROL('E'):
+                vty_end_of_line(vty);
+                break;
+            case CONTROL('F'):
+                vty_forward_char(vty);
+                break;
+            case CONTROL('H'):
+            case 0x7f:
+                vty_delete_backward_char(vty);
+                break;
+            case CONTROL('K'):
+                vty_kill_line(vty);
+                break;
+            case CONTROL('N'):
+                vty_next_line(vty);
+                break;
+            case CONTROL('P'):
+                vty_previous_line(vty);
+                break;
+            case CONTROL('U'):
+                vty_kill_line_from_beginning(vty);
+                break;
+            case CONTROL('W'):
+                vty_backward_kill_word(vty);
+                break;
+            case '\033':
+                vty->escape = VTY_PRE_ESCAPE;
+                break;
+            case '\t':
+                vty_complete_command(vty);
+                break;
+            case '?':
+                vty_describe_command(vty);
+                break;
+            case '\n':
+                if (vty_input_held(vty))
+                    return i;
+                vty_execute_line(vty);
+                if (vty->deficit <= 0)
+                    return i + 1;
+                break;
+            default:
+                if (c == ' ' || analyze_char(c))
+                    vty_self_insert(vty, c);
+                break;
+        }
+        if (vty->status == vty::VTY_CLOSE)
+            return i + 1;
+    }
+    return n;
+}
+
+DEFUN (show_history,
+       show_history_cmd,
+       "show history",
+       "Show running system information\n"
+       "Display the session command history\n")
+{
+    int index;
+
+    for (index = vty->hindex + 1; index != vty->hindex;)
+    {
+        if (index == VTY_MAXHIST)
+        {
+            index = 0;
+            continue;
+        }
+
+        if (vty_hist(vty, index)[0] != '\0')
+            vty_out (vty, "  %s%s", vty_hist(vty, index), VTY_NEWLINE);
+
+        index++;
+    }
+
+    return CMD_SUCCESS;
+}
+
+DEFUN (terminal_length,
+       terminal_length_cmd,
+       "terminal length <0-512>",
+       "Set terminal line parameters\n"
+       "Set number of lines on a screen\n"
+       "Number of lines on screen (0 for no pausing)\n")
+{
+    vty->lines = atoi(argv[0]);
+    return CMD_SUCCESS;
+}
+
+DEFUN (terminal_no_length,
+       terminal_no_length_cmd,
+       "terminal no length",
+       "Set terminal line parameters\n"
+       "Negate a command or set its defaults\n"
+       "Set number of lines on a screen\n")
+{
+    vty->lines = -1;
+    return CMD_SUCCESS;
+}
+
+/* Set time out value. */
+static int exec_timeout(struct vty *vty, const char *min_str, const char *sec_str)
+{
+    unsigned long timeout = 0;
+
+    /* min_str and sec_str are already checked by parser.  So it must be
+       all digit string. */
+    if (min_str)
+        timeout = strtol(min_str, NULL, 10) * 60;
+    if (sec_str)
+        timeout += strtol(sec_str, NULL, 10);
+
+    vty->v_timeout = timeout;
+    vty_timeout_arm(vty);
+
+    return CMD_SUCCESS;
+}
+
+DEFUN (exec_timeout_min,
+       exec_timeout_min_cmd,
+       "exec-timeout <0-35791>",
+       "Set timeout value\n"
+       "Timeout value in minutes\n")
+{
+    return exec_timeout (vty, argv[0], NULL);
+}
+
+DEFUN (exec_timeout_sec,
+       exec_timeout_sec_cmd,
+       "exec-timeout <0-35791> <0-2147483>",
+       "Set the EXEC timeout\n"
+       "Timeout in minutes\n"
+       "Timeout in seconds\n")
+{
+    return exec_timeout (vty, argv[0], argv[1]);
+}
+
+DEFUN (no_exec_timeout,
+       no_exec_timeout_cmd,
+       "no exec-timeout",
+       "Negate a command or set its defaults\n"
+       "Set the EXEC timeout\n")
+{
+    return exec_timeout (vty, NULL, NULL);
+}
+
+/* Install vty's own commands. */
+DEFUN (show_memory,
+       show_memory_cmd,
+       "show memory",
+       "Show running system information\n"
+       "Memory pools\n")
+{
+    unsigned long total, used;
+
+    pthread_mutex_lock(&vty_pool.lock);
+    total = vty_pool.total;
+    used = vty_pool.used;
+    pthread_mutex_unlock(&vty_pool.lock);
+
+    vty_out (vty, "Sessions: %lu in use, %lu allocated, %lu bytes each%s",
+             used, total, (unsigned long)vty_pool.size, VTY_NEWLINE);
+    vty_out (vty, "Output chunks: %lu allocated, %d bytes each%s",
+             buffer_chunk_count(), BUFFER_SIZE_DEFAULT, VTY_NEWLINE);
+    return CMD_SUCCESS;
+}
+
+static void vty_init(void)
+{
+    pool_init(&vty_pool, sizeof(struct vty_slab) + (VTY_MAXHIST + 1) * vty_max_input);
+    pool_reserve(&vty_pool, vty_max_sessions < VTY_POOL_RESERVE ? vty_max_sessions : VTY_POOL_RESERVE);
+
+    /* Four slots per connection that can be counted at once. */
+    if (vty_max_per_peer > 0)
+    {
+        unsigned long want = 4UL * ((unsigned long)vty_max_sessions + vty_wait_max), size = 64;
+
+        while (size < want && size < VTY_PEER_SLOTS_MAX)
+            size *= 2;
+        vty_peers = (struct vty_peer *)calloc(size, sizeof(struct vty_peer));
+        if (vty_peers == NULL)
+            zlog_err("Can't allocate %lu address slots, -P is off", size);
+        vty_peers_mask = size - 1;
+    }
+}
+
+static int vty_input_full(struct vty *vty)
+{
+    return buffer_length(vty->ibuf) >= VTY_INPUT_BACKLOG;
+}
+
+/* Bytes received from the client. They go straight to the line editor
+   while the session has execution time left in this round and nothing
+   queued; the rest, and all input of a connection still waiting for a
+   session, is kept in ibuf for vty_run(). */
+static void vty_recv(struct vty *vty, unsigned char *buf, int len)
+{
+    struct vty_master *m = vty->master;
+    unsigned long iac = vty->telnet.commands;
+    int n, used = 0;
+
+    vty->v_input = m->wheel.now;
+    metrics_add(&m->metrics.bytes_in, len);
+    if (vty->type == vty::VTY_SHELL_SERV)
+        n = len;
+    else
+    {
+        n = telnet_parse(&vty->telnet, buf, len, buf, vty->obuf);
+        metrics_add(&m->metrics.iac, vty->telnet.commands - iac);
+    }
+
+    if (!vty->waiting && buffer_empty(vty->ibuf))
+    {
+        if (vty->run_round != m->round)
+        {
+            vty->deficit = VTY_QUANTUM_US;
+            vty->run_round = m->round;
+        }
+        used = vty_input(vty, buf, n);
+    }
+    if (used < n && vty->status != vty::VTY_CLOSE)
+    {
+        /* ^C must not queue up behind what it is meant to stop. */
+        if (vty->status == vty::VTY_NORMAL && vty_more_active(vty) &&
+            memchr(buf + used, CONTROL('C'), n - used))
+        {
+            vty_stop_output(vty);
+            return;
+        }
+        buffer_put(vty->ibuf, buf + used, n - used);
+        if (!vty->waiting)
+            vty_run_add(vty);
+    }
+}
+
+/* One round of deficit round robin over the sessions with queued
+   input: each gets VTY_QUANTUM_US more command execution time and runs
+   lines until it is used up; a command that overran leaves a debt for
+   the next round. A session pasting a long config thus takes turns
+   with the others instead of holding the worker, and one that just
+   types never queues at all. Sessions queued during the round wait
+   for the next. */
+static void vty_run(struct vty_master *m)
+{
+    int n = m->run_count;
+
+    m->round++;
+    while (n-- > 0 && m->run_head)
+    {
+        struct vty *vty = m->run_head;
+        struct buffer_data *d;
+
+        vty_run_del(vty);
+        vty->deficit += VTY_QUANTUM_US;
+        if (vty->deficit > VTY_QUANTUM_US)
+            vty->deficit = VTY_QUANTUM_US;
+        vty->run_round = m->round;
+
+        while ((d = vty->ibuf->head) != NULL && vty->deficit > 0 && vty->status != vty::VTY_CLOSE)
+        {
+            int used = vty_input(vty, d->data + d->sp, d->cp - d->sp);
+
+            buffer_consume(vty->ibuf, used);
+            /* Held up by the output of the last line: push it out, and
+               leave the rest until the socket has taken it all. Held
+               back for a hot restart: leave it. */
+            if (used == 0 && (vty_input_held(vty) || vty_session_flush(vty) < 0 ||
+                              vty_output_pending(vty)))
+                break;
+        }
+
+        if (vty->status != vty::VTY_CLOSE && vty->input_paused &&
+            buffer_length(vty->ibuf) < VTY_INPUT_BACKLOG / 2)
+        {
+            vty->input_paused = 0;
+            if ((*vty_io->resume) (vty) < 0)
+                vty->status = vty::VTY_CLOSE;
+        }
+        if (vty->status == vty::VTY_CLOSE || vty_session_flush(vty) < 0)
+        {
+            vty_session_close(m, vty);
+            continue;
+        }
+        if (!buffer_empty(vty->ibuf) && !vty_output_pending(vty))
+            vty_run_add(vty);
+    }
+}
+
+/* Edge-triggered read: drain the socket until EAGAIN, or until the
+   session has VTY_INPUT_BACKLOG queued; vty_run() reads on once it has
+   worked that off. Returns -1 on a receive error. */
+static int vty_read(struct vty *vty)
+{
+    unsigned char buffer[VTY_READ_BUFSIZ];
+
+    while (1)
+    {
+        int valread;
+
+        if (vty->input_eof)
+            return 0;
+        if (vty_input_full(vty))
+        {
+            vty->input_paused = 1;
+            return 0;
+        }
+        valread = read(vty->fd, buffer, VTY_READ_BUFSIZ);
+        if (valread == 0)
+        {
+            vty_input_end(vty);
+            return 0;
+        }
+        if (valread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        vty_recv(vty, buffer, valread);
+        if (vty->status == vty::VTY_CLOSE)
+            return -1;
+    }
+}
+
+/* Send the rejection banner to a connection that got neither a session
+   nor a place in the queue. It never reached the worker's books, so it
+   is written out directly. */
+static void vty_reject(struct vty *vty, const char *msg, int limit)
+{
+    vty->master = NULL;
+    if (vty->type == vty::VTY_TERM)
+        vty_hello_echo(vty);
+    vty_out(vty, msg, limit);
+    if (vty->type == vty::VTY_SHELL_SERV)
+    {
+        /* A vtysh client waits for the status. */
+        vty->ret = CMD_WARNING;
+        vty_prompt(vty);
+    }
+    vty_flush(vty);
+    vty_close(vty);
+}
+
+/* Timer of a connection in the admission queue: once a second tell it
+   where it stands, and give up after vty_wait_timeout_val. Slots are
+   handed out by vty_admit_tick(). */
+static void vty_wait_timeout(struct timer *t)
+{
+    struct vty *vty = timer_entry(t, struct vty, t_timeout);
+    struct vty_master *m = vty->master;
+    int pos;
+
+    if (vty_wait_timeout_val && m->wheel.now - vty->v_start >= TIMER_SEC(vty_wait_timeout_val))
+    {
+        vty_out(vty, "%% No session came free in %lu seconds, please try again later.%s",
+                vty_wait_timeout_val, VTY_NEWLINE);
+        vty_session_close(m, vty);
+        return;
+    }
+    pos = vty_wait_position(vty);
+    if (pos != vty->wait_pos)
+    {
+        vty->wait_pos = pos;
+        vty_out(vty, "%% You are number %d in the queue.%s", pos, VTY_NEWLINE);
+        if (vty_session_flush(vty) < 0)
+        {
+            vty_session_close(m, vty);
+            return;
+        }
+    }
+    timer_add(&m->wheel, t, TIMER_SEC(1));
+}
+
+/* A queued connection: it is watched for hangups and its input is kept
+   for when it gets a session. */
+static void vty_wait_start(struct vty_master *m, struct vty *vty)
+{
+    metrics_add(&m->metrics.queued, 1);
+    vty->v_start = m->wheel.now;
+    vty->t_timeout.func = vty_wait_timeout;
+    timer_add(&m->wheel, &vty->t_timeout, TIMER_SEC(1));
+
+    zlog_info("Vty connection from %s, fd %d, worker %d, number %d in the queue",
+              vty->address, vty->fd, m->id, vty->wait_pos);
+    vty_out(vty, "%s%% All %d sessions are in use, you are number %d in the queue.%s",
+            VTY_NEWLINE, vty_max_sessions, vty->wait_pos, VTY_NEWLINE);
+    if (vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+/* A connection got its session slot, straight away or from the queue. */
+static void vty_session_start(struct vty_master *m, struct vty *vty)
+{
+    vty_session_count(m, 1);
+    metrics_add(&m->metrics.accepts, 1);
+
+    vty->v_timeout = vty_timeout_val;
+    vty->v_start = vty->v_input = vty->v_keepalive = m->wheel.now;
+    vty->t_timeout.func = vty_timeout;
+    if (vty_password && vty->type == vty::VTY_TERM)
+        vty->node = AUTH_NODE;
+    vty_timeout_arm(vty);
+
+    vty->session_id = __atomic_add_fetch(&vty_session_seq, 1, __ATOMIC_RELAXED);
+    audit_session_open(vty->session_id, vty->address);
+    zlog_info("Vty connection from %s, fd %d, worker %d, session %u",
+              vty->address, vty->fd, m->id, vty->session_id);
+
+    /* A vtysh client just sends its commands. */
+    if (vty->type == vty::VTY_TERM)
+    {
+        vty_hello_echo(vty);
+        vty_out(vty, "Vty connection from %s. %s", vty->address, VTY_NEWLINE);
+
+        // 发送欢迎消息
+        vty_out(vty, "Welcome to my Telnet server![%d]. %s", vty_session_total(), VTY_NEWLINE);
+        if (vty->node == AUTH_NODE)
+            vty_out(vty, "%sUser Access Verification%s%s", VTY_NEWLINE, VTY_NEWLINE, VTY_NEWLINE);
+        vty_prompt(vty);
+    }
+
+    /* Typed ahead while waiting. */
+    if (!buffer_empty(vty->ibuf))
+        vty_run_add(vty);
+    if (vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+/* A new connection, or one that was still waiting in the old process
+   of a hot restart: a session, a place in the queue or no. */
+static void vty_session_admit(struct vty_master *m, struct vty *vty)
+{
+    struct vty_listener *l = vty->listener;
+    int ret;
+
+    ret = vty_admit(vty);
+    if (ret == VTY_ADMIT_PEER)
+    {
+        metrics_add(&m->metrics.rejects, 1);
+        zlog_notice("Connection from %s refused, %d sessions from there already",
+                    vty->address, vty_max_per_peer);
+        vty_reject(vty, "\r\nmini_vtysh just permit %d socket connect from one address!\r\n",
+                   vty_max_per_peer);
+        return;
+    }
+    if (ret == VTY_ADMIT_LISTENER)
+    {
+        metrics_add(&m->metrics.rejects, 1);
+        zlog_notice("Connection from %s refused, %s has its %d sessions",
+                    vty->address, l->spec, l->max);
+        vty_reject(vty, "\r\nmini_vtysh just permit %d socket connect here!\r\n", l->max);
+        return;
+    }
+    if (ret == VTY_ADMIT_FULL)
+    {
+        metrics_add(&m->metrics.rejects, 1);
+        zlog_notice("Connection from %s refused, %d sessions open and %d waiting",
+                    vty->address, vty_max_sessions, vty_wait_max);
+        vty_reject(vty, "\r\nmini_vtysh just permit %d socket connect!\r\n"
+                   "please wait other connect close.\r\n", vty_max_sessions);
+        return;
+    }
+
+    if (vtyvec_set(m, vty->fd, vty) < 0 || (*vty_io->add) (m, vty) < 0)
+    {
+        vtyvec_set(m, vty->fd, NULL);
+        if (vty_admit_leave(vty))
+            vty_wait_admit(m);
+        vty_close(vty);
+        return;
+    }
+
+    if (ret == VTY_ADMIT_WAIT)
+        vty_wait_start(m, vty);
+    else
+        vty_session_start(m, vty);
+}
+
+/* Set up a freshly accepted connection, see vty_session_admit(). */
+static void vty_session_open(struct vty_master *m, int fd, union sockunion *su,
+                             struct vty_listener *l)
+{
+    struct vty *vty = vty_new(fd);
+
+    if (vty == NULL)
+    {
+        close(fd);
+        return;
+    }
+    vty->master = m;
+    vty->listener = l;
+    vty->type = l->shell ? vty::VTY_SHELL_SERV : vty::VTY_TERM;
+    vty->node_max = l->node_max;
+    vty->node = (l->node_max < ENABLE_NODE) ? VIEW_NODE : ENABLE_NODE;
+    if (l->shell)
+    {
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+
+        /* Who it is, for the log and the audit journal. */
+        vty->lines = 0;
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+            snprintf(vty->address, SU_ADDRSTRLEN, "local pid %d uid %u", (int)cred.pid, cred.uid);
+        else
+            snprintf(vty->address, SU_ADDRSTRLEN, "local");
+    }
+    else
+    {
+        int on = 1;
+
+        /* Output is already gathered into one write per round; a
+           reply that comes later than the echo, from a job or a
+           daemon, must not wait for the client's delayed ACK. */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        sockunion2str (su, vty->address, SU_ADDRSTRLEN);
+    }
+    vty_session_admit(m, vty);
+}
+
+/* Parse a -p listener: [address:]port, [ipv6-address]:port or
+   unix:path, then any of ",max=N" for sessions of its own and
+   ",node=view|enable|config" for the highest node they may enter. */
+static int vty_listen_parse(const char *arg)
+{
+    struct vty_listener *l = &vty_listeners[vty_nlisteners];
+    char *spec, *opts, *host, *port, *end;
+    long n;
+
+    if (vty_nlisteners == VTY_LISTEN_MAX)
+    {
+        fprintf(stderr, "At most %d listeners\n", VTY_LISTEN_MAX);
+        return -1;
+    }
+    memset(l, 0, sizeof(*l));
+    l->spec = strdup(arg);
+    l->fd = -1;
+    l->shell = 0;
+    l->node_max = NODE_MAX;
+
+    spec = strdup(arg);
+    if ((opts = strchr(spec, ',')) != NULL)
+        *opts++ = '\0';
+
+    if (strncmp(spec, "unix:", 5) == 0)
+    {
+        if (spec[5] == '\0' || strlen(spec + 5) >= sizeof(l->path))
+            goto bad;
+        snprintf(l->path, sizeof(l->path), "%s", spec + 5);
+        l->su.sa.sa_family = AF_UNIX;
+        l->shell = 1;
+    }
+    else
+    {
+        host = NULL;
+        port = spec;
+        if (spec[0] == '[')
+        {
+            host = spec + 1;
+            if ((end = strchr(host, ']')) == NULL || end[1] != ':')
+                goto bad;
+            *end = '\0';
+            port = end + 2;
+            l->su.sin6.sin6_family = AF_INET6;
+            if (inet_pton(AF_INET6, host, &l->su.sin6.sin6_addr) != 1)
+                goto bad;
+        }
+        else if ((end = strrchr(spec, ':')) != NULL)
+        {
+            host = spec;
+            *end = '\0';
+            port = end + 1;
+        }
+        if (l->su.sa.sa_family != AF_INET6)
+        {
+            l->su.sin.sin_family = AF_INET;
+            l->su.sin.sin_addr.s_addr = INADDR_ANY;
+            if (host && inet_pton(AF_INET, host, &l->su.sin.sin_addr) != 1)
+                goto bad;
+        }
+        n = strtol(port, &end, 10);
+        if (*port == '\0' || *end != '\0' || n <= 0 || n > 65535)
+            goto bad;
+        /* Same place in sin and sin6. */
+        l->su.sin.sin_port = htons(n);
+    }
+
+    for (char *opt = opts ? strtok(opts, ",") : NULL; opt; opt = strtok(NULL, ","))
+    {
+        if (strncmp(opt, "max=", 4) == 0 && (n = atoi(opt + 4)) > 0)
+            l->max = n;
+        else if (strcmp(opt, "node=view") == 0)
+            l->node_max = VIEW_NODE;
+        else if (strcmp(opt, "node=enable") == 0)
+            l->node_max = ENABLE_NODE;
+        else if (strcmp(opt, "node=config") == 0)
+            l->node_max = NODE_MAX;
+        else
+            goto bad;
+    }
+    free(spec);
+    vty_nlisteners++;
+    return 0;
+
+bad:
+    fprintf(stderr, "Bad listener %s\n", arg);
+    free(spec);
+    free(l->spec);
+    return -1;
+}
+
+/* Open listener i for worker m. A TCP listener gets a socket of the
+   worker's own; the Unix one is made once and shared. */
+static int vty_serv_sock(struct vty_master *m, int i)
+{
+    struct vty_listener *l = &vty_listeners[i];
+    int family = l->su.sa.sa_family;
+    int opt = 1;
+    int fd;
+
+    if (family == AF_UNIX && l->fd >= 0)
+    {
+        m->listen_fd[i] = l->fd;
+        return 0;
+    }
+    if (m->id < l->nadopt)
+    {
+        /* Bound and listening in the old process already; its Unix
+           socket is not unlinked either. */
+        m->listen_fd[i] = l->adopt[m->id];
+        if (family == AF_UNIX)
+            l->fd = m->listen_fd[i];
+        return 0;
+    }
+
+    // 创建 socket 文件描述符
+    if ((fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        zlog_err("Socket creation failed for %s: %s", l->spec, safe_strerror(errno));
+        return -1;
+    }
+    m->listen_fd[i] = fd;
+
+    if (family == AF_UNIX)
+    {
+        struct sockaddr_un addr;
+        mode_t old_mask;
+        int ret;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", l->path);
+        unlink(l->path);
+        /* Owner and group only, as for quagga's vtysh sockets. */
+        old_mask = umask(0007);
+        ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        umask(old_mask);
+        if (ret < 0) {
+            zlog_err("Bind failed for %s: %s", l->spec, safe_strerror(errno));
+            return -1;
+        }
+        l->fd = fd;
+    }
+    else
+    {
+        // 设置 socket 选项，允许多个连接
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) ||
+            (family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)))) {
+            zlog_err("Setsockopt failed for %s: %s", l->spec, safe_strerror(errno));
+            return -1;
+        }
+        if (bind(fd, &l->su.sa, (family == AF_INET6) ? sizeof(l->su.sin6) : sizeof(l->su.sin)) < 0) {
+            zlog_err("Bind failed for %s: %s", l->spec, safe_strerror(errno));
+            return -1;
+        }
+    }
+
+    if (listen(fd, vty_backlog) < 0) {
+        zlog_err("Listen failed for %s: %s", l->spec, safe_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Listener index of fd in m, -1 if it is none. */
+static int vty_listen_lookup(struct vty_master *m, int fd)
+{
+    for (int i = 0; i < vty_nlisteners; i++)
+        if (m->listen_fd[i] == fd)
+            return i;
+    return -1;
+}
+
+/* epoll backend. */
+
+/* Accept every pending connection on the (edge-triggered) listener
+   i. A shared one may have been drained by another worker. */
+static void vty_accept(struct vty_master *m, int i)
+{
+    union sockunion su;
+    socklen_t len;
+    int fd;
+
+    while (1)
+    {
+        len = sizeof (union sockunion);
+        memset (&su, 0, sizeof (union sockunion));
+        fd = accept4(m->listen_fd[i], &su.sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                zlog_err("Accept failed: %s", safe_strerror(errno));
+            return;
+        }
+        vty_session_open(m, fd, &su, &vty_listeners[i]);
+    }
+}
+
+/* Dispatch one epoll event for a client socket. */
+static void vty_event(struct vty_master *m, struct epoll_event *ev)
+{
+    struct vty *vty = vtyvec_lookup(m, ev->data.fd);
+
+    if (vty == NULL)
+        return;
+
+    if (ev->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        if (vty_read(vty) < 0)
+        {
+            vty_session_close(m, vty);
+            return;
+        }
+    }
+
+    /* One writev() for everything produced by this event, and on
+       EPOLLOUT for whatever the socket refused last time. */
+    if (vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+/* Add listener i to the set, or with EPOLL_CTL_DEL take it out. */
+static int vty_epoll_listener(struct vty_master *m, int i, int op)
+{
+    struct epoll_event event;
+
+    /* Only one worker is woken for a connection on a shared one. */
+    event.events = EPOLLIN | EPOLLET;
+    if (vty_listeners[i].su.sa.sa_family == AF_UNIX)
+        event.events |= EPOLLEXCLUSIVE;
+    event.data.fd = m->listen_fd[i];
+    if (epoll_ctl(m->epoll_fd, op, m->listen_fd[i], &event) < 0) {
+        zlog_err("epoll_ctl: %s", safe_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int vty_epoll_start(struct vty_master *m)
+{
+    struct epoll_event event;
+
+    if ((m->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        zlog_err("epoll_create1: %s", safe_strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < vty_nlisteners; i++)
+        if (vty_epoll_listener(m, i, EPOLL_CTL_ADD) < 0)
+            return -1;
+
+    event.events = EPOLLIN;
+    event.data.fd = m->job_fd;
+    if (m->job_fd >= 0 && epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->job_fd, &event) < 0) {
+        zlog_err("epoll_ctl: %s", safe_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Client sockets are registered once for both directions, see
+   vty_session_flush(). */
+static int vty_epoll_add(struct vty_master *m, struct vty *vty)
+{
+    struct epoll_event event;
+
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = vty->fd;
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, vty->fd, &event) < 0)
+    {
+        zlog_err("epoll_ctl: %s", safe_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static buffer_status_t vty_epoll_flush(struct vty *vty)
+{
+    return buffer_flush_available(vty->wbuf, vty->wfd);
+}
+
+/* What is left unread since vty_read() stopped raises no new edge. */
+static int vty_epoll_resume(struct vty *vty)
+{
+    return vty_read(vty);
+}
+
+/* close() also removes the fd from the epoll set. */
+static void vty_epoll_release(struct vty_master *m, struct vty *vty)
+{
+    vty_close(vty);
+}
+
+/* Connections that come meanwhile wait in the listen queue, for the
+   new process or for this one again. */
+static void vty_epoll_listen(struct vty_master *m, int on)
+{
+    for (int i = 0; i < vty_nlisteners; i++)
+        vty_epoll_listener(m, i, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL);
+    if (!on)
+        vty_restart_ack();
+}
+
+/* Unlike on release, close() would not do: the new process has the
+   socket too. */
+static int vty_epoll_detach(struct vty_master *m, struct vty *vty)
+{
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, vty->fd, NULL) < 0)
+        zlog_err("epoll_ctl: %s", safe_strerror(errno));
+    return 0;
+}
+
+static void vty_epoll_loop(struct vty_master *m)
+{
+    struct epoll_event events[EVENT_NUM];
+
+    while (1)
+    {
+        /* Queued input is worked off between polls that do not wait. */
+        int n = epoll_wait(m->epoll_fd, events, EVENT_NUM,
+                           m->run_count ? 0 : timer_wheel_timeout(&m->wheel));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            zlog_err("epoll_wait: %s", safe_strerror(errno));
+            return;
+        }
+        timer_wheel_advance(&m->wheel);
+        for (int i = 0; i < n; i++)
+        {
+            int l = vty_listen_lookup(m, events[i].data.fd);
+
+            if (l >= 0)
+                vty_accept(m, l);
+            else if (events[i].data.fd == m->job_fd)
+            {
+                if (read(m->job_fd, &m->job_count, sizeof(m->job_count)) < 0)
+                    zlog_err("job wakeup: %s", safe_strerror(errno));
+                vty_job_events(m);
+            }
+            else
+                vty_event(m, &events[i]);
+        }
+        vty_run(m);
+    }
+}
+
+static const struct vty_io vty_epoll_io =
+{
+    "epoll",
+    vty_epoll_start,
+    vty_epoll_add,
+    vty_epoll_flush,
+    vty_epoll_resume,
+    vty_epoll_release,
+    vty_epoll_listen,
+    vty_epoll_detach,
+    vty_epoll_loop,
+};
+
+#ifdef VTY_IO_URING
+/* io_uring backend. The listener has one multishot accept and every
+   session one multishot receive into the worker's provided buffer ring,
+   so in the steady state a reconnect storm or a burst of keystrokes
+   costs no submissions at all; output goes out as linked sends, and all
+   of a loop's submissions share its one io_uring_enter(). Requests
+   carry the vty they belong to, an accept the index of its listener
+   instead, with the operation in the low bits: vtys come from
+   vty_pool, 64 byte aligned. */
+#define VTY_URING_ENTRIES    256
+#define VTY_URING_CQ_ENTRIES 4096
+
+/* Receive buffers of VTY_READ_BUFSIZ per worker. */
+#define VTY_URING_BUFS       1024
+
+#define VTY_URING_ACCEPT     0
+#define VTY_URING_RECV       1
+#define VTY_URING_SEND       2
+#define VTY_URING_CANCEL     3
+#define VTY_URING_JOB        4
+#define VTY_URING_OP_BITS    6
+#define VTY_URING_OP_MASK    ((1 << VTY_URING_OP_BITS) - 1)
+
+static uint64_t vty_uring_data(struct vty *vty, int op)
+{
+    return (uint64_t)(uintptr_t)vty | op;
+}
+
+static void vty_uring_accept_arm(struct vty_master *m, int i)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&m->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m->listen_fd[i];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = ((uint64_t)i << VTY_URING_OP_BITS) | VTY_URING_ACCEPT;
+    m->accept_armed |= 1u << i;
+}
+
+static void vty_uring_recv_arm(struct vty *vty)
+{
+    struct vty_master *m = vty->master;
+    struct io_uring_sqe *sqe = uring_get_sqe(&m->ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = vty->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m->bufs.bgid;
+    sqe->user_data = vty_uring_data(vty, VTY_URING_RECV);
+    vty->io_refs++;
+    vty->io_recv = 1;
+}
+
+/* Read the next job pool kick, see vty_job_publish(). */
+static void vty_uring_job_arm(struct vty_master *m)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&m->ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m->job_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m->job_count;
+    sqe->len = sizeof(m->job_count);
+    sqe->user_data = vty_uring_data(NULL, VTY_URING_JOB);
+}
+
+/* Whether the kernel has everything this backend uses. */
+static int vty_uring_probe(void)
+{
+    struct uring r;
+    struct uring_bufs b;
+    int ok;
+
+    if (uring_init(&r, 8, 16) < 0)
+        return -1;
+    /* Multishot receive came with 6.0, as did SEND_ZC, which unlike the
+       former the probe can see. Provided buffer rings are 5.19. */
+    ok = (r.features & IORING_FEAT_EXT_ARG) &&
+        uring_supported(&r, IORING_OP_ACCEPT) && uring_supported(&r, IORING_OP_RECV) &&
+        uring_supported(&r, IORING_OP_SEND) && uring_supported(&r, IORING_OP_ASYNC_CANCEL) &&
+        uring_supported(&r, IORING_OP_READ) &&
+        uring_supported(&r, IORING_OP_SEND_ZC) && uring_bufs_init(&r, &b, 0, 1, 16) == 0;
+    if (ok)
+        uring_bufs_free(&r, &b);
+    uring_exit(&r);
+    return ok ? 0 : -1;
+}
+
+static int vty_uring_start(struct vty_master *m)
+{
+    if (uring_init(&m->ring, VTY_URING_ENTRIES, VTY_URING_CQ_ENTRIES) < 0)
+    {
+        zlog_err("io_uring_setup: %s", safe_strerror(errno));
+        return -1;
+    }
+    if (uring_bufs_init(&m->ring, &m->bufs, 0, VTY_URING_BUFS, VTY_READ_BUFSIZ) < 0)
+    {
+        zlog_err("io_uring buffer ring: %s", safe_strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < vty_nlisteners; i++)
+        vty_uring_accept_arm(m, i);
+    if (m->job_fd >= 0)
+        vty_uring_job_arm(m);
+    return 0;
+}
+
+static int vty_uring_add(struct vty_master *m, struct vty *vty)
+{
+    vty_uring_recv_arm(vty);
+    return 0;
+}
+
+/* Queue wbuf as a chain of linked sends straight from its chunks. The
+   chunks stay in wbuf until the completions consume them and nothing
+   more is queued before the chain is done, so bytes go out in order and
+   the pager sees them as pending. */
+static buffer_status_t vty_uring_flush(struct vty *vty)
+{
+    struct uring *r = &vty->master->ring;
+    struct io_uring_sqe *sqe = NULL;
+    struct buffer_data *d;
+    int n = 0;
+
+    if (vty->io_sends)
+        return BUFFER_PENDING;
+
+    /* A chain must not be split over two submissions. */
+    if (r->sq_entries - (r->sqe_tail - *r->sq_head) < BUFFER_MAX_CHUNKS)
+        uring_submit(r, 0, 0);
+
+    for (d = vty->wbuf->head; d && n < BUFFER_MAX_CHUNKS; d = d->next)
+    {
+        if (d->cp == d->sp)
+            continue;
+        /* Linked, and corked with MSG_MORE so that the chain leaves as
+           one burst rather than a segment per chunk held up by Nagle. */
+        if (sqe)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+            sqe->msg_flags |= MSG_MORE;
+        }
+        sqe = uring_get_sqe(r);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = vty->wfd;
+        sqe->addr = (uint64_t)(uintptr_t)(d->data + d->sp);
+        sqe->len = d->cp - d->sp;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = vty_uring_data(vty, VTY_URING_SEND);
+        n++;
+    }
+    if (n == 0)
+    {
+        buffer_reset(vty->wbuf);
+        return BUFFER_EMPTY;
+    }
+    vty->io_sends += n;
+    vty->io_refs += n;
+    return BUFFER_PENDING;
+}
+
+/* Stop the multishot receive while the session has enough input
+   queued. */
+static void vty_uring_pause(struct vty *vty)
+{
+    struct io_uring_sqe *sqe;
+
+    if (vty->input_paused)
+        return;
+    vty->input_paused = 1;
+    if (!vty->io_recv)
+        return;
+    sqe = uring_get_sqe(&vty->master->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = vty_uring_data(vty, VTY_URING_RECV);
+    sqe->user_data = vty_uring_data(NULL, VTY_URING_CANCEL);
+}
+
+/* The receive may still be on its way out, then it is armed again
+   when its last completion comes in. */
+static int vty_uring_resume(struct vty *vty)
+{
+    if (!vty->io_recv && !vty->input_eof)
+        vty_uring_recv_arm(vty);
+    return 0;
+}
+
+/* Cancel the receive and whatever the socket has no room for. Sends of
+   last words queued just before go first, so like with epoll they are
+   tried once. */
+static void vty_uring_release(struct vty_master *m, struct vty *vty)
+{
+    struct io_uring_sqe *sqe;
+
+    vty->status = vty::VTY_CLOSE;
+    vty->io_closed = 1;
+    if (vty->io_refs == 0)
+    {
+        vty_close(vty);
+        return;
+    }
+    sqe = uring_get_sqe(&m->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = vty->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = vty_uring_data(NULL, VTY_URING_CANCEL);
+}
+
+/* Cancel the accepts; the worker has stopped once their last
+   completions are in, see vty_uring_accept(). One that is still on its
+   way out when accepting starts again is armed when it comes. */
+static void vty_uring_listen(struct vty_master *m, int on)
+{
+    for (int i = 0; i < vty_nlisteners; i++)
+    {
+        struct io_uring_sqe *sqe;
+
+        if (on && !(m->accept_armed & (1u << i)))
+            vty_uring_accept_arm(m, i);
+        else if (!on && (m->accept_armed & (1u << i)))
+        {
+            sqe = uring_get_sqe(&m->ring);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ((uint64_t)i << VTY_URING_OP_BITS) | VTY_URING_ACCEPT;
+            sqe->user_data = vty_uring_data(NULL, VTY_URING_CANCEL);
+        }
+    }
+    if (!on && m->accept_armed == 0)
+        vty_restart_ack();
+}
+
+/* The receive is cancelled first, like for vty_uring_pause(), and
+   sends have to complete. */
+static int vty_uring_detach(struct vty_master *m, struct vty *vty)
+{
+    if (vty->io_recv)
+        vty_uring_pause(vty);
+    return vty->io_refs != 0;
+}
+
+/* A request of a closed session completed. Returns 1 if it was. */
+static int vty_uring_closed(struct vty *vty)
+{
+    if (!vty->io_closed)
+        return 0;
+    if (vty->io_refs == 0)
+        vty_close(vty);
+    return 1;
+}
+
+static void vty_uring_accept(struct vty_master *m, struct io_uring_cqe *cqe, int i)
+{
+    if (cqe->res >= 0)
+    {
+        union sockunion su;
+        socklen_t len = sizeof (union sockunion);
+
+        memset (&su, 0, sizeof (union sockunion));
+        getpeername(cqe->res, &su.sa, &len);
+        vty_session_open(m, cqe->res, &su, &vty_listeners[i]);
+    }
+    else if (cqe->res != -ECONNABORTED && cqe->res != -EINTR && cqe->res != -EAGAIN &&
+             cqe->res != -ECANCELED)
+        zlog_err("Accept failed: %s", safe_strerror(-cqe->res));
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        m->accept_armed &= ~(1u << i);
+        if (m->restart == VTY_RESTART_NONE)
+            vty_uring_accept_arm(m, i);
+        else if (m->accept_armed == 0)
+            vty_restart_ack();
+    }
+}
+
+static void vty_uring_recv(struct vty_master *m, struct vty *vty, struct io_uring_cqe *cqe)
+{
+    int more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (cqe->res > 0 && !vty->io_closed)
+            vty_recv(vty, uring_buf(&m->bufs, bid), cqe->res);
+        uring_buf_put(&m->bufs, bid);
+    }
+    if (!more)
+    {
+        vty->io_refs--;
+        vty->io_recv = 0;
+    }
+    if (vty_uring_closed(vty))
+        return;
+
+    /* Out of buffers, or cancelled by vty_uring_pause(), only stops the
+       receive, end of file stops it for good; anything else ends the
+       session. */
+    if ((cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) ||
+        vty->status == vty::VTY_CLOSE)
+    {
+        vty_session_close(m, vty);
+        return;
+    }
+    if (cqe->res == 0)
+        vty_input_end(vty);
+    else if (vty_input_full(vty))
+        vty_uring_pause(vty);
+    else if (!vty->io_recv && !vty->input_paused)
+        vty_uring_recv_arm(vty);
+
+    /* More is on its way in the next completion: flush once after it,
+       like epoll does after reading to EAGAIN. */
+    if (more && (cqe->flags & IORING_CQE_F_SOCK_NONEMPTY))
+        return;
+    if (vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+/* A short send fails the rest of its chain with -ECANCELED; what is
+   left in wbuf is queued again once the whole chain is back. */
+static void vty_uring_sent(struct vty_master *m, struct vty *vty, struct io_uring_cqe *cqe)
+{
+    vty->io_refs--;
+    vty->io_sends--;
+    if (cqe->res > 0)
+    {
+        buffer_consume(vty->wbuf, cqe->res);
+        metrics_add(&m->metrics.bytes_out, cqe->res);
+    }
+    if (vty_uring_closed(vty))
+        return;
+
+    if (cqe->res < 0 && cqe->res != -ECANCELED)
+    {
+        vty_session_close(m, vty);
+        return;
+    }
+    if (vty->io_sends == 0 && vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+static void vty_uring_loop(struct vty_master *m)
+{
+    struct io_uring_cqe *cqe;
+
+    while (1)
+    {
+        /* Queued input is worked off between enters that do not wait. */
+        if (uring_submit(&m->ring, m->run_count == 0, timer_wheel_timeout(&m->wheel)) < 0)
+        {
+            zlog_err("io_uring_enter: %s", safe_strerror(errno));
+            return;
+        }
+        timer_wheel_advance(&m->wheel);
+
+        /* Handlers queue new requests, they go with the next enter. */
+        while ((cqe = uring_peek_cqe(&m->ring)) != NULL)
+        {
+            struct io_uring_cqe c = *cqe;
+            struct vty *vty = (struct vty *)(uintptr_t)(c.user_data & ~(uint64_t)VTY_URING_OP_MASK);
+
+            uring_cqe_seen(&m->ring);
+            switch (c.user_data & VTY_URING_OP_MASK)
+            {
+                case VTY_URING_ACCEPT:
+                    vty_uring_accept(m, &c, (int)(c.user_data >> VTY_URING_OP_BITS));
+                    break;
+                case VTY_URING_RECV:
+                    vty_uring_recv(m, vty, &c);
+                    break;
+                case VTY_URING_SEND:
+                    vty_uring_sent(m, vty, &c);
+                    break;
+                case VTY_URING_JOB:
+                    vty_job_events(m);
+                    vty_uring_job_arm(m);
+                    break;
+                default:
+                    break;
+            }
+        }
+        vty_run(m);
+    }
+}
+
+static const struct vty_io vty_uring_io =
+{
+    "io_uring",
+    vty_uring_start,
+    vty_uring_add,
+    vty_uring_flush,
+    vty_uring_resume,
+    vty_uring_release,
+    vty_uring_listen,
+    vty_uring_detach,
+    vty_uring_loop,
+};
+#endif /* VTY_IO_URING */
+
+/* Run the worker's event loop forever. */
+static void *vty_loop(void *arg)
+{
+    (*vty_io->loop) ((struct vty_master *)arg);
+    return NULL;
+}
+
+/* Pin a worker to one core, round robin over the online cpus. */
+static void vty_worker_pin(struct vty_master *m)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpuset;
+
+    if (ncpu <= 1)
+        return;
+    CPU_ZERO(&cpuset);
+    CPU_SET(m->id % ncpu, &cpuset);
+    pthread_setaffinity_np(m->tid, sizeof(cpuset), &cpuset);
+}
+
+/* Create every worker's listeners up front so that bind errors are
+   reported before any thread runs, then start workers 1..N-1. Worker 0
+   runs on the calling thread. */
+static int vty_workers_start(void)
+{
+    masters = (struct vty_master *)aligned_alloc(64, vty_worker_num * sizeof(struct vty_master));
+    if (masters == NULL)
+        return -1;
+    memset(masters, 0, vty_worker_num * sizeof(struct vty_master));
+
+    for (int i = 0; i < vty_worker_num; i++)
+    {
+        masters[i].id = i;
+        timer_wheel_init(&masters[i].wheel);
+        masters[i].t_admit.func = vty_admit_tick;
+        masters[i].t_drain.func = vty_drain_tick;
+        /* Blocking, io_uring reads it; epoll only reads it when told
+           it is readable. Hot restart kicks it too, so every worker
+           has one. */
+        if ((masters[i].job_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        {
+            zlog_err("eventfd: %s", safe_strerror(errno));
+            return -1;
+        }
+        if (metrics_register(&masters[i].metrics) < 0)
+            return -1;
+        for (int l = 0; l < vty_nlisteners; l++)
+            if (vty_serv_sock(&masters[i], l) < 0)
+                return -1;
+        if ((*vty_io->start) (&masters[i]) < 0)
+            return -1;
+    }
+
+    /* Daemon replies wake the workers through job_fd too. */
+    if (vty_daemon_dir)
+    {
+        int wakeup[vty_worker_num];
+
+        for (int i = 0; i < vty_worker_num; i++)
+            wakeup[i] = masters[i].job_fd;
+        if (ipc_start(vty_daemon_dir, vty_worker_num, wakeup) < 0)
+            return -1;
+    }
+
+    masters[0].tid = pthread_self();
+    vty_worker_pin(&masters[0]);
+    for (int i = 1; i < vty_worker_num; i++)
+    {
+        if (pthread_create(&masters[i].tid, NULL, vty_loop, &masters[i]) != 0)
+        {
+            zlog_err("create the thread failed");
+            return -1;
+        }
+        vty_worker_pin(&masters[i]);
+    }
+    return 0;
+}
+
+/* Hot restart, SIGUSR2: the server execs its binary again and hands
+   the new process its listening sockets and its configuration, then
+   its sessions one by one as their output is out; see handoff.h for
+   what goes over the socket between the two. Commands typed meanwhile
+   are held back and go along, see vty_input_held(). Connections that
+   come meanwhile wait in the listen queues, so none is refused and no
+   session drops. The old process exits once it has nothing left. */
+
+/* Seconds the workers get to stop accepting and the new process to
+   start, and the sessions to go idle, their output out and the pager
+   done with, before they are closed. */
+#define VTY_RESTART_WAIT  10
+#define VTY_DRAIN_TIMEOUT 60
+
+/* What to exec, saved at startup: by restart time the file has
+   usually been replaced, which is the point. */
+static char vty_exe[PATH_MAX];
+static char **vty_argv;
+
+/* Old process: workers done with the current state, and the socket to
+   the new one. */
+static int vty_restart_acks;
+static int vty_restart_sock = -1;
+
+/* New process: the socket to the old one while it hands over, the old
+   one's pid, and our listeners by the index the old one had them at. */
+static int vty_handoff_sock = -1;
+static pid_t vty_handoff_pid;
+static struct vty_listener *vty_handoff_map[VTY_LISTEN_MAX];
+
+/* A session of the old process for a worker, see vty_handoff_events(). */
+struct vty_adopt
+{
+    struct vty_adopt *next;
+    int fd;
+    size_t len;
+    char rec[];
+};
+
+static void vty_restart_ack(void)
+{
+    __atomic_add_fetch(&vty_restart_acks, 1, __ATOMIC_RELEASE);
+}
+
+/* Move every worker on to state. Each acks once it stopped accepting
+   and running commands, and again once it has no session left. */
+static void vty_restart_set(int state)
+{
+    uint64_t one = 1;
+
+    if (state != VTY_RESTART_FORCE)
+        __atomic_store_n(&vty_restart_acks, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&vty_restart_state, state, __ATOMIC_RELEASE);
+    for (int i = 0; i < vty_worker_num; i++)
+        if (write(masters[i].job_fd, &one, sizeof(one)) < 0)
+            zlog_err("restart wakeup: %s", safe_strerror(errno));
+}
+
+/* Input stopped for a handover that did not happen goes on, and so
+   do the commands held back. Returns -1 if the session is to close. */
+static int vty_restart_resume(struct vty *vty)
+{
+    if (!vty->waiting && !buffer_empty(vty->ibuf))
+        vty_run_add(vty);
+    if (!vty->input_paused || buffer_length(vty->ibuf) >= VTY_INPUT_BACKLOG / 2)
+        return 0;
+    vty->input_paused = 0;
+    return (*vty_io->resume) (vty);
+}
+
+/* Kicked: catch up with the restart. */
+static void vty_restart_events(struct vty_master *m)
+{
+    int state = __atomic_load_n(&vty_restart_state, __ATOMIC_ACQUIRE);
+
+    if (state == m->restart || (m->restart == VTY_RESTART_DONE && state != VTY_RESTART_NONE))
+        return;
+
+    if (state == VTY_RESTART_NONE)
+    {
+        /* It failed: back to work, first to what queued meanwhile. */
+        m->restart = state;
+        timer_del(&m->wheel, &m->t_drain);
+        for (int fd = 0; fd < m->vtyvec_size; fd++)
+        {
+            struct vty *vty = m->vtyvec[fd];
+
+            if (vty && vty_restart_resume(vty) < 0)
+                vty_session_close(m, vty);
+        }
+        (*vty_io->listen) (m, 1);
+        vty_wait_admit(m);
+        return;
+    }
+
+    if (m->restart == VTY_RESTART_NONE)
+    {
+        m->restart = state;
+        (*vty_io->listen) (m, 0);
+    }
+    m->restart = state;
+    if (state != VTY_RESTART_STOP && !timer_pending(&m->t_drain))
+        timer_add(&m->wheel, &m->t_drain, 1);
+}
+
+/* Nothing of the session is in flight: no command, output or telnet
+   command half way, and it fits in a record. A prompt owed with input
+   held back is the new process's to write, after that input. */
+static int vty_handoff_idle(struct vty *vty)
+{
+    return vty->status == vty::VTY_NORMAL && vty->job == NULL && vty->output_func == NULL &&
+           (!vty->prompt_wait || !buffer_empty(vty->ibuf)) && !vty->z_on && !vty->input_eof &&
+           buffer_empty(vty->pbuf) && buffer_empty(vty->obuf) && buffer_empty(vty->wbuf) &&
+           vty->telnet.state <= TELNET_CR &&
+           sizeof(struct handoff_session) + vty->length + VTY_MAXHIST +
+           buffer_length(vty->ibuf) <= HANDOFF_MSG_MAX;
+}
+
+/* Hand vty over to the new process if it is idle, with the input it
+   has not run. Returns 0 once it is gone from here, 1 if it has to
+   wait, -1 if the new process is. */
+static int vty_handoff_session(struct vty_master *m, struct vty *vty)
+{
+    static __thread char rec[HANDOFF_MSG_MAX] __attribute__ ((aligned (8)));
+    struct handoff_session *hs = (struct handoff_session *)rec;
+    char *p = rec + sizeof(*hs);
+    uint32_t now = m->wheel.now;
+    struct buffer_data *d;
+
+    /* The client is told the compressed stream ends, the new process
+       does not know it. */
+    if (vty->z_on && buffer_empty(vty->obuf))
+        vty_flush(vty);
+    if (!vty_handoff_idle(vty))
+    {
+        if (vty_restart_resume(vty) < 0)
+            vty_session_close(m, vty);
+        return 1;
+    }
+    /* Nothing may come in after the record is made. */
+    if ((*vty_io->detach) (m, vty))
+        return 1;
+
+    memset(hs, 0, sizeof(*hs));
+    for (int i = 0; i < vty_nlisteners; i++)
+        if (vty->listener == &vty_listeners[i])
+            hs->listener = i;
+    hs->session_id = vty->session_id;
+    hs->waiting = vty->waiting;
+    hs->node = vty->node;
+    hs->escape = vty->escape;
+    hs->escape_param = vty->escape_param;
+    hs->fail = vty->fail;
+    hs->lines = vty->lines;
+    hs->timeout = vty->v_timeout;
+    hs->start_ms = (now - vty->v_start) * TIMER_TICK_MS;
+    hs->input_ms = (now - vty->v_input) * TIMER_TICK_MS;
+    hs->telnet_state = vty->telnet.state;
+    hs->width = vty->telnet.width;
+    hs->height = vty->telnet.height;
+#define VTY_HANDOFF_OPTS(o) \
+    do { hs->o[0] = (uint64_t)vty->telnet.o; hs->o[1] = (uint64_t)(vty->telnet.o >> 64); } while (0)
+    VTY_HANDOFF_OPTS(local);
+    VTY_HANDOFF_OPTS(remote);
+    VTY_HANDOFF_OPTS(local_pending);
+    VTY_HANDOFF_OPTS(remote_pending);
+    VTY_HANDOFF_OPTS(local_supported);
+#undef VTY_HANDOFF_OPTS
+    memcpy(hs->ttype, vty->telnet.ttype, sizeof(hs->ttype));
+    memcpy(hs->address, vty->address, sizeof(hs->address));
+    if (vty->node == INTERFACE_NODE && vty->index)
+        snprintf(hs->context, sizeof(hs->context), "interface %s",
+                 ((struct interface *)vty->index)->name);
+
+    /* The edit line, then the history as far as it fits; what does not
+       goes as empty slots. */
+    hs->length = vty->length;
+    hs->cp = vty->cp;
+    memcpy(p, vty->buf, vty->length);
+    p += vty->length;
+    hs->hist = VTY_MAXHIST;
+    hs->hindex = vty->hindex;
+    hs->hp = vty->hp;
+    for (int i = 0; i < VTY_MAXHIST; i++)
+    {
+        size_t n = strlen(vty_hist(vty, i));
+
+        if ((size_t)(p - rec) + n + 1 + (VTY_MAXHIST - i - 1) + buffer_length(vty->ibuf) > HANDOFF_MSG_MAX)
+            n = 0;
+        memcpy(p, vty_hist(vty, i), n);
+        p[n] = '\0';
+        p += n + 1;
+    }
+    for (d = vty->ibuf->head; d; d = d->next)
+    {
+        memcpy(p, d->data + d->sp, d->cp - d->sp);
+        p += d->cp - d->sp;
+        hs->input += d->cp - d->sp;
+    }
+
+    if (handoff_send(vty_restart_sock, HANDOFF_SESSION, rec, p - rec, &vty->fd, 1) < 0)
+    {
+        zlog_err("Handover of session %u: %s", vty->session_id, safe_strerror(errno));
+        vty->input_paused = 0;
+        if ((*vty_io->add) (m, vty) < 0)
+            vty_session_close(m, vty);
+        return -1;
+    }
+
+    vtyvec_set(m, vty->fd, NULL);
+    vty_run_del(vty);
+    timer_del(&m->wheel, &vty->t_timeout);
+    if (!vty->waiting)
+        vty_session_count(m, -1);
+    vty_admit_leave(vty);
+    zlog_info("Vty connection from %s handed over, fd %d, session %u",
+              vty->address, vty->fd, vty->session_id);
+    vty_close(vty);
+    return 0;
+}
+
+/* Every tick while draining: hand over whatever went idle, or once the
+   time is up close it all. The worker is done when nothing is left. */
+static void vty_drain_tick(struct timer *t)
+{
+    struct vty_master *m = timer_entry(t, struct vty_master, t_drain);
+
+    if (m->restart != VTY_RESTART_DRAIN && m->restart != VTY_RESTART_FORCE)
+        return;
+    for (int fd = 0; fd < m->vtyvec_size; fd++)
+    {
+        struct vty *vty = m->vtyvec[fd];
+
+        if (vty == NULL)
+            continue;
+        if (m->restart == VTY_RESTART_FORCE)
+        {
+            vty_out(vty, "%s%% Server restarted, please reconnect.%s", VTY_NEWLINE, VTY_NEWLINE);
+            vty_session_close(m, vty);
+        }
+        else if (vty_handoff_session(m, vty) < 0)
+            break;
+    }
+    if (m->metrics.sessions == 0 && m->metrics.waiting == 0)
+    {
+        m->restart = VTY_RESTART_DONE;
+        vty_restart_ack();
+        return;
+    }
+    timer_add(&m->wheel, t, 1);
+}
+
+/* Events of the journal go to the new process once it writes it. */
+static int vty_restart_audit(int type, uint32_t session, const char *text, int ret,
+                             uint32_t latency_us, int node)
+{
+    char rec[sizeof(struct handoff_audit) + AUDIT_TEXT_MAX] __attribute__ ((aligned (8)));
+    struct handoff_audit *ha = (struct handoff_audit *)rec;
+    size_t len = text ? strnlen(text, AUDIT_TEXT_MAX) : 0;
+
+    ha->type = type;
+    ha->session = session;
+    ha->ret = ret;
+    ha->latency_us = latency_us;
+    ha->node = node;
+    memcpy(ha + 1, text, len);
+    return handoff_send(vty_restart_sock, HANDOFF_AUDIT, rec, sizeof(*ha) + len, NULL, 0);
+}
+
+/* The workers have all acked, or timeout milliseconds passed. */
+static int vty_restart_wait(int timeout)
+{
+    for (; timeout > 0; timeout -= 10)
+    {
+        if (__atomic_load_n(&vty_restart_acks, __ATOMIC_ACQUIRE) >= vty_worker_num)
+            return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+/* Fork and exec ourselves with fd, the new process's end of the
+   socket, named in HANDOFF_ENV. The signal mask goes along, so the new
+   process does not die of an early SIGUSR2 either. */
+static pid_t vty_restart_exec(int fd)
+{
+    char var[sizeof(HANDOFF_ENV) + 16];
+    char **envp;
+    int n = 0;
+    pid_t pid;
+
+    while (environ[n])
+        n++;
+    if ((envp = (char **)malloc((n + 2) * sizeof(char *))) == NULL)
+        return -1;
+    memcpy(envp, environ, n * sizeof(char *));
+    snprintf(var, sizeof(var), "%s=%d", HANDOFF_ENV, fd);
+    envp[n] = var;
+    envp[n + 1] = NULL;
+
+    /* Other threads may hold locks: nothing but system calls in the
+       child. */
+    pid = fork();
+    if (pid == 0)
+    {
+        fcntl(fd, F_SETFD, 0);
+        execve(vty_exe, vty_argv, envp);
+        _exit(127);
+    }
+    free(envp);
+    return pid;
+}
+
+/* The configuration as "show running-config" has it, then every
+   listener with its sockets. The workers hold commands back by now,
+   so nothing changes it after this. */
+static int vty_restart_send(int sock)
+{
+    struct handoff_hello hello;
+    struct buffer_data *d;
+    struct vty *vty;
+    int ret = 0;
+
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = HANDOFF_MAGIC;
+    hello.version = HANDOFF_VERSION;
+    hello.pid = getpid();
+    hello.workers = vty_worker_num;
+    hello.session_seq = __atomic_load_n(&vty_session_seq, __ATOMIC_RELAXED);
+    if (handoff_send(sock, HANDOFF_HELLO, &hello, sizeof(hello), NULL, 0) < 0)
+        return -1;
+
+    if ((vty = vty_new(-1)) == NULL)
+        return -1;
+    vty->type = vty::VTY_FILE;
+    cmd_config_write(vty);
+    for (d = vty->obuf->head; d && ret == 0; d = d->next)
+        ret = handoff_send(sock, HANDOFF_CONFIG, d->data + d->sp, d->cp - d->sp, NULL, 0);
+    vty_close(vty);
+
+    for (int i = 0; i < vty_nlisteners && ret == 0; i++)
+    {
+        struct vty_listener *l = &vty_listeners[i];
+        int fds[HANDOFF_FDS_MAX], nfds = 0;
+
+        if (l->su.sa.sa_family == AF_UNIX)
+            fds[nfds++] = l->fd;
+        else
+            for (int w = 0; w < vty_worker_num && nfds < HANDOFF_FDS_MAX; w++)
+                fds[nfds++] = masters[w].listen_fd[i];
+        ret = handoff_send(sock, HANDOFF_LISTENER, l->spec, strlen(l->spec) + 1, fds, nfds);
+    }
+    if (ret == 0)
+        ret = handoff_send(sock, HANDOFF_END, NULL, 0, NULL, 0);
+    return ret;
+}
+
+/* Wait for the workers to hand everything over, closing what is left
+   after VTY_DRAIN_TIMEOUT. Returns -1 if the new process went away. */
+static int vty_restart_drain(int sock)
+{
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    int ticks = 0;
+
+    while (__atomic_load_n(&vty_restart_acks, __ATOMIC_ACQUIRE) < vty_worker_num)
+    {
+        /* It sends nothing more: anything to read is its end. */
+        if (poll(&pfd, 1, 100) > 0)
+            return -1;
+        if (++ticks == VTY_DRAIN_TIMEOUT * 10)
+        {
+            zlog_warn("%d sessions did not go idle in %d seconds, closing them",
+                      vty_session_total(), VTY_DRAIN_TIMEOUT);
+            vty_restart_set(VTY_RESTART_FORCE);
+        }
+        else if (ticks == (VTY_DRAIN_TIMEOUT + VTY_RESTART_WAIT) * 10)
+        {
+            zlog_err("Workers still not done, exiting anyway");
+            break;
+        }
+    }
+    return 0;
+}
+
+/* SIGUSR2. Returns only if the restart failed, with everything as it
+   was before. */
+static void vty_restart(void)
+{
+    static char buf[HANDOFF_MSG_MAX];
+    int sv[2], fds[HANDOFF_FDS_MAX], nfds = 0, type;
+    pid_t pid;
+
+    if (vty_handoff_sock >= 0)
+    {
+        zlog_warn("Still taking over from pid %d, not restarting", (int)vty_handoff_pid);
+        return;
+    }
+    zlog_notice("Restarting %s...", vty_exe);
+
+    /* From here no session starts: the session numbers the new process
+       goes on from are final. */
+    vty_restart_set(VTY_RESTART_STOP);
+    if (vty_restart_wait(VTY_RESTART_WAIT * 1000) < 0)
+    {
+        zlog_err("Restart: workers did not stop accepting");
+        goto resume;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        zlog_err("Restart: socketpair: %s", safe_strerror(errno));
+        goto resume;
+    }
+    pid = vty_restart_exec(sv[1]);
+    close(sv[1]);
+    if (pid < 0)
+    {
+        zlog_err("Restart: fork: %s", safe_strerror(errno));
+        close(sv[0]);
+        goto resume;
+    }
+    if (vty_restart_send(sv[0]) < 0 ||
+        handoff_recv(sv[0], &type, buf, fds, &nfds, VTY_RESTART_WAIT * 1000) < 0 ||
+        type != HANDOFF_READY)
+    {
+        zlog_err("Restart: pid %d did not take over: %s", (int)pid,
+                 errno ? safe_strerror(errno) : "it exited");
+        kill(pid, SIGKILL);
+        close(sv[0]);
+        goto resume;
+    }
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+
+    /* The new process accepts now, and has the journal. */
+    vty_restart_sock = sv[0];
+    audit_forward(vty_restart_audit);
+    if (handoff_send(sv[0], HANDOFF_JOURNAL, NULL, 0, NULL, 0) == 0)
+    {
+        zlog_notice("Pid %d took over the listeners, handing %d sessions over",
+                    (int)pid, vty_session_total());
+        vty_restart_set(VTY_RESTART_DRAIN);
+        if (vty_restart_drain(sv[0]) == 0)
+        {
+            handoff_send(sv[0], HANDOFF_DONE, NULL, 0, NULL, 0);
+            zlog_notice("Handed over to pid %d, exiting", (int)pid);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    /* It went away. The socket stays open, a worker may be sending on
+       it right now; the sends just fail. */
+    zlog_err("Restart: pid %d went away, going on here", (int)pid);
+    audit_forward(NULL);
+    shutdown(sv[0], SHUT_RDWR);
+
+resume:
+    vty_restart_set(VTY_RESTART_NONE);
+}
+
+static void *vty_restart_thread(void *arg)
+{
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    while (1)
+        if (sigwait(&set, &sig) == 0)
+            vty_restart();
+    return NULL;
+}
+
+/* Every thread has SIGUSR2 blocked from main() on; this one takes it. */
+static int vty_restart_init(void)
+{
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, vty_restart_thread, NULL) != 0)
+    {
+        zlog_err("Can't start the restart thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/* New process. One of the old process's listeners: ours if we have it
+   too, by its -p spec. A TCP one has a socket per old worker; those
+   beyond our own workers are closed, with what waits on them. */
+static struct vty_listener *vty_handoff_listener(const char *spec, int *fds, int nfds)
+{
+    for (int i = 0; i < vty_nlisteners; i++)
+    {
+        struct vty_listener *l = &vty_listeners[i];
+        int keep;
+
+        if (strcmp(l->spec, spec) != 0 || nfds == 0)
+            continue;
+        keep = (l->su.sa.sa_family == AF_UNIX) ? 1 : (nfds < vty_worker_num) ? nfds : vty_worker_num;
+        if (nfds > keep)
+            zlog_warn("%s: %d sockets of the old workers closed, connections waiting there are lost",
+                      spec, nfds - keep);
+        if ((l->adopt = (int *)malloc(keep * sizeof(int))) == NULL)
+            keep = 0;
+        else
+            memcpy(l->adopt, fds, keep * sizeof(int));
+        l->nadopt = keep;
+        for (int k = keep; k < nfds; k++)
+            close(fds[k]);
+        return l;
+    }
+    zlog_warn("Listener %s is gone, its connections are closed", spec);
+    for (int k = 0; k < nfds; k++)
+        close(fds[k]);
+    return NULL;
+}
+
+/* The old process's configuration, the way -f loads a file. */
+static void vty_handoff_config(char *text, size_t len)
+{
+    struct vty *vty;
+    char *p = text, *end = text + len;
+    int errors = 0;
+
+    if ((vty = vty_new(-1)) == NULL)
+        return;
+    vty->type = vty::VTY_FILE;
+    vty->node = CONFIG_NODE;
+    vty->lines = 0;
+    while (p < end)
+    {
+        char *eol = (char *)memchr(p, '\n', end - p), *line = p;
+
+        if (eol == NULL)
+            eol = end;
+        p = eol + 1;
+        while (line < eol && isspace((unsigned char)*line))
+            line++;
+        while (eol > line && isspace((unsigned char)eol[-1]))
+            eol--;
+        if (line == eol || *line == '!' || *line == '#')
+            continue;
+        *eol = '\0';
+        if (cmd_execute_command(vty, line, NULL) != CMD_SUCCESS)
+        {
+            zlog_warn("Configuration of the old process: \"%s\" failed", line);
+            errors++;
+        }
+        buffer_reset(vty->obuf);
+    }
+    vty_close(vty);
+    if (errors)
+        zlog_warn("%d lines of the old configuration failed", errors);
+}
+
+/* New process, before the workers start: the old process's
+   configuration and listeners. */
+static int vty_handoff_begin(void)
+{
+    static char buf[HANDOFF_MSG_MAX];
+    struct handoff_hello hello;
+    char *config = NULL;
+    size_t config_len = 0;
+    int fds[HANDOFF_FDS_MAX], nfds, type, n = 0;
+    ssize_t len;
+
+    memset(&hello, 0, sizeof(hello));
+    while ((len = handoff_recv(vty_handoff_sock, &type, buf, fds, &nfds, VTY_RESTART_WAIT * 1000)) >= 0 &&
+           type != HANDOFF_END)
+    {
+        if (type == HANDOFF_HELLO && len == sizeof(hello))
+            memcpy(&hello, buf, len);
+        else if (type == HANDOFF_CONFIG && len > 0)
+        {
+            char *more = (char *)realloc(config, config_len + len);
+
+            if (more == NULL)
+                break;
+            config = more;
+            memcpy(config + config_len, buf, len);
+            config_len += len;
+        }
+        else if (type == HANDOFF_LISTENER && len > 0 && n < VTY_LISTEN_MAX)
+        {
+            buf[len - 1] = '\0';
+            vty_handoff_map[n++] = vty_handoff_listener(buf, fds, nfds);
+            nfds = 0;
+        }
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+    }
+    if (len < 0 || type != HANDOFF_END || hello.magic != HANDOFF_MAGIC || hello.version != HANDOFF_VERSION)
+    {
+        zlog_err("Hot restart: no handover from the old process: %s",
+                 (len >= 0) ? "not a server we understand" : errno ? safe_strerror(errno) : "it went away");
+        free(config);
+        return -1;
+    }
+
+    vty_handoff_pid = hello.pid;
+    vty_session_seq = hello.session_seq;
+    if (hello.workers != (uint32_t)vty_worker_num)
+        zlog_notice("Taking over %u workers' sessions with %d", hello.workers, vty_worker_num);
+    vty_handoff_config(config, config_len);
+    free(config);
+    zlog_notice("Taking over from pid %d", (int)hello.pid);
+    return 0;
+}
+
+/* Queue a session for worker m. */
+static void vty_handoff_push(struct vty_master *m, int fd, const char *rec, size_t len)
+{
+    struct vty_adopt *a = (struct vty_adopt *)malloc(sizeof(*a) + len);
+    uint64_t one = 1;
+
+    if (a == NULL)
+    {
+        close(fd);
+        return;
+    }
+    a->fd = fd;
+    a->len = len;
+    memcpy(a->rec, rec, len);
+    a->next = __atomic_load_n(&m->adopts, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&m->adopts, &a->next, a, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    if (write(m->job_fd, &one, sizeof(one)) < 0)
+        zlog_err("handoff wakeup: %s", safe_strerror(errno));
+}
+
+/* New process, once its workers run: the old one may hand over now.
+   Sessions go to the workers round robin, journal events to ours. */
+static void *vty_handoff_thread(void *arg)
+{
+    static char buf[HANDOFF_MSG_MAX] __attribute__ ((aligned (8)));
+    int fds[HANDOFF_FDS_MAX], nfds = 0, type, next = 0, sessions = 0;
+    ssize_t len = -1;
+
+    if (handoff_send(vty_handoff_sock, HANDOFF_READY, NULL, 0, NULL, 0) == 0)
+        while ((len = handoff_recv(vty_handoff_sock, &type, buf, fds, &nfds, -1)) >= 0 &&
+               type != HANDOFF_DONE)
+        {
+            if (type == HANDOFF_SESSION && nfds == 1 && (size_t)len >= sizeof(struct handoff_session))
+            {
+                vty_handoff_push(&masters[next], fds[0], buf, len);
+                next = (next + 1) % vty_worker_num;
+                sessions++;
+                nfds = 0;
+            }
+            else if (type == HANDOFF_JOURNAL)
+                audit_release();
+            else if (type == HANDOFF_AUDIT && (size_t)len >= sizeof(struct handoff_audit))
+            {
+                struct handoff_audit *ha = (struct handoff_audit *)buf;
+                char text[AUDIT_TEXT_MAX + 1];
+                size_t n = len - sizeof(*ha);
+
+                if (n > AUDIT_TEXT_MAX)
+                    n = AUDIT_TEXT_MAX;
+                memcpy(text, ha + 1, n);
+                text[n] = '\0';
+                audit_event(ha->type, ha->session, n ? text : NULL, ha->ret, ha->latency_us, ha->node);
+            }
+            for (int i = 0; i < nfds; i++)
+                close(fds[i]);
+        }
+
+    /* Whatever happened, the journal is ours now. */
+    audit_release();
+    if (len < 0)
+        zlog_err("Hot restart: pid %d went away after %d sessions", (int)vty_handoff_pid, sessions);
+    else
+        zlog_notice("Hot restart: took over %d sessions from pid %d", sessions, (int)vty_handoff_pid);
+    close(vty_handoff_sock);
+    __atomic_store_n(&vty_handoff_sock, -1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int vty_handoff_start(void)
+{
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, vty_handoff_thread, NULL) != 0)
+    {
+        zlog_err("Can't start the handoff thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/* A session of the old process goes on here where it left off: same
+   node, edit line, history, terminal and timers. One that was waiting
+   for a session goes through admission again. */
+static void vty_handoff_adopt(struct vty_master *m, struct vty_adopt *a)
+{
+    const struct handoff_session *hs = (const struct handoff_session *)a->rec;
+    const char *p = a->rec + sizeof(*hs), *end = a->rec + a->len;
+    struct vty_listener *l = (hs->listener < VTY_LISTEN_MAX) ? vty_handoff_map[hs->listener] : NULL;
+    uint32_t now = m->wheel.now;
+    struct vty *vty;
+    char context[sizeof(hs->context) + 1];
+    int n;
+
+    if (l == NULL || hs->length > (size_t)(end - p) || (vty = vty_new(a->fd)) == NULL)
+    {
+        zlog_warn("Session %u from %.*s could not be taken over", hs->session_id,
+                  (int)sizeof(hs->address), hs->address);
+        close(a->fd);
+        return;
+    }
+    vty->master = m;
+    vty->listener = l;
+    vty->type = l->shell ? vty::VTY_SHELL_SERV : vty::VTY_TERM;
+    vty->node_max = l->node_max;
+    snprintf(vty->address, sizeof(vty->address), "%.*s", (int)sizeof(hs->address), hs->address);
+    vty->lines = hs->lines;
+    vty->fail = hs->fail;
+    vty->escape = hs->escape;
+    vty->escape_param = hs->escape_param;
+    vty->telnet.state = (hs->telnet_state <= TELNET_CR) ? hs->telnet_state : TELNET_DATA;
+    vty->telnet.width = hs->width;
+    vty->telnet.height = hs->height;
+#define VTY_HANDOFF_OPTS(o) \
+    vty->telnet.o = (telnet_opts)hs->o[0] | ((telnet_opts)hs->o[1] << 64)
+    VTY_HANDOFF_OPTS(local);
+    VTY_HANDOFF_OPTS(remote);
+    VTY_HANDOFF_OPTS(local_pending);
+    VTY_HANDOFF_OPTS(remote_pending);
+    VTY_HANDOFF_OPTS(local_supported);
+#undef VTY_HANDOFF_OPTS
+    snprintf(vty->telnet.ttype, sizeof(vty->telnet.ttype), "%.*s", (int)sizeof(hs->ttype), hs->ttype);
+
+    /* The edit line, the history, then the input not run yet. */
+    n = (hs->length < (uint32_t)vty->max) ? hs->length : vty->max - 1;
+    memcpy(vty->buf, p, n);
+    vty->length = n;
+    vty->cp = (hs->cp < (uint32_t)n) ? hs->cp : n;
+    p += hs->length;
+    for (uint32_t i = 0; i < hs->hist && p < end; i++)
+    {
+        size_t len = strnlen(p, end - p);
+
+        if (i < VTY_MAXHIST)
+            snprintf(vty_hist(vty, i), vty->max, "%.*s", (int)len, p);
+        p += len + 1;
+    }
+    vty->hindex = hs->hindex % VTY_MAXHIST;
+    vty->hp = hs->hp % VTY_MAXHIST;
+    if (p < end)
+        buffer_put(vty->ibuf, p, ((size_t)(end - p) < hs->input) ? (size_t)(end - p) : hs->input);
+
+    if (hs->waiting)
+    {
+        vty->node = (l->node_max < ENABLE_NODE) ? VIEW_NODE : ENABLE_NODE;
+        vty_session_admit(m, vty);
+        return;
+    }
+
+    vty->session_id = hs->session_id;
+    vty->node = (hs->node <= l->node_max) ? hs->node : l->node_max;
+    if (hs->context[0] && vty->node > CONFIG_NODE)
+    {
+        /* vty->index was the old process's: enter it again. */
+        snprintf(context, sizeof(context), "%.*s", (int)sizeof(hs->context), hs->context);
+        vty->node = CONFIG_NODE;
+        if (cmd_execute_command(vty, context, NULL) != CMD_SUCCESS)
+            zlog_warn("Session %u: \"%s\" failed, it is back in config mode", vty->session_id, context);
+        buffer_reset(vty->obuf);
+    }
+    if (vtyvec_set(m, vty->fd, vty) < 0 || (*vty_io->add) (m, vty) < 0)
+    {
+        vtyvec_set(m, vty->fd, NULL);
+        vty_close(vty);
+        return;
+    }
+
+    /* It had its slot in the old process; it keeps it, whatever the
+       limits here. */
+    pthread_mutex_lock(&vty_admit_lock);
+    if (l->max)
+        l->sessions++;
+    else
+        vty_admitted++;
+    vty_peer_count(vty, 1);
+    pthread_mutex_unlock(&vty_admit_lock);
+    vty_session_count(m, 1);
+
+    vty->v_timeout = hs->timeout;
+    vty->v_start = now - hs->start_ms / TIMER_TICK_MS;
+    vty->v_input = now - hs->input_ms / TIMER_TICK_MS;
+    vty->v_keepalive = now;
+    vty->t_timeout.func = vty_timeout;
+    vty_timeout_arm(vty);
+
+    audit_session_open(vty->session_id, vty->address);
+    zlog_info("Vty connection from %s taken over, fd %d, worker %d, session %u",
+              vty->address, vty->fd, m->id, vty->session_id);
+    if (!buffer_empty(vty->ibuf))
+        vty_run_add(vty);
+    if (vty_session_flush(vty) < 0)
+        vty_session_close(m, vty);
+}
+
+/* Kicked: sessions vty_handoff_thread() queued for this worker, in the
+   order they came. */
+static void vty_handoff_events(struct vty_master *m)
+{
+    struct vty_adopt *a = __atomic_exchange_n(&m->adopts, NULL, __ATOMIC_ACQUIRE), *order = NULL;
+
+    while (a)
+    {
+        struct vty_adopt *next = a->next;
+
+        a->next = order;
+        order = a;
+        a = next;
+    }
+    while ((a = order) != NULL)
+    {
+        order = a->next;
+        vty_handoff_adopt(m, a);
+        free(a);
+    }
+}
+
+/* Batch mode, -f: commands from a file or stdin run through a
+   VTY_FILE vty with the same parser and commands as a session, before
+   any worker starts. It reads like a configuration file: it starts in
+   CONFIG_NODE and cmd_execute_command() goes up the nodes as needed,
+   so saved "show running-config" output loads back as it is. A
+   regular file is mapped, anything else read VTY_BATCH_READ at a
+   time; output collects in obuf and goes to stdout VTY_BATCH_WRITE at
+   a time. */
+#define VTY_BATCH_READ (1024 * 1024)
+#define VTY_BATCH_WRITE (BUFFER_MAX_CHUNKS * BUFFER_SIZE_DEFAULT)
+
+static const char *vty_batch_file;
+static int vty_batch_serve;
+
+struct vty_batch
+{
+    struct vty *vty;
+    const char *name;
+    unsigned long lineno;
+    unsigned long errors;
+
+    /* Output failed, e.g. stdout is a closed pipe: the rest of the file
+       is still applied, its output dropped. */
+    int quiet;
+
+    /* The current line, NUL terminated. */
+    char *line;
+    size_t size;
+};
+
+/* Write the output out once there is a writev's worth of it, or all of
+   it with force. stdout may be non-blocking, shared with a parent. */
+static void vty_batch_write(struct vty_batch *b, int force)
+{
+    struct vty *vty = b->vty;
+    buffer_status_t ret;
+
+    if (b->quiet || buffer_empty(vty->obuf) ||
+        (!force && buffer_length(vty->obuf) < VTY_BATCH_WRITE))
+    {
+        if (b->quiet)
+            buffer_reset(vty->obuf);
+        return;
+    }
+    while ((ret = vty_flush(vty)) == BUFFER_PENDING)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = vty->wfd;
+        pfd.events = POLLOUT;
+        poll(&pfd, 1, -1);
+    }
+    if (ret == BUFFER_ERROR)
+    {
+        zlog_warn("Batch output: %s", safe_strerror(errno));
+        buffer_reset(vty->obuf);
+        b->quiet = 1;
+    }
+}
+
+static void vty_batch_line(struct vty_batch *b, const char *p, size_t len)
+{
+    struct vty *vty = b->vty;
+    int ret;
+
+    b->lineno++;
+    while (len && isspace((unsigned char)p[len - 1]))
+        len--;
+    while (len && isspace((unsigned char)*p))
+        p++, len--;
+    if (len == 0 || *p == '!' || *p == '#')
+        return;
+
+    if (len >= b->size)
+    {
+        char *line = (char *)realloc(b->line, len + 1);
+
+        if (line == NULL)
+        {
+            zlog_err("%s line %lu: out of memory", b->name, b->lineno);
+            b->errors++;
+            return;
+        }
+        b->line = line;
+        b->size = len + 1;
+    }
+    memcpy(b->line, p, len);
+    b->line[len] = '\0';
+
+    ret = vty_execute(vty, (const unsigned char *)b->line);
+    while (vty->output_func)
+    {
+        if (!(*vty->output_func) (vty, vty->output_arg))
+            vty_output_end(vty);
+        vty_batch_write(b, 0);
+    }
+    if (ret != CMD_SUCCESS)
+    {
+        vty_out (vty, "%% %s line %lu: %s%s", b->name, b->lineno, b->line, VTY_NEWLINE);
+        b->errors++;
+    }
+    vty_batch_write(b, 0);
+}
+
+/* Run the complete lines of data. Returns the bytes used, up to and
+   including the last newline. */
+static size_t vty_batch_feed(struct vty_batch *b, const char *data, size_t len)
+{
+    const char *p = data, *end = data + len, *nl;
+
+    while (b->vty->status != vty::VTY_CLOSE && (nl = (const char *)memchr(p, '\n', end - p)) != NULL)
+    {
+        vty_batch_line(b, p, nl - p);
+        p = nl + 1;
+    }
+    return p - data;
+}
+
+static int vty_batch_map(struct vty_batch *b, int fd, size_t size)
+{
+    const char *data;
+    size_t used;
+
+    data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    used = vty_batch_feed(b, data, size);
+    if (used < size && b->vty->status != vty::VTY_CLOSE)
+        vty_batch_line(b, data + used, size - used);
+    munmap((void *)data, size);
+    return 0;
+}
+
+/* A pipe, a terminal or anything else that cannot be mapped. The
+   output so far goes out before each read, so a script fed a line at
+   a time by another program gets its answers as it goes. */
+static int vty_batch_read(struct vty_batch *b, int fd)
+{
+    size_t size = VTY_BATCH_READ, len = 0, used;
+    char *data = (char *)malloc(size);
+    ssize_t n;
+
+    if (data == NULL)
+        return -1;
+    while (b->vty->status != vty::VTY_CLOSE)
+    {
+        vty_batch_write(b, 1);
+        n = read(fd, data + len, size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            zlog_err("%s: %s", b->name, safe_strerror(errno));
+            free(data);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += n;
+        used = vty_batch_feed(b, data, len);
+        memmove(data, data + used, len - used);
+        len -= used;
+
+        /* A line longer than the buffer. */
+        if (len == size)
+        {
+            char *bigger = (char *)realloc(data, size * 2);
+
+            if (bigger == NULL)
+            {
+                free(data);
+                return -1;
+            }
+            data = bigger;
+            size *= 2;
+        }
+    }
+    if (len && b->vty->status != vty::VTY_CLOSE)
+        vty_batch_line(b, data, len);
+    free(data);
+    return 0;
+}
+
+/* Run file, "-" for stdin. Returns the number of lines that failed, or
+   -1 if the file could not be read. */
+static long vty_batch(const char *file)
+{
+    struct vty_batch b;
+    struct stat st;
+    uint64_t start = vty_clock_us();
+    int fd, ret;
+
+    fd = (strcmp(file, "-") == 0) ? dup(STDIN_FILENO) : open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        zlog_err("Can't open %s: %s", file, safe_strerror(errno));
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.name = (strcmp(file, "-") == 0) ? "stdin" : file;
+    if ((b.vty = vty_new(fd)) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    b.vty->type = vty::VTY_FILE;
+    b.vty->wfd = STDOUT_FILENO;
+    b.vty->node = CONFIG_NODE;
+    b.vty->lines = 0;
+    snprintf(b.vty->address, sizeof(b.vty->address), "%s", "batch");
+    b.vty->session_id = __atomic_add_fetch(&vty_session_seq, 1, __ATOMIC_RELAXED);
+    audit_session_open(b.vty->session_id, b.vty->address);
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        ret = vty_batch_map(&b, fd, st.st_size);
+    else
+        ret = -1;
+    if (ret < 0 && b.lineno == 0)
+        ret = vty_batch_read(&b, fd);
+    vty_batch_write(&b, 1);
+
+    audit_session_close(b.vty->session_id);
+    vty_close(b.vty);
+    free(b.line);
+    zlog_notice("%s: %lu lines in %.3f s, %lu failed", b.name, b.lineno,
+                (vty_clock_us() - start) / 1e6, b.errors);
+    return (ret < 0) ? -1 : (long)b.errors;
+}
+
+static void usage(const char *progname)
+{
+    printf("Usage: %s [-p listener]... [-m max_sessions] [-w workers] [-i input_len]\n"
+           "          [-a password] [-t idle_timeout] [-L login_timeout] [-k keepalive]\n"
+           "          [-l syslog|stderr|logfile] [-j audit_journal] [-M metrics_file|unix:path]\n"
+           "          [-e epoll|uring] [-b backlog] [-q wait_queue] [-W wait_timeout]\n"
+           "          [-P max_per_address] [-T job_threads] [-f file|- [-S]] [-D daemon_dir]\n"
+           "          [-z level]\n"
+           "  -p listens on [addr:]port, [v6addr]:port or unix:path, repeatable (default 23);\n"
+           "     append ,max=N to give it its own session cap and ,node=view|enable|config\n"
+           "     to limit how far its sessions may go. Unix sockets speak the vtysh protocol\n"
+           "  -w 0 starts one worker per online cpu\n"
+           "  -i sets the per-session command line buffer size\n"
+           "  -t, -L and -k are in seconds, 0 disables (defaults %d, %d, %d)\n"
+           "  -M exports Prometheus metrics to a file or a unix socket\n"
+           "  -e picks the I/O backend; uring falls back to epoll if unavailable\n"
+           "  -q connections beyond -m wait in a queue of this length (default %d, 0 rejects)\n"
+           "  -W gives up waiting after these seconds, 0 never (default %d)\n"
+           "  -P caps sessions and waiters from one address, 0 disables\n"
+           "  -T threads for long running commands (default %d, 0 runs them in the workers)\n"
+           "  -f runs the commands in a file, - for stdin, and exits; with -S it\n"
+           "     goes on to serve with what they configured\n"
+           "  -D forwards daemon commands to the daemons listening on <dir>/<name>.vty\n"
+           "  -z offers MCCP2 compression of bulk output at this zlib level (1-9)\n"
+           "SIGUSR2 restarts the server from its binary without dropping a connection.\n",
+           progname, VTY_TIMEOUT_DEFAULT, VTY_LOGIN_TIMEOUT_DEFAULT, VTY_KEEPALIVE_DEFAULT,
+           VTY_WAIT_QUEUE_DEFAULT, VTY_WAIT_TIMEOUT_DEFAULT, VTY_JOB_THREADS_DEFAULT);
+}
+
+int main(int argc, char *argv[]) {
+    const char *logdest = "stderr";
+    const char *metrics_dest = NULL;
+    const char *backend = "epoll";
+    const char *handoff;
+    sigset_t sigs;
+    int opt;
+
+    /* For a hot restart, see vty_restart(). */
+    if (readlink("/proc/self/exe", vty_exe, sizeof(vty_exe) - 1) < 0)
+        snprintf(vty_exe, sizeof(vty_exe), "%s", argv[0]);
+    vty_argv = argv;
+
+    while ((opt = getopt(argc, argv, "p:m:w:i:a:t:L:k:l:j:M:e:b:q:W:P:T:f:SD:z:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            if (vty_listen_parse(optarg) < 0)
+                return -1;
+            break;
+        case 'm':
+            vty_max_sessions = atoi(optarg);
+            break;
+        case 'i':
+            vty_max_input = atoi(optarg);
+            if (vty_max_input < 16)
+                vty_max_input = 16;
+            break;
+        case 'a':
+            vty_password = optarg;
+            break;
+        case 't':
+            vty_timeout_val = strtoul(optarg, NULL, 10);
+            break;
+        case 'L':
+            vty_login_timeout = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            vty_keepalive = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            logdest = optarg;
+            break;
+        case 'j':
+            vty_journal = optarg;
+            break;
+        case 'M':
+            metrics_dest = optarg;
+            break;
+        case 'e':
+            backend = optarg;
+            break;
+        case 'b':
+            vty_backlog = atoi(optarg);
+            break;
+        case 'q':
+            vty_wait_max = atoi(optarg);
+            break;
+        case 'W':
+            vty_wait_timeout_val = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            vty_max_per_peer = atoi(optarg);
+            break;
+        case 'T':
+            vty_job_threads = atoi(optarg);
+            break;
+        case 'f':
+            vty_batch_file = optarg;
+            break;
+        case 'S':
+            vty_batch_serve = 1;
+            break;
+        case 'D':
+            vty_daemon_dir = optarg;
+            break;
+        case 'z':
+            vty_compress_level = atoi(optarg);
+            if (vty_compress_level < 0 || vty_compress_level > 9)
+            {
+                fprintf(stderr, "-z wants a level from 1 to 9, or 0\n");
+                return -1;
+            }
+            break;
+        case 'w':
+            vty_worker_num = atoi(optarg);
+            if (vty_worker_num <= 0)
+                vty_worker_num = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN); // 写已关闭的套接字由 writev 返回 EPIPE
+
+    /* 处理子进程退出以免产生僵尸进程 */
+    signal(SIGCHLD, SIG_IGN);
+
+    /* Ctrl+C 与终止信号只由 vty_signal_thread() 接收，热重启信号只由
+       vty_restart_thread() 接收，先于任何线程屏蔽 */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    /* Started by a hot restart: the old process still writes the
+       journal. */
+    if ((handoff = getenv(HANDOFF_ENV)) != NULL)
+    {
+        vty_handoff_sock = atoi(handoff);
+        unsetenv(HANDOFF_ENV);
+        audit_hold();
+    }
+
+    if (zlog_init(logdest) < 0 || vty_signal_init() < 0)
+        return -1;
+    if (vty_journal && audit_init(vty_journal) < 0)
+        return -1;
+
+    vty_io = &vty_epoll_io;
+    if (strcmp(backend, "uring") == 0)
+    {
+#ifdef VTY_IO_URING
+        if (vty_uring_probe() == 0)
+            vty_io = &vty_uring_io;
+        else
+            zlog_warn("io_uring is not usable here, falling back to epoll");
+#else
+        zlog_warn("Built without io_uring, falling back to epoll");
+#endif
+    }
+    else if (strcmp(backend, "epoll") != 0)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (vty_nlisteners == 0)
+        vty_listen_parse("23");
+
+    cmd_init();
+    vty_init();
+    if_init();
+
+    /* The old process's configuration takes the place of -f. */
+    if (vty_handoff_sock >= 0)
+    {
+        if (vty_handoff_begin() < 0)
+            return -1;
+    }
+    else if (vty_batch_file)
+    {
+        long errors = vty_batch(vty_batch_file);
+
+        if (errors < 0 || !vty_batch_serve)
+            return (errors == 0) ? 0 : 1;
+    }
+
+    if (vty_job_threads > 0 && workq_init(&vty_jobq, vty_job_threads, VTY_JOB_QUEUE_MAX) < 0)
+    {
+        zlog_err("Can't start %d job threads", vty_job_threads);
+        return -1;
+    }
+    if (vty_workers_start() < 0)
+        return -1;
+    if (metrics_dest && metrics_export(metrics_dest) < 0)
+        return -1;
+    if (vty_handoff_sock >= 0 && vty_handoff_start() < 0)
+        return -1;
+    if (vty_restart_init() < 0)
+        return -1;
+
+    zlog_notice("Server started with %d %s worker(s). Waiting for connections...",
+                vty_worker_num, vty_io->name);
+
+    vty_loop(&masters[0]);
 
-            vty_out(new_socket, msg); // 发送命令行提示符
-            close(new_socket);
-            connect_num--;
-            continue;
-        }
-        pthread_t socketID;
-        int ret = pthread_create(&socketID,NULL,handle_client,&new_socket);
-        if(ret != 0){
-            perror("create the thread failed\n");
-            close(new_socket);
-            connect_num--;
-            continue;
-        }
-        perror("New connection accepted.");
-        pthread_detach(socketID); 
-        
-    }
-    close(server_fd);
     return 0;
 }
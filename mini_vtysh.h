@@ -11,6 +11,8 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -19,6 +21,25 @@
 #include <assert.h>
 #include <ctype.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <poll.h>
+
+#include "buffer.h"
+#include "telnet.h"
+#include "command.h"
+#include "timer.h"
+#include "log.h"
+#include "audit.h"
+#include "metrics.h"
+#include "pool.h"
+#include "uring.h"
+#include "workq.h"
+#include "ipc.h"
+#include "handoff.h"
 
 #define HexPrint(_buf, _len) \
         {\
@@ -35,11 +56,6 @@
             printf("\nsize = %d\n***************************************************\n", _m_len);\
         }
 
-#define Syslog(_level, fmt, ...) \
-                do{openlog("[MINI_VTYSH]", LOG_NDELAY | LOG_CONS | LOG_PERROR , LOG_LOCAL5); \
-                syslog(_level, " " fmt "", ##__VA_ARGS__); \
-                closelog();}while(0)
-
 #define LOG_EMERG       0       /* system is unusable */
 #define LOG_ALERT       1       /* action must be taken immediately */
 #define LOG_CRIT        2       /* critical conditions */
@@ -61,21 +77,63 @@
 # define TELOPT_TTYPE 24  /* terminal type */
 # define TELOPT_NAWS  31  /* window size */
 
-#define EVENT_NUM 5
+#define EVENT_NUM 64
 #define MAX_INPUT_LENGTH 128
+#define VTY_MAXHIST 20
+
+/* Session timer defaults, seconds. */
+#define VTY_TIMEOUT_DEFAULT 600
+#define VTY_LOGIN_TIMEOUT_DEFAULT 60
+#define VTY_KEEPALIVE_DEFAULT 60
+
+/* Admission defaults: connections that may wait for a free session,
+   and for how many seconds. */
+#define VTY_WAIT_QUEUE_DEFAULT 16
+#define VTY_WAIT_TIMEOUT_DEFAULT 60
+
+/* Vty read buffer escape state. */
+#define VTY_ESCAPE_NONE 0
+#define VTY_PRE_ESCAPE  1
+#define VTY_ESCAPE      2
 #define VTY_READ_BUFSIZ 512
-static int connect_num = 0;
-const char *prompt = "SWITCH# ";
+
+/* The pager refills the socket queue, and asks an output generator for
+   more, only while they hold less than this. */
+#define VTY_OUTPUT_LOW 16384
+
+/* Command execution time a session gets per scheduling round, and the
+   input it may have queued before its socket is no longer read. */
+#define VTY_QUANTUM_US 2000
+#define VTY_INPUT_BACKLOG 65536
+
+/* Job pool for CMD_ATTR_ASYNC commands: default threads, and commands
+   that may wait for a thread before more are refused. */
+#define VTY_JOB_THREADS_DEFAULT 2
+#define VTY_JOB_QUEUE_MAX 64
+
+/* Listening addresses, see -p. */
+#define VTY_LISTEN_MAX 8
+
+/* Smallest flush that is sent compressed once a client accepted MCCP2;
+   anything smaller, like echo and prompts, goes out as is. */
+#define VTY_COMPRESS_MIN 512
+
+#define VTY_MORE_STR " --More-- "
 
 #define sockunion_family(X)  (X)->sa.sa_family
-#define VTY_NEWLINE "\r\n"
+#define VTY_NEWLINE ((vty->type == vty::VTY_TERM) ? "\r\n" : "\n")
 
 union sockunion 
 {
   struct sockaddr sa;
   struct sockaddr_in sin;
+  struct sockaddr_in6 sin6;
 };
 
+struct vty_master;
+struct vty_job;
+struct vty_listener;
+
 /* Structure of command element. */
 struct cmd_element 
 {
@@ -84,6 +142,13 @@ struct cmd_element
   const char *doc;			/* Documentation of this command. */
   int daemon;                   /* Daemon to which this command belong. */
   u_char attr;			/* Command attributes */
+  unsigned int index;		/* Its place in command.def, from 1. */
+
+  /* string and doc split up at compile time, see struct cmd_token. */
+  const char *text;
+  const char *desc;
+  const struct cmd_token *tokens;
+  int ntokens;
 };
 
 /* VTY struct. */
@@ -101,12 +166,47 @@ struct vty
   /* Node status of this vty */
   int node;
 
+  /* What is this vty doing. */
+  enum {VTY_NORMAL, VTY_CLOSE, VTY_MORE, VTY_MORELINE} status;
+
+  /* For current referencing point of interface. */
+  void *index;
+
   /* Failure count */
   int fail;
 
   /* Output buffer. */
   struct buffer *obuf;
 
+  /* Command output waiting for the pager, see vty_more_pump(). */
+  struct buffer *pbuf;
+
+  /* What the I/O backends write out: obuf itself, or once the client
+     agreed to MCCP2 the buffer vty_compress() fills from it. zs is the
+     deflate stream, kept for the session once made, and z_on says a
+     compressed stream is open. */
+  struct buffer *wbuf;
+  struct z_stream_s *zs;
+  int z_on;
+
+  /* Terminal length, -1 follows NAWS, 0 disables paging. */
+  int lines;
+
+  /* Lines left on the current screen and column in the last one. */
+  int more_lines;
+  int more_col;
+
+  /* Lazy output generator: called for more output as the pager drains,
+     returns 0 when done. clean is called once it is done or the user
+     quit the pager. */
+  int (*output_func) (struct vty *, void *);
+  void (*output_clean) (struct vty *, void *);
+  void *output_arg;
+
+  /* Position a generator can keep here instead of allocating arg;
+     zeroed by vty_output_stream(). */
+  long output_pos;
+
   /* Command input buffer */
   char *buf;
 
@@ -119,22 +219,123 @@ struct vty
   /* Command max length. */
   int max;
 
-  /* Timeout seconds and thread. */
+  /* Histry of command, VTY_MAXHIST slots of max bytes. */
+  char *hist;
+
+  /* History lookup current point */
+  int hp;
+
+  /* History insert end point */
+  int hindex;
+
+  /* Escape status. */
+  unsigned char escape;
+
+  /* Numeric parameter of the escape sequence being read. */
+  unsigned char escape_param;
+
+  /* Telnet protocol state. */
+  struct telnet telnet;
+
+  /* Event loop this vty belongs to. */
+  struct vty_master *master;
+
+  /* io_uring backend: requests in flight that refer to this vty, the
+     sends among them, whether the session is closed and only waits
+     for them to complete before it is freed, and whether its receive
+     is armed. */
+  int io_refs;
+  int io_sends;
+  int io_closed;
+  int io_recv;
+
+  /* Input received but not yet fed to the line editor. Reading stops
+     while it holds VTY_INPUT_BACKLOG bytes, and for good once the
+     client has sent all it will, see vty_input_end(). */
+  struct buffer *ibuf;
+  int input_paused;
+  int input_eof;
+
+  /* A command is done and the prompt is owed. It is held back until
+     all input at hand is fed, and dropped if more lines come, so a
+     script sending many lines in one go sees a single prompt at the
+     end; see vty_session_flush(). */
+  int prompt_wait;
+
+  /* Deficit round robin, see vty_run(): execution time left in this
+     round, microseconds, the round it belongs to and the link in the
+     worker's run queue. */
+  long deficit;
+  unsigned long run_round;
+  struct vty *run_next;
+  int run_queued;
+
+  /* Place in the admission queue, linked under vty_admit_lock, and the
+     position the client was last told. */
+  struct vty *wait_next;
+  struct vty *wait_prev;
+  int waiting;
+  int wait_pos;
+
+  /* CMD_ATTR_ASYNC command running on the job pool. Until it is done
+     its output streams in through the pager and input waits. */
+  struct vty_job *job;
+
+  /* Listener the session came in on, and the highest node its policy
+     lets it enter. */
+  struct vty_listener *listener;
+  int node_max;
+
+  /* Return of the last command, for the status a VTY_SHELL_SERV client
+     gets after its output. */
+  int ret;
+
+  /* Timeout seconds and thread. One timer covers the login, idle and
+     keepalive deadlines; input only records v_input and the timer
+     re-arms itself lazily when it fires. */
   unsigned long v_timeout;
-#define SU_ADDRSTRLEN 16
+  struct timer t_timeout;
+
+  /* Wheel ticks of session start, last input and last keepalive. */
+  uint32_t v_start;
+  uint32_t v_input;
+  uint32_t v_keepalive;
+
+  /* Session number in the audit journal. */
+  uint32_t session_id;
+#define SU_ADDRSTRLEN INET6_ADDRSTRLEN
   /* What address is this vty comming from. */
   char address[SU_ADDRSTRLEN];
 };
 
 
 #define DEFUN_CMD_ELEMENT(funcname, cmdname, cmdstr, helpstr, attrs, dnum) \
+  static_assert(cmd_spec_check(cmdstr, helpstr) != CMD_SPEC_EMPTY, \
+                #cmdname ": empty command"); \
+  static_assert(cmd_spec_check(cmdstr, helpstr) != CMD_SPEC_ARGC, \
+                "\"" cmdstr "\": more than CMD_ARGC_MAX tokens"); \
+  static_assert(cmd_spec_check(cmdstr, helpstr) != CMD_SPEC_RANGE, \
+                "\"" cmdstr "\": a range is <lo-hi>, lo <= hi"); \
+  static_assert(cmd_spec_check(cmdstr, helpstr) != CMD_SPEC_LINE, \
+                "\"" cmdstr "\": .LINE takes the rest of the line, it comes last"); \
+  static_assert(cmd_spec_check(cmdstr, helpstr) != CMD_SPEC_HELP, \
+                "\"" cmdstr "\": one help line per token"); \
+  static_assert(cmd_spec_same(cmdstr, cmd_specs[CMD_INDEX_##cmdname]), \
+                "\"" cmdstr "\": command.def has " #cmdname " otherwise"); \
+  static constexpr auto cmdname##_spec = \
+    cmd_spec_parse<sizeof(cmdstr), sizeof(helpstr), cmd_spec_count(cmdstr)>(cmdstr, helpstr); \
   struct cmd_element cmdname = \
   { \
     .string = cmdstr, \
     .func = funcname, \
     .doc = helpstr, \
-    .attr = attrs, \
     .daemon = dnum, \
+    .attr = attrs, \
+    .index = CMD_INDEX_##cmdname, \
+    .text = cmdname##_spec.text, \
+    .desc = cmdname##_spec.desc, \
+    .tokens = cmdname##_spec.tokens, \
+    .ntokens = cmd_spec_count(cmdstr), \
   };
 
 #define DEFUN_CMD_FUNC_DECL(funcname) \
@@ -153,12 +354,312 @@ struct vty
   DEFUN_CMD_ELEMENT(funcname, cmdname, cmdstr, helpstr, 0, 0) \
   DEFUN_CMD_FUNC_TEXT(funcname)
 
+#define DEFUN_ATTR(funcname, cmdname, cmdstr, helpstr, attr) \
+  DEFUN_CMD_FUNC_DECL(funcname) \
+  DEFUN_CMD_ELEMENT(funcname, cmdname, cmdstr, helpstr, attr, 0) \
+  DEFUN_CMD_FUNC_TEXT(funcname)
+
+/* Daemons a command belongs to, for cmd_element.daemon. Bit i is
+   ipc_daemon_names[i], see ipc.h. */
+#define VTYSH_ZEBRA  0x01
+#define VTYSH_RIPD   0x02
+#define VTYSH_RIPNGD 0x04
+#define VTYSH_OSPFD  0x08
+#define VTYSH_OSPF6D 0x10
+#define VTYSH_BGPD   0x20
+#define VTYSH_ISISD  0x40
+#define VTYSH_PIMD   0x80
+#define VTYSH_ALL    0xff
+
+/* A command that runs in daemons: it is sent to those of them that
+   are up and their replies are its output. */
+#define DEFSH(daemon, cmdname, cmdstr, helpstr) \
+  DEFUN_CMD_ELEMENT(vty_daemon_unreachable, cmdname, cmdstr, helpstr, 0, daemon)
+
+
+
+/* Prototypes. */
+struct vty *vty_new(int fd);
+void vty_close(struct vty *vty);
+int vty_out(struct vty *vty, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+buffer_status_t vty_flush(struct vty *vty);
+void vty_output_stream(struct vty *vty, int (*func) (struct vty *, void *),
+                       void (*clean) (struct vty *, void *), void *arg);
+int vty_cancelled(struct vty *vty);
+int vty_daemon_unreachable(struct cmd_element *, struct vty *, int, const char *[]);
 
 
 typedef socklen_t SOCKLEN_T;
 typedef struct timeval TIMEVAL_T;
 typedef struct sockaddr SOCKADDR_T;
 typedef struct sockaddr_in SOCKADDR_IN_T;
+typedef struct sockaddr_storage SOCKADDR_STORAGE_T;
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/* Datagrams one recvmmsg()/sendmmsg() call moves at most; longer
+   vectors take several calls. */
+#define UDP_BATCH_MAX 64
+
+/* One datagram of a batch. With GRO or GSO, uiSegSize says that
+   pvBuff holds several datagrams of that size back to back, the last
+   one possibly shorter; a GRO buffer wants 64K to be of use. */
+typedef struct
+{
+    void *pvBuff;
+    unsigned int uiBuffLen;     /* Recv: room at pvBuff. */
+    unsigned int uiDataLen;     /* Recv: bytes received. Send: bytes to send. */
+    unsigned int uiSegSize;     /* 0 for a single datagram. */
+    SOCKLEN_T stAddrLen;        /* Send: 0 for the client's own server. */
+    SOCKADDR_STORAGE_T stAddr;  /* Recv: the sender. Send: the destination. */
+} UDP_MSG_T;
+
+/* Resolve pcHost:uiPort once, for a socket of family iFamily: an IPv4
+   address becomes v4-mapped for an IPv6 socket. */
+inline int UdpResolve(const char *pcHost, unsigned int uiPort, int iFamily, int iFlags,
+                      SOCKADDR_STORAGE_T *pstAddr, SOCKLEN_T *pstAddrLen)
+{
+    struct addrinfo stHints, *pstRes = NULL;
+    char acPort[8];
+
+    if((0 == uiPort) || (65535 < uiPort) || (NULL == pstAddr) || (NULL == pstAddrLen))
+    {
+        return -1;
+    }
+
+    memset(&stHints, 0x00, sizeof(stHints));
+    stHints.ai_family = AF_UNSPEC;
+    stHints.ai_socktype = SOCK_DGRAM;
+    stHints.ai_flags = iFlags;
+    snprintf(acPort, sizeof(acPort), "%u", uiPort);
+    if((0 != getaddrinfo((pcHost && *pcHost) ? pcHost : NULL, acPort, &stHints, &pstRes)) || (NULL == pstRes))
+    {
+        return -1;
+    }
+
+    memset(pstAddr, 0x00, sizeof(*pstAddr));
+    if((AF_INET6 == iFamily) && (AF_INET == pstRes->ai_family))
+    {
+        struct sockaddr_in *pstIn = (struct sockaddr_in *)pstRes->ai_addr;
+        struct sockaddr_in6 *pstIn6 = (struct sockaddr_in6 *)pstAddr;
+
+        pstIn6->sin6_family = AF_INET6;
+        pstIn6->sin6_port = pstIn->sin_port;
+        pstIn6->sin6_addr.s6_addr[10] = 0xff;
+        pstIn6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&pstIn6->sin6_addr.s6_addr[12], &pstIn->sin_addr, 4);
+        *pstAddrLen = sizeof(struct sockaddr_in6);
+    }
+    else if((AF_INET == iFamily) && (AF_INET6 == pstRes->ai_family))
+    {
+        freeaddrinfo(pstRes);
+        return -1;
+    }
+    else
+    {
+        memcpy(pstAddr, pstRes->ai_addr, pstRes->ai_addrlen);
+        *pstAddrLen = pstRes->ai_addrlen;
+    }
+    freeaddrinfo(pstRes);
+
+    return 0;
+}
+
+/* Receive up to uiCount datagrams: one call returns what is queued,
+   waiting only for the first on a blocking socket. Returns how many
+   arrived, 0 if none is there on a non-blocking socket, -1 on error. */
+inline int UdpRecvBatch(int iSock, UDP_MSG_T *pstMsgs, unsigned int uiCount)
+{
+    struct mmsghdr astHdr[UDP_BATCH_MAX];
+    struct iovec astIov[UDP_BATCH_MAX];
+    union
+    {
+        char acBuf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr stAlign;
+    } astCtl[UDP_BATCH_MAX];
+    unsigned int uiDone = 0;
+
+    if((0 > iSock) || (NULL == pstMsgs))
+    {
+        return -1;
+    }
+
+    while(uiDone < uiCount)
+    {
+        unsigned int uiNum = uiCount - uiDone;
+        int iRet;
+
+        if(UDP_BATCH_MAX < uiNum) uiNum = UDP_BATCH_MAX;
+        memset(astHdr, 0x00, uiNum * sizeof(astHdr[0]));
+        for(unsigned int i = 0; i < uiNum; i++)
+        {
+            UDP_MSG_T *pstMsg = &pstMsgs[uiDone + i];
+
+            astIov[i].iov_base = pstMsg->pvBuff;
+            astIov[i].iov_len = pstMsg->uiBuffLen;
+            astHdr[i].msg_hdr.msg_name = &pstMsg->stAddr;
+            astHdr[i].msg_hdr.msg_namelen = sizeof(pstMsg->stAddr);
+            astHdr[i].msg_hdr.msg_iov = &astIov[i];
+            astHdr[i].msg_hdr.msg_iovlen = 1;
+            astHdr[i].msg_hdr.msg_control = astCtl[i].acBuf;
+            astHdr[i].msg_hdr.msg_controllen = sizeof(astCtl[i].acBuf);
+        }
+
+        iRet = recvmmsg(iSock, astHdr, uiNum, uiDone ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+        if(0 > iRet)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            if(uiDone || (EAGAIN == errno) || (EWOULDBLOCK == errno))
+            {
+                break;
+            }
+            return -1;
+        }
+
+        for(int i = 0; i < iRet; i++)
+        {
+            UDP_MSG_T *pstMsg = &pstMsgs[uiDone + i];
+            struct cmsghdr *pstCmsg;
+
+            pstMsg->uiDataLen = astHdr[i].msg_len;
+            pstMsg->stAddrLen = astHdr[i].msg_hdr.msg_namelen;
+            pstMsg->uiSegSize = 0;
+            for(pstCmsg = CMSG_FIRSTHDR(&astHdr[i].msg_hdr); pstCmsg;
+                pstCmsg = CMSG_NXTHDR(&astHdr[i].msg_hdr, pstCmsg))
+            {
+                if((SOL_UDP == pstCmsg->cmsg_level) && (UDP_GRO == pstCmsg->cmsg_type))
+                {
+                    int iSegSize;
+
+                    memcpy(&iSegSize, CMSG_DATA(pstCmsg), sizeof(iSegSize));
+                    if((unsigned int)iSegSize < pstMsg->uiDataLen) pstMsg->uiSegSize = iSegSize;
+                }
+            }
+        }
+        uiDone += iRet;
+        if((unsigned int)iRet < uiNum)
+        {
+            break;
+        }
+    }
+
+    return uiDone;
+}
+
+/* Send uiCount datagrams, those without an address to pstDefault.
+   Returns how many went, fewer if the socket buffer filled up on a
+   non-blocking socket (wait for EPOLLOUT and send the rest), -1 if
+   not even the first could go. */
+inline int UdpSendBatch(int iSock, const UDP_MSG_T *pstMsgs, unsigned int uiCount,
+                        const SOCKADDR_STORAGE_T *pstDefault, SOCKLEN_T stDefaultLen)
+{
+    struct mmsghdr astHdr[UDP_BATCH_MAX];
+    struct iovec astIov[UDP_BATCH_MAX];
+    union
+    {
+        char acBuf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr stAlign;
+    } astCtl[UDP_BATCH_MAX];
+    unsigned int uiDone = 0;
+
+    if((0 > iSock) || (NULL == pstMsgs))
+    {
+        return -1;
+    }
+
+    while(uiDone < uiCount)
+    {
+        unsigned int uiNum = uiCount - uiDone;
+        int iRet;
+
+        if(UDP_BATCH_MAX < uiNum) uiNum = UDP_BATCH_MAX;
+        memset(astHdr, 0x00, uiNum * sizeof(astHdr[0]));
+        for(unsigned int i = 0; i < uiNum; i++)
+        {
+            const UDP_MSG_T *pstMsg = &pstMsgs[uiDone + i];
+
+            astIov[i].iov_base = pstMsg->pvBuff;
+            astIov[i].iov_len = pstMsg->uiDataLen;
+            if(pstMsg->stAddrLen)
+            {
+                astHdr[i].msg_hdr.msg_name = (void *)&pstMsg->stAddr;
+                astHdr[i].msg_hdr.msg_namelen = pstMsg->stAddrLen;
+            }
+            else if(pstDefault)
+            {
+                astHdr[i].msg_hdr.msg_name = (void *)pstDefault;
+                astHdr[i].msg_hdr.msg_namelen = stDefaultLen;
+            }
+            astHdr[i].msg_hdr.msg_iov = &astIov[i];
+            astHdr[i].msg_hdr.msg_iovlen = 1;
+            if(pstMsg->uiSegSize && (pstMsg->uiSegSize < pstMsg->uiDataLen))
+            {
+                struct cmsghdr *pstCmsg;
+                uint16_t usSegSize = pstMsg->uiSegSize;
+
+                memset(&astCtl[i], 0x00, sizeof(astCtl[i]));
+                astHdr[i].msg_hdr.msg_control = astCtl[i].acBuf;
+                astHdr[i].msg_hdr.msg_controllen = sizeof(astCtl[i].acBuf);
+                pstCmsg = CMSG_FIRSTHDR(&astHdr[i].msg_hdr);
+                pstCmsg->cmsg_level = SOL_UDP;
+                pstCmsg->cmsg_type = UDP_SEGMENT;
+                pstCmsg->cmsg_len = CMSG_LEN(sizeof(usSegSize));
+                memcpy(CMSG_DATA(pstCmsg), &usSegSize, sizeof(usSegSize));
+            }
+        }
+
+        iRet = sendmmsg(iSock, astHdr, uiNum, MSG_NOSIGNAL);
+        if(0 > iRet)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            if(uiDone || (EAGAIN == errno) || (EWOULDBLOCK == errno))
+            {
+                break;
+            }
+            return -1;
+        }
+        uiDone += iRet;
+        if((unsigned int)iRet < uiNum)
+        {
+            break;
+        }
+    }
+
+    return uiDone;
+}
+
+inline int UdpSetNonBlock(int iSock, bool bOn)
+{
+    int iFlags = fcntl(iSock, F_GETFL);
+
+    if(0 > iFlags)
+    {
+        return -1;
+    }
+    return fcntl(iSock, F_SETFL, bOn ? (iFlags | O_NONBLOCK) : (iFlags & ~O_NONBLOCK));
+}
+
+inline int UdpEpollAdd(int iSock, int iEpollFd, unsigned int uiEvents, void *pvPtr)
+{
+    struct epoll_event stEvent;
+
+    memset(&stEvent, 0x00, sizeof(stEvent));
+    stEvent.events = uiEvents;
+    stEvent.data.ptr = pvPtr;
+    return epoll_ctl(iEpollFd, EPOLL_CTL_ADD, iSock, &stEvent);
+}
+
 //UDP 服务端类
 class CUdpServer
 {
@@ -171,48 +672,76 @@ public:
     int CUdpRecvData(void *pvBuff, unsigned int uiBuffLen, SOCKADDR_IN_T *pstClientInfo);
     int CUdpSendData(const void *pvData, unsigned int uiDataLen, SOCKADDR_IN_T stClientInfo);
 
+    //批量收发，见 UdpRecvBatch()/UdpSendBatch()；IPv6 客户端只能用这两个接口
+    int CUdpRecvBatch(UDP_MSG_T *pstMsgs, unsigned int uiCount);
+    int CUdpSendBatch(const UDP_MSG_T *pstMsgs, unsigned int uiCount);
+
+    int CUdpGetSock() const { return m_iSerSock; }
+    int CUdpSetNonBlock(bool bOn = true);
+    int CUdpEpollAdd(int iEpollFd, unsigned int uiEvents, void *pvPtr);
+    int CUdpSetGro(bool bOn = true);
+
 private:
     int m_iSerSock;
+    int m_iFamily;
     unsigned int m_uiPort;
-    unsigned char m_uiHost[16];
+    unsigned char m_uiHost[INET6_ADDRSTRLEN];
 };
 
-CUdpServer::CUdpServer()
+inline CUdpServer::CUdpServer()
 {
     m_uiPort = 0;
     m_iSerSock = -1;
+    m_iFamily = AF_INET;
     memset(m_uiHost, 0x00, sizeof(m_uiHost));
 }
 
-CUdpServer::CUdpServer(const char *pcHost, unsigned int uiPort)
+inline CUdpServer::CUdpServer(const char *pcHost, unsigned int uiPort)
 {
-    m_uiPort = uiPort;
+    m_uiPort = 0;
+    m_iSerSock = -1;
+    m_iFamily = AF_INET;
     memset(m_uiHost, 0x00, sizeof(m_uiHost));
-    strcpy((char*)m_uiHost, pcHost);
     CUdpSocket(pcHost, uiPort);
 }
 
-CUdpServer::~CUdpServer()
+inline CUdpServer::~CUdpServer()
 {
     m_uiPort = 0;
-    if(0 < m_iSerSock) close(m_iSerSock);
+    if(0 <= m_iSerSock) close(m_iSerSock);
 }
 
-int CUdpServer::CUdpSocket(const char *pcHost, unsigned int uiPort)
+//pcHost 为 NULL 或空串时监听所有 IPv4 地址，为 "::" 时同时监听所有 IPv4 与 IPv6 地址
+inline int CUdpServer::CUdpSocket(const char *pcHost, unsigned int uiPort)
 {
+    SOCKADDR_STORAGE_T stAddr;
+    SOCKLEN_T stAddrLen;
     int iRet = 0;
-    m_uiPort = uiPort;
-    memset(m_uiHost, 0x00, sizeof(m_uiHost));
-    strcpy((char*)m_uiHost, pcHost);
 
-    if( (0 == m_uiPort) || (NULL == m_uiHost))
+    if(0 == uiPort)
     {
         assert(true);
         //LOG(LOG_ERR, "Para is error!");
         return -1;
     }
 
-    m_iSerSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(0 <= m_iSerSock)
+    {
+        close(m_iSerSock);
+        m_iSerSock = -1;
+    }
+    m_uiPort = uiPort;
+    snprintf((char *)m_uiHost, sizeof(m_uiHost), "%s", pcHost ? pcHost : "");
+
+    if(0 != UdpResolve(('\0' == m_uiHost[0]) ? "0.0.0.0" : (const char *)m_uiHost, m_uiPort,
+                       AF_UNSPEC, AI_PASSIVE | AI_NUMERICHOST, &stAddr, &stAddrLen))
+    {
+        //LOG(LOG_ERR, "Incorrect ip address!");
+        return -1;
+    }
+    m_iFamily = stAddr.ss_family;
+
+    m_iSerSock = socket(m_iFamily, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     if(0 > m_iSerSock)
     {
         //LOG(LOG_ERR, "Udp server socket failed!");
@@ -230,24 +759,30 @@ int CUdpServer::CUdpSocket(const char *pcHost, unsigned int uiPort)
 
     int iOptval = 1;
     setsockopt(m_iSerSock, SOL_SOCKET, SO_REUSEADDR, &iOptval, sizeof(int));
+    if(AF_INET6 == m_iFamily)
+    {
+        iOptval = !IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)&stAddr)->sin6_addr);
+        setsockopt(m_iSerSock, IPPROTO_IPV6, IPV6_V6ONLY, &iOptval, sizeof(int));
+    }
 
-    struct sockaddr_in stAddr;
-    stAddr.sin_family = AF_INET;
-    stAddr.sin_port = htons(m_uiPort);
-    stAddr.sin_addr.s_addr = inet_addr((const char *)m_uiHost);
-    iRet = bind(m_iSerSock, (struct sockaddr *)&stAddr, (socklen_t)sizeof(stAddr));
+    iRet = bind(m_iSerSock, (SOCKADDR_T *)&stAddr, stAddrLen);
     if(0 > iRet)
     {
         //LOG(LOG_ERR, "Udp server bind failed!");
+        close(m_iSerSock);
+        m_iSerSock = -1;
         return -1;
     }
 
     return m_iSerSock;
 }
 
-int CUdpServer::CUdpRecvData(void *pvBuff, unsigned int uiBuffLen, SOCKADDR_IN_T *pstClientInfo)
+//IPv6 套接字上 IPv4 客户端的地址由 ::ffff:a.b.c.d 还原；IPv6 客户端的报文无法用
+//SOCKADDR_IN_T 表示，读走后返回 -1，errno 为 EAFNOSUPPORT
+inline int CUdpServer::CUdpRecvData(void *pvBuff, unsigned int uiBuffLen, SOCKADDR_IN_T *pstClientInfo)
 {
     int inRead = 0;
+    SOCKADDR_STORAGE_T stAddr;
     SOCKLEN_T stAddrLen;
     
     if((NULL == pvBuff) || (NULL == pstClientInfo))
@@ -256,13 +791,37 @@ int CUdpServer::CUdpRecvData(void *pvBuff, unsigned int uiBuffLen, SOCKADDR_IN_T
         return -1;
     }
 
-    stAddrLen = sizeof(SOCKADDR_IN_T);
-    inRead = recvfrom(m_iSerSock, pvBuff, uiBuffLen, 0, (SOCKADDR_T *)pstClientInfo,(SOCKLEN_T *)&stAddrLen);
+    stAddrLen = sizeof(stAddr);
+    inRead = recvfrom(m_iSerSock, pvBuff, uiBuffLen, 0, (SOCKADDR_T *)&stAddr, &stAddrLen);
+    if(0 > inRead)
+    {
+        return inRead;
+    }
+
+    memset(pstClientInfo, 0x00, sizeof(*pstClientInfo));
+    if(AF_INET == stAddr.ss_family)
+    {
+        memcpy(pstClientInfo, &stAddr, sizeof(*pstClientInfo));
+    }
+    else if((AF_INET6 == stAddr.ss_family) &&
+            IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)&stAddr)->sin6_addr))
+    {
+        struct sockaddr_in6 *pstIn6 = (struct sockaddr_in6 *)&stAddr;
+
+        pstClientInfo->sin_family = AF_INET;
+        pstClientInfo->sin_port = pstIn6->sin6_port;
+        memcpy(&pstClientInfo->sin_addr, &pstIn6->sin6_addr.s6_addr[12], 4);
+    }
+    else
+    {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
 
     return inRead;
 }
 
-int CUdpServer::CUdpSendData(const void *pvData, unsigned int uiDataLen, SOCKADDR_IN_T stClientInfo)
+inline int CUdpServer::CUdpSendData(const void *pvData, unsigned int uiDataLen, SOCKADDR_IN_T stClientInfo)
 {
     int inSend = 0;
 
@@ -272,11 +831,52 @@ int CUdpServer::CUdpSendData(const void *pvData, unsigned int uiDataLen, SOCKADD
         return -1;
     }
 
-    inSend = sendto(m_iSerSock, pvData, uiDataLen, 0, (SOCKADDR_T *)&stClientInfo, sizeof(SOCKADDR_T));
+    if(AF_INET6 == m_iFamily)
+    {
+        struct sockaddr_in6 stIn6;
+
+        memset(&stIn6, 0x00, sizeof(stIn6));
+        stIn6.sin6_family = AF_INET6;
+        stIn6.sin6_port = stClientInfo.sin_port;
+        stIn6.sin6_addr.s6_addr[10] = 0xff;
+        stIn6.sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&stIn6.sin6_addr.s6_addr[12], &stClientInfo.sin_addr, 4);
+        return sendto(m_iSerSock, pvData, uiDataLen, 0, (SOCKADDR_T *)&stIn6, sizeof(stIn6));
+    }
+
+    inSend = sendto(m_iSerSock, pvData, uiDataLen, 0, (SOCKADDR_T *)&stClientInfo, sizeof(SOCKADDR_IN_T));
 
     return inSend;
 }
 
+inline int CUdpServer::CUdpRecvBatch(UDP_MSG_T *pstMsgs, unsigned int uiCount)
+{
+    return UdpRecvBatch(m_iSerSock, pstMsgs, uiCount);
+}
+
+//回复时直接使用收到的 UDP_MSG_T 中的地址
+inline int CUdpServer::CUdpSendBatch(const UDP_MSG_T *pstMsgs, unsigned int uiCount)
+{
+    return UdpSendBatch(m_iSerSock, pstMsgs, uiCount, NULL, 0);
+}
+
+inline int CUdpServer::CUdpSetNonBlock(bool bOn)
+{
+    return UdpSetNonBlock(m_iSerSock, bOn);
+}
+
+inline int CUdpServer::CUdpEpollAdd(int iEpollFd, unsigned int uiEvents, void *pvPtr)
+{
+    return UdpEpollAdd(m_iSerSock, iEpollFd, uiEvents, pvPtr);
+}
+
+//内核 5.0 之前不支持，返回 -1
+inline int CUdpServer::CUdpSetGro(bool bOn)
+{
+    int iOptval = bOn;
+    return setsockopt(m_iSerSock, SOL_UDP, UDP_GRO, &iOptval, sizeof(int));
+}
+
 //UDP客户端类
 class CUdpClient
 {
@@ -290,74 +890,120 @@ public:
     int CUdpRecvData(void *pcBuff, unsigned int uiBuffLen, const char *pcHost, unsigned int uiPort);
     int CUdpSendData(const void *pcData, unsigned int uiDataLen, const char *pcHost, unsigned int uiPort);
 
+    //批量收发；发送时 stAddrLen 为 0 的报文发往构造时指定的服务端
+    int CUdpRecvBatch(UDP_MSG_T *pstMsgs, unsigned int uiCount);
+    int CUdpSendBatch(const UDP_MSG_T *pstMsgs, unsigned int uiCount);
+    int CUdpResolve(const char *pcHost, unsigned int uiPort, UDP_MSG_T *pstMsg);
+
     int CUdpSetSendTimeout(unsigned int uiSeconds = 3);
     int CUdpSetRecvTimeout(unsigned int uiSeconds = 3);
     int CUdpSetBroadcastOpt();
 
+    int CUdpGetSock() const { return m_iClientSock; }
+    int CUdpSetNonBlock(bool bOn = true);
+    int CUdpEpollAdd(int iEpollFd, unsigned int uiEvents, void *pvPtr);
+    int CUdpSetGro(bool bOn = true);
+
 private:
     int CUdpSocket();
-    int CUdpGetSockaddr(const char * pcHost, unsigned int uiPort, SOCKADDR_IN_T *pstSockaddr);
+    int CUdpGetSockaddr(const char * pcHost, unsigned int uiPort, SOCKADDR_STORAGE_T *pstSockaddr, SOCKLEN_T *pstLen);
 
 private:
     int m_iClientSock;
+    int m_iFamily;
     unsigned int m_uiPort;
-    unsigned char m_ucHost[16];
-    SOCKADDR_IN_T m_stServerInfo;
+    unsigned char m_ucHost[INET6_ADDRSTRLEN];
+    SOCKADDR_STORAGE_T m_stServerInfo;
+    SOCKLEN_T m_stServerLen;
+    //最近一次按主机名发送的地址，避免每次重新解析
+    char m_acLastHost[INET6_ADDRSTRLEN];
+    unsigned int m_uiLastPort;
+    SOCKADDR_STORAGE_T m_stLastInfo;
+    SOCKLEN_T m_stLastLen;
 };
 
-CUdpClient::CUdpClient()
+inline CUdpClient::CUdpClient()
 {
     m_iClientSock = -1;
+    m_iFamily = AF_INET;
     m_uiPort = 0;
     memset(m_ucHost, 0x00, sizeof(m_ucHost));
     memset(&m_stServerInfo, 0x00, sizeof(m_stServerInfo));
+    m_stServerLen = 0;
+    memset(m_acLastHost, 0x00, sizeof(m_acLastHost));
+    m_uiLastPort = 0;
+    m_stLastLen = 0;
     CUdpSocket();
 }
     
-CUdpClient::CUdpClient(const char *pcHost, unsigned int uiPort)
+inline CUdpClient::CUdpClient(const char *pcHost, unsigned int uiPort)
 {
     m_iClientSock = -1;
+    m_iFamily = AF_INET;
     m_uiPort = uiPort;
     memset(m_ucHost, 0x00, sizeof(m_ucHost));
-    strcpy((char*)m_ucHost, pcHost);
+    snprintf((char *)m_ucHost, sizeof(m_ucHost), "%s", pcHost ? pcHost : "");
     memset(&m_stServerInfo, 0x00, sizeof(m_stServerInfo));
+    m_stServerLen = 0;
+    memset(m_acLastHost, 0x00, sizeof(m_acLastHost));
+    m_uiLastPort = 0;
+    m_stLastLen = 0;
     CUdpSocket();
+    if(0 != CUdpGetSockaddr((const char *)m_ucHost, m_uiPort, &m_stServerInfo, &m_stServerLen))
+    {
+        //SysLog(LOG_ERR, "Get sockaddr failed!");
+        m_stServerLen = 0;
+    }
 }
 
-CUdpClient::~CUdpClient()
+inline CUdpClient::~CUdpClient()
 {
-    if(0 < m_iClientSock) close(m_iClientSock);
+    if(0 <= m_iClientSock) close(m_iClientSock);
 }
 
-int CUdpClient::CUdpGetSockaddr(const char * pcHost, unsigned int uiPort, SOCKADDR_IN_T *pstSockaddr)
+inline int CUdpClient::CUdpGetSockaddr(const char * pcHost, unsigned int uiPort, SOCKADDR_STORAGE_T *pstSockaddr, SOCKLEN_T *pstLen)
 {
-    SOCKADDR_IN_T stSockaddr;
-    
-    if((NULL == pcHost) || (0 == uiPort) || (NULL == pstSockaddr))
+    if((NULL == pcHost) || ('\0' == *pcHost) || (0 == uiPort) || (NULL == pstSockaddr) || (NULL == pstLen))
     {
         //SysLog(LOG_ERR, "Para is error!");
         return -1;
     }
 
-    memset(&stSockaddr, 0x00, sizeof(stSockaddr));
-    stSockaddr.sin_family = AF_INET;
-    stSockaddr.sin_port = htons(uiPort);
-    stSockaddr.sin_addr.s_addr = inet_addr(pcHost);
-    if(stSockaddr.sin_addr.s_addr == INADDR_ANY)
+    if(0 != UdpResolve(pcHost, uiPort, m_iFamily, 0, pstSockaddr, pstLen))
     {
         //SysLog(LOG_ERR, "Incorrect ip address!");
         return -1;
     }
 
-    memcpy(pstSockaddr, &stSockaddr, sizeof(SOCKADDR_IN_T));
+    if(((AF_INET == pstSockaddr->ss_family) && (INADDR_ANY == ((SOCKADDR_IN_T *)pstSockaddr)->sin_addr.s_addr)) ||
+       ((AF_INET6 == pstSockaddr->ss_family) &&
+        IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)pstSockaddr)->sin6_addr)))
+    {
+        //SysLog(LOG_ERR, "Incorrect ip address!");
+        return -1;
+    }
 
     return 0;
 }
 
 
-int CUdpClient::CUdpSocket()
+//IPv6 套接字同时可以发往 IPv4 地址，系统不支持 IPv6 时退回 IPv4
+inline int CUdpClient::CUdpSocket()
 {
-    m_iClientSock = socket(AF_INET, SOCK_DGRAM, 0);
+    int iOptval = 0;
+
+    m_iFamily = AF_INET6;
+    m_iClientSock = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if((0 <= m_iClientSock) && (0 != setsockopt(m_iClientSock, IPPROTO_IPV6, IPV6_V6ONLY, &iOptval, sizeof(int))))
+    {
+        close(m_iClientSock);
+        m_iClientSock = -1;
+    }
+    if(0 > m_iClientSock)
+    {
+        m_iFamily = AF_INET;
+        m_iClientSock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    }
     if(0 > m_iClientSock)
     {
         //SysLog(LOG_ERR, "Udp client socket failed!");
@@ -370,7 +1016,7 @@ int CUdpClient::CUdpSocket()
     return 0;
 }
 
-int CUdpClient::CUdpSetSendTimeout(unsigned int uiSeconds)
+inline int CUdpClient::CUdpSetSendTimeout(unsigned int uiSeconds)
 {
     TIMEVAL_T stTimeout;
     
@@ -380,7 +1026,7 @@ int CUdpClient::CUdpSetSendTimeout(unsigned int uiSeconds)
     return setsockopt(m_iClientSock, SOL_SOCKET, SO_SNDTIMEO, &stTimeout, sizeof(stTimeout));
 }
 
-int CUdpClient::CUdpSetRecvTimeout(unsigned int uiSeconds)
+inline int CUdpClient::CUdpSetRecvTimeout(unsigned int uiSeconds)
 {
     TIMEVAL_T stTimeout;
     
@@ -390,63 +1036,100 @@ int CUdpClient::CUdpSetRecvTimeout(unsigned int uiSeconds)
     return setsockopt(m_iClientSock, SOL_SOCKET, SO_RCVTIMEO, &stTimeout, sizeof(stTimeout));
 }
 
-int CUdpClient::CUdpSetBroadcastOpt()
+inline int CUdpClient::CUdpSetBroadcastOpt()
 {
     int iOptval = 1;
     return setsockopt(m_iClientSock, SOL_SOCKET, SO_BROADCAST | SO_REUSEADDR, &iOptval, sizeof(int));
 }
 
-int CUdpClient::CUdpRecvData(void *pcBuff, unsigned int uiBuffLen)
+inline int CUdpClient::CUdpSetNonBlock(bool bOn)
+{
+    return UdpSetNonBlock(m_iClientSock, bOn);
+}
+
+inline int CUdpClient::CUdpEpollAdd(int iEpollFd, unsigned int uiEvents, void *pvPtr)
+{
+    return UdpEpollAdd(m_iClientSock, iEpollFd, uiEvents, pvPtr);
+}
+
+inline int CUdpClient::CUdpSetGro(bool bOn)
+{
+    int iOptval = bOn;
+    return setsockopt(m_iClientSock, SOL_UDP, UDP_GRO, &iOptval, sizeof(int));
+}
+
+inline int CUdpClient::CUdpRecvData(void *pcBuff, unsigned int uiBuffLen)
 {
     return  CUdpRecvData(pcBuff, uiBuffLen, (const char *)m_ucHost, m_uiPort);
 }
 
-int CUdpClient::CUdpRecvData(void *pcBuff, unsigned int uiBuffLen, const char *pcHost, unsigned int uiPort)
+//接收不按来源过滤，pcHost/uiPort 只做参数检查
+inline int CUdpClient::CUdpRecvData(void *pcBuff, unsigned int uiBuffLen, const char *pcHost, unsigned int uiPort)
 {
-    SOCKLEN_T stSockLen = 0;
-    SOCKADDR_IN_T stSockaddr;
-    
     if((NULL == pcBuff) || (NULL == pcHost) || (0 == uiPort))
     {
         //SysLog(LOG_ERR, "Para is error!");
         return -1;
     }
 
-    memset(&stSockaddr, 0x00, sizeof(stSockaddr));
-    if(0 != CUdpGetSockaddr(pcHost, uiPort, &stSockaddr))
+    return recvfrom(m_iClientSock, pcBuff, uiBuffLen, 0, NULL, NULL);
+}
+
+inline int CUdpClient::CUdpSendData(const void *pcData, unsigned int uiDataLen) 
+{ 
+    if((NULL == pcData) || (0 == m_stServerLen))
     {
-        //SysLog(LOG_ERR, "Get sockaddr failed!");
+        //SysLog(LOG_ERR, "Para is error!");
         return -1;
     }
 
-    stSockLen = sizeof(SOCKADDR_IN_T);
-    return recvfrom(m_iClientSock, pcBuff, uiBuffLen, 0, (SOCKADDR_T *)&stSockaddr, (SOCKLEN_T *)&stSockLen);
-}
-
-int CUdpClient::CUdpSendData(const void *pcData, unsigned int uiDataLen) 
-{ 
-    return CUdpSendData(pcData, uiDataLen, (const char*)m_ucHost, m_uiPort); 
+    return sendto(m_iClientSock, pcData, uiDataLen, 0, (SOCKADDR_T *)&m_stServerInfo, m_stServerLen);
 }
 
-int CUdpClient::CUdpSendData(const void *pcData, unsigned int uiDataLen, const char *pcHost, unsigned int uiPort)
+inline int CUdpClient::CUdpSendData(const void *pcData, unsigned int uiDataLen, const char *pcHost, unsigned int uiPort)
 {
-    SOCKADDR_IN_T stSockaddr;
-    
     if((NULL == pcData) || (NULL == pcHost) || (0 == uiPort))
     {
         //SysLog(LOG_ERR, "Para is error!");
         return -1;
     }
 
-    memset(&stSockaddr, 0x00, sizeof(stSockaddr));
-    if(0 != CUdpGetSockaddr(pcHost, uiPort, &stSockaddr))
+    if((0 == m_stLastLen) || (uiPort != m_uiLastPort) || (0 != strcmp(pcHost, m_acLastHost)))
     {
-        //SysLog(LOG_ERR, "Get sockaddr failed!");
-        return -1;
+        m_stLastLen = 0;
+        if((sizeof(m_acLastHost) <= strlen(pcHost)) ||
+           (0 != CUdpGetSockaddr(pcHost, uiPort, &m_stLastInfo, &m_stLastLen)))
+        {
+            //SysLog(LOG_ERR, "Get sockaddr failed!");
+            m_stLastLen = 0;
+            return -1;
+        }
+        strcpy(m_acLastHost, pcHost);
+        m_uiLastPort = uiPort;
     }
 
-    return sendto(m_iClientSock, pcData, uiDataLen, 0, (SOCKADDR_T *)&stSockaddr, (SOCKLEN_T)sizeof(stSockaddr));
+    return sendto(m_iClientSock, pcData, uiDataLen, 0, (SOCKADDR_T *)&m_stLastInfo, m_stLastLen);
+}
+
+inline int CUdpClient::CUdpRecvBatch(UDP_MSG_T *pstMsgs, unsigned int uiCount)
+{
+    return UdpRecvBatch(m_iClientSock, pstMsgs, uiCount);
+}
+
+inline int CUdpClient::CUdpSendBatch(const UDP_MSG_T *pstMsgs, unsigned int uiCount)
+{
+    return UdpSendBatch(m_iClientSock, pstMsgs, uiCount, m_stServerLen ? &m_stServerInfo : NULL, m_stServerLen);
+}
+
+//为批量发送填好 pstMsg 的目的地址，解析一次后可反复使用
+inline int CUdpClient::CUdpResolve(const char *pcHost, unsigned int uiPort, UDP_MSG_T *pstMsg)
+{
+    if(NULL == pstMsg)
+    {
+        return -1;
+    }
+    return CUdpGetSockaddr(pcHost, uiPort, &pstMsg->stAddr, &pstMsg->stAddrLen);
 }
 
 
-#endif /*MINI_VTYSH_H*/
\ No newline at end of file
+#endif /*MINI_VTYSH_H*/
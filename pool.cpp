@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+void pool_init(struct pool *p, size_t size)
+{
+    memset(p, 0, sizeof(*p));
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+    p->size = (size + 63) & ~(size_t)63;
+    pthread_mutex_init(&p->lock, NULL);
+}
+
+/* Caller holds the lock. */
+static int pool_grow(struct pool *p)
+{
+    char *slab = (char *)aligned_alloc(64, p->size * POOL_SLAB_OBJECTS);
+
+    if (slab == NULL)
+        return -1;
+    for (int i = POOL_SLAB_OBJECTS - 1; i >= 0; i--)
+    {
+        void **obj = (void **)(slab + i * p->size);
+
+        *obj = p->free;
+        p->free = obj;
+    }
+    p->total += POOL_SLAB_OBJECTS;
+    return 0;
+}
+
+int pool_reserve(struct pool *p, unsigned long n)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while (ret == 0 && p->total < n)
+        ret = pool_grow(p);
+    pthread_mutex_unlock(&p->lock);
+    return ret;
+}
+
+void *pool_get(struct pool *p)
+{
+    void **obj;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->free == NULL && pool_grow(p) < 0)
+    {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+    obj = (void **)p->free;
+    p->free = *obj;
+    p->used++;
+    pthread_mutex_unlock(&p->lock);
+    return obj;
+}
+
+void pool_put(struct pool *p, void *obj)
+{
+    if (obj == NULL)
+        return;
+    pthread_mutex_lock(&p->lock);
+    *(void **)obj = p->free;
+    p->free = obj;
+    p->used--;
+    pthread_mutex_unlock(&p->lock);
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_block *b, **link;
+    void *ptr;
+
+    size = (size + 7) & ~(size_t)7;
+
+    /* Move on to the next kept block that is big enough; smaller ones
+       are just skipped until the arena is rewound. */
+    while (a->cur == NULL || a->used + size > a->cur->size)
+    {
+        link = a->cur ? &a->cur->next : &a->head;
+        if (*link == NULL)
+        {
+            size_t bsize = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+
+            b = (struct arena_block *)malloc(sizeof(struct arena_block) + bsize);
+            if (b == NULL)
+                return NULL;
+            b->next = NULL;
+            b->size = bsize;
+            *link = b;
+        }
+        a->cur = *link;
+        a->used = 0;
+    }
+
+    ptr = a->cur->data + a->used;
+    a->used += size;
+    return ptr;
+}
@@ -0,0 +1,75 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Fixed size object pool. Objects are carved out of slabs of
+   POOL_SLAB_OBJECTS and recycled through a freelist; slabs are never
+   given back, so memory use follows the peak number of live objects
+   and stays flat under allocate/free churn. Objects are cache line
+   aligned so that objects used by different threads do not share
+   lines. Safe to use from any thread. */
+#define POOL_SLAB_OBJECTS 64
+
+struct pool
+{
+  size_t size;			/* Object size, rounded to 64. */
+  void *free;			/* Freelist, linked through the objects. */
+  pthread_mutex_t lock;
+
+  unsigned long total;		/* Objects carved so far. */
+  unsigned long used;
+};
+
+void pool_init(struct pool *p, size_t size);
+
+/* Carve objects until at least n exist. */
+int pool_reserve(struct pool *p, unsigned long n);
+
+/* Uninitialized object, NULL if out of memory. */
+void *pool_get(struct pool *p);
+void pool_put(struct pool *p, void *obj);
+
+/* Scratch arena for short lived allocations of one thread. Allocation
+   bumps a pointer; arena_release() rewinds to a mark taken before, so
+   blocks are kept and reused and the steady state allocates nothing.
+   Marks nest, which lets a caller of arena users keep its own data. */
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block
+{
+  struct arena_block *next;
+  size_t size;
+  char data[];
+};
+
+struct arena
+{
+  struct arena_block *head;
+  struct arena_block *cur;
+  size_t used;			/* In cur. */
+};
+
+struct arena_mark
+{
+  struct arena_block *cur;
+  size_t used;
+};
+
+/* 8 byte aligned memory, NULL if out of memory. */
+void *arena_alloc(struct arena *a, size_t size);
+
+static inline struct arena_mark arena_mark(struct arena *a)
+{
+  struct arena_mark m = { a->cur, a->used };
+  return m;
+}
+
+static inline void arena_release(struct arena *a, struct arena_mark m)
+{
+  a->cur = m.cur;
+  a->used = m.used;
+}
+
+#endif /*POOL_H*/
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <arpa/telnet.h>
+
+#include "telnet.h"
+
+/* Options this server performs, and options it lets the client perform. */
+#define TELNET_LOCAL_SUPPORTED  (TELNET_OPT_BIT(TELOPT_ECHO) | TELNET_OPT_BIT(TELOPT_SGA))
+#define TELNET_REMOTE_SUPPORTED (TELNET_OPT_BIT(TELOPT_NAWS) | TELNET_OPT_BIT(TELOPT_TTYPE) | \
+                                 TELNET_OPT_BIT(TELOPT_SGA))
+
+void telnet_init(struct telnet *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->local_supported = TELNET_LOCAL_SUPPORTED;
+}
+
+static void telnet_send(struct buffer *out, unsigned char verb, unsigned char opt)
+{
+    unsigned char cmd[] = { IAC, verb, opt };
+    buffer_put(out, cmd, sizeof(cmd));
+}
+
+void telnet_request(struct telnet *t, struct buffer *out, unsigned char verb, unsigned char opt)
+{
+    telnet_opts bit = TELNET_OPT_BIT(opt);
+
+    switch (verb)
+    {
+        case WILL: t->local_pending |= bit; break;
+        case DO:   t->remote_pending |= bit; break;
+        case WONT: t->local &= ~bit; break;
+        case DONT: t->remote &= ~bit; break;
+    }
+    telnet_send(out, verb, opt);
+}
+
+/* Ask for the terminal type once the client agreed to TTYPE. */
+static void telnet_ttype_send(struct buffer *out)
+{
+    unsigned char cmd[] = { IAC, SB, TELOPT_TTYPE, TELQUAL_SEND, IAC, SE };
+    buffer_put(out, cmd, sizeof(cmd));
+}
+
+/* WILL/WONT from the peer: it offers or refuses to perform an option. */
+static void telnet_remote(struct telnet *t, struct buffer *reply, int enable, unsigned char opt)
+{
+    telnet_opts bit = TELNET_OPT_BIT(opt);
+    int pending = (t->remote_pending & bit) != 0;
+
+    t->remote_pending &= ~bit;
+    if (enable)
+    {
+        if (!(TELNET_REMOTE_SUPPORTED & bit))
+        {
+            telnet_send(reply, DONT, opt);
+            return;
+        }
+        if (t->remote & bit)
+            return;
+        t->remote |= bit;
+        if (!pending)
+            telnet_send(reply, DO, opt);
+        if (opt == TELOPT_TTYPE)
+            telnet_ttype_send(reply);
+    }
+    else if ((t->remote & bit) || pending)
+    {
+        t->remote &= ~bit;
+        if (!pending)
+            telnet_send(reply, DONT, opt);
+    }
+}
+
+/* DO/DONT from the peer: it asks us to perform an option or stop. */
+static void telnet_local(struct telnet *t, struct buffer *reply, int enable, unsigned char opt)
+{
+    telnet_opts bit = TELNET_OPT_BIT(opt);
+    int pending = (t->local_pending & bit) != 0;
+
+    t->local_pending &= ~bit;
+    if (enable)
+    {
+        if (!(t->local_supported & bit))
+        {
+            telnet_send(reply, WONT, opt);
+            return;
+        }
+        if (t->local & bit)
+            return;
+        t->local |= bit;
+        if (!pending)
+            telnet_send(reply, WILL, opt);
+    }
+    else if ((t->local & bit) || pending)
+    {
+        t->local &= ~bit;
+        if (!pending)
+            telnet_send(reply, WONT, opt);
+    }
+}
+
+/* A complete IAC SB <option> ... IAC SE was received. */
+static void telnet_subnegotiation(struct telnet *t)
+{
+    switch (t->sb_option)
+    {
+        case TELOPT_NAWS:
+            if (t->sb_len == 4)
+            {
+                t->width = (t->sb_buf[0] << 8) | t->sb_buf[1];
+                t->height = (t->sb_buf[2] << 8) | t->sb_buf[3];
+            }
+            break;
+        case TELOPT_TTYPE:
+            if (t->sb_len > 1 && t->sb_buf[0] == TELQUAL_IS)
+            {
+                int len = t->sb_len - 1;
+
+                if (len >= TELNET_TTYPE_MAX)
+                    len = TELNET_TTYPE_MAX - 1;
+                memcpy(t->ttype, t->sb_buf + 1, len);
+                t->ttype[len] = '\0';
+            }
+            break;
+    }
+}
+
+int telnet_parse(struct telnet *t, const unsigned char *in, int n,
+                 unsigned char *data, struct buffer *reply)
+{
+    const unsigned char *end = in + n;
+    unsigned char *out = data;
+
+    for (; in < end; in++)
+    {
+        unsigned char c = *in;
+
+        switch (t->state)
+        {
+            case TELNET_CR:
+                t->state = TELNET_DATA;
+                if (c == '\n' || c == '\0')
+                    break;
+                /* fall through */
+            case TELNET_DATA:
+                if (c == IAC)
+                    t->state = TELNET_IAC;
+                else if (c == '\r')
+                {
+                    *out++ = '\n';
+                    t->state = TELNET_CR;
+                }
+                else if (c != '\0')
+                    *out++ = c;
+                break;
+
+            case TELNET_IAC:
+                t->state = TELNET_DATA;
+                if (c != IAC)
+                    t->commands++;
+                switch (c)
+                {
+                    case IAC:  *out++ = IAC; break;
+                    case WILL: t->state = TELNET_WILL; break;
+                    case WONT: t->state = TELNET_WONT; break;
+                    case DO:   t->state = TELNET_DO; break;
+                    case DONT: t->state = TELNET_DONT; break;
+                    case SB:   t->state = TELNET_SB; break;
+                    /* Map the function commands onto the control keys the
+                       line editor already understands. */
+                    case IP:   *out++ = 0x03; break;
+                    case EC:   *out++ = 0x7f; break;
+                    case EL:   *out++ = 0x15; break;
+                    case AYT:  buffer_putstr(reply, "\r\n[yes]\r\n"); break;
+                    default:   break;   /* NOP, GA, DM, BREAK, AO */
+                }
+                break;
+
+            case TELNET_WILL: telnet_remote(t, reply, 1, c); t->state = TELNET_DATA; break;
+            case TELNET_WONT: telnet_remote(t, reply, 0, c); t->state = TELNET_DATA; break;
+            case TELNET_DO:   telnet_local(t, reply, 1, c);  t->state = TELNET_DATA; break;
+            case TELNET_DONT: telnet_local(t, reply, 0, c);  t->state = TELNET_DATA; break;
+
+            case TELNET_SB:
+                t->sb_option = c;
+                t->sb_len = 0;
+                t->state = TELNET_SB_DATA;
+                break;
+
+            case TELNET_SB_DATA:
+                if (c == IAC)
+                    t->state = TELNET_SB_IAC;
+                else if (t->sb_len < TELNET_SB_MAX)
+                    t->sb_buf[t->sb_len++] = c;
+                break;
+
+            case TELNET_SB_IAC:
+                if (c == SE)
+                {
+                    telnet_subnegotiation(t);
+                    t->state = TELNET_DATA;
+                }
+                else
+                {
+                    /* IAC IAC is an escaped 255 inside the payload. Anything
+                       else is a protocol error, keep collecting. */
+                    if (c == IAC && t->sb_len < TELNET_SB_MAX)
+                        t->sb_buf[t->sb_len++] = IAC;
+                    t->state = TELNET_SB_DATA;
+                }
+                break;
+        }
+    }
+
+    return out - data;
+}
@@ -0,0 +1,84 @@
+#ifndef TELNET_H
+#define TELNET_H
+
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define TELNET_SB_MAX    64   /* Longest subnegotiation payload kept. */
+#define TELNET_TTYPE_MAX 32
+
+/* MCCP2, not in <arpa/telnet.h>. */
+#ifndef TELOPT_COMPRESS2
+#define TELOPT_COMPRESS2 86
+#endif
+
+/* A bit per option below 128. */
+typedef unsigned __int128 telnet_opts;
+
+/* Receive states of the RFC 854 parser. */
+enum telnet_state
+{
+  TELNET_DATA = 0,
+  TELNET_CR,          /* Last data byte was CR, swallow LF/NUL. */
+  TELNET_IAC,
+  TELNET_WILL,
+  TELNET_WONT,
+  TELNET_DO,
+  TELNET_DONT,
+  TELNET_SB,          /* Waiting for the subnegotiation option. */
+  TELNET_SB_DATA,
+  TELNET_SB_IAC,
+};
+
+/* Per-session protocol state. The parser keeps everything it needs to
+   resume in the middle of a command here, so IAC sequences may be split
+   at any byte across reads. */
+struct telnet
+{
+  unsigned char state;
+  unsigned char sb_option;
+  unsigned short sb_len;
+  unsigned char sb_buf[TELNET_SB_MAX];
+
+  /* Options below 128 only; everything else is refused. "local" are
+     options we perform (WILL), "remote" are options the peer performs
+     (DO). The pending masks record requests we sent and still expect
+     an answer for, so acknowledgements are not answered again.
+     local_supported is what a DO is agreed to, see telnet_init(). */
+  telnet_opts local;
+  telnet_opts remote;
+  telnet_opts local_pending;
+  telnet_opts remote_pending;
+  telnet_opts local_supported;
+
+  /* Window size from NAWS, 0 when unknown. */
+  unsigned short width;
+  unsigned short height;
+
+  /* Terminal type from TTYPE IS. */
+  char ttype[TELNET_TTYPE_MAX];
+
+  /* IAC commands received, for statistics. */
+  unsigned long commands;
+};
+
+#define TELNET_OPT_BIT(opt) ((opt) < 128 ? ((telnet_opts)1 << (opt)) : 0)
+
+/* Reset state for a new connection. Options we perform are ECHO and
+   SGA; add to local_supported for more. */
+void telnet_init(struct telnet *t);
+
+/* Queue an option request (WILL/WONT/DO/DONT) and remember it is in
+   flight. */
+void telnet_request(struct telnet *t, struct buffer *out, unsigned char verb, unsigned char opt);
+
+/* Run the parser over n received bytes in a single pass. Data bytes are
+   written to data (which may alias in, the output never overtakes the
+   input), with IAC IAC unescaped and CR LF / CR NUL / LF all turned into
+   a single '\n'. Negotiation replies are appended to reply. Returns the
+   number of data bytes. */
+int telnet_parse(struct telnet *t, const unsigned char *in, int n,
+                 unsigned char *data, struct buffer *reply);
+
+#endif /*TELNET_H*/
@@ -0,0 +1,182 @@
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define TIMER_WHEEL_SPAN ((uint32_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+uint64_t timer_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void timer_wheel_init(struct timer_wheel *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->base_ms = timer_clock_ms();
+}
+
+static void timer_unlink(struct timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/* Put t into the slot of the level its distance falls into. Slots are
+   indexed by the absolute expiry bits of that level, so a level-n slot
+   is cascaded exactly when the wheel reaches its range. */
+static void timer_link(struct timer_wheel *w, struct timer *t)
+{
+    uint32_t delta;
+    int level = 0, slot;
+    struct timer **head;
+
+    if ((int32_t)(t->expires - w->now) < 0)
+        t->expires = w->now;
+    delta = t->expires - w->now;
+    if (delta >= TIMER_WHEEL_SPAN)
+    {
+        t->expires = w->now + TIMER_WHEEL_SPAN - 1;
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= ((uint32_t)1 << (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+
+    slot = (t->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    head = &w->slots[level][slot];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    w->bitmap[level] |= (uint64_t)1 << slot;
+}
+
+void timer_add(struct timer_wheel *w, struct timer *t, uint32_t ticks)
+{
+    if (timer_pending(t))
+        timer_unlink(t);
+    else
+        w->count++;
+    t->expires = w->now + (ticks ? ticks : 1);
+    timer_link(w, t);
+}
+
+/* Bitmap bits are cleared lazily when an empty slot is looked at, so
+   deleting never has to find out which slot the timer was in. */
+void timer_del(struct timer_wheel *w, struct timer *t)
+{
+    if (!timer_pending(t))
+        return;
+    timer_unlink(t);
+    w->count--;
+}
+
+/* Detach a whole slot; the returned list is self-contained so timers
+   in it can still be deleted by callbacks while it is processed. */
+static struct timer *timer_slot_take(struct timer_wheel *w, int level, int slot, struct timer **head)
+{
+    *head = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->bitmap[level] &= ~((uint64_t)1 << slot);
+    if (*head)
+        (*head)->pprev = head;
+    return *head;
+}
+
+static void timer_cascade(struct timer_wheel *w, int level, int slot)
+{
+    struct timer *head, *t;
+
+    timer_slot_take(w, level, slot, &head);
+    while ((t = head) != NULL)
+    {
+        timer_unlink(t);
+        timer_link(w, t);
+    }
+}
+
+/* Absolute tick of the next non-empty level-0 slot before the next
+   cascade, or of that cascade. */
+static uint32_t timer_next_tick(struct timer_wheel *w)
+{
+    uint32_t idx = w->now & TIMER_WHEEL_MASK;
+    uint32_t window = w->now & ~(uint32_t)TIMER_WHEEL_MASK;
+
+    while (idx < TIMER_WHEEL_MASK)
+    {
+        uint64_t mask = w->bitmap[0] & (~(uint64_t)0 << (idx + 1));
+        int slot;
+
+        if (mask == 0)
+            break;
+        slot = __builtin_ctzll(mask);
+        if (w->slots[0][slot])
+            return window + slot;
+        w->bitmap[0] &= ~((uint64_t)1 << slot);
+    }
+    return window + TIMER_WHEEL_SIZE;
+}
+
+int timer_wheel_timeout(struct timer_wheel *w)
+{
+    uint64_t now_ms, due_ms;
+
+    if (w->count == 0)
+        return -1;
+    now_ms = timer_clock_ms();
+    due_ms = w->base_ms + (uint64_t)timer_next_tick(w) * TIMER_TICK_MS;
+    return (due_ms > now_ms) ? (int)(due_ms - now_ms) : 0;
+}
+
+void timer_wheel_advance(struct timer_wheel *w)
+{
+    uint32_t target = (timer_clock_ms() - w->base_ms) / TIMER_TICK_MS;
+
+    while ((int32_t)(target - w->now) > 0)
+    {
+        struct timer *head, *t;
+        uint32_t next;
+        int level, slot;
+
+        if (w->count == 0)
+        {
+            w->now = target;
+            return;
+        }
+
+        /* Skip the ticks with nothing to do. */
+        next = timer_next_tick(w);
+        if ((int32_t)(next - target) > 0)
+        {
+            w->now = target;
+            return;
+        }
+        w->now = next;
+
+        slot = w->now & TIMER_WHEEL_MASK;
+        if (slot == 0)
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                int index = (w->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+                timer_cascade(w, level, index);
+                if (index != 0)
+                    break;
+            }
+
+        timer_slot_take(w, 0, slot, &head);
+        while ((t = head) != NULL)
+        {
+            timer_unlink(t);
+            w->count--;
+            (*t->func) (t);
+        }
+    }
+}
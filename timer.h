@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hierarchical timer wheel. TIMER_WHEEL_LEVELS wheels of
+   TIMER_WHEEL_SIZE slots, each level TIMER_WHEEL_SIZE times coarser than
+   the one below. Adding, deleting and expiring a timer is O(1); a
+   timer is touched again only when its level cascades down, at most
+   TIMER_WHEEL_LEVELS - 1 times. One wheel belongs to one event loop and
+   is never shared between threads. */
+#define TIMER_TICK_MS       100
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS  4
+
+/* Convert seconds to wheel ticks. */
+#define TIMER_SEC(s)        ((uint32_t)(s) * (1000 / TIMER_TICK_MS))
+
+/* Intrusive timer, embedded in the object it belongs to. */
+struct timer
+{
+  struct timer *next;
+  struct timer **pprev;		/* NULL when not armed. */
+  uint32_t expires;		/* Absolute tick. */
+  void (*func) (struct timer *);
+};
+
+struct timer_wheel
+{
+  /* Current tick and the monotonic time of tick 0. */
+  uint32_t now;
+  uint64_t base_ms;
+
+  unsigned int count;
+
+  /* One bit per non-empty slot, to find the next expiry without
+     walking empty slots. */
+  uint64_t bitmap[TIMER_WHEEL_LEVELS];
+  struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+#define timer_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Milliseconds of CLOCK_MONOTONIC. */
+uint64_t timer_clock_ms(void);
+
+void timer_wheel_init(struct timer_wheel *w);
+
+/* Arm t to fire after the given number of ticks (at least one). An
+   armed timer is moved. */
+void timer_add(struct timer_wheel *w, struct timer *t, uint32_t ticks);
+void timer_del(struct timer_wheel *w, struct timer *t);
+
+static inline int timer_pending(const struct timer *t)
+{
+  return t->pprev != NULL;
+}
+
+/* Milliseconds until the wheel needs attention, -1 when it is empty.
+   Suitable as epoll_wait() timeout. */
+int timer_wheel_timeout(struct timer_wheel *w);
+
+/* Bring the wheel up to the current time and run expired timers. */
+void timer_wheel_advance(struct timer_wheel *w);
+
+#endif /*TIMER_H*/
@@ -0,0 +1,378 @@
+/* Reader for the mini_vtysh audit journal (see audit.h). Prints the
+   records that match the filters, or replays the matching commands
+   against a server. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <arpa/telnet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "../audit.h"
+
+/* Reply timeout while replaying, milliseconds. */
+#define REPLAY_TIMEOUT 5000
+
+struct audit_str
+{
+  const char *str;
+  uint16_t len;
+};
+
+/* Filters; zero means no filter. */
+static uint32_t filter_epoch;
+static uint32_t filter_session;
+static uint64_t filter_from;
+static uint64_t filter_to;
+static const char *filter_prefix;
+
+/* Replay target. */
+static int replay_fd = -1;
+static const char *replay_password;
+
+/* Strings of the current epoch by id, and peer ref of every session. */
+static struct audit_str *strings;
+static uint32_t nstrings;
+static uint32_t *peers;
+static uint32_t npeers;
+
+static void *grow(void *p, uint32_t *n, uint32_t need, size_t size)
+{
+    uint32_t max = *n ? *n : 256;
+
+    if (need < *n)
+        return p;
+    while (max <= need)
+        max *= 2;
+    p = realloc(p, max * size);
+    if (p == NULL)
+        abort();
+    memset((char *)p + *n * size, 0, (max - *n) * size);
+    *n = max;
+    return p;
+}
+
+static struct audit_str *string_get(uint32_t ref)
+{
+    static struct audit_str unknown = { "?", 1 };
+
+    return (ref < nstrings && strings[ref].str) ? &strings[ref] : &unknown;
+}
+
+/* "YYYY-mm-dd HH:MM:SS" local time or seconds since the epoch, to
+   microseconds. */
+static uint64_t parse_time(const char *s)
+{
+    struct tm tm;
+    char *end;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+    if (end && *end == '\0')
+    {
+        tm.tm_isdst = -1;
+        return (uint64_t)mktime(&tm) * 1000000;
+    }
+    return strtoull(s, NULL, 10) * 1000000;
+}
+
+static void print_time(uint64_t ts_us)
+{
+    time_t sec = ts_us / 1000000;
+    struct tm tm;
+    char buf[32];
+
+    localtime_r(&sec, &tm);
+    strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", &tm);
+    printf("%s.%03u", buf, (unsigned)(ts_us / 1000 % 1000));
+}
+
+/* Read server output until a prompt, copying the text to stdout and
+   answering option requests: the server may echo and suppress
+   go-ahead, everything else is refused. */
+static int replay_wait_prompt(void)
+{
+    unsigned char buf[4096];
+    char tail[2] = { 0, 0 };
+    int state = 0;
+    unsigned char verb = 0;
+
+    while (1)
+    {
+        struct pollfd pfd = { replay_fd, POLLIN, 0 };
+        ssize_t n;
+
+        if (poll(&pfd, 1, REPLAY_TIMEOUT) <= 0)
+        {
+            fprintf(stderr, "replay: no prompt from server\n");
+            return -1;
+        }
+        n = read(replay_fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            fprintf(stderr, "replay: connection closed\n");
+            return -1;
+        }
+
+        for (ssize_t i = 0; i < n; i++)
+        {
+            unsigned char c = buf[i];
+
+            switch (state)
+            {
+                case 0:
+                    if (c == IAC)
+                    {
+                        state = 1;
+                        continue;
+                    }
+                    putchar(c);
+                    tail[0] = tail[1];
+                    tail[1] = c;
+                    break;
+                case 1:
+                    if (c == DO || c == DONT || c == WILL || c == WONT)
+                        verb = c, state = 2;
+                    else if (c == SB)
+                        state = 3;
+                    else
+                        state = 0;
+                    break;
+                case 2:
+                    if (verb == DO || verb == WILL)
+                    {
+                        unsigned char reply[3] = { IAC, 0, c };
+
+                        if (verb == WILL)
+                            reply[1] = (c == TELOPT_ECHO || c == TELOPT_SGA) ? DO : DONT;
+                        else
+                            reply[1] = WONT;
+                        if (write(replay_fd, reply, 3) < 0)
+                            return -1;
+                    }
+                    state = 0;
+                    break;
+                case 3:
+                    if (c == IAC)
+                        state = 4;
+                    break;
+                case 4:
+                    state = (c == SE) ? 0 : 3;
+                    break;
+            }
+        }
+        fflush(stdout);
+
+        /* Prompts end in "# " or "> ", the login prompt in ": ". */
+        if (tail[1] == ' ' && (tail[0] == '#' || tail[0] == '>'))
+            return 0;
+        if (tail[1] == ' ' && tail[0] == ':' && replay_password)
+        {
+            if (write(replay_fd, replay_password, strlen(replay_password)) < 0 ||
+                write(replay_fd, "\r\n", 2) < 0)
+                return -1;
+            tail[0] = tail[1] = 0;
+        }
+    }
+}
+
+static int replay_connect(const char *target)
+{
+    struct sockaddr_in addr;
+    char host[64];
+    const char *colon = strrchr(target, ':');
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(colon ? atoi(colon + 1) : 23);
+    snprintf(host, sizeof(host), "%.*s", colon ? (int)(colon - target) : (int)strlen(target), target);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", host);
+        return -1;
+    }
+
+    replay_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (replay_fd < 0 || connect(replay_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        return -1;
+    }
+    return replay_wait_prompt();
+}
+
+static int replay_command(const struct audit_str *cmd)
+{
+    if (write(replay_fd, cmd->str, cmd->len) < 0 || write(replay_fd, "\r\n", 2) < 0)
+        return -1;
+    return replay_wait_prompt();
+}
+
+/* Apply one record. Returns -1 to stop. */
+static int audit_record(uint32_t epoch, const struct audit_record *rec, const char *payload)
+{
+    struct audit_str *cmd = NULL;
+
+    switch (rec->type)
+    {
+        case AUDIT_EPOCH:
+            for (uint32_t i = 0; i < nstrings; i++)
+                strings[i].str = NULL;
+            memset(peers, 0, npeers * sizeof(uint32_t));
+            return 0;
+        case AUDIT_STRING:
+            strings = (struct audit_str *)grow(strings, &nstrings, rec->ref, sizeof(struct audit_str));
+            strings[rec->ref].str = payload;
+            strings[rec->ref].len = rec->len;
+            return 0;
+        case AUDIT_OPEN:
+            peers = (uint32_t *)grow(peers, &npeers, rec->session, sizeof(uint32_t));
+            peers[rec->session] = rec->ref;
+            break;
+        case AUDIT_COMMAND:
+            cmd = string_get(rec->ref);
+            break;
+        case AUDIT_CLOSE:
+            break;
+        default:
+            return 0;
+    }
+
+    if ((filter_epoch && epoch != filter_epoch) ||
+        (filter_session && rec->session != filter_session) ||
+        (filter_from && rec->ts_us < filter_from) ||
+        (filter_to && rec->ts_us >= filter_to))
+        return 0;
+    if (filter_prefix && (cmd == NULL || cmd->len < strlen(filter_prefix) ||
+                          strncmp(cmd->str, filter_prefix, strlen(filter_prefix)) != 0))
+        return 0;
+
+    if (replay_fd >= 0)
+        return cmd ? replay_command(cmd) : 0;
+
+    struct audit_str *peer = string_get(rec->session < npeers ? peers[rec->session] : 0);
+
+    print_time(rec->ts_us);
+    printf(" session %u:%u %.*s ", epoch, rec->session, peer->len, peer->str);
+    if (rec->type == AUDIT_OPEN)
+        printf("open\n");
+    else if (rec->type == AUDIT_CLOSE)
+        printf("close\n");
+    else
+        printf("node %u ret %d %uus: %.*s\n", rec->node, rec->ret, rec->latency_us, cmd->len, cmd->str);
+    return 0;
+}
+
+static void usage(const char *progname)
+{
+    printf("Usage: %s [-s [epoch:]session] [-f from] [-t to] [-p command_prefix]\n"
+           "          [-r host:port [-a password]] journal\n"
+           "  times are \"YYYY-mm-dd HH:MM:SS\" or seconds since 1970\n"
+           "  -r replays the matching commands against a server\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct audit_file_header *fh;
+    const char *replay = NULL;
+    const char *base;
+    struct stat st;
+    size_t off;
+    uint32_t epoch = 0;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "s:f:t:p:r:a:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                if (strchr(optarg, ':'))
+                    sscanf(optarg, "%u:%u", &filter_epoch, &filter_session);
+                else
+                    filter_session = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                filter_from = parse_time(optarg);
+                break;
+            case 't':
+                filter_to = parse_time(optarg);
+                break;
+            case 'p':
+                filter_prefix = optarg;
+                break;
+            case 'r':
+                replay = optarg;
+                break;
+            case 'a':
+                replay_password = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : -1;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(argv[optind]);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(*fh))
+    {
+        fprintf(stderr, "%s: too short for an audit journal\n", argv[optind]);
+        return -1;
+    }
+    base = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    fh = (const struct audit_file_header *)base;
+    if (memcmp(fh->magic, AUDIT_MAGIC, sizeof(fh->magic)) != 0 ||
+        fh->version != AUDIT_VERSION || fh->header_size != sizeof(struct audit_record))
+    {
+        fprintf(stderr, "%s: not an audit journal of version %d\n", argv[optind], AUDIT_VERSION);
+        return -1;
+    }
+
+    if (replay && replay_connect(replay) < 0)
+        return -1;
+
+    /* A record cut short by a crash ends the walk. */
+    for (off = sizeof(*fh); off + sizeof(struct audit_record) <= (size_t)st.st_size;)
+    {
+        const struct audit_record *rec = (const struct audit_record *)(base + off);
+        size_t size = sizeof(*rec) + AUDIT_ALIGN(rec->len);
+
+        if (off + size > (size_t)st.st_size)
+            break;
+        if (rec->type == AUDIT_EPOCH)
+            epoch++;
+        if (audit_record(epoch, rec, base + off + sizeof(*rec)) < 0)
+            return -1;
+        off += size;
+    }
+
+    if (replay_fd >= 0)
+    {
+        putchar('\n');
+        close(replay_fd);
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+/* Reference backend daemon for mini_vtysh's command forwarding (see
+   ipc.h). Listens on <dir>/<name>.vty and answers every command with
+   a line naming itself, the command and its node, followed by -l
+   lines of made up output. It takes the shared rings it is offered
+   unless -S tells it to stick to the socket. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../ipc.h"
+
+/* Most eventfds a server may hand over, one per worker. */
+#define DAEMON_FDS_MAX 256
+
+static const char *name;
+static int out_lines;
+static int socket_only;
+
+/* The server we talk to. Over the rings replies go to the ring of
+   the request's worker, over the socket they are written out. */
+struct peer
+{
+    int sock;
+    void *base;
+    size_t size;
+    int workers;
+    int wakeup[DAEMON_FDS_MAX];
+};
+
+static int write_all(int fd, const void *p, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p = (const char *)p + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_record(struct peer *p, uint32_t worker, int type, uint64_t id, int ret,
+                       const char *data, uint32_t len)
+{
+    struct ipc_msg *msg;
+    uint32_t next;
+
+    if (p->base == NULL)
+    {
+        char buf[IPC_RECORD(IPC_MSG_MAX)];
+
+        msg = (struct ipc_msg *)buf;
+        memset(msg, 0, sizeof(*msg));
+        msg->len = len;
+        msg->type = type;
+        msg->id = id;
+        msg->ret = ret;
+        msg->worker = worker;
+        if (len)
+            memcpy(msg + 1, data, len);
+        return write_all(p->sock, buf, IPC_RECORD(len));
+    }
+
+    /* The worker drains its ring whenever it is kicked, and it was when
+       the ring had last been empty. */
+    struct ipc_ring *r = ipc_ring_at(p->base, worker, 1);
+    while ((msg = ipc_ring_reserve(r, len, &next)) == NULL)
+        usleep(50);
+    msg->len = len;
+    msg->type = type;
+    msg->node = 0;
+    msg->id = id;
+    msg->ret = ret;
+    msg->worker = worker;
+    if (len)
+        memcpy(msg + 1, data, len);
+    if (ipc_ring_commit(r, next))
+    {
+        uint64_t one = 1;
+
+        if (write(p->wakeup[worker], &one, sizeof(one)) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Run a command: here, describe it. Output goes out IPC_MSG_MAX at a
+   time. */
+static int answer(struct peer *p, uint32_t worker, struct ipc_msg *req)
+{
+    char out[IPC_MSG_MAX];
+    size_t len;
+
+    len = snprintf(out, sizeof(out), "%s: %.*s (node %u)\n", name,
+                   (int)req->len, (const char *)(req + 1), req->node);
+    for (int i = 0; i < out_lines; i++)
+    {
+        char line[128];
+        int n = snprintf(line, sizeof(line), "  %-6d 10.%d.%d.0/24 via 192.168.0.%d\n",
+                         i, (i >> 8) & 255, i & 255, i % 254 + 1);
+
+        if (len + n > sizeof(out))
+        {
+            if (send_record(p, worker, IPC_REPLY, req->id, 0, out, len) < 0)
+                return -1;
+            len = 0;
+        }
+        memcpy(out + len, line, n);
+        len += n;
+    }
+    if (len && send_record(p, worker, IPC_REPLY, req->id, 0, out, len) < 0)
+        return -1;
+    return send_record(p, worker, IPC_END, req->id, 0, NULL, 0);
+}
+
+/* The rings: every kick, run what every worker queued. */
+static void serve_rings(struct peer *p, int efd)
+{
+    struct pollfd pfd[2] = { { efd, POLLIN, 0 }, { p->sock, POLLIN, 0 } };
+
+    while (poll(pfd, 2, -1) >= 0 || errno == EINTR)
+    {
+        char buf[256];
+
+        if (pfd[1].revents && read(p->sock, buf, sizeof(buf)) <= 0)
+            return;
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+        if (read(efd, buf, sizeof(uint64_t)) < 0)
+            return;
+        for (int w = 0; w < p->workers; w++)
+        {
+            struct ipc_ring *r = ipc_ring_at(p->base, w, 0);
+            struct ipc_msg *msg;
+            uint32_t next;
+
+            while ((msg = ipc_ring_peek(r, &next)) != NULL)
+            {
+                if (msg->type == IPC_REQUEST && answer(p, w, msg) < 0)
+                    return;
+                ipc_ring_release(r, next);
+            }
+        }
+    }
+}
+
+/* The socket: records both ways. */
+static void serve_socket(struct peer *p)
+{
+    static char in[2 * IPC_RECORD(IPC_MSG_MAX)];
+    size_t have = 0;
+    ssize_t n;
+
+    while ((n = read(p->sock, in + have, sizeof(in) - have)) > 0 || (n < 0 && errno == EINTR))
+    {
+        size_t off = 0;
+
+        if (n < 0)
+            continue;
+        have += n;
+        while (have - off >= sizeof(struct ipc_msg))
+        {
+            struct ipc_msg *msg = (struct ipc_msg *)(in + off);
+
+            if (msg->len > IPC_MSG_MAX)
+                return;
+            if (have - off < IPC_RECORD(msg->len))
+                break;
+            if (msg->type == IPC_REQUEST && answer(p, msg->worker, msg) < 0)
+                return;
+            off += IPC_RECORD(msg->len);
+        }
+        memmove(in, in + off, have - off);
+        have -= off;
+    }
+}
+
+/* One server connection, from its IPC_HELLO to its end. */
+static void serve(int sock)
+{
+    struct
+    {
+        struct ipc_msg msg;
+        struct ipc_hello hello;
+    } in, out;
+    union
+    {
+        char buf[CMSG_SPACE(DAEMON_FDS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } octl;
+    int fds[DAEMON_FDS_MAX], nfds = 0;
+    struct iovec iov = { &in, sizeof(in) };
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    struct peer p;
+    int efd = -1;
+
+    memset(&p, 0, sizeof(p));
+    p.sock = sock;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    if (recvmsg(sock, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(in))
+        return;
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            memcpy(fds + nfds, CMSG_DATA(cmsg), n * sizeof(int));
+            nfds += n;
+        }
+    if (in.msg.type != IPC_HELLO || in.hello.magic != IPC_MAGIC ||
+        in.hello.version != IPC_VERSION || in.hello.ring_size != IPC_RING_SIZE ||
+        in.hello.workers == 0 || in.hello.workers >= DAEMON_FDS_MAX)
+    {
+        fprintf(stderr, "Not a server we understand\n");
+        goto out;
+    }
+    p.workers = in.hello.workers;
+
+    /* The memfd, then an eventfd per worker. */
+    if (!socket_only && nfds == p.workers + 1)
+    {
+        p.size = IPC_SEGMENT_SIZE(p.workers);
+        p.base = mmap(NULL, p.size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        if (p.base == MAP_FAILED || (efd = eventfd(0, EFD_CLOEXEC)) < 0)
+            p.base = NULL;
+        else
+            memcpy(p.wakeup, fds + 1, p.workers * sizeof(int));
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.msg.type = IPC_HELLO;
+    out.msg.len = sizeof(out.hello);
+    out.msg.ret = (p.base != NULL);
+    out.hello = in.hello;
+    iov.iov_base = &out;
+    iov.iov_len = sizeof(out);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (p.base)
+    {
+        memset(&octl, 0, sizeof(octl));
+        mh.msg_control = octl.buf;
+        mh.msg_controllen = sizeof(octl.buf);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &efd, sizeof(int));
+    }
+    if (sendmsg(sock, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof(out))
+        goto out;
+
+    printf("%s: server with %d workers, over %s\n", name, p.workers,
+           p.base ? "shared memory" : "the socket");
+    fflush(stdout);
+    if (p.base)
+        serve_rings(&p, efd);
+    else
+        serve_socket(&p);
+    printf("%s: server gone\n", name);
+    fflush(stdout);
+
+out:
+    if (p.base)
+        munmap(p.base, p.size);
+    if (efd >= 0)
+        close(efd);
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+}
+
+static void usage(const char *progname)
+{
+    printf("Usage: %s -n name [-D dir] [-l lines] [-S]\n"
+           "  -n is the daemon, e.g. zebra or ospfd, and the socket is <dir>/<name>.vty\n"
+           "  -D defaults to /var/run/mini_vtysh\n"
+           "  -l adds this many lines of output to every reply\n"
+           "  -S refuses the shared rings, everything goes over the socket\n",
+           progname);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = "/var/run/mini_vtysh";
+    struct sockaddr_un addr;
+    int opt, sock;
+
+    while ((opt = getopt(argc, argv, "n:D:l:Sh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'D':
+            dir = optarg;
+            break;
+        case 'l':
+            out_lines = atoi(optarg);
+            break;
+        case 'S':
+            socket_only = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (name == NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s.vty", dir, name) >= (int)sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: path too long\n", dir);
+        return 1;
+    }
+    unlink(addr.sun_path);
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", addr.sun_path, strerror(errno));
+        return 1;
+    }
+
+    /* One server at a time. */
+    while (1)
+    {
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "accept: %s\n", strerror(errno));
+            return 1;
+        }
+        serve(fd);
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "uring.h"
+
+#ifdef VTY_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                       unsigned int flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *r, unsigned int entries, unsigned int cq_entries)
+{
+    struct io_uring_params p;
+    void *ptr;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = cq_entries;
+    r->fd = uring_setup(entries, &p);
+    if (r->fd < 0 && errno == EINVAL)
+    {
+        /* Kernels before 5.19 know neither of the two hints. */
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+        r->fd = uring_setup(entries, &p);
+    }
+    if (r->fd < 0)
+        return -1;
+    r->features = p.features;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    ptr = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               r->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED)
+        goto fail;
+    r->sq_ring = ptr;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ring = r->sq_ring;
+    else
+    {
+        ptr = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED)
+            goto fail;
+        r->cq_ring = ptr;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               r->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        goto fail;
+    r->sqes = (struct io_uring_sqe *)ptr;
+
+    r->sq_head = (unsigned int *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+    r->sq_mask = *(unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+
+    r->cq_head = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = *(unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+    return 0;
+
+fail:
+    uring_exit(r);
+    return -1;
+}
+
+void uring_exit(struct uring *r)
+{
+    int err = errno;
+
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    errno = err;
+}
+
+int uring_supported(struct uring *r, int op)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    int ret = 0;
+
+    if (probe == NULL)
+        return 0;
+    if (uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && op <= probe->last_op)
+        ret = (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    free(probe);
+    return ret;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+    struct io_uring_sqe *sqe;
+
+    if (r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+        uring_submit(r, 0, 0);
+    sqe = &r->sqes[r->sqe_tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[r->sqe_tail & r->sq_mask] = r->sqe_tail & r->sq_mask;
+    r->sqe_tail++;
+    return sqe;
+}
+
+int uring_submit(struct uring *r, int wait, int timeout_ms)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int to_submit, flags = 0;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (wait && uring_peek_cqe(r))
+        wait = 0;
+    if (to_submit == 0 && !wait)
+        return 0;
+
+    if (wait)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0)
+        {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+
+    ret = uring_enter(r->fd, to_submit, wait ? 1 : 0, flags,
+                      (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                      (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    if (ret < 0 && (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        return 0;
+    return ret;
+}
+
+int uring_bufs_init(struct uring *r, struct uring_bufs *b, uint16_t bgid,
+                    unsigned int count, unsigned int size)
+{
+    struct io_uring_buf_reg reg;
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+
+    memset(b, 0, sizeof(*b));
+    b->ring = (struct io_uring_buf_ring *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->ring == MAP_FAILED)
+    {
+        b->ring = NULL;
+        return -1;
+    }
+    b->base = (unsigned char *)malloc((size_t)count * size);
+    if (b->base == NULL)
+    {
+        munmap(b->ring, ring_size);
+        b->ring = NULL;
+        return -1;
+    }
+    b->count = count;
+    b->size = size;
+    b->bgid = bgid;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->ring;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int err = errno;
+
+        free(b->base);
+        munmap(b->ring, ring_size);
+        memset(b, 0, sizeof(*b));
+        errno = err;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        uring_buf_put(b, i);
+    return 0;
+}
+
+void uring_bufs_free(struct uring *r, struct uring_bufs *b)
+{
+    struct io_uring_buf_reg reg;
+
+    if (b->ring == NULL)
+        return;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->bgid;
+    uring_register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(b->ring, b->count * sizeof(struct io_uring_buf));
+    free(b->base);
+    memset(b, 0, sizeof(*b));
+}
+
+#endif /* VTY_IO_URING */
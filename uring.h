@@ -0,0 +1,118 @@
+#ifndef URING_H
+#define URING_H
+
+/* Minimal io_uring wrapper on the raw system calls, just what the vty
+   workers need: one ring per thread, SQEs filled in place and handed
+   to the kernel in one io_uring_enter() per loop, CQEs read straight
+   off the shared ring, and provided buffer rings for receives.
+   Build with -DVTY_NO_IO_URING to leave it out. */
+#if defined(__linux__) && !defined(VTY_NO_IO_URING)
+# if defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   define VTY_IO_URING 1
+#  endif
+# endif
+#endif
+
+#ifdef VTY_IO_URING
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+struct uring
+{
+  int fd;
+  unsigned int features;
+
+  /* Submission queue. sqe_tail runs ahead of *sq_tail by the SQEs
+     filled since the last uring_submit(). */
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_array;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int sqe_tail;
+  struct io_uring_sqe *sqes;
+
+  /* Completion queue. */
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+};
+
+/* Provided buffer ring: count buffers of size bytes the kernel picks
+   from for IOSQE_BUFFER_SELECT reads, given back by uring_buf_put(). */
+struct uring_bufs
+{
+  struct io_uring_buf_ring *ring;
+  unsigned char *base;
+  unsigned int count;		/* Power of two. */
+  unsigned int size;
+  uint16_t bgid;
+  uint16_t tail;
+};
+
+/* Set up a ring of entries SQEs and cq_entries CQEs. Returns -1 with
+   errno set on failure. */
+int uring_init(struct uring *r, unsigned int entries, unsigned int cq_entries);
+void uring_exit(struct uring *r);
+
+/* Whether the running kernel knows opcode op. */
+int uring_supported(struct uring *r, int op);
+
+/* A cleared SQE. A full queue is submitted first to make room. */
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+/* Submit the queued SQEs and, with wait set and no CQE ready, sleep
+   until one arrives or timeout_ms passes (-1 forever). Returns -1
+   with errno set on failure; a timeout or a signal is not one. */
+int uring_submit(struct uring *r, int wait, int timeout_ms);
+
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+  unsigned int head = *r->cq_head;
+
+  if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &r->cqes[head & r->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *r)
+{
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_bufs_init(struct uring *r, struct uring_bufs *b, uint16_t bgid,
+                    unsigned int count, unsigned int size);
+void uring_bufs_free(struct uring *r, struct uring_bufs *b);
+
+static inline unsigned char *uring_buf(struct uring_bufs *b, unsigned int bid)
+{
+  return b->base + (size_t)bid * b->size;
+}
+
+/* Hand buffer bid back to the kernel. */
+static inline void uring_buf_put(struct uring_bufs *b, unsigned int bid)
+{
+  /* Not &ring->bufs[]: in C++ the empty struct of the header's flex
+     array declaration has size 1 and moves bufs off the ring start. */
+  struct io_uring_buf *buf = (struct io_uring_buf *)b->ring + (b->tail & (b->count - 1));
+
+  buf->addr = (uint64_t)(uintptr_t)uring_buf(b, bid);
+  buf->len = b->size;
+  buf->bid = bid;
+  b->tail++;
+  __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+#endif /* VTY_IO_URING */
+
+#endif /*URING_H*/
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "workq.h"
+
+/* Own work comes off the head, in submission order. */
+static struct work *workq_take(struct workq_thread *t)
+{
+    struct work *w;
+
+    pthread_mutex_lock(&t->lock);
+    if ((w = t->head) != NULL)
+    {
+        t->head = w->next;
+        if (t->head)
+            t->head->prev = NULL;
+        else
+            t->tail = NULL;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return w;
+}
+
+/* Stolen work comes off the tail, away from the owner. */
+static struct work *workq_steal(struct workq_thread *t)
+{
+    struct work *w;
+
+    pthread_mutex_lock(&t->lock);
+    if ((w = t->tail) != NULL)
+    {
+        t->tail = w->prev;
+        if (t->tail)
+            t->tail->next = NULL;
+        else
+            t->head = NULL;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return w;
+}
+
+static struct work *workq_next(struct workq_thread *t)
+{
+    struct workq *q = t->q;
+    int self = t - q->threads;
+    struct work *w;
+
+    if ((w = workq_take(t)) != NULL)
+        return w;
+    for (int i = 1; i < q->nthreads && w == NULL; i++)
+        w = workq_steal(&q->threads[(self + i) % q->nthreads]);
+    return w;
+}
+
+static void *workq_thread_main(void *arg)
+{
+    struct workq_thread *t = (struct workq_thread *)arg;
+    struct workq *q = t->q;
+    struct work *w;
+
+    while (1)
+    {
+        if ((w = workq_next(t)) != NULL)
+        {
+            __atomic_sub_fetch(&q->queued, 1, __ATOMIC_RELAXED);
+            (*w->func) (w);
+            continue;
+        }
+
+        /* queued is raised before the work is linked in, so this may
+           go round once more while a submit is under way. */
+        pthread_mutex_lock(&q->idle_lock);
+        while (__atomic_load_n(&q->queued, __ATOMIC_RELAXED) == 0)
+        {
+            q->idle++;
+            pthread_cond_wait(&q->idle_cond, &q->idle_lock);
+            q->idle--;
+        }
+        pthread_mutex_unlock(&q->idle_lock);
+    }
+    return NULL;
+}
+
+int workq_init(struct workq *q, int nthreads, int max)
+{
+    memset(q, 0, sizeof(*q));
+    q->threads = (struct workq_thread *)aligned_alloc(64, nthreads * sizeof(struct workq_thread));
+    if (q->threads == NULL)
+        return -1;
+    memset(q->threads, 0, nthreads * sizeof(struct workq_thread));
+    q->nthreads = nthreads;
+    q->max = max;
+    pthread_mutex_init(&q->idle_lock, NULL);
+    pthread_cond_init(&q->idle_cond, NULL);
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct workq_thread *t = &q->threads[i];
+
+        pthread_mutex_init(&t->lock, NULL);
+        t->q = q;
+        if (pthread_create(&t->tid, NULL, workq_thread_main, t) != 0)
+            return -1;
+        pthread_detach(t->tid);
+    }
+    return 0;
+}
+
+int workq_submit(struct workq *q, struct work *w, unsigned int hint)
+{
+    struct workq_thread *t = &q->threads[hint % q->nthreads];
+
+    if (__atomic_add_fetch(&q->queued, 1, __ATOMIC_RELAXED) > q->max)
+    {
+        __atomic_sub_fetch(&q->queued, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    w->next = NULL;
+    pthread_mutex_lock(&t->lock);
+    w->prev = t->tail;
+    if (t->tail)
+        t->tail->next = w;
+    else
+        t->head = w;
+    t->tail = w;
+    pthread_mutex_unlock(&t->lock);
+
+    pthread_mutex_lock(&q->idle_lock);
+    if (q->idle)
+        pthread_cond_signal(&q->idle_cond);
+    pthread_mutex_unlock(&q->idle_lock);
+    return 0;
+}
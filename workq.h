@@ -0,0 +1,51 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <pthread.h>
+
+/* Bounded work stealing thread pool. Every thread has its own queue;
+   work is submitted to the queue picked by a hint, the owner takes
+   from the head and a thread that runs dry steals from the tail of the
+   others, so one busy submitter spreads over the whole pool while
+   unrelated submitters do not contend on one lock. Idle threads sleep
+   until there is work. At most max items wait at any time, running
+   ones not counted. */
+struct work
+{
+  struct work *next;
+  struct work *prev;
+  void (*func) (struct work *);
+};
+
+struct workq_thread
+{
+  pthread_mutex_t lock;
+  struct work *head;
+  struct work *tail;
+
+  pthread_t tid;
+  struct workq *q;
+} __attribute__ ((aligned (64)));
+
+struct workq
+{
+  struct workq_thread *threads;
+  int nthreads;
+  int max;
+
+  /* Items waiting in all queues. */
+  int queued;
+
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle_cond;
+  int idle;
+};
+
+/* Start nthreads threads. Returns -1 on failure. */
+int workq_init(struct workq *q, int nthreads, int max);
+
+/* Queue w to run w->func on a pool thread, preferably the one hint
+   maps to. Returns -1 if max items are already waiting. */
+int workq_submit(struct workq *q, struct work *w, unsigned int hint);
+
+#endif /*WORKQ_H*/